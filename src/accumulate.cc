@@ -0,0 +1,79 @@
+// accumulate.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// Program to accumulate the sample statistics used by the builder.
+// Reads features and state alignments (see AlignedFeatureReader) and
+// writes the statistics of each phone, HMM state, and context in the
+// binary sample format (use --sample_type=binary for the builder).
+//
+// \file
+// main executable for the statistics accumulation
+
+#include <string>
+#include <vector>
+#include <fst/symbol-table.h>
+#include "accumulator.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+using fst::SymbolTable;
+
+DEFINE_string(features, "", "binary feature file");
+DEFINE_string(alignment, "", "binary state alignment file");
+DEFINE_string(phone_syms, "", "phone symbols used in the alignment");
+DEFINE_int32(num_left_contexts, 1, "number of left context symbols");
+DEFINE_int32(num_right_contexts, 1, "number of right context symbols");
+DEFINE_string(boundary_context, "sil", "context label to use at boundaries");
+DEFINE_string(samples_file, "", "output sample data file");
+DEFINE_int32(num_threads, 1, "number of threads used for the accumulation");
+DEFINE_int32(num_shards, 64, "number of statistics hash maps");
+
+int main(int argc, char **argv) {
+  SetFlags("", &argc, &argv, true);
+  using trainc::StatisticsAccumulator;
+  SymbolTable *phone_symbols = SymbolTable::ReadText(FLAGS_phone_syms);
+  if (!phone_symbols) {
+    REP(FATAL) << "cannot read phone symbols from " << FLAGS_phone_syms;
+    return 1;
+  }
+  const int num_phones = phone_symbols->AvailableKey();
+  vector<string> phones(num_phones);
+  for (int p = 0; p < num_phones; ++p)
+    phones[p] = phone_symbols->Find(p);
+  const int boundary_phone = phone_symbols->Find(FLAGS_boundary_context);
+  if (boundary_phone < 0) {
+    REP(FATAL) << "boundary phone not defined: " << FLAGS_boundary_context;
+    return 1;
+  }
+  StatisticsAccumulator accumulator(num_phones, FLAGS_num_left_contexts,
+                                    FLAGS_num_right_contexts, boundary_phone,
+                                    FLAGS_num_shards);
+  if (!accumulator.AddFiles(FLAGS_features, FLAGS_alignment,
+                            FLAGS_num_threads)) {
+    REP(FATAL) << "cannot accumulate " << FLAGS_features << " "
+               << FLAGS_alignment;
+    return 1;
+  }
+  REP(INFO) << "samples: " << accumulator.NumSamples();
+  if (!accumulator.Write(FLAGS_samples_file, phones)) {
+    REP(FATAL) << "cannot write " << FLAGS_samples_file;
+    return 1;
+  }
+  delete phone_symbols;
+  return 0;
+}
@@ -0,0 +1,357 @@
+// accumulator.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+//
+
+#include <algorithm>
+#include <ext/hash_map>
+#include <vector>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "accumulator.h"
+#include "file.h"
+#include "hash.h"
+#include "sample.h"
+#include "sample_reader.h"
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
+
+namespace trainc {
+
+namespace {
+const int kUtterancesPerThread = 4;
+}  // namespace
+
+AlignedFeatureReader::AlignedFeatureReader()
+    : features_(NULL), alignment_(NULL), error_(false) {}
+
+AlignedFeatureReader::~AlignedFeatureReader() {
+  Close();
+}
+
+bool AlignedFeatureReader::Open(const std::string &feature_file,
+                                const std::string &alignment_file) {
+  Close();
+  error_ = false;
+  File *features = File::Create(feature_file, "r");
+  File *alignment = File::Create(alignment_file, "r");
+  if (!(features && features->Open() && alignment && alignment->Open())) {
+    LOG(ERROR) << "cannot open " << feature_file << " or " << alignment_file;
+    delete features;
+    delete alignment;
+    return false;
+  }
+  features_ = new InputBuffer(features);
+  alignment_ = new InputBuffer(alignment);
+  return true;
+}
+
+void AlignedFeatureReader::Close() {
+  delete features_;
+  delete alignment_;
+  features_ = alignment_ = NULL;
+}
+
+bool AlignedFeatureReader::Read(AlignedUtterance *utterance) {
+  CHECK_NOTNULL(features_);
+  error_ = false;
+  if (features_->AtEnd() && alignment_->AtEnd())
+    return false;
+  error_ = true;
+  int32_t num_frames, dimension, num_aligned;
+  if (!(features_->ReadBinary(&num_frames) &&
+        features_->ReadBinary(&dimension) &&
+        alignment_->ReadBinary(&num_aligned))) {
+    LOG(ERROR) << "cannot read utterance header";
+    return false;
+  }
+  if (num_frames != num_aligned || num_frames < 0 || dimension <= 0) {
+    LOG(ERROR) << "invalid utterance: frames=" << num_frames
+               << " aligned=" << num_aligned << " dimension=" << dimension;
+    return false;
+  }
+  utterance->dimension = dimension;
+  utterance->features.resize(num_frames * dimension);
+  alignment_buffer_.resize(2 * num_frames);
+  utterance->phones.resize(num_frames);
+  utterance->states.resize(num_frames);
+  if (num_frames) {
+    if (!(features_->ReadBinary(&utterance->features[0],
+                                utterance->features.size()) &&
+          alignment_->ReadBinary(&alignment_buffer_[0],
+                                 alignment_buffer_.size()))) {
+      LOG(ERROR) << "cannot read utterance data";
+      return false;
+    }
+  }
+  for (int t = 0; t < num_frames; ++t) {
+    utterance->phones[t] = alignment_buffer_[2 * t];
+    utterance->states[t] = alignment_buffer_[2 * t + 1];
+  }
+  error_ = false;
+  return true;
+}
+
+// ====================================================================
+
+// Phone, HMM state, and context phones of a sample.
+struct StatisticsAccumulator::Key {
+  int phone, state;
+  // left contexts (nearest first), followed by the right contexts.
+  std::vector<int> context;
+
+  size_t HashValue() const {
+    size_t h = HashRange(context.begin(), context.end(), phone);
+    HashCombine(h, state);
+    return h;
+  }
+  bool IsEqual(const Key &other) const {
+    return phone == other.phone && state == other.state &&
+        context == other.context;
+  }
+  bool operator<(const Key &other) const {
+    if (phone != other.phone) return phone < other.phone;
+    if (state != other.state) return state < other.state;
+    return context < other.context;
+  }
+};
+
+struct StatisticsAccumulator::Shard {
+  typedef __gnu_cxx::hash_map<Key, DoubleStatistics,
+                              Hash<Key>, Equal<Key> > StatisticsMap;
+  StatisticsMap statistics;
+#ifdef HAVE_THREADS
+  threads::Mutex mutex;
+#endif
+};
+
+#ifdef HAVE_THREADS
+class StatisticsAccumulator::Mapper {
+public:
+  explicit Mapper(StatisticsAccumulator *accumulator)
+      : accumulator_(accumulator) {}
+  Mapper* Clone() const {
+    return new Mapper(accumulator_);
+  }
+  void Map(const AlignedUtterance *utterance) {
+    accumulator_->AddUtterance(*utterance);
+  }
+  void Reset() {}
+private:
+  StatisticsAccumulator *accumulator_;
+};
+#endif
+
+StatisticsAccumulator::StatisticsAccumulator(
+    int num_phones, int num_left_contexts, int num_right_contexts,
+    int boundary_phone, int num_shards)
+    : num_phones_(num_phones), num_left_contexts_(num_left_contexts),
+      num_right_contexts_(num_right_contexts),
+      boundary_phone_(boundary_phone), dimension_(-1) {
+  CHECK_GT(num_shards, 0);
+  CHECK_GE(boundary_phone, 0);
+  CHECK_LT(boundary_phone, num_phones);
+  for (int s = 0; s < num_shards; ++s)
+    shards_.push_back(new Shard());
+}
+
+StatisticsAccumulator::~StatisticsAccumulator() {
+  STLDeleteElements(&shards_);
+}
+
+bool StatisticsAccumulator::IsValid(const AlignedUtterance &utterance) const {
+  for (int t = 0; t < utterance.NumFrames(); ++t) {
+    if (utterance.phones[t] < 0 || utterance.phones[t] >= num_phones_ ||
+        utterance.states[t] < 0)
+      return false;
+  }
+  return true;
+}
+
+void StatisticsAccumulator::AddUtterance(const AlignedUtterance &utterance) {
+  CHECK_EQ(utterance.dimension, dimension_);
+  const std::vector<int> &phones = utterance.phones;
+  const std::vector<int> &states = utterance.states;
+  const int num_frames = utterance.NumFrames();
+  // first frame of each phone segment
+  std::vector<int> begin;
+  for (int t = 0; t < num_frames; ++t) {
+    if (!t || phones[t] != phones[t - 1] || states[t] < states[t - 1])
+      begin.push_back(t);
+  }
+  const int num_segments = begin.size();
+  begin.push_back(num_frames);
+  Key key;
+  key.context.resize(num_left_contexts_ + num_right_contexts_);
+  DoubleStatistics stat(dimension_);
+  std::vector<float> observation(dimension_);
+  for (int s = 0; s < num_segments; ++s) {
+    key.phone = phones[begin[s]];
+    for (int l = 0; l < num_left_contexts_; ++l) {
+      const int c = s - l - 1;
+      key.context[l] = c >= 0 ? phones[begin[c]] : boundary_phone_;
+    }
+    for (int r = 0; r < num_right_contexts_; ++r) {
+      const int c = s + r + 1;
+      key.context[num_left_contexts_ + r] =
+          c < num_segments ? phones[begin[c]] : boundary_phone_;
+    }
+    for (int t = begin[s]; t < begin[s + 1];) {
+      key.state = states[t];
+      stat.Reset(dimension_);
+      for (; t < begin[s + 1] && states[t] == key.state; ++t) {
+        observation.assign(utterance.Frame(t),
+                           utterance.Frame(t) + dimension_);
+        stat.AddObservation(observation);
+      }
+      Shard *shard = shards_[key.HashValue() % shards_.size()];
+#ifdef HAVE_THREADS
+      threads::MutexLock lock(&shard->mutex);
+#endif
+      Shard::StatisticsMap::iterator i = shard->statistics.find(key);
+      if (i == shard->statistics.end())
+        shard->statistics.insert(std::make_pair(key, stat));
+      else
+        i->second.Accumulate(stat);
+    }
+  }
+}
+
+bool StatisticsAccumulator::AddFiles(const std::string &feature_file,
+                                     const std::string &alignment_file,
+                                     int num_threads) {
+  AlignedFeatureReader reader;
+  if (!reader.Open(feature_file, alignment_file))
+    return false;
+  const int batch_size = std::max(1, num_threads * kUtterancesPerThread);
+  std::vector<AlignedUtterance> batch(batch_size);
+#ifdef HAVE_THREADS
+  threads::ThreadPool<const AlignedUtterance*, Mapper> pool;
+  if (num_threads > 1)
+    pool.Init(num_threads, Mapper(this));
+#endif
+  int num_utterances = 0;
+  bool end = false;
+  while (!end) {
+    int size = 0;
+    for (; size < batch_size; ++size) {
+      if (!reader.Read(&batch[size])) {
+        if (reader.HasError()) return false;
+        end = true;
+        break;
+      }
+      if (!IsValid(batch[size])) {
+        REP(ERROR) << "invalid phone or state in utterance "
+                   << num_utterances + size;
+        return false;
+      }
+      if (dimension_ < 0) dimension_ = batch[size].dimension;
+      if (batch[size].dimension != dimension_) {
+        REP(ERROR) << "feature dimension mismatch in utterance "
+                   << num_utterances + size;
+        return false;
+      }
+    }
+#ifdef HAVE_THREADS
+    if (num_threads > 1) {
+      for (int u = 0; u < size; ++u)
+        pool.Submit(&batch[u]);
+      pool.Wait();
+    } else
+#endif
+    {
+      for (int u = 0; u < size; ++u)
+        AddUtterance(batch[u]);
+    }
+    num_utterances += size;
+  }
+  VLOG(1) << "accumulated utterances: " << num_utterances;
+  return true;
+}
+
+int StatisticsAccumulator::NumSamples() const {
+  int n = 0;
+  for (int s = 0; s < shards_.size(); ++s)
+    n += shards_[s]->statistics.size();
+  return n;
+}
+
+namespace {
+template<class E>
+bool EntryKeyLess(const E *a, const E *b) {
+  return a->first < b->first;
+}
+}  // namespace
+
+void StatisticsAccumulator::GetEntries(
+    std::vector<const Entry*> *entries) const {
+  entries->clear();
+  entries->reserve(NumSamples());
+  for (int s = 0; s < shards_.size(); ++s) {
+    const Shard::StatisticsMap &statistics = shards_[s]->statistics;
+    for (Shard::StatisticsMap::const_iterator i = statistics.begin();
+         i != statistics.end(); ++i)
+      entries->push_back(&*i);
+  }
+  std::sort(entries->begin(), entries->end(), EntryKeyLess<Entry>);
+}
+
+void StatisticsAccumulator::GetSamples(Samples *samples) const {
+  samples->SetFeatureDimension(dimension_);
+  std::vector<const Entry*> entries;
+  GetEntries(&entries);
+  for (std::vector<const Entry*>::const_iterator e = entries.begin();
+       e != entries.end(); ++e) {
+    const Key &key = (*e)->first;
+    Sample *sample = samples->AddSample(key.phone, key.state);
+    std::vector<int>::const_iterator c = key.context.begin();
+    sample->left_context_.assign(c, c + num_left_contexts_);
+    sample->right_context_.assign(c + num_left_contexts_, key.context.end());
+    sample->stat.Accumulate((*e)->second);
+  }
+}
+
+bool StatisticsAccumulator::Write(
+    const std::string &filename,
+    const std::vector<std::string> &phones) const {
+  CHECK_EQ(phones.size(), num_phones_);
+  SampleBinaryWriter writer;
+  if (!writer.Open(filename, std::max(dimension_, 0), num_left_contexts_,
+                   num_right_contexts_, phones))
+    return false;
+  std::vector<const Entry*> entries;
+  GetEntries(&entries);
+  std::vector<int> left, right;
+  Statistics stat;
+  for (std::vector<const Entry*>::const_iterator e = entries.begin();
+       e != entries.end(); ++e) {
+    const Key &key = (*e)->first;
+    std::vector<int>::const_iterator c = key.context.begin();
+    left.assign(c, c + num_left_contexts_);
+    right.assign(c + num_left_contexts_, key.context.end());
+    stat.Reset(dimension_);
+    stat.Accumulate((*e)->second);
+    writer.Write(key.phone, key.state, left, right, stat);
+  }
+  VLOG(1) << "wrote samples: " << writer.NumSamples();
+  return writer.Close();
+}
+
+}  // namespace trainc
@@ -0,0 +1,137 @@
+// accumulator.h
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Accumulation of sample statistics from features and state alignments.
+
+#ifndef ACCUMULATOR_H_
+#define ACCUMULATOR_H_
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "util.h"
+
+namespace trainc {
+
+class DoubleStatistics;
+class InputBuffer;
+class Samples;
+
+// Features and state alignment of an utterance.
+struct AlignedUtterance {
+  int dimension;
+  // num_frames x dimension feature values
+  std::vector<float> features;
+  // phone and HMM state of each frame
+  std::vector<int> phones, states;
+  AlignedUtterance() : dimension(0) {}
+  int NumFrames() const { return phones.size(); }
+  const float* Frame(int t) const { return &features[t * dimension]; }
+};
+
+// Reads utterances from a binary feature file and a binary alignment file.
+// Both files consist of a sequence of utterances in the same order.
+// Feature file, per utterance:
+//   int32 num_frames, int32 dimension, float features[num_frames][dimension]
+// Alignment file, per utterance:
+//   int32 num_frames, num_frames times: int32 phone, int32 hmm_state
+// Phones are indexes of the phone symbol table.
+// Values are stored in the native byte order.
+class AlignedFeatureReader {
+public:
+  AlignedFeatureReader();
+  ~AlignedFeatureReader();
+
+  bool Open(const std::string &feature_file,
+            const std::string &alignment_file);
+  void Close();
+  // Read the next utterance.
+  // Returns false at the end of the files or if an error occurred.
+  bool Read(AlignedUtterance *utterance);
+  // True if the previous call of Read() failed because of an error.
+  bool HasError() const { return error_; }
+
+private:
+  InputBuffer *features_, *alignment_;
+  std::vector<int32_t> alignment_buffer_;
+  bool error_;
+  DISALLOW_COPY_AND_ASSIGN(AlignedFeatureReader);
+};
+
+// Accumulates the statistics of each combination of phone, HMM state,
+// and context phones.
+// A new phone segment starts if the aligned phone changes or if the HMM
+// state decreases. Contexts beyond the utterance boundaries are filled
+// with the boundary phone.
+// The statistics are stored in several hash maps (shards), each protected
+// by a mutex, such that utterances can be accumulated in parallel.
+class StatisticsAccumulator {
+public:
+  StatisticsAccumulator(int num_phones, int num_left_contexts,
+                        int num_right_contexts, int boundary_phone,
+                        int num_shards);
+  ~StatisticsAccumulator();
+
+  // Set the feature dimension.
+  // Has to be called before AddUtterance(); AddFiles() uses the dimension
+  // of the first utterance if not set.
+  void SetDimension(int dimension) { dimension_ = dimension; }
+  int Dimension() const { return dimension_; }
+
+  // Accumulate the statistics of the utterance.
+  // Can be called concurrently from several threads.
+  void AddUtterance(const AlignedUtterance &utterance);
+
+  // Read and accumulate all utterances of the given files using
+  // num_threads threads.
+  bool AddFiles(const std::string &feature_file,
+                const std::string &alignment_file, int num_threads);
+
+  // Check the phone indexes of the utterance.
+  bool IsValid(const AlignedUtterance &utterance) const;
+
+  // Number of distinct samples.
+  int NumSamples() const;
+
+  // Add all samples. Sets the feature dimension of samples.
+  void GetSamples(Samples *samples) const;
+
+  // Write all samples to a binary sample file (see SampleBinaryReader),
+  // sorted by phone, HMM state, and context.
+  // phones are the phone symbols.
+  bool Write(const std::string &filename,
+             const std::vector<std::string> &phones) const;
+
+private:
+  struct Key;
+  struct Shard;
+  class Mapper;
+  typedef std::pair<const Key, DoubleStatistics> Entry;
+  // All samples sorted by key.
+  void GetEntries(std::vector<const Entry*> *entries) const;
+
+  int num_phones_, num_left_contexts_, num_right_contexts_;
+  int boundary_phone_, dimension_;
+  std::vector<Shard*> shards_;
+  DISALLOW_COPY_AND_ASSIGN(StatisticsAccumulator);
+};
+
+}  // namespace trainc
+
+#endif  // ACCUMULATOR_H_
@@ -0,0 +1,126 @@
+// accumulator_test.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Tests for StatisticsAccumulator
+
+#include "accumulator.h"
+#include "file.h"
+#include "sample.h"
+#include "unittest.h"
+
+namespace trainc {
+
+class StatisticsAccumulatorTest : public ::testing::Test {
+public:
+  void SetUp() {
+    feature_file_ = FLAGS_test_tmpdir + "/features.bin";
+    alignment_file_ = FLAGS_test_tmpdir + "/alignment.bin";
+  }
+
+  // One-dimensional features with value t + 1 for frame t.
+  void AddFrame(int phone, int state) {
+    utterance_.dimension = 1;
+    utterance_.features.push_back(utterance_.NumFrames() + 1);
+    utterance_.phones.push_back(phone);
+    utterance_.states.push_back(state);
+  }
+
+  // Write num_utterances copies of utterance_.
+  // The alignment has num_frames_offset frames more than the features.
+  void WriteFiles(int num_utterances, int num_frames_offset = 0) {
+    OutputBuffer features(File::Create(feature_file_, "w"));
+    OutputBuffer alignment(File::Create(alignment_file_, "w"));
+    for (int u = 0; u < num_utterances; ++u) {
+      const int32_t num_frames = utterance_.NumFrames();
+      features.WriteBinary(num_frames);
+      features.WriteBinary(static_cast<int32_t>(utterance_.dimension));
+      for (int i = 0; i < utterance_.features.size(); ++i)
+        features.WriteBinary(utterance_.features[i]);
+      alignment.WriteBinary(num_frames + num_frames_offset);
+      for (int t = 0; t < num_frames; ++t) {
+        alignment.WriteBinary(static_cast<int32_t>(utterance_.phones[t]));
+        alignment.WriteBinary(static_cast<int32_t>(utterance_.states[t]));
+      }
+    }
+    features.CloseFile();
+    alignment.CloseFile();
+  }
+
+  void ExpectSample(const Sample &sample, int left, int right,
+                    float weight, float sum, float sum2) {
+    ASSERT_EQ(1, sample.left_context_.size());
+    ASSERT_EQ(1, sample.right_context_.size());
+    EXPECT_EQ(left, sample.left_context_[0]);
+    EXPECT_EQ(right, sample.right_context_[0]);
+    EXPECT_EQ(weight, sample.stat.weight());
+    EXPECT_EQ(sum, sample.stat.sum()[0]);
+    EXPECT_EQ(sum2, sample.stat.sum2()[0]);
+  }
+
+protected:
+  std::string feature_file_, alignment_file_;
+  AlignedUtterance utterance_;
+};
+
+// Phone 2 occurs twice in a row, separated by the decreasing state.
+TEST_F(StatisticsAccumulatorTest, Accumulate) {
+  const int num_phones = 3, boundary = 0, num_utterances = 10;
+  AddFrame(1, 0);
+  AddFrame(1, 0);
+  AddFrame(1, 1);
+  AddFrame(2, 0);
+  AddFrame(2, 0);
+  AddFrame(2, 1);
+  AddFrame(2, 0);
+  WriteFiles(num_utterances);
+  const int threads[] = { 1, 3 };
+  for (int i = 0; i < 2; ++i) {
+    StatisticsAccumulator accumulator(num_phones, 1, 1, boundary, 4);
+    EXPECT_TRUE(accumulator.AddFiles(feature_file_, alignment_file_,
+                                     threads[i]));
+    EXPECT_EQ(1, accumulator.Dimension());
+    EXPECT_EQ(5, accumulator.NumSamples());
+    Samples samples;
+    samples.SetNumPhones(num_phones);
+    accumulator.GetSamples(&samples);
+    const float n = num_utterances;
+    ASSERT_EQ(1, samples.GetSamples(1, 0).size());
+    ExpectSample(samples.GetSamples(1, 0).front(), 0, 2, 2 * n, 3 * n, 5 * n);
+    ASSERT_EQ(1, samples.GetSamples(1, 1).size());
+    ExpectSample(samples.GetSamples(1, 1).front(), 0, 2, n, 3 * n, 9 * n);
+    const Samples::SampleList &s20 = samples.GetSamples(2, 0);
+    ASSERT_EQ(2, s20.size());
+    ExpectSample(s20.front(), 1, 2, 2 * n, 9 * n, 41 * n);
+    ExpectSample(s20.back(), 2, 0, n, 7 * n, 49 * n);
+    ASSERT_EQ(1, samples.GetSamples(2, 1).size());
+    ExpectSample(samples.GetSamples(2, 1).front(), 1, 2, n, 6 * n, 36 * n);
+  }
+}
+
+TEST_F(StatisticsAccumulatorTest, Invalid) {
+  AddFrame(1, 0);
+  AddFrame(2, 0);
+  WriteFiles(2, 1);
+  StatisticsAccumulator accumulator(3, 1, 1, 0, 1);
+  EXPECT_FALSE(accumulator.AddFiles(feature_file_, alignment_file_, 1));
+  WriteFiles(2);
+  StatisticsAccumulator small(2, 1, 1, 0, 1);
+  EXPECT_FALSE(small.AddFiles(feature_file_, alignment_file_, 1));
+}
+
+}  // namespace trainc
@@ -42,10 +42,17 @@ using std::vector;
 using fst::SymbolTable;
 
 // Input parameters:
-// TODO(rybach): allow multiple sample data files.
-DEFINE_string(samples_file, "", "sample data file");
+DEFINE_string(samples_file, "",
+              "sample data files (comma separated, - for stdin)");
+DEFINE_bool(merge_samples, false,
+            "merge samples with identical contexts while loading. "
+            "Reduces the number of seen contexts (see min_seen_contexts)");
+DEFINE_int32(sample_chunk_size, 100000,
+             "number of samples read at once");
 // See SampleReader
-DEFINE_string(sample_type, "text", "sample file type");
+DEFINE_string(sample_type, "text", "sample file type: text or binary");
+DEFINE_string(sample_format, "float",
+              "storage of the sample statistics: float, fp16, bf16, block16");
 DEFINE_string(phone_syms, "", "labels for context (output) symbols");
 DEFINE_int32(num_left_contexts, 1, "number of left context symbols");
 DEFINE_int32(num_right_contexts, 1, "number of right context symbols");
@@ -57,6 +64,8 @@ DEFINE_int32(min_observations, 1000,
              "minimum number of observations per leaf");
 DEFINE_double(variance_floor, 0.001,
                "minimum variance threshold for Gaussian models");
+DEFINE_string(accumulator, "float",
+              "precision of the summed statistics: float, double, kahan");
 DEFINE_bool(use_composition, true,
             "use composition of C and the counting transducer");
 DEFINE_bool(shifted_models, true,
@@ -68,12 +77,31 @@ DEFINE_bool(determistic_split, true,
 DEFINE_bool(ignore_absent_models, false,
              "do not consider models for splitting which are not part of the"
              "used counting transducer");
+DEFINE_bool(check_splits, false,
+            "check the modified states of the C transducer after each split"
+            " (debugging)");
+DEFINE_bool(check_transducer, false,
+            "check that the C transducer accepts all phone sequences");
+DEFINE_int32(check_samples, 0,
+             "number of random phone sequences checked by --check_transducer"
+             " (0 = all sequences)");
+DEFINE_int32(check_seed, 1, "random seed for --check_samples");
 DEFINE_string(replay, "", "execute the splits from the given file");
+DEFINE_string(warm_start, "",
+              "execute the splits from the given file before optimizing");
+// Distributed split optimization, see DistributedSplitter.
+DEFINE_string(distributed_role, "", "coordinator or worker");
+DEFINE_string(distributed_address, "",
+              "unix:<path> or <host>:<port> of the coordinator");
+DEFINE_int32(num_workers, 0, "number of worker processes");
+DEFINE_int32(worker_id, 0, "worker index in [1, num_workers]");
 
 // Output parameters:
 DEFINE_string(ci_state_list, "", "list of context independent states");
 DEFINE_string(hmm_list, "", "HMM list");
 DEFINE_string(Ctrans, "", "C transducer output file");
+DEFINE_string(Ctrans_type, "vector",
+              "FST type of the C transducer: vector, const, or compact");
 DEFINE_string(CLtrans, "", "split counting transducer output file");
 DEFINE_string(ci_hmmlist, "", "CI HMM list output file");
 DEFINE_string(hmmlist, "", "HMM list output file");
@@ -81,7 +109,8 @@ DEFINE_string(hmm_to_phone_map, "", "CD HMM to phone map output file");
 DEFINE_string(hmm_syms, "", "HMM symbol table output file");
 DEFINE_string(leaf_model, "", "state distribution model output file");
 // see ModelWriter
-DEFINE_string(leaf_model_type, "", "type of state model output file");
+DEFINE_string(leaf_model_type, "",
+              "type of state model output file: text, rwth-text, binary");
 DEFINE_string(state_syms, "", "States symbol table output file");
 DEFINE_string(Htrans, "", "H transducer output file");
 
@@ -132,7 +161,18 @@ DEFINE_string(final_phones, "", "file containing word end phones");
 DEFINE_string(state_model_log, "", "state model information");
 DEFINE_string(transducer_log, "", "transducer state information");
 DEFINE_int32(max_hyps, 0, "maximum number of hypotheses evaluated");
-DEFINE_int32(num_threads, 1, "number of threads used for split calculations");
+DEFINE_bool(question_tables, false,
+            "evaluate all questions of a context position in one pass");
+DEFINE_bool(prune_hyps, false,
+            "prune split hypotheses using upper bounds of the gain");
+DEFINE_bool(lazy_hyps, false,
+            "create the split hypotheses of new models only when required");
+DEFINE_int32(cost_cache_size, 0,
+             "number of cached split model costs and statistics, "
+             "0 disables the cache (not with --question_tables or "
+             "--prune_hyps)");
+DEFINE_int32(num_threads, 1,
+             "number of threads used for split calculations and loading");
 
 namespace trainc {
 
@@ -165,11 +205,22 @@ class Builder {
     if (!FLAGS_final_phones.empty())
       builder_.SetFinalPhones(FLAGS_final_phones);
 
-    SampleReader *reader = SampleReader::Create(FLAGS_sample_type);
-    reader->SetPhoneSymbols(phone_symbols);
+    vector<string> sample_files;
+    SplitStringUsing(FLAGS_samples_file, ",", &sample_files);
     Samples *samples = new Samples();
     samples->SetNumPhones(num_phones);
-    reader->Read(FLAGS_samples_file, samples);
+    if (!ReadSampleFiles(FLAGS_sample_type, phone_symbols, sample_files,
+                         FLAGS_num_threads, FLAGS_sample_chunk_size,
+                         FLAGS_merge_samples, samples)) {
+      REP(FATAL) << "cannot read samples";
+      return;
+    }
+    StatisticsFormat format;
+    if (!ParseStatisticsFormat(FLAGS_sample_format, &format)) {
+      REP(FATAL) << "unknown sample format: " << FLAGS_sample_format;
+      return;
+    }
+    samples->Pack(format);
     builder_.SetSamples(samples);
     if (!FLAGS_phone_length.empty()) {
       builder_.SetPhoneLength(FLAGS_phone_length);
@@ -182,14 +233,34 @@ class Builder {
 
     // generate the context dependency transducer.
     builder_.Build();
+    // the coordinator writes the result of a distributed optimization.
+    if (FLAGS_distributed_role == "worker")
+      return;
+    if (FLAGS_check_transducer && !builder_.CheckTransducer())
+      REP(FATAL) << "invalid C transducer";
     WriteOutput();
   }
 
  private:
   // Forward flags to the ContextBuilder.
   void SetParameters() {
+    if (!FLAGS_replay.empty() && !FLAGS_distributed_role.empty())
+      REP(FATAL) << "--replay cannot be used with --distributed_role";
+    if (!FLAGS_warm_start.empty() &&
+        !(FLAGS_replay.empty() && FLAGS_distributed_role.empty()))
+      REP(FATAL) << "--warm_start cannot be used with --replay or "
+                 << "--distributed_role";
+    if (!FLAGS_warm_start.empty() && FLAGS_warm_start == FLAGS_save_splits)
+      REP(FATAL) << "--warm_start and --save_splits must be different files";
+    if (FLAGS_cost_cache_size > 0 &&
+        (FLAGS_question_tables || FLAGS_prune_hyps))
+      REP(FATAL) << "--cost_cache_size cannot be used with "
+                 << "--question_tables or --prune_hyps";
     builder_.SetReplay(FLAGS_replay);
+    builder_.SetDistributed(FLAGS_distributed_role, FLAGS_distributed_address,
+                            FLAGS_num_workers, FLAGS_worker_id);
     builder_.SetSaveSplits(FLAGS_save_splits);
+    builder_.SetWarmStart(FLAGS_warm_start);
     builder_.SetContextLength(FLAGS_num_left_contexts,
                               FLAGS_num_right_contexts,
                               FLAGS_split_center_phone);
@@ -197,16 +268,26 @@ class Builder {
     builder_.SetMinSeenContexts(FLAGS_min_seen_contexts);
     builder_.SetMinObservations(FLAGS_min_observations);
     builder_.SetVarianceFloor(FLAGS_variance_floor);
+    AccumulatorType accumulator;
+    if (!ParseAccumulatorType(FLAGS_accumulator, &accumulator))
+      REP(FATAL) << "unknown accumulator type: " << FLAGS_accumulator;
+    builder_.SetAccumulator(accumulator);
     builder_.SetTargetNumModels(FLAGS_target_num_models);
     builder_.SetTargetNumStates(FLAGS_target_num_states);
     builder_.SetStatePenaltyWeight(FLAGS_state_penalty_weight);
     builder_.SetMaxHypotheses(FLAGS_max_hyps);
+    builder_.SetCostCacheSize(FLAGS_cost_cache_size);
+    builder_.SetUseQuestionTables(FLAGS_question_tables);
+    builder_.SetPruneHypotheses(FLAGS_prune_hyps);
+    builder_.SetLazyHypotheses(FLAGS_lazy_hyps);
     builder_.SetTransducerInitType(FLAGS_transducer_init);
     builder_.SetCountingTransducer(FLAGS_counting_transducer);
     builder_.SetUseComposition(FLAGS_use_composition);
     builder_.SetShiftedTransducer(FLAGS_shifted_models);
     builder_.SetSplitDetermistic(FLAGS_determistic_split);
     builder_.SetIgnoreAbsentModels(FLAGS_ignore_absent_models);
+    builder_.SetCheckSplits(FLAGS_check_splits);
+    builder_.SetCheckSamples(FLAGS_check_samples, FLAGS_check_seed);
   }
 
   void SetQuestionSets(const SymbolTable &phone_symbols) {
@@ -322,7 +403,7 @@ class Builder {
     if (!FLAGS_cd2ci_state_name_map.empty())
       hmm_compiler.WriteStateNameMap(FLAGS_cd2ci_state_name_map);
     if (!FLAGS_Ctrans.empty())
-      builder_.WriteTransducer(FLAGS_Ctrans);
+      builder_.WriteTransducer(FLAGS_Ctrans, FLAGS_Ctrans_type);
     if (!FLAGS_CLtrans.empty())
       builder_.WriteCountingTransducer(FLAGS_CLtrans);
     if (!FLAGS_state_model_log.empty())
@@ -95,8 +95,8 @@ public:
   virtual ~StateObserver() {}
   void NotifyAddState(const State *s) { receiver_->StateAdded(s); }
   void NotifyRemoveState(const State *s) { receiver_->StateRemoved(s); }
-  void NotifyAddArc(const State::ArcRef) { receiver_->ArcUpdate(); }
-  void NotifyRemoveArc(const State::ArcRef) { receiver_->ArcUpdate(); }
+  void NotifyAddArc(const State::ArcRef a) { receiver_->ArcUpdate(a); }
+  void NotifyRemoveArc(const State::ArcRef a) { receiver_->ArcUpdate(a); }
 private:
   ComposedTransducer *receiver_;
 };
@@ -182,6 +182,11 @@ void ComposedTransducer::StateRemoved(const State *s) {
   need_update_ = true;
 }
 
+void ComposedTransducer::ArcUpdate(const State::ArcRef arc) {
+  cfst_->InvalidateArcs(arc->source());
+  need_update_ = true;
+}
+
 void ComposedTransducer::FinishSplit() {
   c_->FinishSplit();
   if (need_update_) {
@@ -75,7 +75,7 @@ public:
   void StateRemoved(const State *s);
 
   // process add/remove arc event from the C transducer
-  void ArcUpdate() { need_update_ = true; }
+  void ArcUpdate(const State::ArcRef arc);
 
   AbstractSplitPredictor* CreateSplitPredictor() const;
 private:
@@ -27,7 +27,9 @@
 #include "composed_transducer.h"
 #include "context_set.h"
 #include "hash.h"
+#include "distributed_splitter.h"
 #include "hmm_compiler.h"
+#include "kernels.h"
 #include "lexicon_check.h"
 #include "lexicon_compiler.h"
 #include "lexicon_transducer.h"
@@ -43,6 +45,8 @@
 #include "transducer_init.h"
 #include "context_builder.h"
 
+DECLARE_int32(num_threads);
+
 namespace trainc {
 
 using __gnu_cxx::hash_set;
@@ -67,6 +71,10 @@ ContextBuilder::ContextBuilder()
       split_center_(false),
       shifted_cl_(true),
       determistic_cl_(true),
+      check_splits_(false),
+      check_samples_(0),
+      check_seed_(0),
+      accumulator_(kFloatAccumulator),
       builder_(new ModelSplitter()) {}
 
 ContextBuilder::~ContextBuilder() {
@@ -83,6 +91,9 @@ ContextBuilder::~ContextBuilder() {
     question_sets_.pop_back();
   }
   delete builder_;
+  // Release the context sets of this builder, unless they are still used.
+  if (!ContextSetTable::Instance()->ClearIfUnused())
+    VLOG(1) << "context set table in use";
 }
 
 void ContextBuilder::SetReplay(const std::string &filename) {
@@ -97,6 +108,25 @@ void ContextBuilder::SetReplay(const std::string &filename) {
   }
 }
 
+void ContextBuilder::SetDistributed(const std::string &role,
+                                    const std::string &address,
+                                    int num_workers, int worker_id) {
+  if (role.empty()) return;
+  int rank = -1;
+  if (role == "coordinator")
+    rank = 0;
+  else if (role == "worker")
+    rank = worker_id;
+  else
+    LOG(FATAL) << "unknown distributed role: " << role;
+  if (rank < 0 || rank > num_workers || (role == "worker" && rank == 0))
+    LOG(FATAL) << "invalid worker id " << worker_id
+               << " for " << num_workers << " workers";
+  delete builder_;
+  VLOG(1) << "distributed " << role << " " << rank << " using " << address;
+  builder_ = new DistributedSplitter(rank, num_workers, address);
+}
+
 void ContextBuilder::SetSaveSplits(const std::string &filename) {
   if (!filename.empty()) {
     File *file = File::OpenOrDie(filename, "w");
@@ -104,6 +134,15 @@ void ContextBuilder::SetSaveSplits(const std::string &filename) {
   }
 }
 
+void ContextBuilder::SetWarmStart(const std::string &filename) {
+  if (!filename.empty()) {
+    VLOG(1) << "warm start from split file " << filename;
+    File *file = File::OpenOrDie(filename, "r");
+    if (!builder_->SetWarmStart(file))
+      LOG(FATAL) << "error reading split file " << filename;
+  }
+}
+
 // Set num_phones_, construct all_phones, and create phone_info_
 void ContextBuilder::SetPhoneSymbols(const SymbolTable &phone_symbols) {
   delete phone_symbols_;
@@ -144,9 +183,12 @@ void ContextBuilder::SetDefaultQuestionSet(
   CHECK_GE(num_right_contexts_, 0);
   question_sets_.push_back(QuestionSet());
   QuestionSet *default_questions = &question_sets_.back();
-  ConvertQuestionSet(question_set, default_questions);
-  builder_->GetQuestions()->resize(num_left_contexts_ + num_right_contexts_ + 1,
-                                   default_questions);
+  question_tables_.push_back(QuestionTable());
+  QuestionTable *default_table = &question_tables_.back();
+  ConvertQuestionSet(question_set, default_questions, default_table);
+  const int num_positions = num_left_contexts_ + num_right_contexts_ + 1;
+  builder_->GetQuestions()->resize(num_positions, default_questions);
+  builder_->GetQuestionTables()->resize(num_positions, default_table);
 }
 
 void ContextBuilder::SetQuestionSetPerContext(
@@ -155,15 +197,19 @@ void ContextBuilder::SetQuestionSetPerContext(
   CHECK(!questions.empty());
   question_sets_.push_back(QuestionSet());
   QuestionSet *qs = &question_sets_.back();
-  ConvertQuestionSet(question_set, qs);
+  question_tables_.push_back(QuestionTable());
+  QuestionTable *table = &question_tables_.back();
+  ConvertQuestionSet(question_set, qs, table);
   int pos = context_position + num_left_contexts_;
   CHECK(pos < questions.size());
   questions[pos] = qs;
+  (*builder_->GetQuestionTables())[pos] = table;
 }
 
+// The membership table of the questions is stored in table.
 void ContextBuilder::ConvertQuestionSet(
     const SetInventory &set_inventory,
-    QuestionSet *question_set) const {
+    QuestionSet *question_set, QuestionTable *table) const {
   CHECK_GT(num_phones_, 0);
   CHECK_EQ(phone_symbols_->NumSymbols(),
            set_inventory.GetSymTable()->NumSymbols());
@@ -183,6 +229,7 @@ void ContextBuilder::ConvertQuestionSet(
       LOG(WARNING) << "ignoring redundant question " << inv_iter.Name();
     }
   }
+  table->Init(num_phones_, *question_set);
 }
 
 void ContextBuilder::SetContextLength(int left_context, int right_context,
@@ -214,6 +261,26 @@ void ContextBuilder::SetVarianceFloor(float floor) {
   variance_floor_ = floor;
 }
 
+void ContextBuilder::SetAccumulator(AccumulatorType type) {
+  accumulator_ = type;
+}
+
+void ContextBuilder::SetUseQuestionTables(bool use) {
+  builder_->SetUseQuestionTables(use);
+}
+
+void ContextBuilder::SetPruneHypotheses(bool prune) {
+  builder_->SetPruneHypotheses(prune);
+}
+
+void ContextBuilder::SetLazyHypotheses(bool lazy) {
+  builder_->SetLazyHypotheses(lazy);
+}
+
+void ContextBuilder::SetCostCacheSize(int capacity) {
+  builder_->SetCostCacheSize(capacity);
+}
+
 void ContextBuilder::SetTargetNumModels(int num_models) {
   builder_->SetTargetNumModels(num_models);
 }
@@ -351,15 +418,40 @@ void ContextBuilder::SetFinalPhones(const vector<string> &final_phones) {
   ConvertPhones(final_phones, &final_phones_);
 }
 
+// The computations on the statistics are specialized for the feature
+// dimension of the samples, if possible.
 void ContextBuilder::SetSamples(const Samples *samples) {
+  if (SelectDimensionKernels(samples->FeatureDimension()))
+    REP(INFO) << "using kernels for feature dimension "
+              << samples->FeatureDimension();
   builder_->SetSamples(samples);
 }
 
 // Perform a structural check on the ConstructionalTransducer.
 bool ContextBuilder::CheckTransducer() const {
-  return ConstructionalTransducerCheck(
+  if (!ConstructionalTransducerCheck(
         *transducer_, phone_info_, num_left_contexts_,
-        num_right_contexts_).IsValid();
+        num_right_contexts_).IsValid())
+    return false;
+  if (!hmm_compiler_)
+    return true;
+  HmmTransducerCompiler compiler;
+  compiler.SetBoundaryPhone(boundary_phone_);
+  compiler.SetHmmCompiler(hmm_compiler_);
+  compiler.SetTransducer(transducer_);
+  fst::StdVectorFst *c = compiler.CreateTransducer();
+  StringMap hmm_to_phone;
+  hmm_compiler_->GetCDHMMtoPhoneMap(&hmm_to_phone);
+  CTransducerCheck check;
+  check.Init(*phone_symbols_, hmm_compiler_->GetHmmSymbols(), hmm_to_phone,
+             phone_symbols_->Find(boundary_phone_ + 1),
+             num_left_contexts_ + num_right_contexts_ + 1);
+  check.SetTransducer(c);
+  check.SetNumThreads(FLAGS_num_threads);
+  check.SetSampling(check_samples_, check_seed_);
+  const bool valid = check.IsValid();
+  delete c;
+  return valid;
 }
 
 // Create and initialize the ConstructionalTransducer and the
@@ -421,6 +513,7 @@ void ContextBuilder::Build() {
   CHECK_GT(num_phones_, 0);
   models_ = new ModelManager();
   scorer_ = new MaximumLikelihoodScorer(variance_floor_);
+  scorer_->SetAccumulator(accumulator_);
   // TODO(rybach): add scorer factory or at least a SetScorer method
   builder_->SetScorer(scorer_);
   transducer_ = CreateTransducer(models_);
@@ -438,10 +531,22 @@ void ContextBuilder::Build() {
     }
   }
   builder_->SetTransducer(count_transducer);
+  IncrementalTransducerCheck *split_check = NULL;
+  if (check_splits_) {
+    split_check = new IncrementalTransducerCheck(
+        *transducer_, phone_info_, num_left_contexts_, num_right_contexts_);
+    transducer_->RegisterObserver(split_check);
+    builder_->SetSplitCheck(split_check);
+  }
   builder_->InitModels(models_);
   builder_->InitSplitHypotheses(models_);
   builder_->SplitModels(models_);
   builder_->Cleanup();
+  if (split_check) {
+    builder_->SetSplitCheck(NULL);
+    transducer_->UnregisterObserver(split_check);
+    delete split_check;
+  }
   if (!CheckTransducer()) {
     LOG(WARNING) << "C transducer seems to be invalid";
   }
@@ -484,13 +589,20 @@ const HmmCompiler& ContextBuilder::GetHmmCompiler() const {
   return *hmm_compiler_;
 }
 
-void ContextBuilder::WriteTransducer(const string &filename) const {
+void ContextBuilder::WriteTransducer(const string &filename,
+                                     const string &fst_type) const {
   CHECK_NOTNULL(hmm_compiler_);
   CHECK_NOTNULL(transducer_);
   HmmTransducerCompiler compiler;
   compiler.SetBoundaryPhone(boundary_phone_);
   compiler.SetHmmCompiler(hmm_compiler_);
   compiler.SetTransducer(transducer_);
+  if (fst_type != "vector") {
+    if (!compiler.WriteTransducer(filename, fst_type))
+      REP(FATAL) << "cannot write " << filename;
+    VLOG(1) << "wrote " << filename;
+    return;
+  }
   fst::StdVectorFst *c = compiler.CreateTransducer();
   c->Write(filename);
   VLOG(1) << "wrote " << filename;
@@ -524,4 +636,8 @@ int ContextBuilder::NumStates() const {
   return transducer_->NumStates();
 }
 
+const LeafCostCache* ContextBuilder::GetCostCache() const {
+  return builder_->GetCostCache();
+}
+
 }  // namespace trainc
@@ -50,6 +50,7 @@ namespace trainc {
 class ComposedTransducer;
 class ConstructionalTransducer;
 class HmmCompiler;
+class LeafCostCache;
 class LexiconTransducer;
 class ModelSplitter;
 class Samples;
@@ -80,9 +81,24 @@ class ContextBuilder {
   // This method has to be called before any other method.
   void SetReplay(const std::string &filename);
 
+  // if !role.empty(), the split optimization is distributed over a
+  // coordinator process and num_workers worker processes, which
+  // communicate using the given address (see DistributedSplitter).
+  // role is either "coordinator" or "worker", worker_id is in
+  // [1, num_workers]. Cannot be combined with SetReplay.
+  // This method has to be called before any other method.
+  void SetDistributed(const std::string &role, const std::string &address,
+                      int num_workers, int worker_id);
+
   // Save the sequence of splits performed in the given file.
   void SetSaveSplits(const std::string &filename);
 
+  // if !filename.empty(), the splits stored in the given file (see
+  // SetSaveSplits) are executed before the optimization continues with
+  // the resulting models. Cannot be combined with SetReplay or
+  // SetDistributed.
+  void SetWarmStart(const std::string &filename);
+
   // Set the used phone symbols.
   void SetPhoneSymbols(const fst::SymbolTable &phone_symbols);
 
@@ -122,6 +138,31 @@ class ContextBuilder {
   // purpose of cost evaluation.
   void SetVarianceFloor(float floor);
 
+  // Set the precision used to accumulate the statistics of a state model
+  // for the cost evaluation.
+  void SetAccumulator(AccumulatorType type);
+
+  // Evaluate the split hypotheses of a state model at a context position
+  // in one pass using phone to question membership tables.
+  void SetUseQuestionTables(bool use);
+
+  // Prune the evaluation of questions using upper bounds of the gain
+  // derived from the statistics of the context phones. The pruned
+  // hypotheses would not be selected, the result is not affected.
+  // Uses the question tables.
+  void SetPruneHypotheses(bool prune);
+
+  // Create the split hypotheses of a new state model only when it may
+  // contain the best split, using an upper bound of the gain of its splits
+  // derived from the statistics of the context phones. Speeds up runs that
+  // stop early because of the target number of models or states.
+  void SetLazyHypotheses(bool lazy);
+
+  // Cache the costs and summed statistics of at most capacity state models
+  // created by split hypotheses. The cache is disabled if capacity is 0.
+  // The cache cannot be used together with question tables or pruning.
+  void SetCostCacheSize(int capacity);
+
   // Set maximum number of state models to build. If set to zero the
   // number of state models is not limited.
   void SetTargetNumModels(int num_models);
@@ -199,6 +240,18 @@ class ContextBuilder {
   // for splitting.
   void SetIgnoreAbsentModels(bool ignore);
 
+  // Check the states of the C transducer modified by each split
+  // (for debugging). Aborts at the first invalid split.
+  void SetCheckSplits(bool check) { check_splits_ = check; }
+
+  // Check only num_samples randomly drawn phone sequences in the
+  // validation of the final C transducer by CheckTransducer().
+  // num_samples = 0 checks all phone sequences (see CTransducerCheck).
+  void SetCheckSamples(int num_samples, unsigned int seed) {
+    check_samples_ = num_samples;
+    check_seed_ = seed;
+  }
+
   // Set initial phones, i.e. phones occurring at word begin.
   void SetInitialPhones(const vector<string> &initial_phones);
 
@@ -220,6 +273,8 @@ class ContextBuilder {
   void Build();
 
   // Check the intermediate transducer for valid structure.
+  // After Build(), also check that the final C transducer accepts the
+  // phone sequences, using FLAGS_num_threads threads.
   // Mainly intended for unit tests
   bool CheckTransducer() const;
 
@@ -228,7 +283,10 @@ class ContextBuilder {
   const HmmCompiler& GetHmmCompiler() const;
 
   // Construct and write the final context dependency transducer.
-  void WriteTransducer(const string &filename) const;
+  // fst_type is "vector", "const", or "compact". The const and compact
+  // transducers are written without constructing a StdVectorFst.
+  void WriteTransducer(const string &filename,
+                       const string &fst_type = "vector") const;
 
   // Construct and write the split counting transducer.
   // Requires SetCountingTransducer(...) and SetUseComposition(false)
@@ -240,11 +298,15 @@ class ContextBuilder {
   // Number of states in the transducer
   int NumStates() const;
 
+  // The cache of split model costs, NULL if the cache is disabled.
+  const LeafCostCache* GetCostCache() const;
+
  private:
   void ConvertPhones(const vector<string> &src, vector<int> *dst) const;
   void ConvertPhonesFromFile(const string &filename, vector<int> *dst) const;
   void ConvertQuestionSet(const SetInventory &set_inventory,
-                          QuestionSet *question_set) const;
+                          QuestionSet *question_set,
+                          QuestionTable *table) const;
   ComposedTransducer* CreateComposedTransducer(const string &l_file,
                                                ConstructionalTransducer *c) const;
   LexiconTransducer* CreateLexiconTransducer(const std::string &l_file,
@@ -268,9 +330,13 @@ class ContextBuilder {
   MaximumLikelihoodScorer *scorer_;
   int boundary_phone_;
   int num_left_contexts_, num_right_contexts_;
-  bool split_center_, shifted_cl_, determistic_cl_;
+  bool split_center_, shifted_cl_, determistic_cl_, check_splits_;
+  int check_samples_;
+  unsigned int check_seed_;
   float variance_floor_;
+  AccumulatorType accumulator_;
   list<QuestionSet> question_sets_;
+  list<QuestionTable> question_tables_;
   ModelSplitter *builder_;
   DISALLOW_COPY_AND_ASSIGN(ContextBuilder);
 };
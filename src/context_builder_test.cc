@@ -18,10 +18,22 @@
 // Tests for ContextBuilder. Create artificial statistics and runs
 // the C transducer / model construction.
 
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
 #include <sstream>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 #include "fst/fst-decl.h"
+#include "fst/const-fst.h"
+#include "fst/equal.h"
+#include "fst/vector-fst.h"
 #include "file.h"
 #include "context_builder.h"
+#include "cost_cache.h"
 #include "hmm_compiler.h"
 #include "phone_models.h"
 #include "phone_sequence.h"
@@ -385,6 +397,8 @@ class ContextBuilderModelTest : public ContextBuilderTest {
                                         Samples *samples);
   void CheckContextSets(const AllophoneStateModel &state_model,
                         int phone, int state) const;
+  // phone, state, and context of all state models, sorted.
+  void GetStateModels(vector<string> *models) const;
  private:
   vector< vector<int> > model_order_;
 };
@@ -392,6 +406,7 @@ class ContextBuilderModelTest : public ContextBuilderTest {
 void ContextBuilderModelTest::Init(
     int num_phones, int num_left_contexts, int num_right_contexts,
     int num_obs, int min_obs, float penalty_weight, float min_gain) {
+  model_order_.clear();
   model_order_.resize(num_phones + 1);
   ContextBuilderTest::Init(num_phones, num_left_contexts, num_right_contexts,
                            num_obs, min_obs, penalty_weight, min_gain);
@@ -451,6 +466,24 @@ void ContextBuilderModelTest::CreateStatisticsForState(
           << " state=" << state  << " " << index;
 }
 
+void ContextBuilderModelTest::GetStateModels(vector<string> *models) const {
+  typedef vector<const AllophoneStateModel*>::const_iterator ModelIter;
+  const HmmCompiler &hc = builder_->GetHmmCompiler();
+  models->clear();
+  for (int p = 1; p <= num_phones_; ++p) {
+    const int num_states = p < num_phones_ ? kHmmStates : kSilenceStates;
+    for (int s = 0; s < num_states; ++s) {
+      vector<const AllophoneStateModel*> state_models =
+          hc.GetStateModels(p, s);
+      for (ModelIter model = state_models.begin();
+           model != state_models.end(); ++model)
+        models->push_back(StringPrintf("%d %d ", p, s) +
+                          (*model)->GetContext().ToString());
+    }
+  }
+  std::sort(models->begin(), models->end());
+}
+
 void ContextBuilderModelTest::Check() const {
   typedef vector<const AllophoneStateModel*>::const_iterator ModelIter;
   const HmmCompiler &hc = builder_->GetHmmCompiler();
@@ -619,4 +652,296 @@ TEST_F(ContextBuilderTest, ReplayTest) {
   RunTest();
 }
 
+// Each split is checked incrementally, an invalid split aborts the test.
+TEST_F(ContextBuilderModelTest, CheckSplits) {
+  const int num_phones = 4;
+  const int left_context = 2;
+  const int right_context = 1;
+  const int num_obs = 1;
+  const int min_obs = 1;
+  const int state_penalty = 0;
+  const float min_gain = 0.0001;
+  Init(num_phones, left_context, right_context,
+       num_obs, min_obs, state_penalty, min_gain);
+  builder_->SetCheckSplits(true);
+  RunTest();
+}
+
+// The C transducer written directly as ConstFst and CompactFst must
+// have the same size as the StdVectorFst.
+TEST_F(ContextBuilderModelTest, ConstTransducer) {
+  const int num_phones = 4;
+  const int left_context = 1;
+  const int right_context = 1;
+  const int num_obs = 1;
+  const int min_obs = 1;
+  const int state_penalty = 0;
+  const float min_gain = 0.0001;
+  Init(num_phones, left_context, right_context,
+       num_obs, min_obs, state_penalty, min_gain);
+  RunTest();
+  const string prefix = FLAGS_test_tmpdir + "/c";
+  builder_->WriteTransducer(prefix + ".fst");
+  builder_->WriteTransducer(prefix + "_const.fst", "const");
+  builder_->WriteTransducer(prefix + "_compact.fst", "compact");
+  fst::StdVectorFst *c = fst::StdVectorFst::Read(prefix + ".fst");
+  ASSERT_TRUE(c != NULL);
+  const char *types[] = { "_const.fst", "_compact.fst" };
+  for (int t = 0; t < 2; ++t) {
+    fst::StdFst *f = fst::StdFst::Read(prefix + types[t]);
+    ASSERT_TRUE(f != NULL);
+    EXPECT_TRUE(fst::Equal(*c, *f));
+    EXPECT_TRUE(f->Properties(fst::kILabelSorted, true));
+    delete f;
+  }
+  delete c;
+}
+
+// The costs and statistics of split models are cached. The cache is used
+// and yields the same models as the evaluation without cache.
+TEST_F(ContextBuilderModelTest, CostCache) {
+  const int num_phones = 4;
+  const int left_context = 1;
+  const int right_context = 1;
+  const int num_obs = 1;
+  const int min_obs = 1;
+  const int state_penalty = 0;
+  const float min_gain = 0.0001;
+  vector<string> models[2];
+  for (int cache = 0; cache < 2; ++cache) {
+    TearDown();
+    SetUp();
+    Init(num_phones, left_context, right_context,
+         num_obs, min_obs, state_penalty, min_gain);
+    if (cache) builder_->SetCostCacheSize(64);
+    RunTest();
+    GetStateModels(&models[cache]);
+  }
+  const LeafCostCache *cost_cache = builder_->GetCostCache();
+  ASSERT_NOTNULL(cost_cache);
+  EXPECT_GT(cost_cache->NumHits(), 0);
+  EXPECT_FALSE(models[0].empty());
+  EXPECT_TRUE(models[0] == models[1]);
+}
+
+// Split hypotheses evaluated using the question tables yield the same
+// models as the evaluation of each hypothesis.
+TEST_F(ContextBuilderModelTest, QuestionTables) {
+  const int num_phones = 4;
+  const int left_context = 2;
+  const int right_context = 1;
+  const int num_obs = 1;
+  const int min_obs = 1;
+  const int state_penalty = 0;
+  const float min_gain = 0.0001;
+  vector<string> models[2];
+  for (int tables = 0; tables < 2; ++tables) {
+    TearDown();
+    SetUp();
+    Init(num_phones, left_context, right_context,
+         num_obs, min_obs, state_penalty, min_gain);
+    builder_->SetUseQuestionTables(tables);
+    RunTest();
+    GetStateModels(&models[tables]);
+  }
+  EXPECT_FALSE(models[0].empty());
+  EXPECT_TRUE(models[0] == models[1]);
+}
+
+// Pruning the split hypotheses yields the same models as the evaluation
+// of all hypotheses, both if only the best hypothesis is considered and
+// if the best hypotheses are re-ranked by the state penalty.
+TEST_F(ContextBuilderModelTest, PruneHypotheses) {
+  const int num_phones = 4;
+  const int left_context = 2;
+  const int right_context = 1;
+  const int num_obs = 1;
+  const int min_obs = 1;
+  const float min_gain = 0.0001;
+  const int state_penalties[] = { 0, 100000 };
+  for (int p = 0; p < 2; ++p) {
+    const int state_penalty = state_penalties[p];
+    vector<string> models[2];
+    for (int prune = 0; prune < 2; ++prune) {
+      TearDown();
+      SetUp();
+      Init(num_phones, left_context, right_context,
+           num_obs, min_obs, state_penalty, min_gain);
+      builder_->SetUseQuestionTables(true);
+      builder_->SetMaxHypotheses(3);
+      builder_->SetPruneHypotheses(prune);
+      RunTest();
+      GetStateModels(&models[prune]);
+    }
+    EXPECT_FALSE(models[0].empty());
+    EXPECT_TRUE(models[0] == models[1]);
+  }
+}
+
+// The hypotheses of new state models are created lazily. With a target
+// number of models, only some of the lazy models are expanded. The
+// resulting models are the same as with eager creation of the hypotheses.
+TEST_F(ContextBuilderModelTest, LazyHypotheses) {
+  const int num_phones = 4;
+  const int left_context = 1;
+  const int right_context = 1;
+  const int num_obs = 1;
+  const int min_obs = 1;
+  const int state_penalty = 0;
+  const float min_gain = 0.0001;
+  Init(num_phones, left_context, right_context,
+       num_obs, min_obs, state_penalty, min_gain);
+  RunTest();
+  vector<string> models[2];
+  GetStateModels(&models[0]);
+  const int target_num_models = models[0].size() / 2;
+  for (int lazy = 0; lazy < 2; ++lazy) {
+    TearDown();
+    SetUp();
+    Init(num_phones, left_context, right_context,
+         num_obs, min_obs, state_penalty, min_gain);
+    builder_->SetTargetNumModels(target_num_models);
+    builder_->SetLazyHypotheses(lazy);
+    builder_->Build();
+    EXPECT_TRUE(builder_->CheckTransducer());
+    GetStateModels(&models[lazy]);
+  }
+  EXPECT_FALSE(models[0].empty());
+  EXPECT_TRUE(models[0].size() <= target_num_models);
+  EXPECT_TRUE(models[0] == models[1]);
+}
+
+// Continuing the optimization from the splits of a smaller model yields
+// the same models as the optimization from scratch. The saved splits
+// include the replayed splits.
+TEST_F(ContextBuilderModelTest, WarmStart) {
+  const string partial_file = FLAGS_test_tmpdir + "/splits_partial";
+  const string warm_file = FLAGS_test_tmpdir + "/splits_warm";
+  const int num_phones = 4;
+  const int left_context = 1;
+  const int right_context = 1;
+  const int num_obs = 1;
+  const int min_obs = 1;
+  const int state_penalty = 0;
+  const float min_gain = 0.0001;
+  vector<string> models[3];
+  Init(num_phones, left_context, right_context,
+       num_obs, min_obs, state_penalty, min_gain);
+  RunTest();
+  GetStateModels(&models[0]);
+  TearDown();
+  SetUp();
+  builder_->SetSaveSplits(partial_file);
+  Init(num_phones, left_context, right_context,
+       num_obs, min_obs, state_penalty, min_gain);
+  builder_->SetTargetNumModels(models[0].size() / 2);
+  builder_->Build();
+  EXPECT_LT(builder_->GetHmmCompiler().NumStateModels(), models[0].size());
+  TearDown();
+  SetUp();
+  builder_->SetWarmStart(partial_file);
+  builder_->SetSaveSplits(warm_file);
+  Init(num_phones, left_context, right_context,
+       num_obs, min_obs, state_penalty, min_gain);
+  RunTest();
+  GetStateModels(&models[1]);
+  TearDown();
+  SetUp();
+  builder_->SetReplay(warm_file);
+  Init(num_phones, left_context, right_context,
+       num_obs, min_obs, state_penalty, min_gain);
+  RunTest();
+  GetStateModels(&models[2]);
+  EXPECT_FALSE(models[0].empty());
+  EXPECT_TRUE(models[0] == models[1]);
+  EXPECT_TRUE(models[0] == models[2]);
+}
+
+#ifdef HAVE_THREADS
+// Initialization of the models and split hypotheses using several threads.
+// The result is the same as the one of a serial run.
+TEST_F(ContextBuilderModelTest, Threads) {
+  const int num_threads = FLAGS_num_threads;
+  const int num_phones = 4;
+  const int left_context = 1;
+  const int right_context = 1;
+  const int num_obs = 1;
+  const int min_obs = 1;
+  const int state_penalty = 0;
+  const float min_gain = 0.0001;
+  vector<string> models[2];
+  int num_states[2];
+  for (int run = 0; run < 2; ++run) {
+    FLAGS_num_threads = run ? 4 : 1;
+    TearDown();
+    SetUp();
+    Init(num_phones, left_context, right_context,
+         num_obs, min_obs, state_penalty, min_gain);
+    RunTest();
+    GetStateModels(&models[run]);
+    num_states[run] = builder_->NumStates();
+  }
+  FLAGS_num_threads = num_threads;
+  EXPECT_FALSE(models[0].empty());
+  EXPECT_TRUE(models[0] == models[1]);
+  EXPECT_EQ(num_states[0], num_states[1]);
+}
+#endif
+
+// Runs the split optimization with a coordinator (this process) and
+// two forked worker processes. The result is the same as the one of a
+// serial run.
+TEST_F(ContextBuilderModelTest, Distributed) {
+  const int num_workers = 2;
+  const int num_phones = 4;
+  const int left_context = 1;
+  const int right_context = 1;
+  const int num_obs = 1;
+  const int min_obs = 1;
+  const int state_penalty = 0;
+  const float min_gain = 0.0001;
+  const string address = "unix:" + FLAGS_test_tmpdir + "/splitter.socket";
+  vector<string> models[2];
+  Init(num_phones, left_context, right_context,
+       num_obs, min_obs, state_penalty, min_gain);
+  RunTest();
+  GetStateModels(&models[0]);
+  const int num_states = builder_->NumStates();
+  TearDown();
+  SetUp();
+  vector<pid_t> workers;
+  for (int w = 1; w <= num_workers; ++w) {
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      // worker process. uses a separate directory for its input files.
+      // the inherited ContextBuilder is not used.
+      FLAGS_test_tmpdir += StringPrintf("/worker%d", w);
+      mkdir(FLAGS_test_tmpdir.c_str(), 0755);
+      builder_ = new ContextBuilder();
+      builder_->SetDistributed("worker", address, num_workers, w);
+      Init(num_phones, left_context, right_context,
+           num_obs, min_obs, state_penalty, min_gain);
+      builder_->Build();
+      _exit(0);
+    }
+    workers.push_back(pid);
+  }
+  builder_->SetDistributed("coordinator", address, num_workers, 0);
+  Init(num_phones, left_context, right_context,
+       num_obs, min_obs, state_penalty, min_gain);
+  RunTest();
+  GetStateModels(&models[1]);
+  for (vector<pid_t>::const_iterator pid = workers.begin();
+      pid != workers.end(); ++pid) {
+    int status = -1;
+    EXPECT_EQ(waitpid(*pid, &status, 0), *pid);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+  }
+  EXPECT_FALSE(models[0].empty());
+  EXPECT_TRUE(models[0] == models[1]);
+  EXPECT_EQ(builder_->NumStates(), num_states);
+}
+
 }  // namespace trainc
@@ -21,10 +21,158 @@
 
 namespace trainc {
 
+namespace {
+
+// Per thread cache of interned sets, indexed by the hash value of the set.
+// Each valid entry holds a reference to its set.
+struct InternCacheEntry {
+  int generation;
+  ContextSetTable::Id id;
+};
+#ifdef HAVE_THREADS
+__thread InternCacheEntry
+    intern_cache[ContextSetTable::kInternCacheSize];
+#else
+InternCacheEntry intern_cache[ContextSetTable::kInternCacheSize];
+#endif
+
+}  // namespace
+
+ContextSetTable::ContextSetTable()
+    : blocks_(kMaxBlocks, NULL), size_(0), num_sets_(0), generation_(1),
+      num_users_(0) {}
+
+ContextSetTable::~ContextSetTable() {
+  DeleteSets();
+  for (vector<Entry*>::iterator b = blocks_.begin();
+       b != blocks_.end() && *b; ++b)
+    delete[] *b;
+}
+
+void ContextSetTable::DeleteSets() {
+  for (int id = 0; id < size_; ++id)
+    delete GetEntry(id).set;
+}
+
+// A new set is copied to its entry before its id is published.
+// A cached id is valid, if it has been stored in the current generation.
+// The generation changes only while no PhoneContext exists, i.e. not
+// concurrently to Intern() calls of the builder. A set found in the map
+// is referenced while holding the lock, such that it is not removed
+// concurrently.
+ContextSetTable::Id ContextSetTable::Intern(const ContextSet &set) {
+  InternCacheEntry &cached =
+      intern_cache[set.HashValue() % kInternCacheSize];
+  const int generation = this->generation();
+  if (cached.generation == generation) {
+    const ContextSet &c = Get(cached.id);
+    if (c.Capacity() == set.Capacity() && c.IsEqual(set)) {
+      Ref(cached.id);
+      return cached.id;
+    }
+  }
+  Id id = -1;
+#ifdef HAVE_THREADS
+  lock_.ReadLock();
+  IdMap::const_iterator i = ids_.find(set);
+  if (i != ids_.end()) {
+    id = i->second;
+    Ref(id);
+  }
+  lock_.Unlock();
+  if (id < 0) {
+    lock_.WriteLock();
+#endif
+    std::pair<IdMap::iterator, bool> r = ids_.insert(std::make_pair(set, 0));
+    if (r.second) {
+      if (free_ids_.empty()) {
+        const int block = size_ >> kBlockBits;
+        CHECK_LT(block, kMaxBlocks);
+        if (!blocks_[block])
+          blocks_[block] = new Entry[1 << kBlockBits];
+        r.first->second = size_++;
+      } else {
+        r.first->second = free_ids_.back();
+        free_ids_.pop_back();
+      }
+      Entry &entry = GetEntry(r.first->second);
+      entry.set = new ContextSet(set);
+      entry.refs = 1;
+      ++num_sets_;
+    } else {
+      Ref(r.first->second);
+    }
+    id = r.first->second;
+#ifdef HAVE_THREADS
+    lock_.Unlock();
+  }
+#endif
+  // replace the cached set
+  Ref(id);
+  const InternCacheEntry old = cached;
+  cached.generation = generation;
+  cached.id = id;
+  if (old.generation == generation)
+    Unref(old.id);
+  return id;
+}
+
+bool ContextSetTable::Find(const ContextSet &set, Id *id) const {
+#ifdef HAVE_THREADS
+  lock_.ReadLock();
+#endif
+  IdMap::const_iterator i = ids_.find(set);
+  const bool found = i != ids_.end();
+  if (found)
+    *id = i->second;
+#ifdef HAVE_THREADS
+  lock_.Unlock();
+#endif
+  return found;
+}
+
+// The set may have been referenced again, or removed and replaced by a
+// new set, before the lock is acquired.
+void ContextSetTable::Remove(Id id) {
+#ifdef HAVE_THREADS
+  lock_.WriteLock();
+#endif
+  Entry &entry = GetEntry(id);
+  if (entry.set && entry.refs == 0) {
+    ids_.erase(*entry.set);
+    delete entry.set;
+    entry.set = NULL;
+    free_ids_.push_back(id);
+    --num_sets_;
+  }
+#ifdef HAVE_THREADS
+  lock_.Unlock();
+#endif
+}
+
+bool ContextSetTable::ClearIfUnused() {
+#ifdef HAVE_THREADS
+  lock_.WriteLock();
+#endif
+  const bool unused = num_users_ == 0;
+  if (unused) {
+    DeleteSets();
+    ids_.clear();
+    free_ids_.clear();
+    size_ = 0;
+    num_sets_ = 0;
+    __atomic_add_fetch(&generation_, 1, __ATOMIC_RELEASE);
+  }
+#ifdef HAVE_THREADS
+  lock_.Unlock();
+#endif
+  return unused;
+}
+
 string PhoneContext::ToString() const {
   std::stringstream ss;
   for (int p = -NumLeftContexts(); p <= NumRightContexts(); ++p) {
-    const ContextSet &set = contexts_[ContextPositionToIndex(p)];
+    const ContextSet &set = GetContext(p);
     ss << "{";
     for (ContextSet::Iterator p(set); !p.Done(); p.Next())
       ss << p.Value() << " ";
@@ -33,4 +181,18 @@ string PhoneContext::ToString() const {
   return ss.str();
 }
 
+void QuestionTable::Init(int num_phones,
+                         const vector<ContextQuestion*> &questions) {
+  num_phones_ = num_phones;
+  num_questions_ = questions.size();
+  num_words_ = (num_questions_ + kBitsPerWord - 1) / kBitsPerWord;
+  bits_.assign(num_phones_ * num_words_, 0);
+  for (int q = 0; q < num_questions_; ++q) {
+    const ContextSet &phones = questions[q]->GetPhoneSet(0);
+    for (ContextSet::Iterator p(phones); !p.Done(); p.Next())
+      bits_[p.Value() * num_words_ + q / kBitsPerWord] |=
+          static_cast<Word>(1) << (q % kBitsPerWord);
+  }
+}
+
 }  // namespace trainc
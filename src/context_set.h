@@ -18,19 +18,28 @@
 #ifndef CONTEXT_SET_H_
 #define CONTEXT_SET_H_
 
+#include <ext/hash_map>
 #include <string>
 #include <utility>
 #include <vector>
-#include "integer_set.h"
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "dynamic_integer_set.h"
+#include "hash.h"
 #include "util.h"
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
 #include <sstream>
 using std::vector;
 
 namespace trainc {
 
-// Maximum number of phone symbols supported by this module.
-enum { kMaxNumPhones = 256 };
-typedef IntegerSet<uint64, kMaxNumPhones> ContextSet;
+// Context sets of up to kNumInlinePhones phones are stored as bit vector
+// without dynamic memory allocation. Larger phone sets are supported.
+enum { kNumInlinePhones = 256 };
+typedef DynamicIntegerSet<kNumInlinePhones> ContextSet;
 
 // DEBUG
 inline std::string ContextSetToString(const ContextSet &c) {
@@ -59,6 +68,156 @@ inline const ContextSet& GetPairElement(const Partition &p, bool i) {
 }
 
 
+// Table of the distinct ContextSets used in the program.
+// Each set is stored once and identified by an integer id, which allows
+// to compare and hash sets by their id.
+// The sets are reference counted. A set is removed when its last reference
+// is released, its id is reused afterwards. References returned by Get()
+// remain valid while the set is referenced. ClearIfUnused() removes all
+// sets.
+// Intern() is thread-safe. Each thread caches the ids of recently interned
+// sets, which avoids the lock for most lookups. The cache of a thread holds
+// a reference to at most kInternCacheSize sets.
+class ContextSetTable {
+ public:
+  typedef int Id;
+  enum { kInternCacheSize = 256 };
+
+  // The global table.
+  static ContextSetTable* Instance() {
+    static ContextSetTable table;
+    return &table;
+  }
+
+  // Id of the given set, which is added if required.
+  // Adds a reference to the set, which has to be released by Unref().
+  Id Intern(const ContextSet &set);
+
+  // Finds the id of the given set without adding it. Does not add a
+  // reference. Returns false if the set is not in the table.
+  bool Find(const ContextSet &set, Id *id) const;
+
+  // Adds a reference to a set, which is referenced already.
+  void Ref(Id id) { __sync_fetch_and_add(&GetEntry(id).refs, 1); }
+
+  // Releases a reference, the set is removed if it is not used anymore.
+  void Unref(Id id) {
+    if (__sync_sub_and_fetch(&GetEntry(id).refs, 1) == 0)
+      Remove(id);
+  }
+
+  const ContextSet& Get(Id id) const {
+    return *GetEntry(id).set;
+  }
+
+  // Number of distinct sets.
+  int Size() const { return num_sets_; }
+
+  // Removes all sets, if no PhoneContext or ContextSetRef exists. Ids and
+  // references obtained before are invalid afterwards.
+  // Used to release the sets of a finished ContextBuilder.
+  // Returns false if the table is in use.
+  bool ClearIfUnused();
+
+  // Number of existing PhoneContext and ContextSetRef objects.
+  int NumUsers() const { return num_users_; }
+
+  // Called by PhoneContext and ContextSetRef.
+  void AddUser() { __sync_fetch_and_add(&num_users_, 1); }
+  void RemoveUser() { __sync_fetch_and_sub(&num_users_, 1); }
+
+ private:
+  enum { kBlockBits = 12, kBlockMask = (1 << kBlockBits) - 1,
+         kMaxBlocks = 1 << 16 };
+  // set is NULL for unused ids.
+  struct Entry {
+    const ContextSet *set;
+    int refs;
+  };
+  typedef __gnu_cxx::hash_map<ContextSet, Id, Hash<ContextSet>,
+                              Equal<ContextSet> > IdMap;
+  ContextSetTable();
+  ~ContextSetTable();
+  void DeleteSets();
+  void Remove(Id id);
+
+  Entry& GetEntry(Id id) const {
+    DCHECK_LT(id, size_);
+    return blocks_[id >> kBlockBits][id & kBlockMask];
+  }
+
+  // Read by the thread caches without lock.
+  int generation() const {
+    return __atomic_load_n(&generation_, __ATOMIC_ACQUIRE);
+  }
+
+  // Blocks of 2^kBlockBits entries. The array of block pointers is not
+  // resized, which allows to read sets while new sets are added.
+  vector<Entry*> blocks_;
+  IdMap ids_;
+  // Ids of removed sets.
+  vector<Id> free_ids_;
+  // Number of used entries, including the entries of removed sets.
+  int size_;
+  int num_sets_;
+  // Incremented by ClearIfUnused(), invalidates the cached ids.
+  // Starts at 1, such that the zero initialized cache entries are invalid.
+  int generation_;
+  int num_users_;
+#ifdef HAVE_THREADS
+  mutable threads::ReadWriteLock lock_;
+#endif
+  DISALLOW_COPY_AND_ASSIGN(ContextSetTable);
+};
+
+// Counted reference to a set of the ContextSetTable.
+// Like a PhoneContext, a ContextSetRef prevents that the table is cleared.
+class ContextSetRef {
+ public:
+  explicit ContextSetRef(const ContextSet &set) {
+    ContextSetTable *table = ContextSetTable::Instance();
+    table->AddUser();
+    id_ = table->Intern(set);
+  }
+
+  ContextSetRef(const ContextSetRef &other) : id_(other.id_) {
+    ContextSetTable *table = ContextSetTable::Instance();
+    table->AddUser();
+    table->Ref(id_);
+  }
+
+  ~ContextSetRef() {
+    ContextSetTable *table = ContextSetTable::Instance();
+    table->Unref(id_);
+    table->RemoveUser();
+  }
+
+  ContextSetRef& operator=(const ContextSetRef &other) {
+    ContextSetTable *table = ContextSetTable::Instance();
+    table->Ref(other.id_);
+    table->Unref(id_);
+    id_ = other.id_;
+    return *this;
+  }
+
+  // Replace the referenced set.
+  void Set(const ContextSet &set) {
+    ContextSetTable *table = ContextSetTable::Instance();
+    const ContextSetTable::Id id = table->Intern(set);
+    table->Unref(id_);
+    id_ = id;
+  }
+
+  const ContextSet& Get() const {
+    return ContextSetTable::Instance()->Get(id_);
+  }
+
+  ContextSetTable::Id id() const { return id_; }
+
+ private:
+  ContextSetTable::Id id_;
+};
+
 // The left and right context of a CD unit, which may consist of
 // several phones.
 // Each context position is a set of allowed / equivalent
@@ -70,6 +229,8 @@ inline const ContextSet& GetPairElement(const Partition &p, bool i) {
 //  position -1 = B, position -2 = A
 //  position  1 = D, position  2 = E
 //  position  0 = C
+// The context sets are stored as ids in the ContextSetTable.
+// The table is not cleared while a PhoneContext exists.
 class PhoneContext {
  public:
   // Initializes all context sets with an empty set.
@@ -78,7 +239,31 @@ class PhoneContext {
       int num_phones, int num_left_contexts, int num_right_contexts)
       : num_left_contexts_(num_left_contexts),
         contexts_(num_left_contexts + num_right_contexts + 1,
-                  ContextSet(num_phones)) {}
+                  RegisterAndIntern(ContextSet(num_phones))) {
+    for (size_t i = 1; i < contexts_.size(); ++i)
+      ContextSetTable::Instance()->Ref(contexts_[i]);
+  }
+
+  PhoneContext(const PhoneContext &other)
+      : num_left_contexts_(other.num_left_contexts_),
+        contexts_(other.contexts_) {
+    ContextSetTable *table = ContextSetTable::Instance();
+    table->AddUser();
+    RefAll(contexts_);
+  }
+
+  ~PhoneContext() {
+    UnrefAll(contexts_);
+    ContextSetTable::Instance()->RemoveUser();
+  }
+
+  PhoneContext& operator=(const PhoneContext &other) {
+    RefAll(other.contexts_);
+    UnrefAll(contexts_);
+    num_left_contexts_ = other.num_left_contexts_;
+    contexts_ = other.contexts_;
+    return *this;
+  }
 
   // Number of contexts to the left.
   int NumLeftContexts() const {
@@ -92,17 +277,36 @@ class PhoneContext {
 
   // Context at the given position.
   const ContextSet& GetContext(int position) const {
-    return contexts_[ContextPositionToIndex(position)];
+    return ContextSetTable::Instance()->Get(
+        contexts_[ContextPositionToIndex(position)]);
   }
 
-  // Mutable access the the ContextSet for the given position.
-  ContextSet* GetContextRef(int position) {
-    return &contexts_[ContextPositionToIndex(position)];
+  // Id of the context at the given position in the ContextSetTable.
+  ContextSetTable::Id GetContextId(int position) const {
+    return contexts_[ContextPositionToIndex(position)];
   }
 
   // Set the context set of the given position.
   void SetContext(int position, const ContextSet &c) {
-    contexts_[ContextPositionToIndex(position)] = c;
+    ContextSetTable *table = ContextSetTable::Instance();
+    ContextSetTable::Id &id = contexts_[ContextPositionToIndex(position)];
+    const ContextSetTable::Id new_id = table->Intern(c);
+    table->Unref(id);
+    id = new_id;
+  }
+
+  // Add a phone to the context set of the given position.
+  void AddToContext(int position, int phone) {
+    ContextSet c = GetContext(position);
+    c.Add(phone);
+    SetContext(position, c);
+  }
+
+  // Intersect the context set of the given position with c.
+  void IntersectContext(int position, const ContextSet &c) {
+    ContextSet i = GetContext(position);
+    i.Intersect(c);
+    SetContext(position, i);
   }
 
   // Returns true if all ContextSets of this PhoneContext and the
@@ -121,28 +325,39 @@ class PhoneContext {
   // positive for right contexts.
   size_t ContextPositionToIndex(int position) const;
 
+  // Registers this object with the table, before the initial set is
+  // interned. Returns the id of the set.
+  static ContextSetTable::Id RegisterAndIntern(const ContextSet &set) {
+    ContextSetTable *table = ContextSetTable::Instance();
+    table->AddUser();
+    return table->Intern(set);
+  }
+
+  static void RefAll(const vector<ContextSetTable::Id> &ids) {
+    ContextSetTable *table = ContextSetTable::Instance();
+    for (size_t i = 0; i < ids.size(); ++i)
+      table->Ref(ids[i]);
+  }
+
+  static void UnrefAll(const vector<ContextSetTable::Id> &ids) {
+    ContextSetTable *table = ContextSetTable::Instance();
+    for (size_t i = 0; i < ids.size(); ++i)
+      table->Unref(ids[i]);
+  }
+
   size_t num_left_contexts_;
-  vector<ContextSet> contexts_;
+  vector<ContextSetTable::Id> contexts_;
 };
 
 inline bool PhoneContext::IsEqual(const PhoneContext &other) const {
   DCHECK_EQ(contexts_.size(), other.contexts_.size());
-  vector<ContextSet>::const_iterator c = contexts_.begin(),
-      o = other.contexts_.begin();
-  for (; c != contexts_.end(); ++c, ++o)
-    if (!c->IsEqual(*o)) return false;
-  return true;
+  return contexts_ == other.contexts_;
 }
 
 inline size_t PhoneContext::HashValue() const {
-  // TODO(rybach): improve hash function
   DCHECK(!contexts_.empty());
-  size_t h = contexts_.front().HashValue();
-  for (vector<ContextSet>::const_iterator c = contexts_.begin() + 1;
-      c != contexts_.end(); ++c) {
-    HashCombine(h, c->HashValue());
-  }
-  return h;
+  return HashRange(contexts_.begin() + 1, contexts_.end(),
+                   static_cast<size_t>(contexts_.front()));
 }
 
 inline size_t PhoneContext::ContextPositionToIndex(int position) const {
@@ -188,6 +403,38 @@ class ContextQuestion {
   DISALLOW_COPY_AND_ASSIGN(ContextQuestion);
 };
 
+// Phone to question membership bit matrix of a set of questions.
+// Bit q of row p is set if phone p is in phone set 0 of question q.
+class QuestionTable {
+ public:
+  typedef uint64 Word;
+  enum { kBitsPerWord = 64 };
+
+  QuestionTable() : num_phones_(0), num_questions_(0), num_words_(0) {}
+
+  void Init(int num_phones, const vector<ContextQuestion*> &questions);
+
+  int NumPhones() const { return num_phones_; }
+  int NumQuestions() const { return num_questions_; }
+  // Number of words per row.
+  int NumWords() const { return num_words_; }
+
+  // Membership bits of all questions for the given phone.
+  const Word* Row(int phone) const {
+    DCHECK_LT(phone, num_phones_);
+    return &bits_[phone * num_words_];
+  }
+
+  bool HasElement(int phone, int question) const {
+    return (Row(phone)[question / kBitsPerWord] >>
+            (question % kBitsPerWord)) & 1;
+  }
+
+ private:
+  int num_phones_, num_questions_, num_words_;
+  vector<Word> bits_;
+};
+
 }  // namespace trainc
 
 #endif  // CONTEXT_SET_H_
@@ -19,6 +19,7 @@
 
 #include "unittest.h"
 #include "context_set.h"
+#include "integer_set.h"
 
 namespace trainc {
 
@@ -52,6 +53,108 @@ TEST(PhoneContextTest, Test) {
   EXPECT_FALSE(p.IsEqual(pb));
 }
 
+TEST(PhoneContextTest, Modify) {
+  const int num_phones = 10;
+  PhoneContext p(num_phones, 1, 1), q(num_phones, 1, 1);
+  ContextSet a(num_phones);
+  a.Add(2);
+  a.Add(3);
+  p.AddToContext(1, 2);
+  p.AddToContext(1, 3);
+  q.SetContext(1, a);
+  EXPECT_TRUE(p.IsEqual(q));
+  EXPECT_EQ(p.GetContextId(1), q.GetContextId(1));
+  EXPECT_EQ(p.HashValue(), q.HashValue());
+  ContextSet b(num_phones);
+  b.Add(3);
+  p.IntersectContext(1, b);
+  EXPECT_TRUE(p.GetContext(1).IsEqual(b));
+  EXPECT_FALSE(p.IsEqual(q));
+  EXPECT_TRUE(q.GetContext(1).IsEqual(a));
+}
+
+// The representation of large sets does not increase the size of
+// ContextSet objects.
+TEST(ContextSetTest, Size) {
+  EXPECT_LE(sizeof(ContextSet),
+            sizeof(IntegerSet<uint64, kNumInlinePhones>));
+  EXPECT_EQ(sizeof(ContextSet),
+            2 * sizeof(size_t) + kNumInlinePhones / 8);
+}
+
+TEST(ContextSetTableTest, Intern) {
+  const int num_phones = 10;
+  ContextSetTable *table = ContextSetTable::Instance();
+  ContextSet a(num_phones), b(num_phones);
+  a.Add(5);
+  b.Add(5);
+  b.Add(6);
+  ContextSetTable::Id ia = table->Intern(a);
+  ContextSetTable::Id ib = table->Intern(b);
+  EXPECT_NE(ia, ib);
+  EXPECT_EQ(table->Intern(a), ia);
+  EXPECT_TRUE(table->Get(ia).IsEqual(a));
+  EXPECT_TRUE(table->Get(ib).IsEqual(b));
+  const int size = table->Size();
+  EXPECT_EQ(table->Intern(b), ib);
+  EXPECT_EQ(table->Size(), size);
+  ContextSetTable::Id id;
+  EXPECT_TRUE(table->Find(a, &id));
+  EXPECT_EQ(id, ia);
+  table->Unref(ia);
+  table->Unref(ia);
+  table->Unref(ib);
+  table->Unref(ib);
+}
+
+TEST(ContextSetTableTest, Remove) {
+  const int num_phones = 20;
+  const int num_sets = 2000;
+  ContextSetTable *table = ContextSetTable::Instance();
+  const int size = table->Size();
+  for (int i = 0; i < num_sets; ++i) {
+    ContextSet c(num_phones);
+    for (int p = 0; p < num_phones; ++p)
+      if (i & (1 << (p % 11))) c.Add(p + i % 2);
+    table->Unref(table->Intern(c));
+  }
+  // Only the sets referenced by the intern cache remain.
+  EXPECT_LE(table->Size(), size + ContextSetTable::kInternCacheSize);
+  ContextSet c(num_phones);
+  c.Add(num_phones - 1);
+  {
+    ContextSetRef r(c), s(r);
+    r.Set(ContextSet(num_phones));
+    EXPECT_TRUE(s.Get().IsEqual(c));
+    EXPECT_TRUE(r.Get().IsEmpty());
+  }
+  EXPECT_EQ(table->NumUsers(), 0);
+}
+
+TEST(ContextSetTableTest, ClearIfUnused) {
+  const int num_phones = 10;
+  ContextSetTable *table = ContextSetTable::Instance();
+  ContextSet a(num_phones), b(num_phones);
+  a.Add(5);
+  b.Add(6);
+  {
+    PhoneContext p(num_phones, 1, 1);
+    PhoneContext q(p);
+    p.SetContext(1, a);
+    EXPECT_FALSE(table->ClearIfUnused());
+    EXPECT_TRUE(q.GetContext(1).IsEmpty());
+  }
+  table->Intern(a);
+  EXPECT_TRUE(table->ClearIfUnused());
+  EXPECT_EQ(table->Size(), 0);
+  // Cached ids of the cleared table are not used.
+  EXPECT_EQ(table->Intern(b), 0);
+  ContextSetTable::Id ia = table->Intern(a);
+  EXPECT_EQ(ia, 1);
+  EXPECT_TRUE(table->Get(ia).IsEqual(a));
+  EXPECT_EQ(table->Intern(a), ia);
+}
+
 TEST(ContextQuestionTest, HasElement) {
   const int num_phones = 20;
   ContextSet c(num_phones);
@@ -65,4 +168,26 @@ TEST(ContextQuestionTest, HasElement) {
   }
 }
 
+TEST(QuestionTableTest, HasElement) {
+  const int num_phones = 20;
+  const int num_questions = 70;
+  vector<ContextQuestion*> questions;
+  for (int q = 0; q < num_questions; ++q) {
+    ContextSet c(num_phones);
+    for (int p = q % 3; p < num_phones; p += 1 + q % 5)
+      c.Add(p);
+    questions.push_back(new ContextQuestion(c));
+  }
+  QuestionTable table;
+  table.Init(num_phones, questions);
+  EXPECT_EQ(num_questions, table.NumQuestions());
+  EXPECT_EQ(2, table.NumWords());
+  for (int p = 0; p < num_phones; ++p) {
+    for (int q = 0; q < num_questions; ++q)
+      EXPECT_EQ(questions[q]->GetPhoneSet(0).HasElement(p),
+                table.HasElement(p, q));
+  }
+  STLDeleteElements(&questions);
+}
+
 }  // namespace trainc
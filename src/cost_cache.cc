@@ -0,0 +1,97 @@
+// cost_cache.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+//
+
+#include "cost_cache.h"
+#include "hash.h"
+#include "phone_models.h"
+
+namespace trainc {
+
+LeafCostCache::Key::Key(const AllophoneStateModel &model)
+    : state(model.state()), context(model.GetContext()) {
+  model.GetDataPhones(&phones);
+  hash = context.HashValue();
+  HashCombine(hash, state);
+  hash = HashRange(phones.begin(), phones.end(), hash);
+}
+
+LeafCostCache::LeafCostCache(int capacity)
+    : capacity_(capacity), num_lookups_(0), num_hits_(0) {
+  CHECK_GT(capacity_, 0);
+}
+
+LeafCostCache::~LeafCostCache() {}
+
+bool LeafCostCache::Find(const AllophoneStateModel &model, float *cost,
+                         DoubleStatistics *sum) {
+  const Key key(model);
+#ifdef HAVE_THREADS
+  threads::MutexLock lock(&mutex_);
+#endif
+  ++num_lookups_;
+  EntryMap::const_iterator i = map_.find(&key);
+  if (i == map_.end())
+    return false;
+  ++num_hits_;
+  entries_.splice(entries_.begin(), entries_, i->second);
+  *cost = i->second->cost;
+  if (sum)
+    *sum = i->second->sum;
+  return true;
+}
+
+void LeafCostCache::Insert(const AllophoneStateModel &model, float cost,
+                           const DoubleStatistics &sum) {
+  const Key key(model);
+#ifdef HAVE_THREADS
+  threads::MutexLock lock(&mutex_);
+#endif
+  if (map_.find(&key) != map_.end())
+    return;
+  if (map_.size() >= capacity_) {
+    map_.erase(&entries_.back().key);
+    entries_.pop_back();
+  }
+  entries_.push_front(Entry(key, cost, sum));
+  map_.insert(EntryMap::value_type(&entries_.front().key, entries_.begin()));
+}
+
+int LeafCostCache::NumLookups() const {
+#ifdef HAVE_THREADS
+  threads::MutexLock lock(&mutex_);
+#endif
+  return num_lookups_;
+}
+
+int LeafCostCache::NumHits() const {
+#ifdef HAVE_THREADS
+  threads::MutexLock lock(&mutex_);
+#endif
+  return num_hits_;
+}
+
+int LeafCostCache::Size() const {
+#ifdef HAVE_THREADS
+  threads::MutexLock lock(&mutex_);
+#endif
+  return map_.size();
+}
+
+}  // namespace trainc
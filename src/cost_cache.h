@@ -0,0 +1,113 @@
+// cost_cache.h
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Cache of state model costs
+
+#ifndef COST_CACHE_H_
+#define COST_CACHE_H_
+
+#include <ext/hash_map>
+#include <list>
+#include <vector>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "context_set.h"
+#include "sample.h"
+#include "util.h"
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
+
+namespace trainc {
+
+class AllophoneStateModel;
+
+// Bounded cache of the costs and summed statistics of AllophoneStateModels
+// created by splits.
+// The statistics of a state model, and therefore its cost, are defined
+// by the phones of its statistics, its HMM state, and its PhoneContext.
+// The same child model is often created by several split hypotheses,
+// e.g. by questions with the same intersection with the model's context.
+// The least recently used entry is removed if the cache is full.
+// All accesses are synchronized if compiled with thread support.
+class LeafCostCache {
+public:
+  explicit LeafCostCache(int capacity);
+  ~LeafCostCache();
+
+  // Get the cost and the summed statistics of a state model with the same
+  // statistics as model. sum may be NULL.
+  // model requires valid statistics.
+  bool Find(const AllophoneStateModel &model, float *cost,
+            DoubleStatistics *sum);
+
+  // Store the cost and the summed statistics of the given model.
+  void Insert(const AllophoneStateModel &model, float cost,
+              const DoubleStatistics &sum);
+
+  int NumLookups() const;
+  int NumHits() const;
+  int Size() const;
+
+private:
+  struct Key {
+    std::vector<int> phones;
+    int state;
+    PhoneContext context;
+    size_t hash;
+    explicit Key(const AllophoneStateModel &model);
+    size_t HashValue() const { return hash; }
+    bool IsEqual(const Key &other) const {
+      return hash == other.hash && state == other.state &&
+          phones == other.phones && context.IsEqual(other.context);
+    }
+  };
+  struct Entry {
+    Key key;
+    float cost;
+    DoubleStatistics sum;
+    Entry(const Key &k, float c, const DoubleStatistics &s)
+        : key(k), cost(c), sum(s) {}
+  };
+  typedef std::list<Entry> EntryList;
+  struct KeyHash {
+    size_t operator()(const Key *k) const { return k->hash; }
+  };
+  struct KeyEqual {
+    bool operator()(const Key *a, const Key *b) const {
+      return a->IsEqual(*b);
+    }
+  };
+  typedef __gnu_cxx::hash_map<const Key*, EntryList::iterator,
+                              KeyHash, KeyEqual> EntryMap;
+
+  int capacity_;
+  int num_lookups_, num_hits_;
+  // entries ordered by recent use, most recently used first.
+  EntryList entries_;
+  EntryMap map_;
+#ifdef HAVE_THREADS
+  mutable threads::Mutex mutex_;
+#endif
+  DISALLOW_COPY_AND_ASSIGN(LeafCostCache);
+};
+
+}  // namespace trainc
+
+#endif  // COST_CACHE_H_
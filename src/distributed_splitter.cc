@@ -0,0 +1,383 @@
+// distributed_splitter.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "distributed_splitter.h"
+#include "split_optimizer.h"
+
+namespace trainc {
+
+namespace {
+
+// Number of connection attempts of a worker and delay between two attempts
+// in microseconds.
+const int kConnectRetries = 600;
+const int kConnectDelay = 100000;
+
+// Parsed socket address, either "unix:<path>" or "<host>:<port>".
+class SocketAddress {
+public:
+  explicit SocketAddress(const string &address)
+      : address_(address), info_(NULL) {}
+  ~SocketAddress() {
+    if (info_) freeaddrinfo(info_);
+  }
+  bool Parse(bool passive);
+  bool IsUnix() const { return !unix_path_.empty(); }
+  int Family() const { return IsUnix() ? AF_UNIX : info_->ai_family; }
+  const struct sockaddr* Address() const {
+    return IsUnix() ? reinterpret_cast<const struct sockaddr*>(&unix_) :
+        info_->ai_addr;
+  }
+  socklen_t Length() const {
+    return IsUnix() ? sizeof(unix_) : info_->ai_addrlen;
+  }
+  const string& UnixPath() const { return unix_path_; }
+
+private:
+  string address_, unix_path_;
+  struct sockaddr_un unix_;
+  struct addrinfo *info_;
+};
+
+bool SocketAddress::Parse(bool passive) {
+  const string unix_prefix = "unix:";
+  if (address_.compare(0, unix_prefix.size(), unix_prefix) == 0) {
+    unix_path_ = address_.substr(unix_prefix.size());
+    if (unix_path_.empty() || unix_path_.size() >= sizeof(unix_.sun_path))
+      return false;
+    memset(&unix_, 0, sizeof(unix_));
+    unix_.sun_family = AF_UNIX;
+    strncpy(unix_.sun_path, unix_path_.c_str(), sizeof(unix_.sun_path) - 1);
+    return true;
+  }
+  size_t sep = address_.rfind(':');
+  if (sep == string::npos || sep + 1 == address_.size())
+    return false;
+  string host = address_.substr(0, sep), port = address_.substr(sep + 1);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (passive) hints.ai_flags = AI_PASSIVE;
+  int error = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(),
+                          &hints, &info_);
+  if (error) {
+    LOG(ERROR) << "cannot resolve " << address_ << ": " << gai_strerror(error);
+    return false;
+  }
+  return true;
+}
+
+// Disable Nagle's algorithm, messages are small and latency bound.
+void SetNoDelay(const SocketAddress &address, int fd) {
+  if (address.IsUnix()) return;
+  int flag = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+int ListenSocket(const SocketAddress &address, int backlog) {
+  int fd = socket(address.Family(), SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (address.IsUnix()) {
+    unlink(address.UnixPath().c_str());
+  } else {
+    int flag = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+  }
+  if (bind(fd, address.Address(), address.Length()) != 0 ||
+      listen(fd, backlog) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int AcceptSocket(const SocketAddress &address, int listen_fd) {
+  int fd = -1;
+  do {
+    fd = accept(listen_fd, NULL, NULL);
+  } while (fd < 0 && errno == EINTR);
+  if (fd >= 0) SetNoDelay(address, fd);
+  return fd;
+}
+
+// The coordinator might not be listening yet, retry until timeout.
+int ConnectSocket(const SocketAddress &address) {
+  for (int attempt = 0; attempt < kConnectRetries; ++attempt) {
+    int fd = socket(address.Family(), SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, address.Address(), address.Length()) == 0) {
+      SetNoDelay(address, fd);
+      return fd;
+    }
+    close(fd);
+    usleep(kConnectDelay);
+  }
+  return -1;
+}
+
+}  // namespace
+
+template<>
+void OutputBuffer::WriteBinary(const SplitMessage &message) {
+  WriteBinary(message.rank);
+  WriteBinary(message.score);
+  WriteBinary(message.gain);
+  if (message.rank >= 0)
+    WriteBinary(message.split);
+}
+
+template<>
+bool InputBuffer::ReadBinary(SplitMessage *message) {
+  if (!(ReadBinary(&message->rank) && ReadBinary(&message->score) &&
+        ReadBinary(&message->gain)))
+    return false;
+  if (message->rank >= 0) {
+    message->split = SplitDef();
+    return ReadBinary(&message->split);
+  }
+  return true;
+}
+
+void SplitMessageWriter::WriteHello(int rank) {
+  Init();
+  out_.WriteBinary(rank);
+  out_.Flush();
+}
+
+void SplitMessageWriter::Write(const SplitMessage &message) {
+  out_.WriteBinary(message);
+  out_.Flush();
+}
+
+bool SplitMessageReader::ReadHello(int *rank) {
+  return Init() && in_.ReadBinary(rank);
+}
+
+bool SplitMessageReader::Read(SplitMessage *message) {
+  return in_.ReadBinary(message);
+}
+
+DistributedSplitter::DistributedSplitter(int rank, int num_workers,
+                                         const string &address)
+    : rank_(rank), num_processes_(num_workers + 1), next_owner_(0),
+      address_(address), models_(NULL) {
+  CHECK_GT(num_workers, 0);
+  CHECK_GE(rank, 0);
+  CHECK_LE(rank, num_workers);
+}
+
+DistributedSplitter::~DistributedSplitter() {
+  Disconnect();
+}
+
+// Each channel uses separate File objects for reading and writing.
+void DistributedSplitter::OpenChannel(int fd, SplitMessageWriter **writer,
+                                      SplitMessageReader **reader) const {
+  int read_fd = dup(fd);
+  File *out = File::FromDescriptor(fd, "w");
+  File *in = read_fd < 0 ? NULL : File::FromDescriptor(read_fd, "r");
+  if (!(out && in))
+    REP(FATAL) << "cannot open connection: " << strerror(errno);
+  *writer = new SplitMessageWriter(out);
+  (*writer)->SetQuestions(num_left_contexts_, &questions_);
+  *reader = new SplitMessageReader(in);
+}
+
+void DistributedSplitter::Connect() {
+  SocketAddress address(address_);
+  if (!address.Parse(IsCoordinator()))
+    REP(FATAL) << "invalid address: " << address_;
+  if (IsCoordinator()) {
+    const int num_workers = num_processes_ - 1;
+    int listen_fd = ListenSocket(address, num_workers);
+    if (listen_fd < 0)
+      REP(FATAL) << "cannot listen on " << address_ << ": " << strerror(errno);
+    // workers connect in arbitrary order, channels are stored by rank.
+    writers_.assign(num_workers, NULL);
+    readers_.assign(num_workers, NULL);
+    for (int w = 0; w < num_workers; ++w) {
+      int fd = AcceptSocket(address, listen_fd);
+      if (fd < 0)
+        REP(FATAL) << "accept failed: " << strerror(errno);
+      SplitMessageWriter *writer = NULL;
+      SplitMessageReader *reader = NULL;
+      OpenChannel(fd, &writer, &reader);
+      int rank = -1;
+      if (!reader->ReadHello(&rank))
+        REP(FATAL) << "invalid handshake";
+      if (rank < 1 || rank > num_workers || readers_[rank - 1])
+        REP(FATAL) << "invalid worker id: " << rank;
+      writers_[rank - 1] = writer;
+      readers_[rank - 1] = reader;
+      REP(INFO) << "worker " << rank << " connected";
+    }
+    close(listen_fd);
+    if (address.IsUnix()) unlink(address.UnixPath().c_str());
+  } else {
+    int fd = ConnectSocket(address);
+    if (fd < 0)
+      REP(FATAL) << "cannot connect to " << address_ << ": "
+                 << strerror(errno);
+    writers_.resize(1);
+    readers_.resize(1);
+    OpenChannel(fd, &writers_.front(), &readers_.front());
+    writers_.front()->WriteHello(rank_);
+    REP(INFO) << "connected to coordinator as worker " << rank_;
+  }
+}
+
+void DistributedSplitter::Disconnect() {
+  for (vector<SplitMessageWriter*>::iterator w = writers_.begin();
+      w != writers_.end(); ++w)
+    delete *w;
+  for (vector<SplitMessageReader*>::iterator r = readers_.begin();
+      r != readers_.end(); ++r)
+    delete *r;
+  writers_.clear();
+  readers_.clear();
+}
+
+// The lazy models would be expanded in a different order by each process,
+// which breaks the round robin assignment of the state models.
+void DistributedSplitter::SplitModels(ModelManager *models) {
+  if (lazy_hyps_) {
+    REP(WARNING) << "lazy hypotheses are not supported in distributed mode";
+    lazy_hyps_ = false;
+  }
+  models_ = models;
+  Connect();
+  ModelSplitter::SplitModels(models);
+  Disconnect();
+}
+
+// The state models are visited in the same order by all processes.
+int DistributedSplitter::NextOwner() {
+  int owner = next_owner_;
+  next_owner_ = (next_owner_ + 1) % num_processes_;
+  return owner;
+}
+
+void DistributedSplitter::CreateSplitHypotheses(
+    const ModelManager::StateModelRef state_model, bool ci_phone) {
+  if (NextOwner() == rank_)
+    ModelSplitter::CreateSplitHypotheses(state_model, ci_phone);
+}
+
+void DistributedSplitter::CreateInitialSplitHypotheses(
+    const vector<ModelManager::StateModelRef> &state_models,
+    const vector<bool> &ci_phones) {
+  vector<ModelManager::StateModelRef> own_models;
+  vector<bool> own_ci_phones;
+  for (int m = 0; m < state_models.size(); ++m) {
+    if (NextOwner() == rank_) {
+      own_models.push_back(state_models[m]);
+      own_ci_phones.push_back(ci_phones[m]);
+    }
+  }
+  ModelSplitter::CreateInitialSplitHypotheses(own_models, own_ci_phones);
+}
+
+// Best split among the locally owned split hypotheses.
+void DistributedSplitter::FindLocalSplit(SplitHypRef *hyp,
+                                         SplitMessage *message) {
+  *hyp = split_hyps_.end();
+  *message = SplitMessage();
+  if (split_hyps_.empty())
+    return;
+  int new_states = -1, rank = -1, num_counts = 0;
+  float score = 0;
+  *hyp = optimizer_->FindBestSplit(&num_counts, &score, &new_states, &rank);
+  if (*hyp == split_hyps_.end())
+    return;
+  message->rank = rank_;
+  message->score = score;
+  message->gain = (*hyp)->gain;
+  writers_.front()->GetSplitDef(**hyp, &message->split);
+  VLOG(2) << "local best: score=" << score << " gain=" << (*hyp)->gain
+          << " num_hyps: " << split_hyps_.size()
+          << " num_counts: " << num_counts;
+}
+
+// Re-create a split selected from another process.
+ModelSplitter::SplitHypRef DistributedSplitter::AddRemoteSplit(
+    const SplitMessage &message) {
+  const SplitDef &def = message.split;
+  const ContextBuilder::QuestionSet &questions =
+      *questions_[num_left_contexts_ + def.position];
+  CHECK_LT(def.question, questions.size());
+  const ContextQuestion *question = questions[def.question];
+  IndexStateModels(models_);
+  ModelManager::StateModelRef model;
+  if (!model_index_->Find(def.model, &model))
+    LOG(FATAL) << "state model of split not found";
+  AllophoneStateModel::SplitResult split =
+      (*model)->Split(def.position, *question);
+  CHECK(split.first && split.second);
+  (*model)->SplitData(def.position, &split);
+  (*model)->ComputeCosts(&split, *scorer_);
+  return split_hyps_.insert(SplitHypothesis(
+      model, split, question, def.position, message.gain));
+}
+
+ModelSplitter::SplitHypRef DistributedSplitter::FindBestSplit() {
+  DCHECK(optimizer_);
+  SplitHypRef local_hyp;
+  SplitMessage local, best;
+  FindLocalSplit(&local_hyp, &local);
+  if (IsCoordinator()) {
+    // channels are ordered by rank, ties are resolved by the lowest rank.
+    best = local;
+    for (int w = 0; w < readers_.size(); ++w) {
+      SplitMessage candidate;
+      if (!readers_[w]->Read(&candidate))
+        REP(FATAL) << "connection to worker " << (w + 1) << " lost";
+      if (candidate.rank >= 0 &&
+          (best.rank < 0 || candidate.score > best.score))
+        best = candidate;
+    }
+    for (int w = 0; w < writers_.size(); ++w)
+      writers_[w]->Write(best);
+  } else {
+    writers_.front()->Write(local);
+    if (!readers_.front()->Read(&best))
+      REP(FATAL) << "connection to coordinator lost";
+  }
+  if (best.rank < 0)
+    return split_hyps_.end();
+  VLOG(1) << "best split from process " << best.rank
+          << ": score=" << best.score << " gain=" << best.gain
+          << " position=" << best.split.position
+          << " question=" << best.split.question;
+  if (best.rank == rank_)
+    return local_hyp;
+  return AddRemoteSplit(best);
+}
+
+}  // namespace trainc
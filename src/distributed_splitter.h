@@ -0,0 +1,116 @@
+// distributed_splitter.h
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Model splitting distributed over several processes
+
+#ifndef DISTRIBUTED_SPLITTER_H_
+#define DISTRIBUTED_SPLITTER_H_
+
+#include <string>
+#include <vector>
+#include "file.h"
+#include "model_splitter.h"
+#include "recipe.h"
+
+namespace trainc {
+
+// A split proposed by a process (sent to the coordinator) or the split
+// selected by the coordinator (sent to all workers).
+struct SplitMessage {
+  // process owning the split hypothesis, -1 if no split is available.
+  int rank;
+  float score, gain;
+  SplitDef split;
+  SplitMessage() : rank(-1), score(0), gain(0) {}
+};
+
+// Binary encoding of a SplitMessage, see distributed_splitter.cc.
+template<> void OutputBuffer::WriteBinary(const SplitMessage &message);
+template<> bool InputBuffer::ReadBinary(SplitMessage *message);
+
+// Sends SplitMessages using the RecipeWriter encoding of splits.
+class SplitMessageWriter : public RecipeWriter {
+public:
+  explicit SplitMessageWriter(File *file) : RecipeWriter(file) {}
+  // Send the recipe header and the rank of the sending process.
+  void WriteHello(int rank);
+  // Send the message and flush the buffer.
+  void Write(const SplitMessage &message);
+};
+
+// Receives messages written by SplitMessageWriter.
+class SplitMessageReader : public RecipeReader {
+public:
+  explicit SplitMessageReader(File *file) : RecipeReader(file) {}
+  bool ReadHello(int *rank);
+  bool Read(SplitMessage *message);
+};
+
+// ModelSplitter running in several processes, one coordinator and
+// a number of workers, communicating over Unix domain or TCP sockets.
+// All processes load the same samples and build the same transducer.
+// The split hypotheses of each state model are generated and evaluated
+// (including the state counting) by only one process, state models are
+// assigned round robin.
+// In each iteration, every process sends its best split to the
+// coordinator, which selects the overall best split and broadcasts it.
+// All processes apply the selected split, processes not owning the state
+// model re-create the split from its SplitDef.
+// The address is either "unix:<path>" or "<host>:<port>". The coordinator
+// listens on the address, the workers connect to it.
+class DistributedSplitter : public ModelSplitter {
+public:
+  // rank: 0 for the coordinator, 1 .. num_workers for the workers.
+  DistributedSplitter(int rank, int num_workers, const std::string &address);
+  virtual ~DistributedSplitter();
+
+  virtual void SplitModels(ModelManager *models);
+
+  bool IsCoordinator() const { return rank_ == 0; }
+
+protected:
+  virtual void CreateSplitHypotheses(
+      const ModelManager::StateModelRef state_model, bool ci_phone);
+  virtual void CreateInitialSplitHypotheses(
+      const vector<ModelManager::StateModelRef> &state_models,
+      const vector<bool> &ci_phones);
+  virtual SplitHypRef FindBestSplit();
+  // the split hypotheses of the other processes are not known locally.
+  virtual bool HaveSplitHypotheses() const { return true; }
+
+private:
+  void Connect();
+  void Disconnect();
+  void OpenChannel(int fd, SplitMessageWriter **writer,
+                   SplitMessageReader **reader) const;
+  int NextOwner();
+  void FindLocalSplit(SplitHypRef *hyp, SplitMessage *message);
+  SplitHypRef AddRemoteSplit(const SplitMessage &message);
+
+  int rank_, num_processes_, next_owner_;
+  std::string address_;
+  ModelManager *models_;
+  // coordinator: one channel per worker, worker: channel to the coordinator
+  std::vector<SplitMessageWriter*> writers_;
+  std::vector<SplitMessageReader*> readers_;
+  DISALLOW_COPY_AND_ASSIGN(DistributedSplitter);
+};
+
+}  // namespace trainc
+
+#endif  // DISTRIBUTED_SPLITTER_H_
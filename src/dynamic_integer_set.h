@@ -0,0 +1,499 @@
+// dynamic_integer_set.h
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Set of integers without a fixed maximum capacity.
+
+#ifndef DYNAMIC_INTEGER_SET_H_
+#define DYNAMIC_INTEGER_SET_H_
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <vector>
+#include "debug.h"
+#include "hash.h"
+#include "util.h"
+
+namespace trainc {
+
+template<size_t N> class DynamicIntegerSetIterator;
+
+// Set of unsigned integers within a range defined at construction, with
+// the same interface as IntegerSet.
+// Sets with a capacity of up to inline_elements are stored as bit vector
+// inside the object, as in IntegerSet. Larger sets are stored either as
+// sorted array of elements (sparse) or as bit vector on the heap (dense),
+// whichever requires less memory. The representation of a large set
+// depends only on its size, such that equal sets can be compared and
+// hashed using their representation.
+// The representation of a large set is allocated on the heap and shares
+// the memory of the inline bit vector, such that a set is not larger than
+// an IntegerSet of inline_elements elements.
+template<size_t inline_elements = 256>
+class DynamicIntegerSet {
+  typedef uint64 Word;
+ public:
+  typedef unsigned int ValueType;
+  typedef DynamicIntegerSetIterator<inline_elements> Iterator;
+
+  explicit DynamicIntegerSet(size_t capacity)
+      : num_bits_(capacity),
+        num_words_((capacity + (kBitsPerWord - 1)) / kBitsPerWord) {
+    CHECK_LE(capacity, MaxCapacity());
+    if (IsInline())
+      std::fill(inline_, inline_ + num_words_, static_cast<Word>(0));
+    else
+      heap_ = new Heap();
+  }
+
+  DynamicIntegerSet(const DynamicIntegerSet &other)
+      : num_bits_(other.num_bits_), num_words_(other.num_words_) {
+    CopyData(other);
+  }
+
+  ~DynamicIntegerSet() {
+    if (!IsInline()) delete heap_;
+  }
+
+  DynamicIntegerSet& operator=(const DynamicIntegerSet &other) {
+    if (this == &other) return *this;
+    if (!IsInline()) {
+      if (!other.IsInline()) {
+        *heap_ = *other.heap_;
+        num_bits_ = other.num_bits_;
+        num_words_ = other.num_words_;
+        return *this;
+      }
+      delete heap_;
+    }
+    num_bits_ = other.num_bits_;
+    num_words_ = other.num_words_;
+    CopyData(other);
+    return *this;
+  }
+
+  // Maximum number of items in the set.
+  size_t Capacity() const {
+    return num_bits_;
+  }
+
+  // Returns the maximum set size.
+  static size_t MaxCapacity() {
+    return std::numeric_limits<ValueType>::max();
+  }
+
+  // Number of elements.
+  size_t Size() const {
+    switch (mode()) {
+      case kSparse: return heap_->elements.size();
+      case kDense: return heap_->size;
+      default: return CountBits();
+    }
+  }
+
+  // Is element a member of the set.
+  bool HasElement(ValueType element) const {
+    DCHECK_LT(element, num_bits_);
+    if (mode() == kSparse)
+      return std::binary_search(heap_->elements.begin(),
+                                heap_->elements.end(), element);
+    return GetBit(Words(), element);
+  }
+
+  // Add a element to the set.
+  void Add(ValueType element) {
+    DCHECK_LT(element, num_bits_);
+    if (IsInline()) {
+      SetBit(inline_, element);
+    } else if (heap_->mode == kDense) {
+      if (!GetBit(&heap_->bits[0], element)) {
+        SetBit(&heap_->bits[0], element);
+        ++heap_->size;
+      }
+    } else {
+      Elements &elements = heap_->elements;
+      Elements::iterator i =
+          std::lower_bound(elements.begin(), elements.end(), element);
+      if (i == elements.end() || *i != element) {
+        elements.insert(i, element);
+        if (elements.size() > MaxSparseSize())
+          ToDense();
+      }
+    }
+  }
+
+  // Remove a element from the set.
+  void Remove(ValueType element) {
+    DCHECK_LT(element, num_bits_);
+    if (IsInline()) {
+      ClearBit(inline_, element);
+    } else if (heap_->mode == kDense) {
+      if (GetBit(&heap_->bits[0], element)) {
+        ClearBit(&heap_->bits[0], element);
+        if (--heap_->size <= MaxSparseSize())
+          ToSparse();
+      }
+    } else {
+      Elements &elements = heap_->elements;
+      Elements::iterator i =
+          std::lower_bound(elements.begin(), elements.end(), element);
+      if (i != elements.end() && *i == element)
+        elements.erase(i);
+    }
+  }
+
+  // Add a range of elements to the set.
+  template<class InputIterator>
+  void AddElements(InputIterator begin, InputIterator end) {
+    for (; begin != end; ++begin)
+      Add(*begin);
+  }
+
+  // Replace the set with its intersection with the set c.
+  void Intersect(const DynamicIntegerSet &c) {
+    DCHECK_EQ(Capacity(), c.Capacity());
+    const Mode mode = this->mode(), other_mode = c.mode();
+    if (mode == kInline) {
+      for (size_t i = 0; i < num_words_; ++i)
+        inline_[i] &= c.inline_[i];
+    } else if (mode != kSparse && other_mode != kSparse) {
+      Word *a = MutableWords();
+      const Word *o = c.Words();
+      for (size_t i = 0; i < num_words_; ++i)
+        a[i] &= o[i];
+      UpdateDense();
+    } else if (mode == kSparse && other_mode == kSparse) {
+      Elements result;
+      std::set_intersection(heap_->elements.begin(), heap_->elements.end(),
+                            c.heap_->elements.begin(),
+                            c.heap_->elements.end(),
+                            std::back_inserter(result));
+      heap_->elements.swap(result);
+    } else if (mode == kSparse) {
+      const Word *o = c.Words();
+      Elements &elements = heap_->elements;
+      Elements::iterator out = elements.begin();
+      for (Elements::const_iterator e = elements.begin();
+           e != elements.end(); ++e) {
+        if (GetBit(o, *e)) *out++ = *e;
+      }
+      elements.erase(out, elements.end());
+    } else {
+      const Word *a = Words();
+      for (Elements::const_iterator e = c.heap_->elements.begin();
+           e != c.heap_->elements.end(); ++e) {
+        if (GetBit(a, *e)) heap_->elements.push_back(*e);
+      }
+      WordVector().swap(heap_->bits);
+      heap_->mode = kSparse;
+    }
+  }
+
+  // Replace the set with its union with the set c.
+  void Union(const DynamicIntegerSet &c) {
+    DCHECK_EQ(Capacity(), c.Capacity());
+    const Mode mode = this->mode(), other_mode = c.mode();
+    if (mode != kSparse && other_mode != kSparse) {
+      Word *a = MutableWords();
+      const Word *o = c.Words();
+      for (size_t i = 0; i < num_words_; ++i)
+        a[i] |= o[i];
+      if (mode == kDense) heap_->size = CountBits();
+    } else if (mode == kSparse && other_mode == kSparse) {
+      Elements result;
+      result.reserve(heap_->elements.size() + c.heap_->elements.size());
+      std::set_union(heap_->elements.begin(), heap_->elements.end(),
+                     c.heap_->elements.begin(), c.heap_->elements.end(),
+                     std::back_inserter(result));
+      heap_->elements.swap(result);
+      if (heap_->elements.size() > MaxSparseSize())
+        ToDense();
+    } else if (mode == kSparse) {
+      Elements elements;
+      heap_->elements.swap(elements);
+      *heap_ = *c.heap_;
+      AddElements(elements.begin(), elements.end());
+    } else {
+      AddElements(c.heap_->elements.begin(), c.heap_->elements.end());
+    }
+  }
+
+  // Returns true if the set does not contain any item.
+  bool IsEmpty() const {
+    switch (mode()) {
+      case kSparse: return heap_->elements.empty();
+      case kDense: return false;
+      default: break;
+    }
+    for (size_t i = 0; i < num_words_; ++i) {
+      if (inline_[i]) return false;
+    }
+    return true;
+  }
+
+  // Returns true if both sets contain the same elements.
+  bool IsEqual(const DynamicIntegerSet &other) const {
+    DCHECK_EQ(Capacity(), other.Capacity());
+    const Mode mode = this->mode();
+    if (mode != other.mode()) return false;
+    if (mode == kSparse) return heap_->elements == other.heap_->elements;
+    if (mode == kDense && heap_->size != other.heap_->size) return false;
+    const Word *a = Words();
+    const Word *o = other.Words();
+    for (size_t i = 0; i < num_words_; ++i) {
+      if (a[i] != o[i]) return false;
+    }
+    return true;
+  }
+
+  // Returns true if this set is a subset of the given set super_set.
+  bool IsSubSet(const DynamicIntegerSet &super_set) const {
+    DCHECK_EQ(Capacity(), super_set.Capacity());
+    const Mode mode = this->mode(), other_mode = super_set.mode();
+    if (mode != kSparse && other_mode != kSparse) {
+      const Word *m = Words();
+      const Word *s = super_set.Words();
+      for (size_t i = 0; i < num_words_; ++i) {
+        if (m[i] & ~s[i]) return false;
+      }
+      return true;
+    } else if (mode == kSparse && other_mode == kSparse) {
+      return std::includes(super_set.heap_->elements.begin(),
+                           super_set.heap_->elements.end(),
+                           heap_->elements.begin(), heap_->elements.end());
+    } else if (mode == kSparse) {
+      const Word *s = super_set.Words();
+      for (Elements::const_iterator e = heap_->elements.begin();
+           e != heap_->elements.end(); ++e) {
+        if (!GetBit(s, *e)) return false;
+      }
+      return true;
+    } else {
+      // a dense set is larger than any sparse set
+      return false;
+    }
+  }
+
+  // Replace the set by its complement.
+  void Invert() {
+    if (mode() == kSparse) {
+      heap_->bits.assign(num_words_, 0);
+      for (Elements::const_iterator e = heap_->elements.begin();
+           e != heap_->elements.end(); ++e)
+        SetBit(&heap_->bits[0], *e);
+      Elements().swap(heap_->elements);
+      heap_->mode = kDense;
+    }
+    Word *a = MutableWords();
+    for (size_t i = 0; i < num_words_; ++i)
+      a[i] = ~a[i];
+    // set unused bits to zero
+    if (num_words_) {
+      a[num_words_ - 1] &= static_cast<Word>(-1)
+          >> (-num_bits_ & (kBitsPerWord - 1));
+    }
+    if (!IsInline()) UpdateDense();
+  }
+
+  // Reset to empty set
+  void Clear() {
+    if (IsInline()) {
+      std::fill(inline_, inline_ + num_words_, static_cast<Word>(0));
+    } else {
+      WordVector().swap(heap_->bits);
+      heap_->elements.clear();
+      heap_->mode = kSparse;
+    }
+  }
+
+  // Computes a hash value for the set.
+  size_t HashValue() const {
+    if (mode() == kSparse)
+      return HashRange(heap_->elements.begin(), heap_->elements.end(), 0);
+    const Word *a = Words();
+    return HashRange(a, a + num_words_, 0);
+  }
+
+ private:
+  friend class DynamicIntegerSetIterator<inline_elements>;
+  typedef std::vector<ValueType> Elements;
+  typedef std::vector<Word> WordVector;
+  enum { kBitsPerWord = sizeof(Word) * 8,
+         kInlineWords = (inline_elements + kBitsPerWord - 1) / kBitsPerWord };
+  enum Mode { kInline, kSparse, kDense };
+
+  // Representation of a set which is not stored inline.
+  struct Heap {
+    Heap() : mode(kSparse), size(0) {}
+    Mode mode;
+    // number of elements of a dense set
+    size_t size;
+    WordVector bits;
+    Elements elements;
+  };
+
+  bool IsInline() const {
+    return num_bits_ <= inline_elements;
+  }
+
+  Mode mode() const {
+    return IsInline() ? kInline : heap_->mode;
+  }
+
+  // Copies the elements of other, which has the same capacity.
+  // Does not free the heap data of this set.
+  void CopyData(const DynamicIntegerSet &other) {
+    if (IsInline())
+      std::copy(other.inline_, other.inline_ + num_words_, inline_);
+    else
+      heap_ = new Heap(*other.heap_);
+  }
+
+  // Maximum number of elements stored in a sparse set, for which the
+  // array of elements is not larger than the bit vector.
+  size_t MaxSparseSize() const {
+    return num_bits_ / (sizeof(ValueType) * 8);
+  }
+
+  const Word* Words() const {
+    return IsInline() ? inline_ : &heap_->bits[0];
+  }
+  Word* MutableWords() {
+    return IsInline() ? inline_ : &heap_->bits[0];
+  }
+
+  size_t CountBits() const {
+    const Word *a = Words();
+    size_t count = 0;
+    for (size_t i = 0; i < num_words_; ++i)
+      count += __builtin_popcountll(a[i]);
+    return count;
+  }
+
+  static bool GetBit(const Word *a, size_t position) {
+    return (a[position / kBitsPerWord] >> (position % kBitsPerWord)) & 1;
+  }
+  static void SetBit(Word *a, size_t position) {
+    a[position / kBitsPerWord] |=
+        static_cast<Word>(1) << (position % kBitsPerWord);
+  }
+  static void ClearBit(Word *a, size_t position) {
+    a[position / kBitsPerWord] &=
+        ~(static_cast<Word>(1) << (position % kBitsPerWord));
+  }
+
+  // Updates the size of a dense set after modifying the bit vector and
+  // changes the representation if required.
+  void UpdateDense() {
+    heap_->size = CountBits();
+    if (heap_->size <= MaxSparseSize())
+      ToSparse();
+  }
+
+  void ToDense() {
+    DCHECK_EQ(mode(), kSparse);
+    heap_->bits.assign(num_words_, 0);
+    for (Elements::const_iterator e = heap_->elements.begin();
+         e != heap_->elements.end(); ++e)
+      SetBit(&heap_->bits[0], *e);
+    heap_->size = heap_->elements.size();
+    Elements().swap(heap_->elements);
+    heap_->mode = kDense;
+  }
+
+  void ToSparse() {
+    DCHECK_EQ(mode(), kDense);
+    Elements elements;
+    elements.reserve(heap_->size);
+    for (Iterator i(*this); !i.Done(); i.Next())
+      elements.push_back(i.Value());
+    heap_->elements.swap(elements);
+    WordVector().swap(heap_->bits);
+    heap_->mode = kSparse;
+  }
+
+  size_t num_bits_, num_words_;
+  union {
+    Word inline_[kInlineWords];
+    Heap *heap_;
+  };
+};
+
+
+// Iterator for a DynamicIntegerSet.
+template<size_t N>
+class DynamicIntegerSetIterator {
+  typedef DynamicIntegerSet<N> Set;
+ public:
+  DynamicIntegerSetIterator(const Set &set)
+      : set_(set), element_(0), index_(0) {
+    if (set_.mode() == Set::kSparse) {
+      if (!Done()) element_ = set_.heap_->elements[0];
+    } else {
+      FindNext();
+    }
+  }
+
+  bool Done() const {
+    if (set_.mode() == Set::kSparse)
+      return index_ >= set_.heap_->elements.size();
+    return element_ >= set_.num_bits_;
+  }
+
+  void Next() {
+    if (set_.mode() == Set::kSparse) {
+      if (++index_ < set_.heap_->elements.size())
+        element_ = set_.heap_->elements[index_];
+    } else {
+      ++element_;
+      FindNext();
+    }
+  }
+
+  typename Set::ValueType Value() const {
+    return element_;
+  }
+
+ private:
+  // Skips empty words.
+  void FindNext() {
+    const typename Set::Word *a = set_.Words();
+    size_t w = element_ / Set::kBitsPerWord;
+    if (w >= set_.num_words_) return;
+    typename Set::Word bits = a[w] >> (element_ % Set::kBitsPerWord);
+    if (!bits) {
+      do {
+        if (++w == set_.num_words_) {
+          element_ = set_.num_bits_;
+          return;
+        }
+      } while (!a[w]);
+      element_ = w * Set::kBitsPerWord;
+      bits = a[w];
+    }
+    element_ += __builtin_ctzll(bits);
+  }
+
+  const Set &set_;
+  typename Set::ValueType element_;
+  size_t index_;
+};
+
+}  // namespace trainc
+
+#endif  // DYNAMIC_INTEGER_SET_H_
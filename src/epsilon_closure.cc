@@ -18,64 +18,294 @@
 // \file
 //
 
+#include <algorithm>
 #include "epsilon_closure.h"
 
 namespace trainc {
 
+EpsilonClosure::~EpsilonClosure() {
+  Clear();
+}
+
+void EpsilonClosure::Clear() {
+  for (std::vector<Component*>::iterator c = components_.begin();
+      c != components_.end(); ++c)
+    delete *c;
+  components_.clear();
+  free_components_.clear();
+  component_.clear();
+  dirty_.clear();
+}
+
 void EpsilonClosure::AddState(StateId state_id) {
-  if (state_id < visited_.size() && visited_[state_id])
-    return;
+  int c = GetComponent(state_id);
+  if (c < 0) {
+    FindComponents(state_id);
+    c = GetComponent(state_id);
+    DCHECK_GE(c, 0);
+  }
+  if (components_[c]->generation != generation_)
+    UpdateContexts(c);
+}
+
+template<class Iter>
+void EpsilonClosure::CollectSuccessors(
+    Iter aiter, std::vector<StateId> *successors) const {
+  typedef typename Iter::ArcAccess ArcAccess;
+  for (; !aiter.Done(); aiter.Next()) {
+    const Arc &arc = aiter.Value();
+    if (!arc.model)
+      successors->push_back(ArcAccess::TargetState(arc));
+  }
+}
+
+void EpsilonClosure::GetSuccessors(StateId state_id, bool forward,
+                                   std::vector<StateId> *successors) const {
+  successors->clear();
   const State *state = l_->GetState(state_id);
-  Collect(state_id, state, NULL);
+  if (!state)
+    return;
+  if (forward) {
+    if (state->NumInputEpsilons())
+      CollectSuccessors(State::ConstForwardArcIterator(state), successors);
+  } else {
+    if (state->NumIncomingEpsilons())
+      CollectSuccessors(State::BackwardArcIterator(state), successors);
+  }
+}
+
+namespace {
+struct TarjanState {
+  int index, lowlink;
+  bool on_stack;
+  TarjanState(int i) : index(i), lowlink(i), on_stack(true) {}
+};
+
+// A state on the depth first search stack and its unvisited successors.
+struct TarjanFrame {
+  typedef LexiconTransducer::StateId StateId;
+  StateId state;
+  std::vector<StateId> successors;
+  size_t next;
+};
+}  // namespace
+
+// Iterative version of Tarjan's algorithm. Components are created
+// in reverse topological order, i.e. all successors of a component exist
+// when it is created. States having a component already are not visited.
+void EpsilonClosure::FindComponents(StateId root) {
+  typedef hash_map<StateId, TarjanState> StateInfo;
+  typedef TarjanFrame Frame;
+  StateInfo info;
+  std::vector<Frame> frames;
+  std::vector<StateId> stack;
+  int index = 0;
+  info.insert(StateInfo::value_type(root, TarjanState(index++)));
+  stack.push_back(root);
+  frames.push_back(Frame());
+  frames.back().state = root;
+  frames.back().next = 0;
+  GetSuccessors(root, forward_, &frames.back().successors);
+  while (!frames.empty()) {
+    Frame &frame = frames.back();
+    if (frame.next < frame.successors.size()) {
+      const StateId t = frame.successors[frame.next++];
+      if (GetComponent(t) >= 0)
+        continue;
+      StateInfo::iterator ti = info.find(t);
+      if (ti == info.end()) {
+        info.insert(StateInfo::value_type(t, TarjanState(index++)));
+        stack.push_back(t);
+        frames.push_back(Frame());
+        frames.back().state = t;
+        frames.back().next = 0;
+        GetSuccessors(t, forward_, &frames.back().successors);
+      } else if (ti->second.on_stack) {
+        TarjanState &s = info.find(frame.state)->second;
+        s.lowlink = std::min(s.lowlink, ti->second.index);
+      }
+    } else {
+      const StateId s = frame.state;
+      frames.pop_back();
+      const TarjanState &si = info.find(s)->second;
+      const int lowlink = si.lowlink;
+      if (si.lowlink == si.index) {
+        std::vector<StateId> members;
+        StateId m;
+        do {
+          m = stack.back();
+          stack.pop_back();
+          info.find(m)->second.on_stack = false;
+          members.push_back(m);
+        } while (m != s);
+        AddComponent(members);
+      }
+      if (!frames.empty()) {
+        TarjanState &p = info.find(frames.back().state)->second;
+        p.lowlink = std::min(p.lowlink, lowlink);
+      }
+    }
+  }
 }
 
-void EpsilonClosure::Collect(StateId state_id, const State *state,
-                             ContextSet *parent_context) {
-  if (state_id < visited_.size() && visited_[state_id]) {
-    if (parent_context)
-      parent_context->Union(contexts_->Context(state_id));
+namespace {
+struct IntervalCompare {
+  bool operator()(const EpsilonClosure::Interval &a,
+                  const EpsilonClosure::Interval &b) const {
+    return a.begin < b.begin;
+  }
+};
+
+// Append the runs of consecutive ids in the sorted states.
+template<class StateId>
+void AddIntervals(const std::vector<StateId> &states,
+                  EpsilonClosure::IntervalList *intervals) {
+  for (size_t i = 0; i < states.size(); ++i) {
+    if (i && states[i] == states[i - 1] + 1)
+      intervals->back().end = states[i] + 1;
+    else
+      intervals->push_back(EpsilonClosure::Interval(states[i], states[i] + 1));
+  }
+}
+
+// Sort and merge overlapping and adjacent intervals.
+void MergeIntervals(EpsilonClosure::IntervalList *intervals) {
+  if (intervals->empty())
     return;
+  std::sort(intervals->begin(), intervals->end(), IntervalCompare());
+  EpsilonClosure::IntervalList::iterator out = intervals->begin();
+  for (EpsilonClosure::IntervalList::const_iterator i = intervals->begin() + 1;
+      i != intervals->end(); ++i) {
+    if (i->begin <= out->end)
+      out->end = std::max(out->end, i->end);
+    else
+      *(++out) = *i;
+  }
+  intervals->erase(out + 1, intervals->end());
+  EpsilonClosure::IntervalList(*intervals).swap(*intervals);
+}
+}  // namespace
+
+void EpsilonClosure::AddComponent(const std::vector<StateId> &states) {
+  int c;
+  if (free_components_.empty()) {
+    c = components_.size();
+    components_.push_back(NULL);
+  } else {
+    c = free_components_.back();
+    free_components_.pop_back();
+  }
+  Component *component = new Component(
+      l_->GetState(states.front())->GetContext(forward_));
+  components_[c] = component;
+  component->states = states;
+  std::sort(component->states.begin(), component->states.end());
+  const StateId max_state = component->states.back();
+  if (max_state >= component_.size())
+    component_.resize(max_state + 1, -1);
+  for (std::vector<StateId>::const_iterator s = states.begin();
+      s != states.end(); ++s)
+    component_[*s] = c;
+  bool cyclic = states.size() > 1;
+  std::vector<StateId> successors;
+  for (std::vector<StateId>::const_iterator s = states.begin();
+      s != states.end(); ++s) {
+    GetSuccessors(*s, forward_, &successors);
+    for (std::vector<StateId>::const_iterator t = successors.begin();
+        t != successors.end(); ++t) {
+      const int tc = GetComponent(*t);
+      DCHECK_GE(tc, 0);
+      if (tc == c)
+        cyclic = true;
+      else
+        component->successors.push_back(tc);
+    }
+  }
+  RemoveDuplicates(&component->successors);
+  if (cyclic)
+    AddIntervals(component->states, &component->reachable);
+  for (std::vector<int>::const_iterator t = component->successors.begin();
+      t != component->successors.end(); ++t) {
+    const Component &succ = *components_[*t];
+    AddIntervals(succ.states, &component->reachable);
+    component->reachable.insert(component->reachable.end(),
+                                succ.reachable.begin(), succ.reachable.end());
   }
-  ContextSet state_context = state->GetContext(forward_);
-  const bool has_eps =
-      forward_ ? state->NumInputEpsilons() : state->NumIncomingEpsilons();
-  if (has_eps) {
-    if (forward_) {
-      CollectReachable(state_id, State::ConstForwardArcIterator(state),
-        &state_context);
+  MergeIntervals(&component->reachable);
+}
+
+// Depth first traversal of the successors of component c with outdated
+// contexts, contexts are computed in post order.
+void EpsilonClosure::UpdateContexts(int c) {
+  std::vector< std::pair<int, size_t> > stack;
+  components_[c]->generation = generation_;
+  stack.push_back(std::make_pair(c, 0));
+  while (!stack.empty()) {
+    Component &component = *components_[stack.back().first];
+    size_t &next = stack.back().second;
+    if (next < component.successors.size()) {
+      Component &succ = *components_[component.successors[next++]];
+      if (succ.generation != generation_) {
+        succ.generation = generation_;
+        stack.push_back(std::make_pair(component.successors[next - 1], 0));
+      }
     } else {
-      CollectReachable(state_id, State::BackwardArcIterator(state),
-        &state_context);
+      std::vector<StateId>::const_iterator s = component.states.begin();
+      component.context = l_->GetState(*s)->GetContext(forward_);
+      for (++s; s != component.states.end(); ++s)
+        component.context.Union(l_->GetState(*s)->GetContext(forward_));
+      for (std::vector<int>::const_iterator t = component.successors.begin();
+          t != component.successors.end(); ++t)
+        component.context.Union(components_[*t]->context);
+      SetContexts(component);
+      stack.pop_back();
     }
   }
-  if (state_id >= visited_.size())
-    visited_.resize(state_id + 1, false);
-  visited_[state_id] = true;
-  contexts_->SetContext(state_id, state_context);
-  if (parent_context)
-    parent_context->Union(state_context);
 }
 
-template<class Iter>
-void EpsilonClosure::CollectReachable(StateId state_id, Iter aiter,
-                                      ContextSet *state_context) {
-  typedef typename Iter::ArcAccess ArcAccess;
-  StateSet reachable;
-  for (; !aiter.Done(); aiter.Next()) {
-    const Arc &arc = aiter.Value();
-    if (!arc.model) {
-      const StateId target_id = ArcAccess::TargetState(arc);
-      const State *target = l_->GetState(target_id);
-      reachable.insert(target_id);
-      Collect(target_id, target, state_context);
-      // StateMap::const_iterator i = states_.find(arc.nextstate);
-      StateMap::const_iterator i = states_.find(target_id);
-      if (i != states_.end())
-        reachable.insert(i->second.begin(), i->second.end());
+void EpsilonClosure::SetContexts(const Component &component) {
+  for (std::vector<StateId>::const_iterator s = component.states.begin();
+      s != component.states.end(); ++s) {
+    contexts_->Erase(*s);
+    contexts_->SetContext(*s, component.context);
+  }
+}
+
+void EpsilonClosure::RemoveComponent(int c) {
+  Component *component = components_[c];
+  for (std::vector<StateId>::const_iterator s = component->states.begin();
+      s != component->states.end(); ++s)
+    component_[*s] = -1;
+  delete component;
+  components_[c] = NULL;
+  free_components_.push_back(c);
+}
+
+// Removes the components of the invalidated states and of all states
+// reaching them. States without component can not reach a state having a
+// component computed before the modification, because all states reachable
+// from a state are added when its component is created.
+void EpsilonClosure::Update() {
+  std::vector<StateId> queue, predecessors;
+  queue.swap(dirty_);
+  while (!queue.empty()) {
+    const StateId s = queue.back();
+    queue.pop_back();
+    const int c = GetComponent(s);
+    if (c >= 0) {
+      std::vector<StateId> states = components_[c]->states;
+      RemoveComponent(c);
+      queue.insert(queue.end(), states.begin(), states.end());
+    }
+    GetSuccessors(s, !forward_, &predecessors);
+    for (std::vector<StateId>::const_iterator p = predecessors.begin();
+        p != predecessors.end(); ++p) {
+      if (GetComponent(*p) >= 0)
+        queue.push_back(*p);
     }
   }
-  if (!reachable.empty())
-    states_.insert(StateMap::value_type(state_id, reachable));
+  contexts_->Clear();
+  ++generation_;
 }
 
 void EpsilonClosure::GetUnion(const vector<StateId> &states,
@@ -89,18 +319,13 @@ void EpsilonClosure::GetUnion(const vector<StateId> &states,
 void EpsilonClosure::AddReachable(StateId state, hash_set<StateId> *reachable) {
   AddState(state);
   reachable->insert(state);
-  StateMap::const_iterator i = states_.find(state);
-  if (i != states_.end())
-    reachable->insert(i->second.begin(), i->second.end());
+  for (Iterator i = Reachable(state); !i.Done(); i.Next())
+    reachable->insert(i.Value());
 }
 
 EpsilonClosure::Iterator EpsilonClosure::Reachable(StateId s) {
   AddState(s);
-  StateMap::const_iterator i = states_.find(s);
-  if (i != states_.end())
-    return Iterator(i->second);
-  else
-    return Iterator();
+  return Iterator(components_[GetComponent(s)]->reachable);
 }
 
 }  // namespace trainc
@@ -21,6 +21,7 @@
 #ifndef EPSILON_CLOSURE_H_
 #define EPSILON_CLOSURE_H_
 
+#include <vector>
 #include <ext/hash_map>
 #include "lexicon_transducer.h"
 #include "debug.h"
@@ -45,6 +46,9 @@ public:
     DCHECK(i != context_.end());
     return i->second;
   }
+  void Erase(StateId s) {
+    context_.erase(s);
+  }
   void Clear() {
     context_.clear();
   }
@@ -54,36 +58,63 @@ protected:
 
 // Explores the epsilon closure of a set of states.
 // Each state in the set has to be added using AddState().
+// The strongly connected components of the epsilon arcs are computed
+// (iteratively, in topological order) when a state is added. All states of
+// a component share the same reachable set, which is stored as a sorted list
+// of state id intervals.
+// Structural changes of the transducer are reported with Invalidate().
+// They are applied on Update(), which discards only the components
+// reaching a changed state and recomputes the contexts of all components.
 class EpsilonClosure {
 public:
   typedef LexiconTransducer::State State;
   typedef LexiconTransducer::Arc Arc;
   typedef LexiconTransducer::StateId StateId;
 
+  // Range of state ids [begin, end)
+  struct Interval {
+    StateId begin, end;
+    Interval(StateId b, StateId e) : begin(b), end(e) {}
+  };
+  typedef std::vector<Interval> IntervalList;
+
   // If forward == false the reversed transducer is used.
   // The full state context of each state in
   // the epsilon closure is computed and stored in contexts.
   EpsilonClosure(const LexiconTransducer *l, bool forward,
                  StateContexts *contexts)
-      : l_(l), forward_(forward), contexts_(contexts) {}
+      : l_(l), forward_(forward), contexts_(contexts), generation_(0) {}
+  ~EpsilonClosure();
   void AddState(StateId state_id);
-  void Clear() {
-    states_.clear();
-    visited_.clear();
+  // Discard all components.
+  void Clear();
+  // Notification that the epsilon arcs of the state or the state itself
+  // have been modified. Has no effect until Update() is called.
+  void Invalidate(StateId state_id) {
+    dirty_.push_back(state_id);
   }
+  // Discard the components affected by the states passed to Invalidate()
+  // and all state contexts.
+  void Update();
   void GetUnion(const std::vector<StateId> &states,
                 hash_set<StateId> *reachable);
   void AddReachable(StateId state, hash_set<StateId> *reachable);
   class Iterator {
   public:
-    Iterator() : i_(NULL, NULL), end_(NULL, NULL) {}
-    Iterator(const hash_set<StateId> &set)
-        : i_(set.begin()), end_(set.end()) {}
+    Iterator() : i_(NULL), end_(NULL), s_(0) {}
+    Iterator(const IntervalList &list)
+        : i_(list.empty() ? NULL : &list[0]),
+          end_(list.empty() ? NULL : &list[0] + list.size()),
+          s_(list.empty() ? 0 : list[0].begin) {}
     bool Done() const { return i_ == end_; }
-    void Next() { ++i_; }
-    StateId Value() const { return *i_; }
+    void Next() {
+      if (++s_ == i_->end && ++i_ != end_)
+        s_ = i_->begin;
+    }
+    StateId Value() const { return s_; }
   private:
-    hash_set<StateId>::const_iterator i_, end_;
+    const Interval *i_, *end_;
+    StateId s_;
   };
 
   Iterator Reachable(StateId s);
@@ -92,18 +123,41 @@ public:
     return contexts_;
   }
 private:
-  void Collect(StateId state_id, const State *state,
-               ContextSet *parent_context);
+  struct Component {
+    // member states, sorted
+    std::vector<StateId> states;
+    // distinct successor components
+    std::vector<int> successors;
+    // states reachable from any member
+    IntervalList reachable;
+    ContextSet context;
+    int generation;
+    explicit Component(const ContextSet &c) : context(c), generation(-1) {}
+  };
+
+  void GetSuccessors(StateId state_id, bool forward,
+                     std::vector<StateId> *successors) const;
   template<class Iter>
-  void CollectReachable(StateId state_id, Iter aiter,
-                        ContextSet *state_context);
-  typedef hash_set<StateId> StateSet;
-  typedef hash_map<StateId, StateSet> StateMap;
-  StateMap states_;
-  std::vector<bool> visited_;
+  void CollectSuccessors(Iter aiter, std::vector<StateId> *successors) const;
+  int GetComponent(StateId s) const {
+    return s < component_.size() ? component_[s] : -1;
+  }
+  void FindComponents(StateId root);
+  void AddComponent(const std::vector<StateId> &states);
+  void UpdateContexts(int c);
+  void SetContexts(const Component &component);
+  void RemoveComponent(int c);
+
+  // component id for each state, -1 if not computed.
+  std::vector<int> component_;
+  std::vector<Component*> components_;
+  std::vector<int> free_components_;
+  std::vector<StateId> dirty_;
   const LexiconTransducer *l_;
   bool forward_;
   StateContexts *contexts_;
+  int generation_;
+  DISALLOW_COPY_AND_ASSIGN(EpsilonClosure);
 };
 
 }  // namespace trainc
@@ -18,17 +18,30 @@
 #include <fstream>
 #include <cstdarg>
 #include <iterator>
+#include <ext/stdio_filebuf.h>
 #include "file.h"
 #include "stringutil.h"
 #include "util.h"
 
 namespace trainc {
 
+namespace {
+// Stream buffer of a file descriptor (GNU libstdc++ extension).
+typedef __gnu_cxx::stdio_filebuf<char> DescriptorBuffer;
+}  // namespace
+
 File::File(const std::string &filename, const char *mode)
-  : mode_(static_cast<std::ios_base::openmode>(0)) {
+  : mode_(static_cast<std::ios_base::openmode>(0)),
+    fd_buffer_(NULL), fd_stream_(NULL) {
   Open(filename, mode);
 }
 
+File::File(int fd, const char *mode)
+  : mode_(static_cast<std::ios_base::openmode>(0)),
+    fd_buffer_(NULL), fd_stream_(NULL) {
+  Open(fd, mode);
+}
+
 File::~File() {
   Close();
 }
@@ -40,16 +53,36 @@ bool File::Open(const std::string &filename, const char *mode) {
   return stream_.is_open() && !stream_.fail();
 }
 
+bool File::Open(int fd, const char *mode) {
+  Close();
+  mode_ = (std::string("w") == mode ? std::ios_base::out : std::ios_base::in);
+  if (fd < 0)
+    return false;
+  // the buffer closes the file descriptor when it is destroyed
+  fd_buffer_ = new DescriptorBuffer(fd, mode_);
+  fd_stream_ = new std::iostream(fd_buffer_);
+  return IsOpen();
+}
+
 void File::Close() {
-  stream_.close();
+  if (fd_stream_) {
+    fd_stream_->flush();
+    delete fd_stream_;
+    delete fd_buffer_;
+    fd_stream_ = NULL;
+    fd_buffer_ = NULL;
+  } else {
+    stream_.close();
+  }
 }
 
 bool File::IsOpen() const {
-  return stream_.is_open();
+  return fd_buffer_ ? static_cast<DescriptorBuffer*>(fd_buffer_)->is_open() :
+      stream_.is_open();
 }
 
 bool File::IsEof() const {
-  return stream_.eof();
+  return fd_stream_ ? fd_stream_->eof() : stream_.eof();
 }
 
 bool File::IsReader() const {
@@ -60,7 +93,9 @@ bool File::IsWriter() const {
   return mode_ & std::ios_base::out;
 }
 
-std::fstream& File::Stream() {
+std::iostream& File::Stream() {
+  if (fd_stream_)
+    return *fd_stream_;
   return stream_;
 }
 
@@ -81,6 +116,15 @@ File* File::OpenOrDie(const std::string &filename, const char *mode) {
   return f;
 }
 
+File* File::FromDescriptor(int fd, const char *mode) {
+  File *f = new File(fd, mode);
+  if (!f->IsOpen()) {
+    delete f;
+    f = NULL;
+  }
+  return f;
+}
+
 std::string File::ReadFileToStringOrDie(const std::string &filename) {
   std::string result;
   ReadFileToStringOrDie(filename, &result);
@@ -99,7 +143,7 @@ void File::Printf(const char *format, ...) {
   va_start(ap, format);
   std::string s = StringVPrintf(format, ap);
   va_end(ap);
-  stream_ << s;
+  Stream() << s;
 }
 
 // =======================================================================
@@ -116,6 +160,11 @@ bool InputBuffer::ReadLine(std::string *line) {
   return !file_->Stream().fail();
 }
 
+bool InputBuffer::AtEnd() {
+  return !file_->IsOpen() ||
+      file_->Stream().peek() == std::char_traits<char>::eof();
+}
+
 bool InputBuffer::ReadToString(std::string *str) {
   if (!file_->IsOpen() || file_->IsEof()) {
     return false;
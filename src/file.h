@@ -30,16 +30,21 @@ namespace trainc {
 class File {
 public:
   File(const std::string &filename, const char *mode);
+  // Use an open file descriptor, e.g. a pipe or a socket.
+  // Takes ownership of the file descriptor.
+  File(int fd, const char *mode);
   ~File();
 
   // for compatibility with Google's File
   static void Init() {}
   static File* Create(const std::string &filename, const char *mode);
   static File* OpenOrDie(const std::string &filename, const char *mode);
+  static File* FromDescriptor(int fd, const char *mode);
   static std::string ReadFileToStringOrDie(const std::string &filename);
   static void ReadFileToStringOrDie(const std::string &filename, std::string *content);
 
   bool Open(const std::string &filename, const char *mode);
+  bool Open(int fd, const char *mode);
   // for compatibility with Google's File
   bool Open() {
     return IsOpen();
@@ -54,11 +59,14 @@ public:
 
   void Printf(const char *format, ...);
 
-  std::fstream& Stream();
+  std::iostream& Stream();
 
 protected:
   std::ios_base::openmode mode_;
   std::fstream stream_;
+  // only used for files opened from a file descriptor, see file.cc
+  std::streambuf *fd_buffer_;
+  std::iostream *fd_stream_;
 };
 
 
@@ -91,6 +99,14 @@ public:
     file_->Stream().read(reinterpret_cast<char*>(t), sizeof(T));
     return !file_->Stream().fail();
   }
+  // Read n objects from binary data.
+  template<class T>
+  bool ReadBinary(T *t, size_t n) {
+    file_->Stream().read(reinterpret_cast<char*>(t), n * sizeof(T));
+    return !file_->Stream().fail();
+  }
+  // True if all data has been read.
+  bool AtEnd();
   // Read from text data.
   template<class T>
   bool ReadText(T *t) {
@@ -179,6 +179,32 @@ public:
     EXPECT_FALSE(r);
   }
 
+  void Descriptor() {
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+    int testInt = 8;
+    float testFloat = 3.67;
+    {
+      File *file = File::FromDescriptor(fds[1], "w");
+      ASSERT_NOTNULL(file);
+      EXPECT_TRUE(file->IsWriter());
+      OutputBuffer o(file);
+      o.WriteBinary(testInt);
+      o.WriteBinary(testFloat);
+    }
+    File *file = File::FromDescriptor(fds[0], "r");
+    ASSERT_NOTNULL(file);
+    InputBuffer in(file);
+    int readInt;
+    float readFloat;
+    EXPECT_TRUE(in.ReadBinary(&readInt));
+    EXPECT_EQ(readInt, testInt);
+    EXPECT_TRUE(in.ReadBinary(&readFloat));
+    EXPECT_EQ(readFloat, testFloat);
+    // write end has been closed
+    EXPECT_FALSE(in.ReadBinary(&readInt));
+  }
+
 protected:
   void WriteToFile(const std::string &s) {
     File *file = File::Create(filename_, "w");
@@ -231,4 +257,8 @@ TEST_F(TestFile, Printf) {
   Printf();
 }
 
+TEST_F(TestFile, Descriptor) {
+  Descriptor();
+}
+
 }  // namespace trainc
@@ -0,0 +1,93 @@
+// float16.h
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Conversion between float and 16 bit floating point formats.
+
+#ifndef FLOAT16_H_
+#define FLOAT16_H_
+
+#include <stdint.h>
+#include <cstring>
+
+namespace trainc {
+
+inline uint32_t FloatBits(float f) {
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+inline float BitsToFloat(uint32_t u) {
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+// IEEE 754 half precision, rounded to nearest even.
+// Values beyond the range of half precision are clamped to the largest
+// finite value (65504). NaN is not supported.
+inline uint16_t FloatToHalf(float f) {
+  const uint32_t u = FloatBits(f);
+  const uint16_t sign = (u >> 16) & 0x8000;
+  const uint32_t abs = u & 0x7fffffff;
+  if (abs >= 0x477ff000)  // rounds to 65520 or more
+    return sign | 0x7bff;
+  if (abs < 0x38800000) {  // below 2^-14: subnormal
+    if (abs < 0x33000000)  // below 2^-25: rounds to zero
+      return sign;
+    const uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+    const int shift = 126 - (abs >> 23);
+    uint32_t h = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t half = 1u << (shift - 1);
+    if (rest > half || (rest == half && (h & 1))) ++h;
+    return sign | h;
+  }
+  uint32_t h = (abs - 0x38000000) >> 13;
+  const uint32_t rest = abs & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) ++h;
+  return sign | h;
+}
+
+inline float HalfToFloat(uint16_t h) {
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  if (!exponent) {
+    // zero or subnormal: mantissa * 2^-24
+    const float f = mantissa * (1.0f / 16777216.0f);
+    return sign ? -f : f;
+  }
+  if (exponent == 0x1f)
+    return BitsToFloat(sign | 0x7f800000 | (mantissa << 13));
+  return BitsToFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+// bfloat16 (the upper 16 bits of a float), rounded to nearest even.
+inline uint16_t FloatToBFloat16(float f) {
+  const uint32_t u = FloatBits(f);
+  return (u + 0x7fff + ((u >> 16) & 1)) >> 16;
+}
+
+inline float BFloat16ToFloat(uint16_t b) {
+  return BitsToFloat(static_cast<uint32_t>(b) << 16);
+}
+
+}  // namespace trainc
+
+#endif  // FLOAT16_H_
@@ -40,7 +40,7 @@ void FstInterfaceImpl::Init(ConstructionalTransducer *c, int boundary_phone) {
   state_ids_.resize(c->NumStates() + 1);
   PhoneContext root_context(c_->NumPhones(), c_->NumLeftContexts(), 0);
   for (int l = 0; l > -c_->NumLeftContexts(); --l)
-    root_context.GetContextRef(l)->Add(boundary_phone);
+    root_context.AddToContext(l, boundary_phone);
   root_ = new State(root_context);
   // VLOG(2) << "root: " << root_->history().ToString();
   CHECK_EQ(GetStateId(root_), kRootId);
@@ -65,6 +65,7 @@ FstInterfaceImpl::StateId FstInterfaceImpl::GetStateId(
       free_ids_.pop_back();
       id2state_[id] = state;
     }
+    ResetArcCache(id);
     state_ids_.insert(StateMap::value_type(state, id));
     // VLOG(2) << "state id: " << state << " " << id;
     return id;
@@ -97,6 +98,40 @@ void FstInterfaceImpl::UpdateStartState() {
     const CArc &arc = aiter.Value();
     root_->AddArc(NULL, arc.output(), arc.target());
   }
+  ResetArcCache(kRootId);
+}
+
+void FstInterfaceImpl::InvalidateArcs(const State *state) {
+  StateMap::const_iterator i = state_ids_.find(state);
+  if (i != state_ids_.end() && i->second < arc_cache_.size())
+    arc_cache_[i->second].valid = false;
+}
+
+void FstInterfaceImpl::ResetArcCache(StateId s) {
+  if (s >= arc_cache_.size()) {
+    arc_cache_.resize(s + 1);
+  } else {
+    arc_cache_[s].valid = false;
+    std::vector<Arc>().swap(arc_cache_[s].arcs);
+  }
+}
+
+const std::vector<FstInterfaceImpl::Arc>& FstInterfaceImpl::GetArcs(
+    StateId s) const {
+  DCHECK_LT(s, arc_cache_.size());
+  ArcCache &cache = arc_cache_[s];
+  if (!cache.valid) {
+    cache.arcs.clear();
+    for (CArcIterator aiter(*id2state_[s]); !aiter.Done(); aiter.Next()) {
+      const CArc &arc = aiter.Value();
+      StateMap::const_iterator next = state_ids_.find(arc.target());
+      DCHECK(next != state_ids_.end());
+      cache.arcs.push_back(
+          Arc(0, arc.output() + 1, Arc::Weight::One(), next->second));
+    }
+    cache.valid = true;
+  }
+  return cache.arcs;
 }
 
 FstInterfaceImpl::Weight FstInterfaceImpl::Final(StateId s) const {
@@ -111,7 +146,7 @@ FstInterfaceImpl::Weight FstInterfaceImpl::Final(StateId s) const {
 size_t FstInterfaceImpl::NumArcs(StateId s) const {
   DCHECK_LT(s, id2state_.size());
   DCHECK(std::find(free_ids_.begin(), free_ids_.end(), s) == free_ids_.end());
-  return id2state_[s]->GetArcs().size();
+  return GetArcs(s).size();
 }
 
 size_t FstInterfaceImpl::NumInputEpsilons(StateId s) const {
@@ -134,6 +169,7 @@ FstInterfaceImpl::StateId FstInterfaceImpl::RemoveState(const State *state) {
   DCHECK(i != state_ids_.end());
   state_ids_.erase(i);
   free_ids_.push_back(id);
+  ResetArcCache(id);
   if (state == boundary_state_)
     boundary_state_ = NULL;
   return id;
@@ -172,48 +208,6 @@ private:
   FstInterfaceImpl::StateMap::const_iterator iter_, end_;
 };
 
-class FstInterfaceImpl::ArcIterator :
-    public fst::ArcIteratorBase<fst::StdArc> {
-  typedef trainc::ArcIterator CArcIterator;
-  typedef fst::StdArc Arc;
-public:
-  ArcIterator(CArcIterator iter, const FstInterfaceImpl &fst) {
-    // TODO(rybach) cache arcs
-    for (; !iter.Done(); iter.Next()) {
-      const CArc &arc = iter.Value();
-      StateMap::const_iterator next = fst.state_ids_.find(arc.target());
-      DCHECK(next != fst.state_ids_.end());
-      arcs_.push_back(Arc(0, arc.output() + 1, Arc::Weight::One(), next->second));
-    }
-    iter_ = arcs_.begin();
-  }
-private:
-  virtual bool Done_() const {
-    return iter_ == arcs_.end();
-  }
-  virtual const Arc& Value_() const {
-    return *iter_;
-  }
-  virtual void Next_() {
-    ++iter_;
-  }
-  virtual size_t Position_() const {
-    return std::distance(arcs_.begin(), iter_);
-  }
-  virtual void Reset_() {
-    iter_ = arcs_.begin();
-  }
-  virtual void Seek_(size_t a) {
-    iter_ = arcs_.begin() + a;
-  }
-  virtual uint32 Flags_() const {
-    return fst::kArcFlags;
-  }
-  virtual void SetFlags_(uint32 flags, uint32 mask) {}
-  std::vector<Arc> arcs_;
-  std::vector<Arc>::const_iterator iter_;
-};
-
 void FstInterfaceImpl::InitStateIterator(
     fst::StateIteratorData<Arc> *data) const {
   data->base = new FstInterfaceImpl::StateIterator(*this);
@@ -221,9 +215,13 @@ void FstInterfaceImpl::InitStateIterator(
 }
 void FstInterfaceImpl::InitArcIterator(
     StateId s, fst::ArcIteratorData<Arc> *data) const {
+  // points directly to the cached arcs, no iterator object is allocated.
   DCHECK_LT(s, id2state_.size());
-  const State *state = id2state_[s];
-  data->base = new FstInterfaceImpl::ArcIterator(CArcIterator(*state), *this);
+  const std::vector<Arc> &arcs = GetArcs(s);
+  data->base = NULL;
+  data->arcs = arcs.empty() ? NULL : &arcs[0];
+  data->narcs = arcs.size();
+  data->ref_count = NULL;
 }
 
 }  // namespace trainc
@@ -21,6 +21,7 @@
 #ifndef FST_INTERFACE_H_
 #define FST_INTERFACE_H_
 
+#include <vector>
 #include "fst/fst.h"
 #include "fst/expanded-fst.h"
 #include "fst/test-properties.h"
@@ -65,18 +66,26 @@ public:
   StateId GetState(const State *state);
   const State* GetStateById(StateId id) const;
   void UpdateStartState();
-
+  void InvalidateArcs(const State *state);
 
   class StateIterator;
-  class ArcIterator;
 private:
   typedef hash_map<const State*, StateId, PointerHash<State> > StateMap;
   typedef trainc::Arc CArc;
   typedef trainc::StateIterator CStateIterator;
   typedef trainc::ArcIterator CArcIterator;
 
+  // Arcs of a state converted to fst::StdArc.
+  struct ArcCache {
+    bool valid;
+    std::vector<Arc> arcs;
+    ArcCache() : valid(false) {}
+  };
+
   StateId GetStateId(const State *state, bool add=true);
   const State* FindBoundaryState() const;
+  const std::vector<Arc>& GetArcs(StateId s) const;
+  void ResetArcCache(StateId s);
 
   static const string kType;
   static const uint64 kProperties;
@@ -89,9 +98,10 @@ private:
   int num_states_;
   int boundary_phone_;
   std::list<StateId> free_ids_;
+  // indexed by StateId, filled on demand by InitArcIterator.
+  mutable std::vector<ArcCache> arc_cache_;
 
   friend class StateIterator;
-  friend class ArcIterator;
 };
 
 
@@ -146,6 +156,12 @@ public:
   void UpdateStartState() {
     GetImpl()->UpdateStartState();
   }
+
+  // Notification that an arc of the given state was added or removed.
+  // Invalidates the cached arcs of the state.
+  void InvalidateArcs(const State *state) {
+    GetImpl()->InvalidateArcs(state);
+  }
 };
 
 }  // namespace trainc
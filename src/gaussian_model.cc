@@ -15,8 +15,14 @@
 // Copyright 2010 RWTH Aachen University. All Rights Reserved.
 // Author: rybach@cs.rwth-aachen.de (David Rybach)
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <algorithm>
+#include <cstring>
 #include "gaussian_model.h"
+#include "parallel_writer.h"
 #include "stringutil.h"
 #include "sample.h"
 
@@ -77,6 +83,8 @@ int GaussianModel::Dimension() const {
 ModelWriter* ModelWriter::Create(const std::string &type) {
   if (type == RwthModelTextWriter::Name())
     return new RwthModelTextWriter;
+  if (type == ModelBinaryWriter::Name())
+    return new ModelBinaryWriter;
   return new ModelTextWriter;
 }
 
@@ -84,6 +92,30 @@ ModelWriter* ModelWriter::Create(const std::string &type) {
 
 const int ModelTextWriter::kFormatVersion = 1;
 
+namespace {
+// Append the values of v formatted like OutputBuffer::WriteText.
+void AppendVector(const GaussianModel::ModelVector &v, std::string *buffer) {
+  typedef GaussianModel::ModelVector::const_iterator Iterator;
+  for (Iterator i = v.begin(); i != v.end(); ++i)
+    StringAppendF(buffer, "%g ", *i);
+}
+}  // namespace
+
+// One line per model: name, mean, and variance.
+class ModelTextWriter::Formatter : public ItemFormatter {
+public:
+  explicit Formatter(const GaussianModel &model) : model_(model) {}
+  virtual void Format(int m, std::string *buffer) const {
+    buffer->append(model_.Name(m));
+    buffer->append(" ");
+    AppendVector(model_.Mean(m), buffer);
+    AppendVector(model_.Variance(m), buffer);
+    buffer->append("\n");
+  }
+private:
+  const GaussianModel &model_;
+};
+
 bool ModelTextWriter::Write(const std::string &filename,
                             const GaussianModel &model) const {
   File *file = File::Create(filename, "w");
@@ -93,29 +125,53 @@ bool ModelTextWriter::Write(const std::string &filename,
   ob.WriteString(StringPrintf("%d %d %d\n", kFormatVersion,
                                             model.Dimension(),
                                             model.NumModels()));
-  for (GaussianModel::Iterator m = model.GetIterator(); !m.Done(); m.Next()) {
-    ob.WriteString(StringPrintf("%s ", m.Name().c_str()));
-    size_t index = m.Index();
-    WriteVector(&ob, model.Mean(index));
-    WriteVector(&ob, model.Variance(index));
-    ob.WriteString("\n");
-  }
+  WriteItems(Formatter(model), model.NumModels(), num_threads_, &ob);
   return ob.CloseFile();
 }
 
-void ModelTextWriter::WriteVector(OutputBuffer *ob, const GaussianModel::ModelVector &v) const {
-  typedef GaussianModel::ModelVector::const_iterator Iterator;
-  for (Iterator i = v.begin(); i != v.end(); ++i) {
-    ob->WriteText(*i);
-    ob->WriteString(" ");
-  }
-}
-
 // ====================================================================
 
 const char *RwthModelTextWriter::kFormatHeader =
     "#Version: 2.0\n#CovarianceType: DiagonalCovariance\n";
 
+// The file consists of 4 sections with one line per model:
+// mixtures, densities, means, and covariances.
+class RwthModelTextWriter::Formatter : public ItemFormatter {
+public:
+  explicit Formatter(const GaussianModel &model)
+      : model_(model), num_models_(model.NumModels()),
+        dimension_(model.Dimension()) {}
+  int NumItems() const { return 4 * num_models_; }
+  virtual void Format(int item, std::string *buffer) const {
+    const int m = item % num_models_;
+    switch (item / num_models_) {
+      case 0:
+        // nDensities, density index, log weight
+        StringAppendF(buffer, "%d %d %d\n", 1, m, 0);
+        break;
+      case 1:
+        // mean index, covariance index
+        StringAppendF(buffer, "%d %d\n", m, m);
+        break;
+      case 2:
+        StringAppendF(buffer, "%d ", dimension_);
+        AppendVector(model_.Mean(m), buffer);
+        buffer->append("\n");
+        break;
+      default: {
+        StringAppendF(buffer, "%d ", dimension_);
+        const GaussianModel::ModelVector &v = model_.Variance(m);
+        for (int d = 0; d < dimension_; ++d)
+          StringAppendF(buffer, "%g 1 ", v[d]);  // value, weight
+        buffer->append("\n");
+      }
+    }
+  }
+private:
+  const GaussianModel &model_;
+  int num_models_, dimension_;
+};
+
 bool RwthModelTextWriter::Write(const std::string &filename,
                                 const GaussianModel &model) const {
   File *file = File::Create(filename, "w");
@@ -131,33 +187,202 @@ bool RwthModelTextWriter::Write(const std::string &filename,
                               n_models, // nDensities
                               n_models, // nMeans
                               n_models)); // nCovariances
-  for (int m = 0; m < n_models; ++m) {
-    ob.WriteString(StringPrintf("%d %d %d\n",
-                                1, // nDensities
-                                m, // density index
-                                0)); // log weight
-  }
-  for (int m = 0; m < n_models; ++m) {
-    ob.WriteString(StringPrintf("%d %d\n",
-                                m, // mean index
-                                m)); // covariance index
+  Formatter formatter(model);
+  WriteItems(formatter, formatter.NumItems(), num_threads_, &ob);
+  return ob.CloseFile();
+}
+
+
+// ====================================================================
+
+const uint32_t ModelBinaryWriter::kMagic = 0x4d474354;  // "TCGM"
+const int ModelBinaryWriter::kVersion = 1;
+const int ModelBinaryWriter::kAlignment = 64;
+
+namespace {
+uint64_t Align(uint64_t offset) {
+  const uint64_t a = ModelBinaryWriter::kAlignment;
+  return (offset + a - 1) / a * a;
+}
+
+void WritePadding(uint64_t *offset, OutputBuffer *ob) {
+  uint64_t aligned = Align(*offset);
+  if (aligned > *offset)
+    ob->WriteString(std::string(aligned - *offset, '\0'));
+  *offset = aligned;
+}
+
+// Compare model indexes by name.
+class ModelNameCompare {
+public:
+  explicit ModelNameCompare(const GaussianModel &model) : model_(model) {}
+  bool operator()(uint32_t a, uint32_t b) const {
+    return model_.Name(a) < model_.Name(b);
   }
-  for (GaussianModel::Iterator m = model.GetIterator(); !m.Done(); m.Next()) {
-    ob.WriteString(StringPrintf("%d ", dimension));
-    WriteVector(&ob, model.Mean(m.Index()));
-    ob.WriteString("\n");
+private:
+  const GaussianModel &model_;
+};
+}  // namespace
+
+bool ModelBinaryWriter::Write(const std::string &filename,
+                              const GaussianModel &model) const {
+  const int num_models = model.NumModels();
+  const int dimension = model.Dimension();
+  std::vector<uint32_t> name_offsets(num_models + 1, 0), sorted(num_models);
+  for (int m = 0; m < num_models; ++m) {
+    name_offsets[m + 1] = name_offsets[m] + model.Name(m).size() + 1;
+    sorted[m] = m;
   }
-  for (GaussianModel::Iterator m = model.GetIterator(); !m.Done(); m.Next()) {
-    ob.WriteString(StringPrintf("%d ", dimension));
-    const GaussianModel::ModelVector &v = model.Variance(m.Index());
-    for (int d = 0; d < dimension; ++d) {
-      ob.WriteText(v[d]); // value
-      ob.WriteString(" 1 "); // weight
+  std::sort(sorted.begin(), sorted.end(), ModelNameCompare(model));
+  const uint64_t matrix_size =
+      static_cast<uint64_t>(num_models) * dimension * sizeof(float);
+  ModelBinaryHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.dimension = dimension;
+  header.num_models = num_models;
+  header.names_offset = Align(sizeof(header));
+  header.means_offset = Align(header.names_offset +
+      (2 * num_models + 1) * sizeof(uint32_t) + name_offsets.back());
+  header.variances_offset = Align(header.means_offset + matrix_size);
+  header.file_size = header.variances_offset + matrix_size;
+
+  File *file = File::Create(filename, "w");
+  if (!file) return false;
+  CHECK(file->Open());
+  OutputBuffer ob(file);
+  uint64_t offset = sizeof(header);
+  ob.WriteBinary(header);
+  WritePadding(&offset, &ob);
+  ob.WriteString(reinterpret_cast<const char*>(&name_offsets[0]),
+                 name_offsets.size() * sizeof(uint32_t));
+  if (num_models)
+    ob.WriteString(reinterpret_cast<const char*>(&sorted[0]),
+                   sorted.size() * sizeof(uint32_t));
+  for (int m = 0; m < num_models; ++m)
+    ob.WriteString(model.Name(m).c_str(), model.Name(m).size() + 1);
+  offset += (2 * num_models + 1) * sizeof(uint32_t) + name_offsets.back();
+  for (int v = 0; v < 2; ++v) {
+    WritePadding(&offset, &ob);
+    for (int m = 0; m < num_models; ++m) {
+      const GaussianModel::ModelVector &values =
+          v ? model.Variance(m) : model.Mean(m);
+      CHECK_EQ(values.size(), dimension);
+      if (dimension)
+        ob.WriteString(reinterpret_cast<const char*>(&values[0]),
+                       dimension * sizeof(float));
     }
-    ob.WriteString("\n");
+    offset += matrix_size;
   }
+  DCHECK_EQ(offset, header.file_size);
   return ob.CloseFile();
 }
 
+// ====================================================================
+
+MappedGaussianModel::MappedGaussianModel()
+    : data_(MAP_FAILED), size_(0), header_(NULL), name_offsets_(NULL),
+      sorted_names_(NULL), names_(NULL), means_(NULL), variances_(NULL) {}
+
+MappedGaussianModel::~MappedGaussianModel() {
+  Close();
+}
+
+bool MappedGaussianModel::Open(const std::string &filename) {
+  Close();
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "cannot open " << filename;
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    size_ = info.st_size;
+    data_ = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    LOG(ERROR) << "cannot map " << filename;
+    size_ = 0;
+    return false;
+  }
+  if (!Init()) {
+    LOG(ERROR) << "invalid model file " << filename;
+    Close();
+    return false;
+  }
+  return true;
+}
+
+// Set the section pointers and verify the header.
+bool MappedGaussianModel::Init() {
+  if (size_ < sizeof(ModelBinaryHeader))
+    return false;
+  const char *data = static_cast<const char*>(data_);
+  header_ = reinterpret_cast<const ModelBinaryHeader*>(data);
+  const uint64_t num_models = header_->num_models;
+  const uint64_t matrix_size =
+      num_models * header_->dimension * sizeof(float);
+  if (header_->magic != ModelBinaryWriter::kMagic ||
+      header_->version != ModelBinaryWriter::kVersion ||
+      header_->num_models < 0 || header_->dimension < 0 ||
+      header_->file_size != size_ ||
+      header_->names_offset % sizeof(uint32_t) ||
+      header_->means_offset % sizeof(float) ||
+      header_->variances_offset % sizeof(float) ||
+      header_->names_offset > size_ || header_->means_offset > size_ ||
+      header_->variances_offset > size_ ||
+      header_->names_offset + (2 * num_models + 1) * sizeof(uint32_t) >
+          header_->means_offset ||
+      header_->means_offset + matrix_size > header_->variances_offset ||
+      header_->variances_offset + matrix_size > size_)
+    return false;
+  name_offsets_ =
+      reinterpret_cast<const uint32_t*>(data + header_->names_offset);
+  sorted_names_ = name_offsets_ + num_models + 1;
+  names_ = reinterpret_cast<const char*>(sorted_names_ + num_models);
+  if (name_offsets_[0] != 0 ||
+      names_ + name_offsets_[num_models] > data + header_->means_offset)
+    return false;
+  // each name is non-empty and terminated by '\0' inside the name block.
+  for (uint64_t m = 0; m < num_models; ++m) {
+    if (name_offsets_[m] >= name_offsets_[m + 1] ||
+        names_[name_offsets_[m + 1] - 1] != '\0' ||
+        sorted_names_[m] >= num_models)
+      return false;
+  }
+  means_ = reinterpret_cast<const float*>(data + header_->means_offset);
+  variances_ =
+      reinterpret_cast<const float*>(data + header_->variances_offset);
+  return true;
+}
+
+void MappedGaussianModel::Close() {
+  if (data_ != MAP_FAILED)
+    munmap(data_, size_);
+  data_ = MAP_FAILED;
+  size_ = 0;
+  header_ = NULL;
+  name_offsets_ = sorted_names_ = NULL;
+  names_ = NULL;
+  means_ = variances_ = NULL;
+}
+
+// Binary search in the sorted name index.
+int MappedGaussianModel::GetIndex(const std::string &name) const {
+  int low = 0, high = NumModels();
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    int c = strcmp(Name(sorted_names_[mid]), name.c_str());
+    if (c == 0)
+      return sorted_names_[mid];
+    else if (c < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return -1;
+}
 
 }  // namespace trainc
@@ -21,6 +21,7 @@
 #ifndef MIXTURE_MODEL_H_
 #define MIXTURE_MODEL_H_
 
+#include <stdint.h>
 #include <map>
 #include <string>
 #include <vector>
@@ -60,7 +61,9 @@ public:
                 const ModelVector &variance);
 
   // estimate a Gaussian from the given sufficient statistics
-  // and add it to the model
+  // and add it to the model.
+  // Can be called concurrently for distinct names, if all names have been
+  // added before using GetIndex(name, true).
   void Estimate(const std::string &name,
                 const Statistics &sufficient_statitics,
                 float variance_floor);
@@ -77,6 +80,10 @@ public:
   int GetIndex(const std::string &name, bool add = false);
 
 
+  const std::string& Name(size_t index) const {
+    DCHECK_LT(index, index_map_.size());
+    return index_map_[index];
+  }
   const ModelVector& Mean(size_t index) const {
     DCHECK_LT(index, means_.size());
     return means_[index];
@@ -115,11 +122,17 @@ private:
 // base class for model writting classes
 class ModelWriter {
 public:
+  ModelWriter() : num_threads_(1) {}
   virtual ~ModelWriter() {}
   virtual bool Write(const std::string &filename, const GaussianModel &model) const = 0;
 
+  // Number of threads used to format the output.
+  void SetNumThreads(int num_threads) { num_threads_ = num_threads; }
+
   // Factory method
   static ModelWriter* Create(const std::string &type);
+protected:
+  int num_threads_;
 };
 
 // write model in a simple text file
@@ -128,9 +141,8 @@ public:
   virtual ~ModelTextWriter() {}
   virtual bool Write(const std::string &filename, const GaussianModel &model) const;
   static std::string Name() { return "text"; }
-protected:
-  void WriteVector(OutputBuffer *ob, const GaussianModel::ModelVector &v) const;
 private:
+  class Formatter;
   static const int kFormatVersion;
 };
 
@@ -140,9 +152,82 @@ public:
   virtual bool Write(const std::string &filename, const GaussianModel &model) const;
   static std::string Name() { return "rwth-text"; }
 private:
+  class Formatter;
   static const char *kFormatHeader;
 };
 
+// Binary model file, which can be memory mapped (see MappedGaussianModel).
+// All sections start at a multiple of kAlignment bytes, offsets are
+// relative to the beginning of the file:
+//   header     ModelBinaryHeader
+//   names      num_models + 1 uint32 offsets of the names in the string data
+//              num_models uint32 model indexes sorted by name
+//              string data (names terminated by '\0')
+//   means      num_models x dimension float
+//   variances  num_models x dimension float
+// Values are stored in the native byte order.
+struct ModelBinaryHeader {
+  uint32_t magic;
+  int32_t version;
+  int32_t dimension;
+  int32_t num_models;
+  uint64_t names_offset;
+  uint64_t means_offset;
+  uint64_t variances_offset;
+  uint64_t file_size;
+};
+
+class ModelBinaryWriter : public ModelWriter {
+public:
+  virtual ~ModelBinaryWriter() {}
+  virtual bool Write(const std::string &filename, const GaussianModel &model) const;
+  static std::string Name() { return "binary"; }
+
+  static const uint32_t kMagic;
+  static const int kVersion;
+  static const int kAlignment;
+};
+
+// Read-only access to a binary model file without copying the data.
+class MappedGaussianModel {
+public:
+  MappedGaussianModel();
+  ~MappedGaussianModel();
+
+  // Map the given file. Returns false if the file cannot be read or is
+  // not a valid binary model file.
+  bool Open(const std::string &filename);
+  void Close();
+
+  // 0 if no file is mapped.
+  int NumModels() const { return header_ ? header_->num_models : 0; }
+  int Dimension() const { return header_ ? header_->dimension : 0; }
+  const char* Name(int index) const {
+    DCHECK_LT(index, NumModels());
+    return names_ + name_offsets_[index];
+  }
+  // index of the given model name or -1.
+  int GetIndex(const std::string &name) const;
+  // dimension() values
+  const float* Mean(int index) const {
+    DCHECK_LT(index, NumModels());
+    return means_ + static_cast<size_t>(index) * Dimension();
+  }
+  const float* Variance(int index) const {
+    DCHECK_LT(index, NumModels());
+    return variances_ + static_cast<size_t>(index) * Dimension();
+  }
+
+private:
+  bool Init();
+  void *data_;
+  size_t size_;
+  const ModelBinaryHeader *header_;
+  const uint32_t *name_offsets_, *sorted_names_;
+  const char *names_;
+  const float *means_, *variances_;
+  DISALLOW_COPY_AND_ASSIGN(MappedGaussianModel);
+};
 
 }  // namespace trainc
 
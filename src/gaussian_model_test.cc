@@ -19,9 +19,12 @@
 // Tests for GaussianModel an ModelWriter
 
 #include <algorithm>
+#include <cstring>
 #include <functional>
+#include "file.h"
 #include "gaussian_model.h"
 #include "sample.h"
+#include "stringutil.h"
 #include "unittest.h"
 
 namespace trainc {
@@ -114,5 +117,112 @@ TEST_F(GaussianModelTest, WriteRwthText) {
   EXPECT_TRUE(r);
 }
 
+TEST_F(GaussianModelTest, WriteBinary) {
+  const std::string filename = FLAGS_test_tmpdir + "/binmodel";
+  ModelWriter *writer = ModelWriter::Create(ModelBinaryWriter::Name());
+  EXPECT_TRUE(writer->Write(filename, *model_));
+  delete writer;
+  MappedGaussianModel mapped;
+  EXPECT_TRUE(mapped.Open(filename));
+  EXPECT_EQ(num_models_, mapped.NumModels());
+  EXPECT_EQ(dim_, mapped.Dimension());
+  for (int m = 0; m < num_models_; ++m) {
+    EXPECT_EQ(names_[m], std::string(mapped.Name(m)));
+    EXPECT_EQ(m, mapped.GetIndex(names_[m]));
+    for (int d = 0; d < dim_; ++d) {
+      EXPECT_EQ(model_->Mean(m)[d], mapped.Mean(m)[d]);
+      EXPECT_EQ(model_->Variance(m)[d], mapped.Variance(m)[d]);
+    }
+  }
+  EXPECT_EQ(-1, mapped.GetIndex("unknown"));
+  // the sections and the mapped matrices are aligned.
+  const size_t alignment = ModelBinaryWriter::kAlignment;
+  EXPECT_EQ(0, reinterpret_cast<size_t>(mapped.Mean(0)) % alignment);
+  EXPECT_EQ(0, reinterpret_cast<size_t>(mapped.Variance(0)) % alignment);
+  mapped.Close();
+  std::string data;
+  File::ReadFileToStringOrDie(filename, &data);
+  ModelBinaryHeader header;
+  ASSERT_GE(data.size(), sizeof(header));
+  memcpy(&header, data.data(), sizeof(header));
+  EXPECT_EQ(0, header.names_offset % alignment);
+  EXPECT_EQ(0, header.means_offset % alignment);
+  EXPECT_EQ(0, header.variances_offset % alignment);
+  EXPECT_EQ(data.size(), header.file_size);
+  const size_t matrix_size = num_models_ * dim_ * sizeof(float);
+  EXPECT_EQ(0, memcmp(&data[header.means_offset], &model_->Mean(0)[0],
+                      dim_ * sizeof(float)));
+  EXPECT_EQ(header.variances_offset + matrix_size, header.file_size);
+  ModelTextWriter text_writer;
+  EXPECT_TRUE(text_writer.Write(filename, *model_));
+  EXPECT_FALSE(mapped.Open(filename));
+}
+
+// The output written with several threads must be identical to the
+// output of a single thread.
+TEST_F(GaussianModelTest, WriteThreads) {
+  GaussianModel model;
+  for (int m = 0; m < 5000; ++m) {
+    std::vector<float> mean(dim_, mean_ * m), cov(dim_, cov_ / (m + 1));
+    model.AddModel(StringPrintf("m%d", m), mean, cov);
+  }
+  ModelWriter *writers[] = { new ModelTextWriter, new RwthModelTextWriter };
+  for (int w = 0; w < 2; ++w) {
+    std::string text[2];
+    for (int t = 0; t < 2; ++t) {
+      const std::string filename = FLAGS_test_tmpdir + "/model_threads";
+      writers[w]->SetNumThreads(t ? 3 : 1);
+      EXPECT_TRUE(writers[w]->Write(filename, model));
+      InputBuffer ib(File::OpenOrDie(filename, "r"));
+      EXPECT_TRUE(ib.ReadToString(&text[t]));
+    }
+    EXPECT_FALSE(text[0].empty());
+    EXPECT_EQ(text[0], text[1]);
+    delete writers[w];
+  }
+}
+
+// Binary model files with inconsistent name sections are rejected.
+TEST_F(GaussianModelTest, MappedCorrupt) {
+  const std::string filename = FLAGS_test_tmpdir + "/binmodel_corrupt";
+  ModelBinaryWriter writer;
+  EXPECT_TRUE(writer.Write(filename, *model_));
+  std::string data;
+  File::ReadFileToStringOrDie(filename, &data);
+  ModelBinaryHeader header;
+  ASSERT_GE(data.size(), sizeof(header));
+  memcpy(&header, data.data(), sizeof(header));
+  const size_t offsets = header.names_offset;
+  const size_t sorted = offsets + (num_models_ + 1) * sizeof(uint32_t);
+  const size_t names = sorted + num_models_ * sizeof(uint32_t);
+  MappedGaussianModel mapped;
+  EXPECT_EQ(0, mapped.NumModels());
+  EXPECT_EQ(-1, mapped.GetIndex(names_[0]));
+  for (int c = 0; c < 4; ++c) {
+    std::string corrupt = data;
+    uint32_t *name_offsets = reinterpret_cast<uint32_t*>(&corrupt[offsets]);
+    switch (c) {
+      case 0:  // offsets not increasing
+        name_offsets[1] = name_offsets[2];
+        break;
+      case 1:  // offset outside of the name block
+        name_offsets[num_models_] = header.means_offset;
+        break;
+      case 2:  // name not terminated
+        corrupt[names + name_offsets[1] - 1] = 'x';
+        break;
+      case 3:  // invalid model index
+        reinterpret_cast<uint32_t*>(&corrupt[sorted])[0] = num_models_;
+        break;
+    }
+    OutputBuffer ob(File::OpenOrDie(filename, "w"));
+    ob.WriteString(corrupt);
+    EXPECT_TRUE(ob.CloseFile());
+    EXPECT_FALSE(mapped.Open(filename));
+    EXPECT_EQ(0, mapped.NumModels());
+    EXPECT_EQ(0, mapped.Dimension());
+  }
+}
+
 
 }  // namespace trainc
@@ -24,13 +24,19 @@
 #include "phone_models.h"
 #include "gaussian_model.h"
 #include "hmm_compiler.h"
+#include "parallel_writer.h"
+#include "stringmap.h"
 #include "util.h"
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
 
 using __gnu_cxx::select1st;
 using namespace std;
 using fst::StdArc;
 using fst::StdVectorFst;
 
+DECLARE_int32(num_threads);
 
 namespace trainc {
 
@@ -169,6 +175,41 @@ namespace {
    private:
     const PhoneModelMap &index_map_;
   };
+
+  // Formats the items of a vector using a method of HmmCompiler.
+  template<class T>
+  class HmmCompilerFormatter : public ItemFormatter {
+   public:
+    typedef void (HmmCompiler::*Method)(const T&, string*) const;
+    HmmCompilerFormatter(const HmmCompiler &compiler, Method method,
+                         const vector<T> &items)
+        : compiler_(compiler), method_(method), items_(items) {}
+    virtual void Format(int item, string *buffer) const {
+      (compiler_.*method_)(items_[item], buffer);
+    }
+   private:
+    const HmmCompiler &compiler_;
+    Method method_;
+    const vector<T> &items_;
+  };
+
+  // Estimates the Gaussian model of one state model per task.
+  class EstimationMapper {
+   public:
+    typedef void (HmmCompiler::*Method)(const AllophoneStateModel*) const;
+    EstimationMapper(const HmmCompiler *compiler, Method method)
+        : compiler_(compiler), method_(method) {}
+    EstimationMapper* Clone() const {
+      return new EstimationMapper(compiler_, method_);
+    }
+    void Map(const AllophoneStateModel *state_model) {
+      (compiler_->*method_)(state_model);
+    }
+    void Reset() {}
+   private:
+    const HmmCompiler *compiler_;
+    Method method_;
+  };
 }  // namespace
 
 // Create the state models and the HMM state symbols.
@@ -189,16 +230,44 @@ void HmmCompiler::CreateStateModels() {
             select1st<StateModelMap::value_type>());
   sort(sorted_models.begin(), sorted_models.end(),
        StateModelNameCompare(state_models_));
+  // the models are added to model_ before the estimation, which can then
+  // be done in parallel.
   typedef vector<StateModelMap::key_type>::const_iterator ModelIter;
   for (ModelIter si = sorted_models.begin(); si != sorted_models.end(); ++si) {
     const AllophoneStateModel *state_model = *si;
     const string model_name = state_models_[state_model];
     VLOG(3) << "state model " << state_model << " " << model_name;
     VLOG(3) << " num_obs=" << state_model->NumObservations();
-    state_model->AddToModel(model_name, model_, variance_floor_);
+    CHECK_EQ(model_->GetIndex(model_name, true), state_model_index);
     CHECK_EQ(hmm_state_symbols_->AddSymbol(model_name), state_model_index + 2);
     ++state_model_index;
   }
+  EstimateStateModels(sorted_models);
+}
+
+void HmmCompiler::EstimateStateModels(
+    const vector<const AllophoneStateModel*> &state_models) const {
+  typedef vector<const AllophoneStateModel*>::const_iterator ModelIter;
+#ifdef HAVE_THREADS
+  if (FLAGS_num_threads > 1) {
+    threads::ThreadPool<const AllophoneStateModel*, EstimationMapper> pool;
+    pool.Init(FLAGS_num_threads,
+              EstimationMapper(this, &HmmCompiler::EstimateStateModel));
+    for (ModelIter m = state_models.begin(); m != state_models.end(); ++m)
+      pool.Submit(*m);
+    pool.Wait();
+    return;
+  }
+#endif
+  for (ModelIter m = state_models.begin(); m != state_models.end(); ++m)
+    EstimateStateModel(*m);
+}
+
+void HmmCompiler::EstimateStateModel(
+    const AllophoneStateModel *state_model) const {
+  StateModelMap::const_iterator name = state_models_.find(state_model);
+  DCHECK(name != state_models_.end());
+  state_model->AddToModel(name->second, model_, variance_floor_);
 }
 
 void HmmCompiler::WriteHmmList(const string &filename) const {
@@ -211,28 +280,33 @@ void HmmCompiler::WriteHmmList(const string &filename) const {
             select1st<PhoneModelMap::value_type>());
   sort(sorted_models.begin(), sorted_models.end(),
        PhoneModelIndexCompare(phone_models_));
-  typedef vector<PhoneModelMap::key_type>::const_iterator ModelIter;
-  for (ModelIter ai = sorted_models.begin(); ai != sorted_models.end(); ++ai) {
-    const AllophoneModel *phone_model = *ai;
-    obuf.WriteString(GetHmmName(phone_model));
-    for (int s = 0; s < phone_model->NumStates(); ++s) {
-      const AllophoneStateModel *state_model = phone_model->GetStateModel(s);
-      StateModelMap::const_iterator sm = state_models_.find(state_model);
-      CHECK(sm != state_models_.end());
-      obuf.WriteString(" " + sm->second);
-    }
-    obuf.WriteString("\n");
-  }
+  HmmCompilerFormatter<PhoneModelMap::key_type> formatter(
+      *this, &HmmCompiler::FormatHmm, sorted_models);
+  WriteItems(formatter, sorted_models.size(), FLAGS_num_threads, &obuf);
   if (!obuf.CloseFile())
     REP(FATAL) << "Close failed for hmm list " << filename;
 }
 
+void HmmCompiler::FormatHmm(const AllophoneModel *const &phone_model,
+                            string *buffer) const {
+  buffer->append(GetHmmName(phone_model));
+  for (int s = 0; s < phone_model->NumStates(); ++s) {
+    const AllophoneStateModel *state_model = phone_model->GetStateModel(s);
+    StateModelMap::const_iterator sm = state_models_.find(state_model);
+    CHECK(sm != state_models_.end());
+    buffer->append(" ");
+    buffer->append(sm->second);
+  }
+  buffer->append("\n");
+}
+
 void HmmCompiler::WriteStateModels(
     const string &filename, const string &file_type,
     const string &feature_type,
     const string &frontend_config) const {
   CHECK_NOTNULL(model_);
   ModelWriter *writer = ModelWriter::Create(file_type);
+  writer->SetNumThreads(FLAGS_num_threads);
   model_->SetFrontendDescription(frontend_config);
   model_->SetFeatureDescription(feature_type);
   if (!writer->Write(filename, *model_))
@@ -256,33 +330,54 @@ void HmmCompiler::WriteCDHMMtoPhoneMap(const string &filename) const {
   File *file = File::OpenOrDie(filename, "w");
   OutputBuffer obuf(file);
   obuf.WriteString(".eps .eps\n.wb .wb\n");
-  for (PhoneModelMap::const_iterator p = phone_models_.begin();
-      p != phone_models_.end(); ++p) {
-    const AllophoneModel *model = p->first;
-    const string phone_symbol =
-        phone_symbols_->Find(model->phones().front() + 1);
-    obuf.WriteString(StringPrintf("%s %s\n",
-                                  GetHmmName(model).c_str(),
-                                  phone_symbol.c_str()));
-  }
+  vector<PhoneModelMap::key_type> models(phone_models_.size());
+  transform(phone_models_.begin(), phone_models_.end(), models.begin(),
+            select1st<PhoneModelMap::value_type>());
+  HmmCompilerFormatter<PhoneModelMap::key_type> formatter(
+      *this, &HmmCompiler::FormatHmmToPhone, models);
+  WriteItems(formatter, models.size(), FLAGS_num_threads, &obuf);
   if (!obuf.CloseFile())
     REP(FATAL) << "Close failed for " << filename;
 }
 
+void HmmCompiler::GetCDHMMtoPhoneMap(StringMap *hmm_to_phone) const {
+  hmm_to_phone->clear();
+  (*hmm_to_phone)[".eps"] = ".eps";
+  (*hmm_to_phone)[".wb"] = ".wb";
+  for (PhoneModelMap::const_iterator m = phone_models_.begin();
+      m != phone_models_.end(); ++m) {
+    (*hmm_to_phone)[GetHmmName(m->first)] =
+        phone_symbols_->Find(m->first->phones().front() + 1);
+  }
+}
+
+void HmmCompiler::FormatHmmToPhone(const AllophoneModel *const &model,
+                                   string *buffer) const {
+  const string phone_symbol =
+      phone_symbols_->Find(model->phones().front() + 1);
+  StringAppendF(buffer, "%s %s\n",
+                GetHmmName(model).c_str(), phone_symbol.c_str());
+}
+
 void HmmCompiler::WriteStateNameMap(const string &filename) const {
   CHECK_GT(state_models_.size(), 0);
   File *file = File::OpenOrDie(filename, "w");
   OutputBuffer obuf(file);
-  for (StateModelMap::const_iterator s = state_models_.begin();
-      s != state_models_.end(); ++s) {
-    string state_name = GetHmmStateName(s->first);
-    obuf.WriteString(StringPrintf("%s %s\n",
-                                  s->second.c_str(), state_name.c_str()));
-  }
+  vector<StateModelMap::value_type> state_models(state_models_.begin(),
+                                                 state_models_.end());
+  HmmCompilerFormatter<StateModelMap::value_type> formatter(
+      *this, &HmmCompiler::FormatStateName, state_models);
+  WriteItems(formatter, state_models.size(), FLAGS_num_threads, &obuf);
   if (!obuf.CloseFile())
     REP(FATAL) << "Close failed for " << filename;
 }
 
+void HmmCompiler::FormatStateName(const StateModelMap::value_type &s,
+                                  string *buffer) const {
+  string state_name = GetHmmStateName(s.first);
+  StringAppendF(buffer, "%s %s\n", s.second.c_str(), state_name.c_str());
+}
+
 // TODO(rybach): Create H transducer using the topology transducer.
 // TODO(rybach): Create deterministic transducer?
 void HmmCompiler::WriteHmmTransducer(const string &filename) const {
@@ -318,33 +413,36 @@ void HmmCompiler::WriteStateModelInfo(const string &filename) const {
   CHECK_GT(state_models_.size(), 0);
   File *file = File::OpenOrDie(filename, "w");
   OutputBuffer obuf(file);
-  for (StateModelMap::const_iterator s = state_models_.begin();
-      s != state_models_.end(); ++s) {
-    const AllophoneStateModel *state_model = s->first;
-    const PhoneContext &context = state_model->GetContext();
-    string sets;
-    for (int pos = -context.NumLeftContexts();
-         pos <= context.NumRightContexts(); ++pos) {
-      sets += StringPrintf("%d={", pos);
-      const ContextSet &c = context.GetContext(pos);
-      for (ContextSet::Iterator p(c); !p.Done(); p.Next())
-        sets += phone_symbols_->Find(p.Value() + 1) + " ";
-      sets += "} ";
-    }
-    obuf.WriteString(s->second);
-    obuf.WriteString(StringPrintf(" num_obs=%d",
-                                  state_model->NumObservations()));
-    obuf.WriteString(StringPrintf(" num_context=%d",
-                                  state_model->NumSeenContexts()));
-    obuf.WriteString(StringPrintf(" cost=%f ",
-                                  state_model->GetCost()));
-    obuf.WriteString(sets);
-    obuf.WriteString("\n");
-  }
+  vector<StateModelMap::value_type> state_models(state_models_.begin(),
+                                                 state_models_.end());
+  HmmCompilerFormatter<StateModelMap::value_type> formatter(
+      *this, &HmmCompiler::FormatStateModelInfo, state_models);
+  WriteItems(formatter, state_models.size(), FLAGS_num_threads, &obuf);
   if (!obuf.CloseFile())
     REP(FATAL) << "Close failed for " << filename;
 }
 
+void HmmCompiler::FormatStateModelInfo(const StateModelMap::value_type &s,
+                                       string *buffer) const {
+  const AllophoneStateModel *state_model = s.first;
+  const PhoneContext &context = state_model->GetContext();
+  buffer->append(s.second);
+  StringAppendF(buffer, " num_obs=%d", state_model->NumObservations());
+  StringAppendF(buffer, " num_context=%d", state_model->NumSeenContexts());
+  StringAppendF(buffer, " cost=%f ", state_model->GetCost());
+  for (int pos = -context.NumLeftContexts();
+       pos <= context.NumRightContexts(); ++pos) {
+    StringAppendF(buffer, "%d={", pos);
+    const ContextSet &c = context.GetContext(pos);
+    for (ContextSet::Iterator p(c); !p.Done(); p.Next()) {
+      buffer->append(phone_symbols_->Find(p.Value() + 1));
+      buffer->append(" ");
+    }
+    buffer->append("} ");
+  }
+  buffer->append("\n");
+}
+
 namespace {
 struct PhonePair : public pair<int, int> {
   PhonePair(int i, int j) : pair<int,int>(i,j) {}
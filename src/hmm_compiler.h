@@ -42,6 +42,7 @@ class Phones;
 class AllophoneStateModel;
 class AllophoneModel;
 class GaussianModel;
+class StringMap;
 
 // Creates and writes the following data:
 //  * hmm list of context dependent HMMS
@@ -102,6 +103,9 @@ class HmmCompiler {
   // Write a mapping from HMM names to phone names.
   void WriteCDHMMtoPhoneMap(const string &filename) const;
 
+  // Get the mapping from HMM names to phone names.
+  void GetCDHMMtoPhoneMap(StringMap *hmm_to_phone) const;
+
   // Write a mapping from CD to CI HMM state names.
   void WriteStateNameMap(const string &filename) const;
 
@@ -146,7 +150,19 @@ class HmmCompiler {
   void AddPhoneModel(const AllophoneModel *phone_model);
   void AddStateModel(const AllophoneStateModel *state_model);
   void CreateStateModels();
+  void EstimateStateModels(
+      const vector<const AllophoneStateModel*> &state_models) const;
+  void EstimateStateModel(const AllophoneStateModel *state_model) const;
   string GetHmmStateName(const AllophoneStateModel *state_model) const;
+  // Append the output line for the given item to buffer.
+  void FormatHmm(const AllophoneModel *const &phone_model,
+                 string *buffer) const;
+  void FormatHmmToPhone(const AllophoneModel *const &phone_model,
+                        string *buffer) const;
+  void FormatStateName(const StateModelMap::value_type &state_model,
+                       string *buffer) const;
+  void FormatStateModelInfo(const StateModelMap::value_type &state_model,
+                            string *buffer) const;
 
   const ModelManager *models_;
   const Phones *phone_info_;
@@ -0,0 +1,138 @@
+// integer_set_bench.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Benchmark of the set operations used for context sets.
+// Compares DynamicIntegerSet with the fixed size IntegerSet for small
+// inventories and for large inventories with sparse and dense sets.
+
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "fst/compat.h"
+#include "dynamic_integer_set.h"
+#include "integer_set.h"
+
+DEFINE_int32(small_phones, 48, "size of the small inventory");
+DEFINE_int32(large_phones, 4000, "size of the large inventory");
+DEFINE_int32(sparse_size, 20, "number of elements in sparse sets");
+DEFINE_int32(num_sets, 1000, "number of sets");
+DEFINE_int32(repetitions, 20, "number of repetitions");
+
+namespace trainc {
+
+namespace {
+
+enum { kMaxLargePhones = 4096 };
+
+double Now() {
+  timeval now;
+  gettimeofday(&now, 0);
+  return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+// Random sets with the given number of elements on average.
+template<class S>
+void CreateSets(int num_phones, int size, std::vector<S> *sets) {
+  sets->clear();
+  for (int i = 0; i < FLAGS_num_sets; ++i) {
+    sets->push_back(S(num_phones));
+    for (int p = 0; p < num_phones; ++p)
+      if (rand() % num_phones < size) sets->back().Add(p);
+  }
+}
+
+// Runs the operations on all pairs of consecutive sets and returns the
+// time per operation in ns. The checksum prevents the removal of the
+// loops by the compiler.
+template<class S>
+void Measure(const std::vector<S> &sets, double *times, size_t *checksum) {
+  const int n = sets.size();
+  const int ops = FLAGS_repetitions * (n - 1);
+  double start = Now();
+  for (int r = 0; r < FLAGS_repetitions; ++r) {
+    for (int i = 1; i < n; ++i) {
+      S s = sets[i - 1];
+      s.Intersect(sets[i]);
+      *checksum += s.IsEmpty();
+    }
+  }
+  times[0] = (Now() - start) / ops * 1e9;
+  start = Now();
+  for (int r = 0; r < FLAGS_repetitions; ++r) {
+    for (int i = 1; i < n; ++i) {
+      S s = sets[i - 1];
+      s.Union(sets[i]);
+      *checksum += s.Size();
+    }
+  }
+  times[1] = (Now() - start) / ops * 1e9;
+  start = Now();
+  for (int r = 0; r < FLAGS_repetitions; ++r) {
+    for (int i = 1; i < n; ++i)
+      *checksum += sets[i].IsEqual(sets[i - 1]) + sets[i].HashValue();
+  }
+  times[2] = (Now() - start) / ops * 1e9;
+  start = Now();
+  for (int r = 0; r < FLAGS_repetitions; ++r) {
+    for (int i = 1; i < n; ++i) {
+      for (typename S::Iterator e(sets[i]); !e.Done(); e.Next())
+        *checksum += e.Value();
+    }
+  }
+  times[3] = (Now() - start) / ops * 1e9;
+}
+
+template<class S>
+void Run(const char *name, int num_phones, int size) {
+  srand(1);
+  std::vector<S> sets;
+  CreateSets(num_phones, size, &sets);
+  double times[4];
+  size_t checksum = 0;
+  Measure(sets, times, &checksum);
+  printf("%-8s phones=%5d size=%5d  intersect: %8.1f  union: %8.1f  "
+         "equal+hash: %8.1f  iterate: %8.1f  (%u)\n",
+         name, num_phones, size, times[0], times[1], times[2], times[3],
+         static_cast<unsigned>(checksum & 1));
+}
+
+}  // namespace
+
+void RunBenchmark() {
+  typedef DynamicIntegerSet<256> Dynamic;
+  printf("time per operation in ns\n");
+  const int small_size = FLAGS_small_phones / 2;
+  Run<IntegerSet<uint64, 256> >("fixed", FLAGS_small_phones, small_size);
+  Run<Dynamic>("dynamic", FLAGS_small_phones, small_size);
+  CHECK_LE(FLAGS_large_phones, kMaxLargePhones);
+  const int sizes[] = { FLAGS_sparse_size, FLAGS_large_phones / 2 };
+  for (int s = 0; s < 2; ++s) {
+    Run<IntegerSet<uint64, kMaxLargePhones> >(
+        "fixed", FLAGS_large_phones, sizes[s]);
+    Run<Dynamic>("dynamic", FLAGS_large_phones, sizes[s]);
+  }
+}
+
+}  // namespace trainc
+
+int main(int argc, char **argv) {
+  SetFlags("", &argc, &argv, true);
+  trainc::RunBenchmark();
+  return 0;
+}
@@ -15,10 +15,11 @@
 // Copyright 2010 Google Inc. All Rights Reserved.
 // Author: rybach@google.com (David Rybach)
 //
-// Tests for IntegerSet.
+// Tests for IntegerSet and DynamicIntegerSet.
 
 #include "unittest.h"
 #include "util.h"
+#include "dynamic_integer_set.h"
 #include "integer_set.h"
 
 using std::vector;
@@ -26,7 +27,7 @@ using std::vector;
 namespace trainc {
 
 // Tests to validate that IntegerSet has set properties.
-template<size_t max_elements>
+template<size_t max_elements, class IntSet = IntegerSet<uint64, max_elements> >
 class IntegerSetTest {
  public:
   IntegerSetTest()
@@ -151,15 +152,14 @@ class IntegerSetTest {
 
  protected:
   void Init(int elements);
-  typedef IntegerSet<uint64, max_elements> IntSet;
   typedef uint32 ValueType;
   IntSet *a_, *b_, *ab_, *empty_, *all_;
   int num_elements;
   vector<ValueType> common_values;
 };
 
-template<size_t max_elements>
-void IntegerSetTest<max_elements>::Init(int elements) {
+template<size_t max_elements, class IntSet>
+void IntegerSetTest<max_elements, IntSet>::Init(int elements) {
   ASSERT_LE(elements, max_elements);
   num_elements = elements;
   a_ = new IntSet(num_elements);
@@ -187,9 +187,9 @@ void IntegerSetTest<max_elements>::Init(int elements) {
 }
 
 // Run all tests with a max. set size of N
-template<size_t N>
+template<size_t N, class IntSet>
 void RunIntegerSetTest() {
-  typedef IntegerSetTest<N> IntSetTest;
+  typedef IntegerSetTest<N, IntSet> IntSetTest;
   IntSetTest t;
   t.TestAllSizes(&IntSetTest::TestSize);
   t.TestAllSizes(&IntSetTest::TestHasMember);
@@ -203,19 +203,84 @@ void RunIntegerSetTest() {
 }
 
 TEST(IntSet32Test, All) {
-  RunIntegerSetTest<32>();
+  RunIntegerSetTest<32, IntegerSet<uint64, 32> >();
 }
 
 TEST(IntSet64Test, All) {
-  RunIntegerSetTest<64>();
+  RunIntegerSetTest<64, IntegerSet<uint64, 64> >();
 }
 
 TEST(IntSet128Test, All) {
-  RunIntegerSetTest<128>();
+  RunIntegerSetTest<128, IntegerSet<uint64, 128> >();
 }
 
 TEST(IntSet256Test, All) {
-  RunIntegerSetTest<256>();
+  RunIntegerSetTest<256, IntegerSet<uint64, 256> >();
+}
+
+// Covers the inline, sparse, and dense representation.
+TEST(DynamicIntSetTest, All) {
+  RunIntegerSetTest<300, DynamicIntegerSet<64> >();
+}
+
+TEST(DynamicIntSetTest, Representation) {
+  typedef DynamicIntegerSet<64> IntSet;
+  const int n = 1000;
+  IntSet sparse(n), dense(n);
+  for (int i = 0; i < n; i += 2) {
+    dense.Add(i);
+    if (i < 40) sparse.Add(i);
+  }
+  EXPECT_EQ(dense.Size(), size_t(n / 2));
+  EXPECT_EQ(sparse.Size(), size_t(20));
+  IntSet s = dense;
+  s.Intersect(sparse);
+  EXPECT_TRUE(s.IsEqual(sparse));
+  EXPECT_TRUE(sparse.IsEqual(s));
+  EXPECT_EQ(s.HashValue(), sparse.HashValue());
+  IntSet d = sparse;
+  for (int i = 40; i < n; i += 2)
+    d.Add(i);
+  EXPECT_TRUE(d.IsEqual(dense));
+  EXPECT_TRUE(dense.IsEqual(d));
+  EXPECT_EQ(d.HashValue(), dense.HashValue());
+  d.Remove(998);
+  EXPECT_FALSE(d.IsEqual(dense));
+  EXPECT_TRUE(d.IsSubSet(dense));
+  EXPECT_FALSE(dense.IsSubSet(d));
+  IntSet u = sparse;
+  u.Union(dense);
+  EXPECT_TRUE(u.IsEqual(dense));
+  IntSet inv = dense;
+  inv.Invert();
+  EXPECT_EQ(inv.Size(), size_t(n / 2));
+  EXPECT_FALSE(inv.HasElement(0));
+  EXPECT_TRUE(inv.HasElement(n - 1));
+  inv.Intersect(dense);
+  EXPECT_TRUE(inv.IsEmpty());
+  int count = 0;
+  for (IntSet::Iterator i(dense); !i.Done(); i.Next(), ++count)
+    EXPECT_EQ(i.Value(), static_cast<unsigned int>(2 * count));
+  EXPECT_EQ(count, n / 2);
+}
+
+TEST(DynamicIntSetTest, Assign) {
+  typedef DynamicIntegerSet<64> IntSet;
+  IntSet small(10), large(1000);
+  small.Add(3);
+  large.Add(500);
+  IntSet s = small, l = large;
+  s = large;
+  EXPECT_EQ(s.Capacity(), size_t(1000));
+  EXPECT_TRUE(s.IsEqual(large));
+  l = small;
+  EXPECT_EQ(l.Capacity(), size_t(10));
+  EXPECT_TRUE(l.IsEqual(small));
+  l = l;
+  EXPECT_TRUE(l.IsEqual(small));
+  s.Add(2);
+  EXPECT_FALSE(s.IsEqual(large));
+  EXPECT_EQ(large.Size(), size_t(1));
 }
 
 }  // namespace trainc
@@ -0,0 +1,60 @@
+// kernels.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+//
+
+#include "kernels.h"
+
+namespace trainc {
+
+namespace {
+
+// Statistics of dimension D consist of 2 * D + 1 values.
+template<int D>
+void SetKernels() {
+  const int n = 2 * D + 1;
+  AccumulateKernel<float, float>::Set(n, &AddValues<float, float, n>);
+  AccumulateKernel<double, float>::Set(n, &AddValues<double, float, n>);
+  AccumulateKernel<double, double>::Set(n, &AddValues<double, double, n>);
+  ScoreKernel<float>::Set(D, &SumLogVariances<float, D>);
+  ScoreKernel<double>::Set(D, &SumLogVariances<double, D>);
+}
+
+}  // namespace
+
+bool SelectDimensionKernels(int dimension) {
+  switch (dimension) {
+    case 39: SetKernels<39>(); break;
+    case 40: SetKernels<40>(); break;
+    case 48: SetKernels<48>(); break;
+    default:
+      ResetDimensionKernels();
+      return false;
+  }
+  return true;
+}
+
+void ResetDimensionKernels() {
+  AccumulateKernel<float, float>::Set(-1, NULL);
+  AccumulateKernel<double, float>::Set(-1, NULL);
+  AccumulateKernel<double, double>::Set(-1, NULL);
+  ScoreKernel<float>::Set(-1, NULL);
+  ScoreKernel<double>::Set(-1, NULL);
+}
+
+}  // namespace trainc
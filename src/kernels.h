@@ -0,0 +1,110 @@
+// kernels.h
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Computations on statistics specialized for a fixed feature dimension.
+
+#ifndef KERNELS_H_
+#define KERNELS_H_
+
+#include <cmath>
+#include <cstddef>
+
+namespace trainc {
+
+// sum[i] += values[i] for i < N.
+template<class T, class U, int N>
+void AddValues(const U *values, T *sum) {
+  for (int i = 0; i < N; ++i)
+    sum[i] += values[i];
+}
+
+// Sum of the log of the floored ML variances of D dimensions.
+// Identical to the generic computation in MaximumLikelihoodScorer.
+template<class T, int D>
+double SumLogVariances(const T *sum, const T *sum2, T n,
+                       float variance_floor) {
+  double ll = 0.0;
+  for (int i = 0; i < D; ++i) {
+    T mean = sum[i] / n;
+    T var = sum2[i] / n;
+    var -= mean * mean;
+    if (var < variance_floor) var = variance_floor;
+    ll += std::log(var);
+  }
+  return ll;
+}
+
+// Kernel for accumulating num_values values of type U to values of type T.
+// The kernel is set by SelectDimensionKernels(), Get() returns NULL for
+// other numbers of values.
+template<class T, class U>
+class AccumulateKernel {
+ public:
+  typedef void (*Function)(const U *values, T *sum);
+  static Function Get(int num_values) {
+    return num_values == num_values_ ? function_ : NULL;
+  }
+  static void Set(int num_values, Function function) {
+    num_values_ = num_values;
+    function_ = function;
+  }
+ private:
+  static int num_values_;
+  static Function function_;
+};
+
+template<class T, class U>
+int AccumulateKernel<T, U>::num_values_ = -1;
+template<class T, class U>
+typename AccumulateKernel<T, U>::Function
+AccumulateKernel<T, U>::function_ = NULL;
+
+// Kernel for the variance term of the ML score of statistics of type T.
+template<class T>
+class ScoreKernel {
+ public:
+  typedef double (*Function)(const T *sum, const T *sum2, T n,
+                             float variance_floor);
+  static Function Get(int dimension) {
+    return dimension == dimension_ ? function_ : NULL;
+  }
+  static void Set(int dimension, Function function) {
+    dimension_ = dimension;
+    function_ = function;
+  }
+ private:
+  static int dimension_;
+  static Function function_;
+};
+
+template<class T> int ScoreKernel<T>::dimension_ = -1;
+template<class T>
+typename ScoreKernel<T>::Function ScoreKernel<T>::function_ = NULL;
+
+// Selects the kernels for the given feature dimension.
+// Kernels are available for the dimensions 39, 40, and 48. Returns false
+// if the dimension is not supported, in which case the generic code is
+// used. Has to be called before any thread uses the statistics.
+bool SelectDimensionKernels(int dimension);
+
+// Reset to the generic code.
+void ResetDimensionKernels();
+
+}  // namespace trainc
+
+#endif  // KERNELS_H_
@@ -39,20 +39,22 @@ size_t LexiconState::NumOutputEpsilons() const {
 }
 
 void LexiconState::UpdateContext() {
-  ContextSet *left_context = context_.GetContextRef(0);
-  ContextSet *right_context = context_.GetContextRef(1);
-  left_context->Clear();
-  right_context->Clear();
+  ContextSet left_context = context_.GetContext(0);
+  ContextSet right_context = context_.GetContext(1);
+  left_context.Clear();
+  right_context.Clear();
   for (ForwardArcIterator aiter(this); !aiter.Done(); aiter.Next()) {
     const Arc &arc = aiter.Value();
     if (arc.model)
-      right_context->Add(arc.ilabel);
+      right_context.Add(arc.ilabel);
   }
   for (BackwardArcIterator aiter(this); !aiter.Done(); aiter.Next()) {
     const Arc &arc = aiter.Value();
     if (arc.model)
-      left_context->Add(arc.ilabel);
+      left_context.Add(arc.ilabel);
   }
+  context_.SetContext(0, left_context);
+  context_.SetContext(1, right_context);
 }
 
 LexiconTransducerImpl::LexiconTransducerImpl() {
@@ -258,6 +260,55 @@ void LexiconTransducer::ApplyModelSplit(
         new_models);
 }
 
+LexiconTransducer::StateId LexiconTransducer::AddState() {
+  StateId s = GetImpl()->AddState(empty_context_);
+  InvalidateClosures(s);
+  return s;
+}
+
+// The outgoing arcs are removed without notification.
+void LexiconTransducer::RemoveState(StateId s) {
+  InvalidateClosures(s);
+  const State *state = GetState(s);
+  for (State::ConstForwardArcIterator aiter(state); !aiter.Done();
+      aiter.Next()) {
+    if (!aiter.Value().model)
+      InvalidateClosures(aiter.Value().nextstate);
+  }
+  GetImpl()->RemoveState(s);
+}
+
+LexiconTransducer::ArcRef LexiconTransducer::AddArc(StateId s,
+                                                    const Arc &arc) {
+  if (!arc.model) {
+    InvalidateClosures(s);
+    InvalidateClosures(arc.nextstate);
+  }
+  return GetImpl()->AddArc(s, arc);
+}
+
+void LexiconTransducer::RemoveArc(StateId s, State::ArcRef arc) {
+  if (!arc->model) {
+    InvalidateClosures(s);
+    InvalidateClosures(arc->nextstate);
+  }
+  GetImpl()->RemoveArc(s, arc);
+}
+
+void LexiconTransducer::UpdateArc(State::ArcRef arc,
+                                  const AllophoneModel *new_model) {
+  if (!arc->model != !new_model) {
+    InvalidateClosures(arc->prevstate);
+    InvalidateClosures(arc->nextstate);
+  }
+  GetImpl()->UpdateArc(arc, new_model);
+}
+
+void LexiconTransducer::InvalidateClosures(StateId s) {
+  for (int i = 0; i < 2; ++i)
+    if (closure_[i]) closure_[i]->Invalidate(s);
+}
+
 void LexiconTransducer::FinishSplit() {
   CHECK_NOTNULL(splitter_);
   splitter_->FinishSplit();
@@ -267,8 +318,7 @@ void LexiconTransducer::FinishSplit() {
 }
 
 void LexiconTransducer::ResetContexts(int pos) {
-  contexts_[pos]->Clear();
-  closure_[pos]->Clear();
+  closure_[pos]->Update();
 }
 
 void LexiconTransducer::Init(const fst::StdExpandedFst &l,
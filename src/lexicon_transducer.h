@@ -389,15 +389,13 @@ public:
   State* GetStateRef(StateId s) const { return GetImpl()->GetStateRef(s); }
   void SetStart(StateId s) { GetImpl()->SetStart(s); }
   bool IsStart(StateId s) const { return GetImpl()->IsStart(s); }
-  StateId AddState() {
-    return GetImpl()->AddState(empty_context_);
-  }
-  void RemoveState(StateId s) { GetImpl()->RemoveState(s); }
-  ArcRef AddArc(StateId s, const Arc &arc) { return GetImpl()->AddArc(s, arc); }
-  void RemoveArc(StateId s, State::ArcRef arc) { GetImpl()->RemoveArc(s, arc); }
-  void UpdateArc(State::ArcRef arc, const AllophoneModel *new_model) {
-    GetImpl()->UpdateArc(arc, new_model);
-  }
+  // The following methods notify the epsilon closures about the
+  // structural change.
+  StateId AddState();
+  void RemoveState(StateId s);
+  ArcRef AddArc(StateId s, const Arc &arc);
+  void RemoveArc(StateId s, State::ArcRef arc);
+  void UpdateArc(State::ArcRef arc, const AllophoneModel *new_model);
   PhoneContext* ContextRef(StateId s) {
     return GetImpl()->GetStateRef(s)->ContextRef();
   }
@@ -473,6 +471,8 @@ protected:
   class Initializer;
   typedef LexiconTransducerImpl::ModelToArcMap ModelToArcMap;
 
+  void InvalidateClosures(StateId s);
+
   int num_phones_;
   bool det_split_, shifted_;
   PhoneContext empty_context_;
@@ -19,6 +19,7 @@
 // Unit tests for LexiconTransducer
 
 #include "unittest.h"
+#include "epsilon_closure.h"
 #include "lexicon_transducer.h"
 
 namespace trainc {
@@ -155,4 +156,43 @@ TEST_F(LexiconTransducerTest, RemoveArc) {
   }
 }
 
+// Epsilon cycle b <-> c reachable from a.
+TEST_F(LexiconTransducerTest, EpsilonClosure) {
+  const fst::StdArc::Weight one = fst::StdArc::Weight::One();
+  StateId a = l_->AddState(), b = l_->AddState(), c = l_->AddState(),
+      d = l_->AddState();
+  l_->AddArc(a, Arc(0, 0, NULL, one, b));
+  l_->AddArc(b, Arc(0, 0, NULL, one, c));
+  State::ArcRef cycle = l_->AddArc(c, Arc(0, 0, NULL, one, b));
+  l_->AddArc(c, Arc(1, 1, m_, one, d));
+  StateContexts contexts;
+  EpsilonClosure closure(l_, true, &contexts);
+  std::set<StateId> reachable;
+  for (EpsilonClosure::Iterator i = closure.Reachable(a); !i.Done(); i.Next())
+    reachable.insert(i.Value());
+  EXPECT_EQ(size_t(2), reachable.size());
+  EXPECT_EQ(size_t(1), reachable.count(b));
+  EXPECT_EQ(size_t(1), reachable.count(c));
+  reachable.clear();
+  for (EpsilonClosure::Iterator i = closure.Reachable(b); !i.Done(); i.Next())
+    reachable.insert(i.Value());
+  EXPECT_EQ(size_t(2), reachable.size());
+  EXPECT_TRUE(closure.Reachable(d).Done());
+
+  // the closure of b and a changes, the closure of d is kept.
+  l_->RemoveArc(c, cycle);
+  closure.Invalidate(c);
+  closure.Invalidate(b);
+  closure.Update();
+  reachable.clear();
+  for (EpsilonClosure::Iterator i = closure.Reachable(b); !i.Done(); i.Next())
+    reachable.insert(i.Value());
+  EXPECT_EQ(size_t(1), reachable.size());
+  EXPECT_EQ(size_t(1), reachable.count(c));
+  EXPECT_TRUE(closure.Reachable(c).Done());
+  hash_set<StateId> all;
+  closure.AddReachable(a, &all);
+  EXPECT_EQ(size_t(3), all.size());
+}
+
 }  // namespace trainc
@@ -16,14 +16,26 @@
 // Author: rybach@google.com (David Rybach)
 //
 
+#include <algorithm>
+#include <limits>
+#include <utility>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "cost_cache.h"
 #include "fst/symbol-table.h"
+#include "hash.h"
 #include "model_splitter.h"
 #include "recipe.h"
 #include "scorer.h"
 #include "split_generator.h"
 #include "split_optimizer.h"
 #include "split_predictor.h"
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
 #include "transducer.h"
+#include "transducer_check.h"
 
 
 
@@ -39,25 +51,34 @@ ModelSplitter::ModelSplitter()
       scorer_(NULL),
       state_penaly_weight_(0),
       num_left_contexts_(0),
+      num_right_contexts_(0),
       target_num_models_(0),
       target_num_states_(0),
       max_hyps_(0),
       split_center_(false),
       ignore_absent_models_(false),
+      lazy_hyps_(false),
+      num_lazy_models_(0),
+      num_expanded_models_(0),
       transducer_(NULL),
       generator_(AbstractSplitGenerator::Create(&split_hyps_,
                                                 FLAGS_num_threads)),
       optimizer_(NULL),
-      recipe_(NULL) {
+      recipe_(NULL),
+      warm_start_(NULL),
+      split_check_(NULL),
+      model_index_(NULL) {
   generator_->SetQuestions(&questions_);
+  generator_->SetQuestionTables(&question_tables_);
 }
 
 ModelSplitter::~ModelSplitter() {
   delete samples_;
   delete generator_;
-  delete scorer_;
   delete optimizer_;
   delete recipe_;
+  delete warm_start_;
+  delete model_index_;
 }
 
 void ModelSplitter::SetSamples(const Samples *samples) {
@@ -73,11 +94,14 @@ void ModelSplitter::SetPhoneInfo(const Phones *phone_info) {
 }
 
 void ModelSplitter::SetScorer(const Scorer *scorer) {
+  scorer_ = scorer;
   generator_->SetScorer(scorer);
 }
 
 void ModelSplitter::SetContext(int num_left, int num_right, bool split_center) {
   num_left_contexts_ = num_left;
+  num_right_contexts_ = num_right;
+  split_center_ = split_center;
   generator_->SetContext(num_left, num_right, split_center);
 }
 
@@ -124,6 +148,16 @@ void ModelSplitter::SetRecipeWriter(File *file) {
   recipe_ = new RecipeWriter(file);
 }
 
+bool ModelSplitter::SetWarmStart(File *file) {
+  delete warm_start_;
+  warm_start_ = new RecipeReader(file);
+  return warm_start_->Init();
+}
+
+void ModelSplitter::SetSplitCheck(IncrementalTransducerCheck *check) {
+  split_check_ = check;
+}
+
 void ModelSplitter::SetTransducer(StateCountingTransducer *t) {
   transducer_ = t;
   optimizer_ = SplitOptimizer::Create(split_hyps_, *transducer_,
@@ -133,52 +167,90 @@ void ModelSplitter::SetTransducer(StateCountingTransducer *t) {
   optimizer_->SetIgnoreAbsentModels(ignore_absent_models_);
 }
 
+// Initializes the statistics of one state model per task.
+class ModelSplitter::InitModelMapper {
+public:
+  explicit InitModelMapper(const ModelSplitter *parent) : parent_(parent) {}
+  InitModelMapper* Clone() const {
+    return new InitModelMapper(parent_);
+  }
+  void Map(AllophoneStateModel *state_model) {
+    parent_->InitStateModel(state_model);
+  }
+  void Reset() {}
+private:
+  const ModelSplitter *parent_;
+};
+
 // Initialize the statistics of the initial HMM state models.
+// The state models are independent of each other and are processed in
+// parallel if more than one thread is used.
 void ModelSplitter::InitModels(ModelManager *models) const {
   CHECK_NOTNULL(samples_);
   CHECK(!questions_.empty());
   CHECK_NOTNULL(generator_);
   CHECK_NOTNULL(optimizer_);
-  for (ModelManager::StateModelRef m = models->GetStateModelsRef()->begin();
-      m != models->GetStateModelsRef()->end(); ++m) {
-    AllophoneStateModel *state_model = *m;
-    CHECK_EQ(state_model->GetAllophones().size(), 1);
-    const vector<int> &phones = state_model->GetAllophones().front()->phones();
-    int state = state_model->state();
-    bool have_data = false;
-    for (vector<int>::const_iterator p = phones.begin();
-        p != phones.end(); ++p) {
-      HmmStateStat *state_stat = new HmmStateStat(*p);
-      if (samples_->HaveSample(*p + 1, state)) {
-        const Samples::SampleList &sample_list =
-            samples_->GetSamples(*p + 1, state);
-        state_stat->SetStats(sample_list);
-        state_model->AddStatistics(state_stat);
-        VLOG(2) << "statistics for phone=" << phone_symbols_->Find(*p + 1)
-                << " state=" << state
-                << ": " << state_stat->NumObservations();
-        have_data = true;
-      } else {
-        REP(WARNING) << "no statistics for "
-                     << phone_symbols_->Find(*p + 1)
-                     << " state " << state;
-        delete state_stat;
-      }
-    }
-    if (have_data) {
-      VLOG(2) << "statistics for state model: "
-              << state_model->NumObservations();
+  ModelManager::StateModelList *state_models = models->GetStateModelsRef();
+#ifdef HAVE_THREADS
+  if (FLAGS_num_threads > 1) {
+    threads::ThreadPool<AllophoneStateModel*, InitModelMapper> pool;
+    pool.Init(FLAGS_num_threads, InitModelMapper(this));
+    for (ModelManager::StateModelRef m = state_models->begin();
+        m != state_models->end(); ++m)
+      pool.Submit(*m);
+    pool.Wait();
+    return;
+  }
+#endif
+  for (ModelManager::StateModelRef m = state_models->begin();
+      m != state_models->end(); ++m)
+    InitStateModel(*m);
+}
+
+void ModelSplitter::InitStateModel(AllophoneStateModel *state_model) const {
+  CHECK_EQ(state_model->GetAllophones().size(), 1);
+  const vector<int> &phones = state_model->GetAllophones().front()->phones();
+  int state = state_model->state();
+  bool have_data = false;
+  for (vector<int>::const_iterator p = phones.begin();
+      p != phones.end(); ++p) {
+    if (samples_->HaveSample(*p + 1, state)) {
+      const Samples::SampleList &sample_list =
+          samples_->GetSamples(*p + 1, state);
+      state_model->AddStatistics(*p, sample_list);
+      VLOG(2) << "statistics for phone=" << phone_symbols_->Find(*p + 1)
+              << " state=" << state
+              << ": " << sample_list.size() << " contexts";
+      have_data = true;
     } else {
-      REP(FATAL) << "no statistics for unit "
-                 << phone_symbols_->Find(phones.front() + 1)
-                 << " state " << state;
+      REP(WARNING) << "no statistics for "
+                   << phone_symbols_->Find(*p + 1)
+                   << " state " << state;
     }
   }
+  if (have_data) {
+    VLOG(2) << "statistics for state model: "
+            << state_model->NumObservations();
+  } else {
+    REP(FATAL) << "no statistics for unit "
+               << phone_symbols_->Find(phones.front() + 1)
+               << " state " << state;
+  }
 }
 
 // Create all split hypotheses for all existing state models.
+// The splits of the warm start recipe are applied beforehand.
 void ModelSplitter::InitSplitHypotheses(ModelManager *models) {
   split_hyps_.clear();
+  lazy_models_.clear();
+  if (recipe_) {
+    recipe_->SetQuestions(num_left_contexts_, &questions_);
+    recipe_->Init();
+  }
+  if (warm_start_)
+    ReplaySplits(models);
+  vector<ModelManager::StateModelRef> state_models;
+  vector<bool> ci_phones;
   for (ModelManager::StateModelRef sm = models->GetStateModelsRef()->begin();
       sm != models->GetStateModelsRef()->end(); ++sm) {
     const AllophoneStateModel &state_model = *(*sm);
@@ -187,12 +259,24 @@ void ModelSplitter::InitSplitHypotheses(ModelManager *models) {
     int phone = phones.front();
     bool ci_phone = phone_info_->IsCiPhone(phone);
     if (!ci_phone || phones.size() > 1) {
-      CreateSplitHypotheses(sm, ci_phone);
+      state_models.push_back(sm);
+      ci_phones.push_back(ci_phone);
     }
   }
+  if (optimizer_)
+    generator_->SetMaxRank(optimizer_->MaxRank());
+  CreateInitialSplitHypotheses(state_models, ci_phones);
   VLOG(1) << "initial split hypotheses: " << split_hyps_.size();
 }
 
+// Create the split hypotheses of all state models at once, which allows
+// the generator to process several state models in parallel.
+void ModelSplitter::CreateInitialSplitHypotheses(
+    const vector<ModelManager::StateModelRef> &state_models,
+    const vector<bool> &ci_phones) {
+  generator_->CreateSplitHypotheses(state_models, ci_phones);
+}
+
 
 
 // Create split hypotheses for all possible splits of the given state model
@@ -214,7 +298,7 @@ ModelSplitter::SplitHypRef ModelSplitter::FindBestSplit() {
   DCHECK(optimizer_);
   int best_new_states = -1, best_rank = -1, num_counts = 0;
   float best_score = 0;
-  SplitHypRef best_hyp = optimizer_->FindBestSplit(
+  SplitHypRef best_hyp = OptimizeSplit(
       &num_counts, &best_score, &best_new_states, &best_rank);
   if (best_hyp == split_hyps_.end())
     return best_hyp;
@@ -235,38 +319,221 @@ ModelSplitter::SplitHypRef ModelSplitter::FindBestSplit() {
   return best_hyp;
 }
 
+// The score of a split is not higher than its gain. A lazy model with an
+// upper bound of the gain lower than the best score cannot contain a better
+// split. Otherwise the hypotheses of the lazy models are created and the
+// optimization is repeated.
+ModelSplitter::SplitHypRef ModelSplitter::OptimizeSplit(
+    int *num_counts, float *best_score, int *new_states, int *rank) {
+  for (;;) {
+    SplitHypRef best_hyp = split_hyps_.end();
+    float score = -std::numeric_limits<float>::max();
+    if (!split_hyps_.empty()) {
+      best_hyp = optimizer_->FindBestSplit(num_counts, best_score,
+                                           new_states, rank);
+      if (best_hyp != split_hyps_.end())
+        score = *best_score;
+    }
+    if (lazy_models_.empty() || lazy_models_.begin()->first < score)
+      return best_hyp;
+    ExpandLazyModels(score);
+  }
+}
+
+// Create the hypotheses of all lazy models with a gain bound of at least
+// min_gain.
+void ModelSplitter::ExpandLazyModels(float min_gain) {
+  vector<ModelManager::StateModelRef> state_models;
+  vector<bool> ci_phones;
+  LazyModels::iterator end = lazy_models_.begin();
+  for (; end != lazy_models_.end() && end->first >= min_gain; ++end) {
+    state_models.push_back(end->second.model);
+    ci_phones.push_back(end->second.ci_phone);
+  }
+  lazy_models_.erase(lazy_models_.begin(), end);
+  num_expanded_models_ += state_models.size();
+  VLOG(2) << "expanding " << state_models.size() << " lazy models";
+  CreateInitialSplitHypotheses(state_models, ci_phones);
+}
+
+// Maximum of the gain bounds of the context positions used by the split
+// generator. -infinity if the state model has no context position to split.
+double ModelSplitter::GainBound(const AllophoneStateModel &model,
+                                bool ci_phone) const {
+  double bound = -std::numeric_limits<double>::infinity();
+  const int from = (ci_phone ? 0 : -num_left_contexts_);
+  const int to = (ci_phone ? 0 : num_right_contexts_);
+  for (int pos = from; pos <= to; ++pos) {
+    if (!split_center_ && pos == 0) continue;
+    bound = std::max(bound, model.GainBound(pos, *scorer_));
+  }
+  return bound;
+}
+
 // Apply the split hypothesis (model_hyp and split_hyp) to the
 // transducer, store the models in the ModelMananger, and create
 // ModelSplitHypotheses for the split state models.
 void ModelSplitter::ApplySplit(ModelManager *models, SplitHypRef split_hyp) {
+  const int phone =
+      (*split_hyp->model)->GetAllophones().front()->phones().front();
+  const bool ci_phone = phone_info_->IsCiPhone(phone);
+  ModelSplit split_result;
+  ExecuteSplit(models, split_hyp, &split_result);
+
+  // create new ModelSplitHypotheses for the new state models.
+  // lazy models are keyed by the upper bound of their gain. models without
+  // a context position to split have no hypotheses.
+  for (int c = 0; c < 2; ++c) {
+    ModelManager::StateModelRef new_state_model =
+        GetPairElement(split_result.state_models, c);
+    if (lazy_hyps_) {
+      const double bound = GainBound(**new_state_model, ci_phone);
+      if (bound == -std::numeric_limits<double>::infinity()) continue;
+      lazy_models_.insert(std::make_pair(
+          bound, LazyModel(new_state_model, ci_phone)));
+      ++num_lazy_models_;
+    } else {
+      CreateSplitHypotheses(new_state_model, ci_phone);
+    }
+  }
+}
+
+// Store the new models of the split in the ModelManager and in the
+// transducer. The new state models are stored in split_result.
+void ModelSplitter::ExecuteSplit(ModelManager *models, SplitHypRef split_hyp,
+                                 ModelSplit *split_result) {
   const int hmm_state = (*split_hyp->model)->state();
   const int position = split_hyp->position;
   const int phone =
       (*split_hyp->model)->GetAllophones().front()->phones().front();
-  const bool ci_phone = phone_info_->IsCiPhone(phone);
 
   // store new models in the ModelManager, delete old models.
-  ModelSplit split_result;
+  if (model_index_)
+    model_index_->Remove(split_hyp->model);
   models->ApplySplit(split_hyp->position, split_hyp->model,
-                     &split_hyp->split, &split_result);
+                     &split_hyp->split, split_result);
+  if (model_index_) {
+    model_index_->Add(split_result->state_models.first);
+    model_index_->Add(split_result->state_models.second);
+  }
 
   // create states and arcs in the context dependency transducer
   typedef vector<AllophoneModelSplit>::iterator ModelIter;
-  for (ModelIter m = split_result.phone_models.begin();
-      m != split_result.phone_models.end(); ++m) {
+  for (ModelIter m = split_result->phone_models.begin();
+      m != split_result->phone_models.end(); ++m) {
     transducer_->ApplyModelSplit(position, split_hyp->question, m->old_model,
         hmm_state, m->new_models);
   }
   transducer_->FinishSplit();
+  if (split_check_) {
+    if (!split_check_->Check())
+      REP(FATAL) << "invalid transducer after split: position=" << position
+                 << " question=" << split_hyp->question->Name()
+                 << " phone=" << phone_symbols_->Find(phone + 1)
+                 << " state=" << hmm_state;
+    VLOG(2) << "checked states: " << split_check_->NumCheckedStates();
+  }
 
-  models->DeleteOldModels(&split_result.phone_models);
+  models->DeleteOldModels(&split_result->phone_models);
+}
 
-  // create new ModelSplitHypotheses for the new state models
-  for (int c = 0; c < 2; ++c) {
-    ModelManager::StateModelRef new_state_model =
-        GetPairElement(split_result.state_models, c);
-    CreateSplitHypotheses(new_state_model, ci_phone);
+namespace {
+// Key of a state model in a StateModelIndex. The context includes the
+// center phones at position 0. The allophones of a state model are not
+// used, because they change with the splits of other state models of the
+// same phone.
+size_t StateModelKey(int state, const PhoneContext &context) {
+  size_t key = context.HashValue();
+  HashCombine(key, state);
+  return key;
+}
+}  // namespace
+
+void StateModelIndex::Add(ModelManager::StateModelRef model) {
+  models_.insert(std::make_pair(
+      StateModelKey((*model)->state(), (*model)->GetContext()), model));
+}
+
+void StateModelIndex::Remove(ModelManager::StateModelRef model) {
+  std::pair<ModelMap::iterator, ModelMap::iterator> range =
+      models_.equal_range(
+          StateModelKey((*model)->state(), (*model)->GetContext()));
+  for (ModelMap::iterator i = range.first; i != range.second; ++i) {
+    if (i->second == model) {
+      models_.erase(i);
+      return;
+    }
+  }
+}
+
+bool StateModelIndex::Find(const AllophoneStateModelStub &stub,
+                           ModelManager::StateModelRef *model) const {
+  std::pair<ModelMap::const_iterator, ModelMap::const_iterator> range =
+      models_.equal_range(StateModelKey(stub.state, stub.context));
+  for (ModelMap::const_iterator i = range.first; i != range.second; ++i) {
+    if (stub.IsEqual(**i->second)) {
+      *model = i->second;
+      return true;
+    }
   }
+  return false;
+}
+
+void ModelSplitter::IndexStateModels(ModelManager *models) {
+  if (model_index_) return;
+  model_index_ = new StateModelIndex();
+  ModelManager::StateModelList *state_models = models->GetStateModelsRef();
+  for (ModelManager::StateModelRef m = state_models->begin();
+       m != state_models->end(); ++m)
+    model_index_->Add(m);
+}
+
+// Execute the splits of the warm start recipe, until the recipe ends or
+// the target number of models or states is reached. The split hypotheses
+// of the intermediate state models are not created.
+// The state models are found using a temporary model_index_.
+// The replayed splits are added to the recipe_.
+void ModelSplitter::ReplaySplits(ModelManager *models) {
+  IndexStateModels(models);
+  int num_splits = 0;
+  while (!IsTargetReached(models->NumStateModels(),
+                          transducer_->NumStates())) {
+    SplitDef def;
+    if (!warm_start_->ReadSplit(&def)) break;
+    ModelManager::StateModelRef model;
+    if (!model_index_->Find(def.model, &model))
+      LOG(FATAL) << "state model of warm start split " << num_splits
+                 << " not found";
+    const QuestionSet &questions =
+        *questions_[num_left_contexts_ + def.position];
+    if (def.question < 0 || def.question >= questions.size())
+      LOG(FATAL) << "invalid question in warm start split " << num_splits;
+    const ContextQuestion *question = questions[def.question];
+    SplitHypothesis hyp(model, (*model)->Split(def.position, *question),
+                        question, def.position, 0);
+    if (!(hyp.split.first && hyp.split.second))
+      LOG(FATAL) << "invalid warm start split " << num_splits;
+    (*model)->SplitData(def.position, &hyp.split);
+    (*model)->ComputeCosts(&hyp.split, *scorer_);
+    hyp.gain = (*model)->GetGain(hyp.split);
+    SplitHypRef split_hyp = split_hyps_.insert(hyp);
+    if (recipe_) recipe_->AddSplit(*split_hyp);
+    ModelSplit split_result;
+    ExecuteSplit(models, split_hyp, &split_result);
+    split_hyps_.erase(split_hyp);
+    ++num_splits;
+  }
+  // the index is not required for the optimization.
+  delete model_index_;
+  model_index_ = NULL;
+  REP(INFO) << "warm start splits: " << num_splits << " "
+            << "#models: " << models->NumStateModels() << " "
+            << "#states: " << transducer_->NumStates();
+}
+
+bool ModelSplitter::IsTargetReached(int num_models, int num_states) const {
+  return (target_num_models_ > 0 && num_models >= target_num_models_) ||
+      (target_num_states_ > 0 && num_states >= target_num_states_);
 }
 
 // Remove the all SplitHypothesis from split_hyps_ which have the same model
@@ -299,13 +566,31 @@ void ModelSplitter::DeleteSplit(
   split->second = NULL;
 }
 
+void ModelSplitter::SetCostCacheSize(int capacity) {
+  generator_->SetCostCacheSize(capacity);
+}
+
+void ModelSplitter::SetUseQuestionTables(bool use) {
+  generator_->SetUseQuestionTables(use);
+}
+
+void ModelSplitter::SetPruneHypotheses(bool prune) {
+  generator_->SetPruneHypotheses(prune);
+}
+
+void ModelSplitter::SetLazyHypotheses(bool lazy) {
+  lazy_hyps_ = lazy;
+}
+
 // Delete all remaining AllophoneStateModels and AllophoneModels in split_hyps_.
 // These models have been created by a split but they are not owned by the
-// ModelManager because the split hasn't been applied.
+// ModelManager because the split hasn't been applied. Their memory is part
+// of the ModelManager's pool, which is released in bulk by the ModelManager.
 void ModelSplitter::Cleanup() {
   for (SplitHypRef hyp = split_hyps_.begin(); hyp != split_hyps_.end(); ++hyp)
     DeleteSplit(&hyp->split);
   split_hyps_.clear();
+  lazy_models_.clear();
 }
 
 // Iteratively split the state models by selecting in each iteration the
@@ -316,13 +601,7 @@ void ModelSplitter::SplitModels(ModelManager *models) {
   int num_models = models->NumStateModels();
   int num_states = transducer_->NumStates();
   int num_new_states = 0;
-  if (recipe_) {
-    recipe_->SetQuestions(num_left_contexts_, &questions_);
-    recipe_->Init();
-  }
-  while (!split_hyps_.empty() &&
-         (target_num_models_ == 0 || num_models < target_num_models_) &&
-         (target_num_states_ == 0 || num_states < target_num_states_)) {
+  while (HaveSplitHypotheses() && !IsTargetReached(num_models, num_states)) {
     SplitHypRef best_split = FindBestSplit();
     if (best_split == split_hyps_.end()) {
       REP(INFO) << "no valid split found";
@@ -338,7 +617,31 @@ void ModelSplitter::SplitModels(ModelManager *models) {
     REP(INFO) << "#models: " << num_models << " "
               << "#states: " << num_states << " "
               << "new states: " << num_new_states;
+    if (VLOG_IS_ON(1)) LogCostCache();
   }
+  LogCostCache();
+  ModelAllocations allocations;
+  models->GetAllocations(&allocations);
+  REP(INFO) << "model allocations: " << allocations.objects
+            << " slabs: " << allocations.slabs;
+  if (lazy_hyps_)
+    REP(INFO) << "lazy models: " << num_lazy_models_
+              << " expanded: " << num_expanded_models_;
+}
+
+const LeafCostCache* ModelSplitter::GetCostCache() const {
+  return generator_->GetCostCache();
+}
+
+void ModelSplitter::LogCostCache() const {
+  const LeafCostCache *cache = generator_->GetCostCache();
+  if (!cache) return;
+  const int lookups = cache->NumLookups();
+  REP(INFO) << "cost cache: lookups: " << lookups
+            << " hits: " << cache->NumHits()
+            << " hit rate: "
+            << (lookups ? static_cast<float>(cache->NumHits()) / lookups : 0)
+            << " entries: " << cache->Size();
 }
 
 
@@ -21,13 +21,17 @@
 #ifndef MODEL_SPLITTER_H_
 #define MODEL_SPLITTER_H_
 
+#include <ext/hash_map>
+#include <functional>
 #include <list>
+#include <map>
 #include <set>
 #include <vector>
 #include "context_builder.h"
 #include "phone_models.h"
 #include "util.h"
 
+using std::multimap;
 using std::multiset;
 using std::vector;
 using std::list;
@@ -38,7 +42,11 @@ class StateCountingTransducer;
 class AbstractSplitGenerator;
 class SplitOptimizer;
 class File;
+class RecipeReader;
 class RecipeWriter;
+class IncrementalTransducerCheck;
+class LeafCostCache;
+class AllophoneStateModelStub;
 
 // A hypothesized split of a state model.
 // Includes the new AllophoneStateModels and the gain in likelihood
@@ -75,6 +83,22 @@ struct SplitHypothesisGainCompare {
 };
 
 
+// Index of state models by HMM state and context, used to find the state
+// model of a split read from a recipe or received from another process.
+class StateModelIndex {
+ public:
+  void Add(ModelManager::StateModelRef model);
+  void Remove(ModelManager::StateModelRef model);
+  // Returns false if no state model matches the given stub.
+  bool Find(const AllophoneStateModelStub &stub,
+            ModelManager::StateModelRef *model) const;
+ private:
+  typedef __gnu_cxx::hash_multimap<size_t, ModelManager::StateModelRef>
+      ModelMap;
+  ModelMap models_;
+};
+
+
 // splitting of tied HMM state models based on acoustic likelihood
 // and transducer size.
 // this class perform the actual optimization.
@@ -90,8 +114,11 @@ class ModelSplitter {
 
   void InitModels(ModelManager *models) const;
   void InitSplitHypotheses(ModelManager *models);
-  void SplitModels(ModelManager *models);
+  virtual void SplitModels(ModelManager *models);
 
+  // Delete the models of the remaining split hypotheses. Has to be called
+  // before the ModelManager is deleted, which releases the slabs of the
+  // models.
   void Cleanup();
   void SetSamples(const Samples *samples);
   void SetPhoneSymbols(const fst::SymbolTable *symbols);
@@ -106,7 +133,24 @@ class ModelSplitter {
   void SetStatePenaltyWeight(float weight);
   void SetMaxHypotheses(int max_hyps);
   void SetIgnoreAbsentModels(bool ignore);
+  // cache the costs and statistics of at most capacity split state models,
+  // 0 disables the cache. Not used with question tables or pruning.
+  void SetCostCacheSize(int capacity);
+  // evaluate the questions of a context position in one pass.
+  void SetUseQuestionTables(bool use);
+  // prune split hypotheses using upper bounds of the gain.
+  void SetPruneHypotheses(bool prune);
+  // create the split hypotheses of new state models only if they may
+  // contain the best split. not supported by DistributedSplitter.
+  void SetLazyHypotheses(bool lazy);
   void SetRecipeWriter(File *file);
+  // execute the splits stored in the given recipe before the optimization.
+  // only the hypotheses of the resulting state models are created.
+  // returns false if the recipe header is invalid.
+  bool SetWarmStart(File *file);
+  // check the states of the C transducer modified by each split.
+  // ownership stays at caller.
+  void SetSplitCheck(IncrementalTransducerCheck *check);
   // set the transducer used for state counting.
   // the transducer will be modified throughout the optimization.
   // ownership stays at caller.
@@ -114,14 +158,53 @@ class ModelSplitter {
   vector<const QuestionSet*>* GetQuestions() {
     return &questions_;
   }
+  // question membership tables, same indexing as GetQuestions().
+  vector<const QuestionTable*>* GetQuestionTables() {
+    return &question_tables_;
+  }
+  // NULL if the cost cache is disabled.
+  const LeafCostCache* GetCostCache() const;
  protected:
-  void CreateSplitHypotheses(const ModelManager::StateModelRef state_model,
-                             bool ci_phone);
+  virtual void CreateSplitHypotheses(
+      const ModelManager::StateModelRef state_model, bool ci_phone);
+  virtual void CreateInitialSplitHypotheses(
+      const vector<ModelManager::StateModelRef> &state_models,
+      const vector<bool> &ci_phones);
   virtual SplitHypRef FindBestSplit();
-
+  // true if there are split hypotheses left to be evaluated.
+  virtual bool HaveSplitHypotheses() const {
+    return !split_hyps_.empty() || !lazy_models_.empty();
+  }
+  // best split found by the optimizer, after creating the hypotheses of
+  // the lazy models which may contain a better split.
+  SplitHypRef OptimizeSplit(int *num_counts, float *best_score,
+                            int *new_states, int *rank);
+  void ExpandLazyModels(float min_gain);
+  // upper bound of the gain of all split hypotheses of the state model.
+  double GainBound(const AllophoneStateModel &model, bool ci_phone) const;
+
+  void InitStateModel(AllophoneStateModel *state_model) const;
   void ApplySplit(ModelManager *models, SplitHypRef split_hyp);
+  void ExecuteSplit(ModelManager *models, SplitHypRef split_hyp,
+                    ModelSplit *split_result);
+  void ReplaySplits(ModelManager *models);
+  // create model_index_ for the current state models, if not done yet.
+  // the index is updated by each executed split afterwards.
+  void IndexStateModels(ModelManager *models);
+  bool IsTargetReached(int num_models, int num_states) const;
   void RemoveModelHypothesis(SplitHypRef best_split);
   void DeleteSplit(AllophoneStateModel::SplitResult *split) const;
+  void LogCostCache() const;
+
+  // state model with deferred creation of its split hypotheses.
+  struct LazyModel {
+    ModelManager::StateModelRef model;
+    bool ci_phone;
+    LazyModel(ModelManager::StateModelRef m, bool ci)
+        : model(m), ci_phone(ci) {}
+  };
+  // ordered by decreasing upper bound of the gain of their splits.
+  typedef multimap<float, LazyModel, std::greater<float> > LazyModels;
 
   const Samples *samples_;
   // split hypotheses are stored in a multiset ordered by achieved gain.
@@ -130,15 +213,24 @@ class ModelSplitter {
   const Phones *phone_info_;
   const Scorer *scorer_;
   float state_penaly_weight_;
-  int num_left_contexts_;
+  int num_left_contexts_, num_right_contexts_;
   int target_num_models_, target_num_states_;
   int max_hyps_;
-  bool split_center_, ignore_absent_models_;
+  bool split_center_, ignore_absent_models_, lazy_hyps_;
+  LazyModels lazy_models_;
+  int num_lazy_models_, num_expanded_models_;
   StateCountingTransducer *transducer_;
   vector<const QuestionSet*> questions_;
+  vector<const QuestionTable*> question_tables_;
   AbstractSplitGenerator *generator_;
   SplitOptimizer *optimizer_;
   RecipeWriter *recipe_;
+  RecipeReader *warm_start_;
+  IncrementalTransducerCheck *split_check_;
+  // NULL until IndexStateModels() is called.
+  StateModelIndex *model_index_;
+ private:
+  class InitModelMapper;
   DISALLOW_COPY_AND_ASSIGN(ModelSplitter);
 };
 
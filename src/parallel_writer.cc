@@ -0,0 +1,116 @@
+// parallel_writer.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+//
+
+#include <algorithm>
+#include <vector>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "file.h"
+#include "parallel_writer.h"
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
+
+namespace trainc {
+
+namespace {
+
+const int kChunksPerThread = 4;
+const int kMaxChunkSize = 1024;
+
+// A range of items and their formatted text.
+struct TextChunk {
+  int begin, end;
+  std::string text;
+  TextChunk() : begin(0), end(0) {}
+};
+
+// The buffer is allocated using the size of the first item as estimate.
+void FormatChunk(const ItemFormatter &formatter, TextChunk *chunk) {
+  chunk->text.clear();
+  for (int i = chunk->begin; i < chunk->end; ++i) {
+    formatter.Format(i, &chunk->text);
+    if (i == chunk->begin)
+      chunk->text.reserve(chunk->text.size() * (chunk->end - chunk->begin) +
+                          chunk->text.size() / 2);
+  }
+}
+
+class FormatMapper {
+public:
+  explicit FormatMapper(const ItemFormatter *formatter)
+      : formatter_(formatter) {}
+  FormatMapper* Clone() const {
+    return new FormatMapper(formatter_);
+  }
+  void Map(TextChunk *chunk) {
+    FormatChunk(*formatter_, chunk);
+  }
+  void Reset() {}
+private:
+  const ItemFormatter *formatter_;
+};
+
+void WriteSequential(const ItemFormatter &formatter, int num_items,
+                     OutputBuffer *out) {
+  TextChunk chunk;
+  for (int begin = 0; begin < num_items; begin += kMaxChunkSize) {
+    chunk.begin = begin;
+    chunk.end = std::min(begin + kMaxChunkSize, num_items);
+    FormatChunk(formatter, &chunk);
+    out->WriteString(chunk.text);
+  }
+}
+
+}  // namespace
+
+void WriteItems(const ItemFormatter &formatter, int num_items,
+                int num_threads, OutputBuffer *out) {
+#ifdef HAVE_THREADS
+  if (num_threads > 1 && num_items > 1) {
+    const int num_chunks = num_threads * kChunksPerThread;
+    const int chunk_size = std::max(1, std::min(kMaxChunkSize,
+                                                num_items / num_chunks));
+    std::vector<TextChunk> chunks(num_chunks);
+    threads::ThreadPool<TextChunk*, FormatMapper> pool;
+    pool.Init(num_threads, FormatMapper(&formatter));
+    int next_item = 0;
+    while (next_item < num_items) {
+      int used_chunks = 0;
+      for (; used_chunks < num_chunks && next_item < num_items;
+           ++used_chunks) {
+        TextChunk &chunk = chunks[used_chunks];
+        chunk.begin = next_item;
+        chunk.end = std::min(next_item + chunk_size, num_items);
+        next_item = chunk.end;
+        pool.Submit(&chunk);
+      }
+      pool.Wait();
+      for (int c = 0; c < used_chunks; ++c)
+        out->WriteString(chunks[c].text);
+    }
+    return;
+  }
+#endif
+  WriteSequential(formatter, num_items, out);
+}
+
+}  // namespace trainc
@@ -0,0 +1,50 @@
+// parallel_writer.h
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Parallel formatting of text output
+
+#ifndef PARALLEL_WRITER_H_
+#define PARALLEL_WRITER_H_
+
+#include <string>
+
+namespace trainc {
+
+class OutputBuffer;
+
+// Formats the text of a sequence of items.
+class ItemFormatter {
+public:
+  virtual ~ItemFormatter() {}
+  // Append the text for the given item to buffer.
+  // Called concurrently from several threads.
+  virtual void Format(int item, std::string *buffer) const = 0;
+};
+
+// Writes the text of the items [0, num_items) in order.
+// The items are partitioned in chunks, which are formatted in parallel
+// into separate buffers. Only a bounded number of chunks is held in
+// memory at once.
+// Without thread support or if num_threads <= 1, all items are formatted
+// sequentially.
+void WriteItems(const ItemFormatter &formatter, int num_items,
+                int num_threads, OutputBuffer *out);
+
+}  // namespace trainc
+
+#endif  // PARALLEL_WRITER_H_
@@ -29,54 +29,11 @@ using std::set;
 
 namespace trainc {
 
-HmmStateStat::HmmStateStat(int phone)
-    : phone_(phone), num_obs_(-1), num_samples_(-1) {}
-
-void HmmStateStat::AddStat(const Sample *sample) {
-  samples_.push_back(sample);
-  num_samples_ = -1;
-  num_obs_ = -1;
-}
-
-void HmmStateStat::SetStats(const Samples::SampleList &sample_list) {
-  std::transform(sample_list.begin(), sample_list.end(),
-                 std::back_insert_iterator<SampleRefList>(samples_),
-                 GetAddress<Sample>());
-  num_samples_ = -1;
-  num_obs_ = -1;
-}
-
-int HmmStateStat::NumContexts() {
-  if (num_samples_ < 0) {
-    num_samples_ = samples_.size();
-  }
-  return num_samples_;
-}
-
-int HmmStateStat::NumObservations() {
-  if (num_obs_ < 0) {
-    num_obs_ = 0;
-    for (SampleRefList::const_iterator i = samples_.begin();
-        i != samples_.end(); ++i)
-      num_obs_ += (*i)->stat.weight();
-  }
-  return num_obs_;
-}
-
-void HmmStateStat::SumStatistics(Statistics *sum) const {
-  SampleRefList::const_iterator dp;
-  if (samples_.empty()) return;
-  if (sum->dimension() <= 0)
-    sum->Reset(samples_.front()->stat.dimension());
-  for (dp = samples_.begin(); dp != samples_.end(); ++dp) {
-    sum->Accumulate((*dp)->stat);
-  }
-}
-
 // ======================================================
 
 AllophoneModel* AllophoneModel::Clone() const {
-  AllophoneModel *a = new AllophoneModel(NumStates());
+  AllophoneModel *a = new(pool_) AllophoneModel(NumStates());
+  a->pool_ = pool_;
   copy(states_.begin(), states_.end(), a->states_.begin());
   a->phones_.resize(phones_.size());
   copy(phones_.begin(), phones_.end(), a->phones_.begin());
@@ -148,36 +105,157 @@ string AllophoneModel::ToString(bool full) const {
 
 // ======================================================
 
+namespace {
+
+// Sample references shared by several AllophoneStateModel::Data objects.
+// Each Data object uses a contiguous range of samples.
+// The reference count is modified atomically, because the models of split
+// hypotheses are created and deleted by the threads of the split generator.
+struct SampleBuffer {
+  vector<const Sample*> samples;
+  int ref_count;
+  bool scratch;
+  SampleBuffer *next;
+  explicit SampleBuffer(bool s) : ref_count(0), scratch(s), next(NULL) {}
+
+  void Ref() {
+#ifdef HAVE_THREADS
+    __sync_add_and_fetch(&ref_count, 1);
+#else
+    ++ref_count;
+#endif
+  }
+  // Returns true if the last reference was removed.
+  bool Unref() {
+#ifdef HAVE_THREADS
+    return __sync_sub_and_fetch(&ref_count, 1) == 0;
+#else
+    return --ref_count == 0;
+#endif
+  }
+};
+
+// Scratch buffers used by AllophoneStateModel::Data::SplitData.
+// Released buffers are kept, with their capacity, in a free list of the
+// releasing thread and are reused by the following splits of this thread.
+// Most split hypotheses are discarded right after their evaluation,
+// therefore each thread of the split generator needs only a few buffers.
+// At most kMaxBuffers buffers are kept per thread.
+class ScratchBuffers {
+ public:
+  static SampleBuffer* Get() {
+    SampleBuffer *buffer = free_;
+    if (!buffer)
+      return new SampleBuffer(true);
+    free_ = buffer->next;
+    --size_;
+    buffer->next = NULL;
+    return buffer;
+  }
+  static void Release(SampleBuffer *buffer) {
+    DCHECK(buffer->scratch);
+    if (size_ >= kMaxBuffers) {
+      delete buffer;
+      return;
+    }
+    buffer->samples.clear();
+    buffer->next = free_;
+    free_ = buffer;
+    ++size_;
+  }
+ private:
+  static const int kMaxBuffers = 4;
+  static SLAB_POOL_THREAD_LOCAL SampleBuffer *free_;
+  static SLAB_POOL_THREAD_LOCAL int size_;
+};
+
+SLAB_POOL_THREAD_LOCAL SampleBuffer *ScratchBuffers::free_ = NULL;
+SLAB_POOL_THREAD_LOCAL int ScratchBuffers::size_ = 0;
+
+}  // namespace
+
 // Statistics of an AllophoneStateModel.
 // Used to evaluate the gain of splitting HMM state models.
-// Contains an HmmStateStat for every phone represented by the modeled unit.
+// The samples are stored as a contiguous range in a SampleBuffer, which is
+// subdivided in one segment for every phone represented by the modeled unit.
+// The state models of an initial model share one buffer. A split writes the
+// sample references of both new models to a scratch buffer, which is reused
+// by later splits once both new models are deleted. If the split is
+// applied, the partitioned samples are copied back to the range of the
+// original model.
 class AllophoneStateModel::Data {
  public:
   Data()
-      : num_observations_(0), num_seen_contexts_(0),
+      : buffer_(NULL), num_observations_(0), num_seen_contexts_(0),
         have_cost_(false), cost_(0) {}
   ~Data() {
-    STLDeleteElements(&data_);
+    SetBuffer(NULL);
+  }
+  // Allocated from the pool of the state model.
+  static void* operator new(size_t size, ModelPool *pool);
+  static void operator delete(void *p, size_t size) {
+    SlabPool<Data>::Free(p);
   }
-  // void AddDatum(const SuffStat &data, const GaussStats &counts);
-  void AddStat(HmmStateStat *stat);
+  static void operator delete(void *p, ModelPool *pool) {
+    SlabPool<Data>::Free(p);
+  }
+  void AddStat(int phone, const Samples::SampleList &samples);
   void SplitData(int context_position, SplitResult *split) const;
+  void CommitSplit(SplitResult *split);
   void EvalCost(const Scorer &scorer);
+  static void EvalCosts(const vector<Data*> &models, const Scorer &scorer);
+  void EvaluateQuestions(int position, const ContextSet &context,
+                         const QuestionTable &table,
+                         const vector<int> *questions, const Scorer &scorer,
+                         SplitSelector *selector,
+                         vector<QuestionSplit> *splits) const;
+  double GainBound(int position, const ContextSet &context,
+                   const Scorer &scorer) const;
   void AddToModel(const string &distname, GaussianModel *model,
                   float variance_floor) const;
   bool HasCost() const { return have_cost_; }
   float cost() const { return cost_; }
+  void SetCost(float cost) {
+    cost_ = cost;
+    have_cost_ = true;
+  }
+  void GetPhones(vector<int> *phones) const;
+  void GetSum(AccumulatorType type, DoubleStatistics *sum) const;
   int num_observations() const { return num_observations_; }
   int num_seen_contexts() const { return num_seen_contexts_; }
  private:
-  void SumCounts(Statistics *sum) const;
-  void SplitContext(int context_position,
-                    const Partition &partition,
-                    SplitResult *split) const;
-  void SplitCenter(const Partition &partition,
-                    SplitResult *split) const;
-
-  vector<HmmStateStat*> data_;
+  // Samples of one phone: range [begin, end) of buffer_.
+  struct PhoneSamples {
+    int phone, begin, end;
+    PhoneSamples(int p, int b, int e) : phone(p), begin(b), end(e) {}
+  };
+  typedef vector<PhoneSamples> PhoneSampleList;
+
+  void SetBuffer(SampleBuffer *buffer);
+  void AddSegment(int phone, int begin, int end);
+  template<class S> void SumCounts(S *sum) const;
+  template<class S>
+  void SumQuestions(int position, const ContextSet &context,
+                    const QuestionTable &table, const vector<int> *questions,
+                    const Scorer &scorer, SplitSelector *selector,
+                    vector<QuestionSplit> *splits) const;
+  template<class S>
+  void SelectQuestions(const QuestionTable &table,
+                       const vector<int> &questions,
+                       const vector<int> &phones, const vector<S> &phone_sums,
+                       const Scorer &scorer, SplitSelector *selector,
+                       vector<QuestionSplit> *splits) const;
+  template<class S>
+  double CostBound(int position, const ContextSet &context,
+                   const Scorer &scorer) const;
+  template<class S>
+  static void SumCosts(const vector<Data*> &models, const Scorer &scorer);
+  static int ContextPhone(int position, const Sample &sample);
+  void SplitSegment(int context_position, const PhoneSamples &segment,
+                    const ContextSet &phones, SampleBuffer *target) const;
+
+  SampleBuffer *buffer_;
+  PhoneSampleList phones_;
   int num_observations_;
   int num_seen_contexts_;
   bool have_cost_;
@@ -186,101 +264,474 @@ class AllophoneStateModel::Data {
   DISALLOW_COPY_AND_ASSIGN(Data);
 };
 
-void AllophoneStateModel::Data::AddStat(HmmStateStat *stat) {
-  data_.push_back(stat);
-  num_seen_contexts_ += stat->NumContexts();
-  num_observations_ += stat->NumObservations();
+// The slab pools of all models of a ModelManager.
+class ModelPool {
+ public:
+  SlabPool<AllophoneStateModel> state_models;
+  SlabPool<AllophoneStateModel::Data> data;
+  SlabPool<AllophoneModel> models;
+};
+
+void* AllophoneStateModel::Data::operator new(size_t size, ModelPool *pool) {
+  return SlabPool<Data>::Allocate(pool ? &pool->data : NULL, size);
+}
+
+void AllophoneStateModel::Data::SetBuffer(SampleBuffer *buffer) {
+  if (buffer)
+    buffer->Ref();
+  if (buffer_ && buffer_->Unref()) {
+    if (buffer_->scratch)
+      ScratchBuffers::Release(buffer_);
+    else
+      delete buffer_;
+  }
+  buffer_ = buffer;
+}
+
+void AllophoneStateModel::Data::AddSegment(int phone, int begin, int end) {
+  int num_obs = 0;
+  for (int i = begin; i < end; ++i)
+    num_obs += buffer_->samples[i]->stat.weight();
+  phones_.push_back(PhoneSamples(phone, begin, end));
+  num_seen_contexts_ += end - begin;
+  num_observations_ += num_obs;
+}
+
+void AllophoneStateModel::Data::AddStat(
+    int phone, const Samples::SampleList &samples) {
+  if (!buffer_)
+    SetBuffer(new SampleBuffer(false));
+  DCHECK_EQ(buffer_->ref_count, 1);
+  vector<const Sample*> &buffer = buffer_->samples;
+  const int begin = buffer.size();
+  std::transform(samples.begin(), samples.end(),
+                 std::back_insert_iterator< vector<const Sample*> >(buffer),
+                 GetAddress<Sample>());
+  AddSegment(phone, begin, buffer.size());
 }
 
+// Distribute the samples to the new AllophoneStateModels.
+// The samples of the first model are followed by the samples of the
+// second model in the scratch buffer. Samples of a phone are kept in
+// their original order.
 void AllophoneStateModel::Data::SplitData(
     int context_position, SplitResult *split) const {
   DCHECK(split->first && split->second);
   Partition partition(
       split->first->context(context_position),
       split->second->context(context_position));
+  SampleBuffer *scratch = ScratchBuffers::Get();
+  scratch->samples.reserve(num_seen_contexts_);
   for (int c = 0; c < 2; ++c) {
     AllophoneStateModel *state_model = GetPairElement(*split, c);
     DCHECK(state_model->data_ == NULL);
-    state_model->data_ = new Data();
-  }
-  if (context_position == 0)
-    SplitCenter(partition, split);
-  else
-    SplitContext(context_position, partition, split);
-}
-
-// Distribute the HmmStateStats to the new AllophoneStateModels
-// depending on their center phone set.
-void AllophoneStateModel::Data::SplitCenter(
-  const Partition &partition,
-  SplitResult *split) const {
-  vector<HmmStateStat*>::const_iterator sp;
-  for (sp = data_.begin(); sp != data_.end(); ++sp) {
-    const HmmStateStat &stat = *(*sp);
-    Data *to_add = NULL;
-    int phone = stat.phone();
-    for (int c = 0; c < 2; ++c) {
-      if (GetPairElement(partition, c).HasElement(phone)) {
-        DCHECK(to_add == NULL);
-        to_add = GetPairElement(*split, c)->data_;
-      }
+    Data *data = new(state_model->pool_) Data();
+    data->SetBuffer(scratch);
+    state_model->data_ = data;
+    const ContextSet &phones = GetPairElement(partition, c);
+    for (PhoneSampleList::const_iterator segment = phones_.begin();
+         segment != phones_.end(); ++segment) {
+      const int begin = scratch->samples.size();
+      SplitSegment(context_position, *segment, phones, scratch);
+      const int end = scratch->samples.size();
+      if (end > begin)
+        data->AddSegment(segment->phone, begin, end);
     }
-    DCHECK(to_add != NULL);
-    to_add->AddStat(new HmmStateStat(stat));
   }
 }
 
-// Distribute the SuffStats of all HmmStateStats to the new AllphoneStateModels.
-void AllophoneStateModel::Data::SplitContext(
-    int context_position,
-    const Partition &partition,
-    SplitResult *split) const {
-  vector<HmmStateStat*>::const_iterator sp;
-  for (sp = data_.begin(); sp != data_.end(); ++sp) {
-    const HmmStateStat &stat = *(*sp);
-    pair<HmmStateStat*, HmmStateStat*> new_stats(NULL, NULL);
-    for (int c = 0; c < 2; ++c) {
-      HmmStateStat* &s = GetPairElement(new_stats, c);
-      s = new HmmStateStat(stat.phone());
-    }
-    HmmStateStat::SampleRefList::const_iterator dp;
-    for (dp = stat.stats().begin(); dp != stat.stats().end(); ++dp) {
-      int phone = -1;
-      if (context_position > 0)
-        phone = (*dp)->right_context_[context_position - 1];
-      else if (context_position < 0)
-        phone = (*dp)->left_context_[-context_position - 1];
-      else
-        CHECK(false);
-      // apply phone symbol index shift
-      DCHECK_GT(phone, 0);
-      --phone;
-      for (int c = 0; c < 2; ++c) {
-        if (GetPairElement(partition, c).HasElement(phone)) {
-          GetPairElement(new_stats, c)->AddStat(*dp);
-        }
-      }
+// Append the samples of segment to target, which have a phone in phones
+// at the given context position.
+void AllophoneStateModel::Data::SplitSegment(
+    int context_position, const PhoneSamples &segment,
+    const ContextSet &phones, SampleBuffer *target) const {
+  vector<const Sample*>::const_iterator begin =
+      buffer_->samples.begin() + segment.begin;
+  vector<const Sample*>::const_iterator end =
+      buffer_->samples.begin() + segment.end;
+  if (context_position == 0) {
+    // split by the center phone set
+    if (phones.HasElement(segment.phone))
+      target->samples.insert(target->samples.end(), begin, end);
+    return;
+  }
+  for (vector<const Sample*>::const_iterator s = begin; s != end; ++s) {
+    if (phones.HasElement(ContextPhone(context_position, **s)))
+      target->samples.push_back(*s);
+  }
+}
+
+// Phone at the given (non-center) context position of the sample.
+int AllophoneStateModel::Data::ContextPhone(int position,
+                                            const Sample &sample) {
+  int phone = -1;
+  if (position > 0)
+    phone = sample.right_context_[position - 1];
+  else
+    phone = sample.left_context_[-position - 1];
+  // apply phone symbol index shift
+  DCHECK_GT(phone, 0);
+  return phone - 1;
+}
+
+// The partitioned samples do not exceed the range of this model.
+void AllophoneStateModel::Data::CommitSplit(SplitResult *split) {
+  if (phones_.empty()) return;
+  const int offset = phones_.front().begin;
+  for (int c = 0; c < 2; ++c) {
+    AllophoneStateModel *state_model = GetPairElement(*split, c);
+    if (!state_model || !state_model->data_) continue;
+    Data *data = state_model->data_;
+    DCHECK(data->buffer_ != buffer_);
+    const vector<const Sample*> &scratch = data->buffer_->samples;
+    for (PhoneSampleList::iterator segment = data->phones_.begin();
+         segment != data->phones_.end(); ++segment) {
+      DCHECK_LE(offset + segment->end, phones_.back().end);
+      std::copy(scratch.begin() + segment->begin,
+                scratch.begin() + segment->end,
+                buffer_->samples.begin() + offset + segment->begin);
+      segment->begin += offset;
+      segment->end += offset;
     }
-    for (int c = 0; c < 2; ++c)
-      GetPairElement(*split, c)->data_->AddStat(GetPairElement(new_stats, c));
+    data->SetBuffer(buffer_);
   }
 }
 
+void AllophoneStateModel::Data::GetPhones(vector<int> *phones) const {
+  phones->clear();
+  for (PhoneSampleList::const_iterator segment = phones_.begin();
+       segment != phones_.end(); ++segment)
+    phones->push_back(segment->phone);
+}
 
+template<class S>
+void AllophoneStateModel::Data::SumCounts(S *sum) const {
+  if (phones_.empty()) return;
+  if (sum->dimension() <= 0)
+    sum->Reset(buffer_->samples[phones_.front().begin]->stat.dimension());
+  for (PhoneSampleList::const_iterator segment = phones_.begin();
+       segment != phones_.end(); ++segment) {
+    for (int i = segment->begin; i < segment->end; ++i)
+      sum->Accumulate(buffer_->samples[i]->stat);
+  }
+}
 
-void AllophoneStateModel::Data::SumCounts(Statistics *sum) const {
-  for (vector<HmmStateStat*>::const_iterator s = data_.begin();
-      s != data_.end(); ++s)
-    (*s)->SumStatistics(sum);
+void AllophoneStateModel::Data::GetSum(AccumulatorType type,
+                                       DoubleStatistics *sum) const {
+  if (phones_.empty()) {
+    *sum = DoubleStatistics();
+    return;
+  }
+  const int dim = buffer_->samples[phones_.front().begin]->stat.dimension();
+  sum->Reset(dim);
+  switch (type) {
+    case kDoubleAccumulator:
+      SumCounts(sum);
+      break;
+    case kCompensatedAccumulator: {
+      CompensatedStatistics compensated;
+      compensated.Reset(dim);
+      SumCounts(&compensated);
+      compensated.GetSum(sum);
+      break;
+    }
+    default: {
+      Statistics float_sum(dim);
+      SumCounts(&float_sum);
+      sum->Accumulate(float_sum);
+    }
+  }
 }
 
 // Evaluates the cost of the AllophoneStateModel by estimating the ML
 // distribution and determining the data likelihood under that distribution.
 void AllophoneStateModel::Data::EvalCost(const Scorer &scorer) {
-  Statistics sum;
-  SumCounts(&sum);
-  cost_ = scorer.score(sum);
-  have_cost_ = true;
+  EvalCosts(vector<Data*>(1, this), scorer);
+}
+
+// The statistics are summed using the precision requested by the scorer.
+void AllophoneStateModel::Data::EvalCosts(const vector<Data*> &models,
+                                          const Scorer &scorer) {
+  switch (scorer.accumulator()) {
+    case kDoubleAccumulator:
+      SumCosts<DoubleStatistics>(models, scorer);
+      break;
+    case kCompensatedAccumulator:
+      SumCosts<CompensatedStatistics>(models, scorer);
+      break;
+    default:
+      SumCosts<Statistics>(models, scorer);
+  }
+}
+
+namespace {
+// Type of the statistics to be scored. Compensated sums are scored in
+// double precision.
+template<class S> struct Result { typedef S Type; };
+template<> struct Result<CompensatedStatistics> {
+  typedef DoubleStatistics Type;
+};
+
+// Move the accumulated sums to the statistics to be scored.
+template<class S> void GetResults(vector<S> *sums, vector<S> *results) {
+  results->swap(*sums);
+}
+void GetResults(vector<CompensatedStatistics> *sums,
+                vector<DoubleStatistics> *results) {
+  results->resize(sums->size());
+  for (int i = 0; i < sums->size(); ++i) {
+    if ((*sums)[i].dimension() > 0)
+      (*sums)[i].GetSum(&(*results)[i]);
+  }
+}
+}  // namespace
+
+// The statistics of all models are summed first and then scored in one
+// batch.
+template<class S>
+void AllophoneStateModel::Data::SumCosts(const vector<Data*> &models,
+                                         const Scorer &scorer) {
+  typedef typename Result<S>::Type R;
+  vector<S> accumulators(models.size());
+  for (int i = 0; i < models.size(); ++i)
+    models[i]->SumCounts(&accumulators[i]);
+  vector<R> sums;
+  GetResults(&accumulators, &sums);
+  vector<const R*> stats(models.size());
+  for (int i = 0; i < models.size(); ++i)
+    stats[i] = &sums[i];
+  vector<float> costs(models.size());
+  scorer.ScoreAll(stats, &costs[0]);
+  for (int i = 0; i < models.size(); ++i)
+    models[i]->SetCost(costs[i]);
+}
+
+void AllophoneStateModel::Data::EvaluateQuestions(
+    int position, const ContextSet &context, const QuestionTable &table,
+    const vector<int> *questions, const Scorer &scorer,
+    SplitSelector *selector, vector<QuestionSplit> *splits) const {
+  switch (scorer.accumulator()) {
+    case kDoubleAccumulator:
+      SumQuestions<DoubleStatistics>(position, context, table, questions,
+                                     scorer, selector, splits);
+      break;
+    case kCompensatedAccumulator:
+      SumQuestions<CompensatedStatistics>(position, context, table, questions,
+                                          scorer, selector, splits);
+      break;
+    default:
+      SumQuestions<Statistics>(position, context, table, questions,
+                               scorer, selector, splits);
+  }
+}
+
+namespace {
+// Relative tolerance of the gain bounds.
+const double kGainBoundTolerance = 1e-5;
+
+// Side of the split by question q for a phone with the given table row.
+// Side 0 for phones in the question's phone set.
+inline int QuestionSide(const QuestionTable::Word *row, int q) {
+  return !((row[q / QuestionTable::kBitsPerWord] >>
+            (q % QuestionTable::kBitsPerWord)) & 1);
+}
+
+bool CompareBounds(const pair<double, int> &a, const pair<double, int> &b) {
+  return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+}  // namespace
+
+// The samples are summed per context phone first. The sums of the phones
+// are then added to the sums of the new models, which are scored in one
+// batch.
+template<class S>
+void AllophoneStateModel::Data::SumQuestions(
+    int position, const ContextSet &context, const QuestionTable &table,
+    const vector<int> *questions, const Scorer &scorer,
+    SplitSelector *selector, vector<QuestionSplit> *splits) const {
+  const int num_questions = table.NumQuestions();
+  QuestionSplit empty_split = { { 0, 0 }, { 0, 0 }, { 0, 0 }, false };
+  splits->assign(num_questions, empty_split);
+  if (phones_.empty()) return;
+  const int dim = buffer_->samples[phones_.front().begin]->stat.dimension();
+  typedef typename Result<S>::Type R;
+  vector<S> accumulators(table.NumPhones());
+  vector<int> phone_obs(table.NumPhones(), 0),
+      phone_contexts(table.NumPhones(), 0);
+  for (PhoneSampleList::const_iterator segment = phones_.begin();
+       segment != phones_.end(); ++segment) {
+    for (int i = segment->begin; i < segment->end; ++i) {
+      const Sample &sample = *buffer_->samples[i];
+      const int phone = (position == 0 ? segment->phone :
+                         ContextPhone(position, sample));
+      if (!context.HasElement(phone)) continue;
+      S &sum = accumulators[phone];
+      if (sum.dimension() <= 0)
+        sum.Reset(dim);
+      sum.Accumulate(sample.stat);
+      phone_obs[phone] += sample.stat.weight();
+      ++phone_contexts[phone];
+    }
+  }
+  vector<R> phone_sums;
+  GetResults(&accumulators, &phone_sums);
+  vector<int> phones;
+  for (int phone = 0; phone < table.NumPhones(); ++phone) {
+    if (!phone_contexts[phone]) continue;
+    phones.push_back(phone);
+    const QuestionTable::Word *row = table.Row(phone);
+    for (int q = 0; q < num_questions; ++q) {
+      const int side = QuestionSide(row, q);
+      QuestionSplit &split = (*splits)[q];
+      split.num_observations[side] += phone_obs[phone];
+      split.num_seen_contexts[side] += phone_contexts[phone];
+    }
+  }
+  if (selector) {
+    SelectQuestions(table, *questions, phones, phone_sums, scorer, selector,
+                    splits);
+    return;
+  }
+  vector<R> sums(2 * num_questions);
+  for (typename vector<R>::iterator sum = sums.begin(); sum != sums.end();
+       ++sum)
+    sum->Reset(dim);
+  for (vector<int>::const_iterator phone = phones.begin();
+       phone != phones.end(); ++phone) {
+    const QuestionTable::Word *row = table.Row(*phone);
+    for (int q = 0; q < num_questions; ++q)
+      sums[2 * q + QuestionSide(row, q)].Accumulate(phone_sums[*phone]);
+  }
+  vector<int> models;
+  for (int q = 0; q < num_questions; ++q) {
+    QuestionSplit &split = (*splits)[q];
+    for (int c = 0; c < 2; ++c) {
+      if (split.num_seen_contexts[c])
+        models.push_back(2 * q + c);
+    }
+    split.evaluated = true;
+  }
+  if (models.empty()) return;
+  BatchStatistics<typename R::Value> batch;
+  batch.Reset(models.size(), dim);
+  for (int i = 0; i < models.size(); ++i)
+    batch.Set(i, sums[models[i]]);
+  vector<float> costs(models.size());
+  scorer.score(batch, &costs[0]);
+  for (int i = 0; i < models.size(); ++i)
+    (*splits)[models[i] / 2].cost[models[i] % 2] = costs[i];
+}
+
+// The cost of a new model is bounded by the sum of the cost bounds of its
+// context phones and by the minimum cost of its number of observations.
+// The sums of the new models are accumulated in the same order as in
+// the evaluation of all questions and are scored by the batch scorer,
+// which yields identical costs.
+template<class S>
+void AllophoneStateModel::Data::SelectQuestions(
+    const QuestionTable &table, const vector<int> &questions,
+    const vector<int> &phones, const vector<S> &phone_sums,
+    const Scorer &scorer, SplitSelector *selector,
+    vector<QuestionSplit> *splits) const {
+  const int dim = buffer_->samples[phones_.front().begin]->stat.dimension();
+  vector<double> phone_bounds(phones.size());
+  for (int p = 0; p < phones.size(); ++p)
+    phone_bounds[p] = scorer.score_bound(phone_sums[phones[p]]);
+  vector< pair<double, int> > bounds;
+  bounds.reserve(questions.size());
+  for (vector<int>::const_iterator q = questions.begin();
+       q != questions.end(); ++q) {
+    double bound_sum[2] = { 0, 0 };
+    for (int p = 0; p < phones.size(); ++p)
+      bound_sum[QuestionSide(table.Row(phones[p]), *q)] += phone_bounds[p];
+    const QuestionSplit &split = (*splits)[*q];
+    double gain_bound = cost_;
+    for (int c = 0; c < 2; ++c) {
+      if (split.num_seen_contexts[c])
+        gain_bound -= std::max(
+            bound_sum[c], scorer.min_score(split.num_observations[c], dim));
+    }
+    bounds.push_back(std::make_pair(gain_bound, *q));
+  }
+  std::sort(bounds.begin(), bounds.end(), CompareBounds);
+  const double tolerance = kGainBoundTolerance * std::fabs(cost_);
+  S sums[2];
+  BatchStatistics<typename S::Value> batch;
+  for (vector< pair<double, int> >::const_iterator b = bounds.begin();
+       b != bounds.end(); ++b) {
+    if (b->first + tolerance < selector->MinGain()) break;
+    const int q = b->second;
+    QuestionSplit &split = (*splits)[q];
+    for (int c = 0; c < 2; ++c)
+      sums[c].Reset(dim);
+    for (vector<int>::const_iterator phone = phones.begin();
+         phone != phones.end(); ++phone)
+      sums[QuestionSide(table.Row(*phone), q)].Accumulate(phone_sums[*phone]);
+    batch.Reset(2, dim);
+    for (int c = 0; c < 2; ++c)
+      batch.Set(c, sums[c]);
+    float costs[2];
+    scorer.score(batch, costs);
+    for (int c = 0; c < 2; ++c) {
+      if (split.num_seen_contexts[c])
+        split.cost[c] = costs[c];
+    }
+    split.evaluated = true;
+    selector->AddSplit(split, cost_ - (split.cost[0] + split.cost[1]));
+  }
+}
+
+double AllophoneStateModel::Data::GainBound(
+    int position, const ContextSet &context, const Scorer &scorer) const {
+  double cost_bound;
+  switch (scorer.accumulator()) {
+    case kDoubleAccumulator:
+      cost_bound = CostBound<DoubleStatistics>(position, context, scorer);
+      break;
+    case kCompensatedAccumulator:
+      cost_bound = CostBound<CompensatedStatistics>(position, context, scorer);
+      break;
+    default:
+      cost_bound = CostBound<Statistics>(position, context, scorer);
+  }
+  return cost_ - cost_bound + kGainBoundTolerance * std::fabs(cost_);
+}
+
+// The new models of a split at the given position partition the context
+// phones. The sum of their costs is therefore bounded by the sum of the
+// cost bounds of all context phones and by the minimum cost of all
+// observations.
+template<class S>
+double AllophoneStateModel::Data::CostBound(
+    int position, const ContextSet &context, const Scorer &scorer) const {
+  if (phones_.empty()) return 0;
+  const int dim = buffer_->samples[phones_.front().begin]->stat.dimension();
+  typedef typename Result<S>::Type R;
+  vector<S> accumulators(context.Capacity());
+  double weight = 0;
+  for (PhoneSampleList::const_iterator segment = phones_.begin();
+       segment != phones_.end(); ++segment) {
+    for (int i = segment->begin; i < segment->end; ++i) {
+      const Sample &sample = *buffer_->samples[i];
+      const int phone = (position == 0 ? segment->phone :
+                         ContextPhone(position, sample));
+      if (!context.HasElement(phone)) continue;
+      S &sum = accumulators[phone];
+      if (sum.dimension() <= 0)
+        sum.Reset(dim);
+      sum.Accumulate(sample.stat);
+      weight += sample.stat.weight();
+    }
+  }
+  vector<R> phone_sums;
+  GetResults(&accumulators, &phone_sums);
+  double bound = 0;
+  for (typename vector<R>::const_iterator sum = phone_sums.begin();
+       sum != phone_sums.end(); ++sum) {
+    if (sum->dimension() > 0)
+      bound += scorer.score_bound(*sum);
+  }
+  return std::max(bound, scorer.min_score(weight, dim));
 }
 
 // Add the summed sufficient statistics for the AllophoneStateModel
@@ -295,10 +746,29 @@ void AllophoneStateModel::Data::AddToModel(
 
 // ======================================================
 
+void* AllophoneStateModel::operator new(size_t size, ModelPool *pool) {
+  return SlabPool<AllophoneStateModel>::Allocate(
+      pool ? &pool->state_models : NULL, size);
+}
+
+void AllophoneStateModel::operator delete(void *p, size_t size) {
+  SlabPool<AllophoneStateModel>::Free(p);
+}
+
+void AllophoneStateModel::operator delete(void *p, ModelPool *pool) {
+  SlabPool<AllophoneStateModel>::Free(p);
+}
+
 AllophoneStateModel::~AllophoneStateModel() {
   delete data_;
 }
 
+AllophoneStateModel* AllophoneStateModel::Clone() const {
+  AllophoneStateModel *m = new(pool_) AllophoneStateModel(state_, context_);
+  m->pool_ = pool_;
+  return m;
+}
+
 void AllophoneStateModel::AddAllophoneRef(AllophoneModel *model) {
   allophones_.push_front(model);
 }
@@ -311,8 +781,8 @@ AllophoneStateModel::SplitResult AllophoneStateModel::Split(
     int position, const ContextQuestion &question) const {
   AllophoneStateModel* new_models[2] = {Clone(), Clone()};
   for (int i = 0; i < 2; ++i) {
-    new_models[i]->context_.GetContextRef(position)->Intersect(
-        question.GetPhoneSet(i));
+    new_models[i]->context_.IntersectContext(position,
+                                             question.GetPhoneSet(i));
     if (new_models[i]->context_.GetContext(position).IsEmpty()) {
       delete new_models[i];
       new_models[i] = NULL;
@@ -333,23 +803,83 @@ void AllophoneStateModel::SplitAllophones(
   DCHECK_EQ(allophones_.size(), split->phone_models.size());
 }
 
-void AllophoneStateModel::AddStatistics(HmmStateStat *stat) {
-  if (!data_) data_ = new Data();
-  data_->AddStat(stat);
+void AllophoneStateModel::AddStatistics(
+    int phone, const Samples::SampleList &samples) {
+  if (!data_) data_ = new(pool_) Data();
+  data_->AddStat(phone, samples);
 }
 
 void AllophoneStateModel::SplitData(int position, SplitResult *split) const {
   data_->SplitData(position, split);
 }
 
+void AllophoneStateModel::CommitSplitData(SplitResult *split) {
+  if (data_) data_->CommitSplit(split);
+}
+
 // This will set the cost_ member of the data_ member of both
-// AllophoneStateModels in split.
+// AllophoneStateModels in split. All missing costs are computed by one
+// call of the batch scorer.
 void AllophoneStateModel::ComputeCosts(
     SplitResult *split, const Scorer &scorer) const {
+  vector<Data*> models;
+  if (!data_->HasCost())
+    models.push_back(data_);
+  for (int c = 0; c < 2; ++c) {
+    Data *data = GetPairElement(*split, c)->data_;
+    if (!data->HasCost())
+      models.push_back(data);
+  }
+  if (!models.empty())
+    Data::EvalCosts(models, scorer);
+}
+
+void AllophoneStateModel::EvaluateQuestions(
+    int position, const QuestionTable &table, const Scorer &scorer,
+    vector<QuestionSplit> *splits) const {
+  if (!data_->HasCost())
+    data_->EvalCost(scorer);
+  data_->EvaluateQuestions(position, context(position), table, NULL, scorer,
+                           NULL, splits);
+}
+
+void AllophoneStateModel::EvaluateQuestions(
+    int position, const QuestionTable &table, const vector<int> &questions,
+    const Scorer &scorer, SplitSelector *selector,
+    vector<QuestionSplit> *splits) const {
   if (!data_->HasCost())
     data_->EvalCost(scorer);
-  split->first->data_->EvalCost(scorer);
-  split->second->data_->EvalCost(scorer);
+  data_->EvaluateQuestions(position, context(position), table, &questions,
+                           scorer, selector, splits);
+}
+
+double AllophoneStateModel::GainBound(int position,
+                                      const Scorer &scorer) const {
+  if (!data_->HasCost())
+    data_->EvalCost(scorer);
+  return data_->GainBound(position, context(position), scorer);
+}
+
+bool AllophoneStateModel::HasCost() const {
+  return data_ && data_->HasCost();
+}
+
+void AllophoneStateModel::SetCost(float cost) {
+  DCHECK(data_ != NULL);
+  data_->SetCost(cost);
+}
+
+void AllophoneStateModel::GetSum(AccumulatorType type,
+                                 DoubleStatistics *sum) const {
+  DCHECK(data_ != NULL);
+  data_->GetSum(type, sum);
+}
+
+void AllophoneStateModel::GetDataPhones(vector<int> *phones) const {
+  if (data_)
+    data_->GetPhones(phones);
+  else
+    phones->clear();
 }
 
 void AllophoneStateModel::AddToModel(
@@ -394,6 +924,24 @@ string AllophoneStateModel::ToString() const {
 
 // ======================================================
 
+void* AllophoneModel::operator new(size_t size, ModelPool *pool) {
+  return SlabPool<AllophoneModel>::Allocate(pool ? &pool->models : NULL,
+                                            size);
+}
+
+void AllophoneModel::operator delete(void *p, size_t size) {
+  SlabPool<AllophoneModel>::Free(p);
+}
+
+void AllophoneModel::operator delete(void *p, ModelPool *pool) {
+  SlabPool<AllophoneModel>::Free(p);
+}
+
+// ======================================================
+
+ModelManager::ModelManager()
+    : num_state_models_(0), pool_(new ModelPool()) {}
+
 ModelManager::~ModelManager() {
   // collect all AllophoneModel objects and
   // delete AllophoneStateModel objects
@@ -412,16 +960,26 @@ ModelManager::~ModelManager() {
       i != models.end(); ++i) {
     delete *i;
   }
+  delete pool_;
+}
+
+void ModelManager::GetAllocations(ModelAllocations *allocations) const {
+  allocations->objects = pool_->state_models.NumAllocations() +
+      pool_->data.NumAllocations() + pool_->models.NumAllocations();
+  allocations->slabs = pool_->state_models.NumSlabs() +
+      pool_->data.NumSlabs() + pool_->models.NumSlabs();
 }
 
 AllophoneModel* ModelManager::InitAllophoneModel(
     int phone, int num_states, const PhoneContext &context) {
   CHECK(context.GetContext(0).HasElement(phone));
-  AllophoneModel *model = new AllophoneModel(phone, num_states);
+  AllophoneModel *model = new(pool_) AllophoneModel(phone, num_states);
+  model->pool_ = pool_;
   PhoneContext state_context = context;
   for (int s = 0; s < model->NumStates(); ++s) {
-    AllophoneStateModel *state_model = new AllophoneStateModel(s,
-                                                               state_context);
+    AllophoneStateModel *state_model =
+        new(pool_) AllophoneStateModel(s, state_context);
+    state_model->pool_ = pool_;
     model->SetStateModel(s, state_model);
     state_model->AddAllophoneRef(model);
     AddStateModel(state_model);
@@ -466,6 +1024,7 @@ ModelManager::StateModelRef ModelManager::ApplySplit(
     if (new_state_model)
       new_ref = AddStateModel(new_state_model);
   }
+  (*old_state_model)->CommitSplitData(new_models);
   return RemoveStateModel(old_state_model);
 }
 
@@ -42,6 +42,7 @@
 #include "debug.h"
 #include "context_set.h"
 #include "sample.h"
+#include "slab_pool.h"
 
 using std::list;
 using __gnu_cxx::slist;
@@ -52,50 +53,38 @@ namespace trainc {
 class Scorer;
 class GaussianModel;
 
-// Statistics for a context dependent HMM state.
-class HmmStateStat {
- public:
-  typedef std::vector<const Sample*> SampleRefList;
-
-  // Initialize statistics for HMM state of the given phone.
-  explicit HmmStateStat(int phone);
-
-  // Set the phone represented by the HMM.
-  void SetPhone(int phone) { phone_ = phone; }
-
-  // Phone represented by the HMM.
-  int phone() const { return phone_; }
-
-  // Set the samples for the model.
-  void SetStats(const Samples::SampleList &samples);
-
-  // Add a Sample object for the model.
-  void AddStat(const Sample *sample);
-
-  // Reference to the list of SuffStat objects.
-  const SampleRefList& stats() const { return samples_; }
-
-  // Number of seen contexts
-  int NumContexts();
-
-  // Total number of observations
-  int NumObservations();
-
-  // Sum the contained statistics
-  void SumStatistics(Statistics *sum) const;
+class AllophoneModel;
+struct ModelSplit;
 
-  // Dimensionality of the used features
-  void Dimension() const;
+// Statistics of the two new models of a split by a question, computed
+// without creating the new models.
+struct QuestionSplit {
+  float cost[2];
+  int num_observations[2];
+  int num_seen_contexts[2];
+  // false if the evaluation of the split has been pruned.
+  bool evaluated;
+};
 
- private:
-  int phone_;
-  int num_obs_, num_samples_;
-  SampleRefList samples_;
+// Required gain of the splits evaluated by
+// AllophoneStateModel::EvaluateQuestions.
+class SplitSelector {
+ public:
+  virtual ~SplitSelector() {}
+  // Splits with a lower gain can be pruned.
+  virtual float MinGain() const = 0;
+  // Called for each evaluated split.
+  virtual void AddSplit(const QuestionSplit &split, float gain) = 0;
 };
 
+// Number of AllophoneStateModels, AllophoneModels and their statistics
+// allocated and the number of slabs used for them (see SlabPool).
+struct ModelAllocations {
+  int64 objects, slabs;
+};
 
-class AllophoneModel;
-struct ModelSplit;
+// Slab pools of the models of a ModelManager.
+class ModelPool;
 
 // Model of a HMM state of a context dependent phone.
 // The object keeps track of the AllophoneModels that contain it.
@@ -106,16 +95,24 @@ class AllophoneStateModel {
 
   // Setup the model for the given state of a context dependent HMM.
   AllophoneStateModel(int state, const PhoneContext &context)
-      : data_(NULL), state_(state), context_(context) {}
+      : data_(NULL), pool_(NULL), state_(state), context_(context) {}
 
   ~AllophoneStateModel();
 
-  // Create a copy of the model.
+  // The models of a ModelManager are allocated from its ModelPool, split
+  // hypotheses create and delete many state models. Models created
+  // without a pool are allocated from the heap.
+  static void* operator new(size_t size) {
+    return operator new(size, static_cast<ModelPool*>(NULL));
+  }
+  static void* operator new(size_t size, ModelPool *pool);
+  static void operator delete(void *p, size_t size);
+  static void operator delete(void *p, ModelPool *pool);
+
+  // Create a copy of the model, allocated from the pool of this model.
   // The new object has an empty list of referring allophone models.
   // Remark: the Data object is not copied.
-  AllophoneStateModel* Clone() const {
-    return new AllophoneStateModel(state_, context_);
-  }
+  AllophoneStateModel* Clone() const;
 
   // Register an AllophoneModel object that contains this AllophoneStateModel.
   void AddAllophoneRef(AllophoneModel *model);
@@ -138,16 +135,67 @@ class AllophoneStateModel {
   void SplitAllophones(int position, const SplitResult &new_models,
                        ModelSplit *split) const;
 
-  // Add statistics to the model.
-  void AddStatistics(HmmStateStat *stat);
+  // Add the samples of the given phone to the model.
+  // Only valid before the model is split.
+  void AddStatistics(int phone, const Samples::SampleList &samples);
 
   // Distribute the statistics to the two new models in split.
   // position is the context position used to split the model.
+  // The sample references of both new models are stored in a scratch
+  // buffer shared by the two new models.
   void SplitData(int position, SplitResult *split) const;
 
+  // Move the sample references of the two new models in split to the
+  // range of sample references used by this model.
+  // Called when the split is applied, this model must not be used
+  // afterwards.
+  void CommitSplitData(SplitResult *split);
+
   // Compute the cost of both new AllophoneStateModels in split.
+  // The cost of a new model is not computed if it is already set.
   void ComputeCosts(SplitResult *split, const Scorer &scorer) const;
 
+  // Evaluate the splits by all questions in table at the given context
+  // position in one pass over the samples: the statistics are summed per
+  // context phone and distributed to the new models of each question
+  // using the membership bits of the phone.
+  // Only phones in context(position) are considered.
+  // Computes the cost of this model, if required.
+  void EvaluateQuestions(int position, const QuestionTable &table,
+                         const Scorer &scorer,
+                         vector<QuestionSplit> *splits) const;
+
+  // Evaluate the splits by the given questions (indexes in table),
+  // pruned using upper bounds of the gain derived from the statistics
+  // of the context phones. The questions are evaluated in order of
+  // decreasing bound until the bound is lower than selector->MinGain().
+  // The bounds are relaxed slightly to account for rounding errors.
+  void EvaluateQuestions(int position, const QuestionTable &table,
+                         const vector<int> &questions, const Scorer &scorer,
+                         SplitSelector *selector,
+                         vector<QuestionSplit> *splits) const;
+
+  // Upper bound of the gain of all splits of this model at the given
+  // context position, derived from the statistics of the context phones
+  // like the bounds used by EvaluateQuestions. The bound is relaxed
+  // slightly to account for rounding errors.
+  // Computes the cost of this model, if required.
+  double GainBound(int position, const Scorer &scorer) const;
+
+  // True if the cost of this model has been computed or set.
+  bool HasCost() const;
+
+  // Set the cost of this model, e.g. from a cache.
+  // Requires valid statistics.
+  void SetCost(float cost);
+
+  // The phones of the statistics of this model.
+  void GetDataPhones(vector<int> *phones) const;
+
+  // The summed statistics of this model, accumulated with the given
+  // precision. Requires valid statistics.
+  void GetSum(AccumulatorType type, DoubleStatistics *sum) const;
+
   // Add the statistics associated with this model to the given GaussianModel
   // using the given name.
   // Finalize() has to be called beforehand to ensure that the underlying
@@ -192,7 +240,10 @@ class AllophoneStateModel {
 
  private:
   class Data;
+  friend class ModelManager;
+  friend class ModelPool;
   Data *data_;
+  ModelPool *pool_;
   int state_;
   AllophoneRefList allophones_;
   PhoneContext context_;
@@ -211,10 +262,18 @@ class AllophoneModel {
 
   // Setup a model with num_state states and center phone phone.
   AllophoneModel(int phone, int num_states)
-      : states_(static_cast<size_t>(num_states), NULL),
+      : pool_(NULL), states_(static_cast<size_t>(num_states), NULL),
         phones_(1, phone) {}
 
-  // Create a copy of the model.
+  // Allocated from the ModelPool of a ModelManager, see AllophoneStateModel.
+  static void* operator new(size_t size) {
+    return operator new(size, static_cast<ModelPool*>(NULL));
+  }
+  static void* operator new(size_t size, ModelPool *pool);
+  static void operator delete(void *p, size_t size);
+  static void operator delete(void *p, ModelPool *pool);
+
+  // Create a copy of the model, allocated from the pool of this model.
   // The AllophoneStateModels remain the same.
   AllophoneModel* Clone() const;
 
@@ -262,8 +321,10 @@ class AllophoneModel {
  private:
   // Only used by Clone()
   explicit AllophoneModel(int num_states)
-      : states_(static_cast<size_t>(num_states), NULL) {}
+      : pool_(NULL), states_(static_cast<size_t>(num_states), NULL) {}
 
+  friend class ModelManager;
+  ModelPool *pool_;
   vector<AllophoneStateModel*> states_;
   vector<int> phones_;
 
@@ -283,10 +344,12 @@ class ModelManager {
   typedef StateModelList::const_iterator StateModelConstRef;
   typedef pair<StateModelRef, StateModelRef> SplitResult;
 
-  ModelManager() : num_state_models_(0) {}
+  ModelManager();
 
   // Delete all remaining AllophoneStateModel objects and all
-  // AllophoneModel objects associated with them.
+  // AllophoneModel objects associated with them and release the slabs
+  // of the model pool. All models created by splits of the managed models
+  // have to be deleted before, see ModelSplitter::Cleanup().
   ~ModelManager();
 
   // Create a new AllophoneModel for the given phone with num_states
@@ -297,6 +360,10 @@ class ModelManager {
   // Number of AllophoneStateModels currently registered.
   int NumStateModels() const { return num_state_models_; }
 
+  // Allocations of the models created by this object and by splits of
+  // its models.
+  void GetAllocations(ModelAllocations *allocations) const;
+
   // Add a new AllophoneStateModel.
   // Returns an iterator that can be used to remove the AllophoneStateModel.
   StateModelRef AddStateModel(AllophoneStateModel *state_model);
@@ -341,6 +408,7 @@ class ModelManager {
   // maintains the number of registered state models,
   int num_state_models_;
   StateModelList state_models_;
+  ModelPool *pool_;
 
   DISALLOW_COPY_AND_ASSIGN(ModelManager);
 };
@@ -16,13 +16,18 @@
 // Author: rybach@google.com (David Rybach)
 //
 // Tests for the classes PhoneContext, AllophoneStateModel, AllphoneModel,
-// Phones. Check basic functionality. No tests for methods that depend on
-// AllphoneStateModel::Data.
+// Phones. Check basic functionality.
 
+#include <algorithm>
+#include <cmath>
 #include <ext/numeric>
 #include "unittest.h"
 #include "util.h"
 #include "phone_models.h"
+#include "scorer.h"
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
 
 using __gnu_cxx::iota;
 
@@ -177,6 +182,344 @@ TEST_F(AllophoneStateModelTest, SplitAllophones) {
   }
 }
 
+TEST_F(AllophoneStateModelTest, SplitData) {
+  const int phone = 9;
+  const int num_samples = 7;
+  Samples::SampleList samples;
+  for (int i = 0; i < num_samples; ++i) {
+    samples.push_back(Sample(1));
+    Sample &sample = samples.back();
+    sample.stat.SetWeight(i + 1);
+    // phone symbols are shifted by one
+    sample.left_context_.push_back((i % 3 ? pl1 : pl2) + 1);
+    sample.right_context_.push_back(pr + 1);
+  }
+  a_->AddStatistics(phone, samples);
+  EXPECT_EQ(num_samples, a_->NumSeenContexts());
+  EXPECT_EQ(28, a_->NumObservations());
+  ContextSet qc(num_phones);
+  qc.Add(pl1);
+  ContextQuestion q(qc);
+  AllophoneStateModel::SplitResult s = a_->Split(-1, q);
+  a_->SplitData(-1, &s);
+  // pl2: samples 0, 3, 6
+  EXPECT_EQ(4, s.first->NumSeenContexts());
+  EXPECT_EQ(2 + 3 + 5 + 6, s.first->NumObservations());
+  EXPECT_EQ(3, s.second->NumSeenContexts());
+  EXPECT_EQ(1 + 4 + 7, s.second->NumObservations());
+  a_->CommitSplitData(&s);
+  delete a_;
+  a_ = NULL;
+  EXPECT_EQ(4, s.first->NumSeenContexts());
+  EXPECT_EQ(3, s.second->NumSeenContexts());
+  // split by the right context: all samples in the first model
+  ContextSet qr(num_phones);
+  qr.Add(pr);
+  ContextQuestion q2(qr);
+  AllophoneStateModel::SplitResult s2 = s.second->Split(1, q2);
+  ASSERT_TRUE(s2.first != NULL);
+  EXPECT_TRUE(s2.second == NULL);
+  delete s2.first;
+  // split by the center phone.
+  ContextSet qp(num_phones);
+  qp.Add(phone);
+  ContextQuestion q3(qp);
+  s.second->GetContextRef()->AddToContext(0, phone);
+  s.second->GetContextRef()->AddToContext(0, phone - 1);
+  AllophoneStateModel::SplitResult s3 = s.second->Split(0, q3);
+  ASSERT_TRUE(s3.first && s3.second);
+  s.second->SplitData(0, &s3);
+  EXPECT_EQ(3, s3.first->NumSeenContexts());
+  EXPECT_EQ(1 + 4 + 7, s3.first->NumObservations());
+  EXPECT_EQ(0, s3.second->NumSeenContexts());
+  delete s3.first;
+  delete s3.second;
+  delete s.first;
+  delete s.second;
+}
+
+// The scratch buffers of deleted hypotheses are reused, while the samples
+// of existing hypotheses are kept.
+TEST_F(AllophoneStateModelTest, SplitDataScratch) {
+  const int phone = 9;
+  const int num_samples = 6;
+  Samples::SampleList samples;
+  for (int i = 0; i < num_samples; ++i) {
+    samples.push_back(Sample(1));
+    Sample &sample = samples.back();
+    sample.stat.SetWeight(i + 1);
+    sample.left_context_.push_back((i % 2 ? pl1 : pl2) + 1);
+    sample.right_context_.push_back(pr + 1);
+  }
+  a_->AddStatistics(phone, samples);
+  ContextSet qc(num_phones);
+  qc.Add(pl1);
+  ContextQuestion q(qc);
+  AllophoneStateModel::SplitResult kept = a_->Split(-1, q);
+  a_->SplitData(-1, &kept);
+  for (int n = 0; n < 3; ++n) {
+    AllophoneStateModel::SplitResult s = a_->Split(-1, q);
+    a_->SplitData(-1, &s);
+    EXPECT_EQ(3, s.first->NumSeenContexts());
+    EXPECT_EQ(2 + 4 + 6, s.first->NumObservations());
+    EXPECT_EQ(1 + 3 + 5, s.second->NumObservations());
+    delete s.first;
+    delete s.second;
+  }
+  EXPECT_EQ(2 + 4 + 6, kept.first->NumObservations());
+  a_->CommitSplitData(&kept);
+  EXPECT_EQ(1 + 3 + 5, kept.second->NumObservations());
+  delete kept.first;
+  delete kept.second;
+}
+
+// The splits evaluated by EvaluateQuestions are equal to the splits
+// created by SplitData.
+TEST_F(AllophoneStateModelTest, EvaluateQuestions) {
+  const int phone = 9;
+  const int num_samples = 20;
+  Samples::SampleList samples;
+  for (int i = 0; i < num_samples; ++i) {
+    samples.push_back(Sample(2));
+    Sample &sample = samples.back();
+    sample.stat.SetWeight(i % 4 + 1);
+    for (int d = 0; d < 2; ++d) {
+      sample.stat.SumRef()[d] = i * (d + 1);
+      sample.stat.Sum2Ref()[d] = i * i * (d + 2);
+    }
+    // phone symbols are shifted by one
+    sample.left_context_.push_back((i % 3 ? pl1 : pl2) + 1);
+    sample.right_context_.push_back(pr + 1);
+  }
+  a_->AddStatistics(phone, samples);
+  vector<ContextQuestion*> questions;
+  for (int q = 0; q < 3; ++q) {
+    ContextSet c(num_phones);
+    if (q != 1) c.Add(pl1);
+    if (q != 0) c.Add(pl2);
+    questions.push_back(new ContextQuestion(c));
+  }
+  QuestionTable table;
+  table.Init(num_phones, questions);
+  MaximumLikelihoodScorer scorer(0.001);
+  vector<QuestionSplit> splits;
+  a_->EvaluateQuestions(-1, table, scorer, &splits);
+  ASSERT_EQ(questions.size(), splits.size());
+  for (int q = 0; q < questions.size(); ++q) {
+    AllophoneStateModel::SplitResult s = a_->Split(-1, *questions[q]);
+    AllophoneStateModel *models[2] = { s.first, s.second };
+    if (s.first && s.second) {
+      a_->SplitData(-1, &s);
+      a_->ComputeCosts(&s, scorer);
+    }
+    for (int c = 0; c < 2; ++c) {
+      if (!models[c]) {
+        EXPECT_EQ(0, splits[q].num_seen_contexts[c]);
+        continue;
+      }
+      if (!(s.first && s.second)) continue;
+      EXPECT_EQ(models[c]->NumSeenContexts(), splits[q].num_seen_contexts[c]);
+      EXPECT_EQ(models[c]->NumObservations(), splits[q].num_observations[c]);
+      EXPECT_LT(fabs(models[c]->GetCost() - splits[q].cost[c]),
+                1e-4 * fabs(models[c]->GetCost()));
+    }
+    delete s.first;
+    delete s.second;
+  }
+  STLDeleteElements(&questions);
+}
+
+// Samples with mean 1000 and variance 1: the float sum of squares looses
+// the variance, the compensated sum has to be scored in double precision.
+TEST_F(AllophoneStateModelTest, CompensatedCost) {
+  const int phone = 9;
+  const int num_samples = 100000;
+  Samples::SampleList samples;
+  for (int i = 0; i < num_samples; ++i) {
+    samples.push_back(Sample(1));
+    Sample &sample = samples.back();
+    const float v = 1000 + (i % 2 ? 1 : -1);
+    sample.stat.SetWeight(1.0);
+    sample.stat.SumRef()[0] = v;
+    sample.stat.Sum2Ref()[0] = v * v;
+    // phone symbols are shifted by one
+    sample.left_context_.push_back((i % 4 < 2 ? pl1 : pl2) + 1);
+    sample.right_context_.push_back(pr + 1);
+  }
+  a_->AddStatistics(phone, samples);
+  ContextSet c(num_phones);
+  c.Add(pl1);
+  vector<ContextQuestion*> questions(1, new ContextQuestion(c));
+  QuestionTable table;
+  table.Init(num_phones, questions);
+  MaximumLikelihoodScorer scorer(0.001);
+  scorer.SetAccumulator(kCompensatedAccumulator);
+  // variance 1
+  const double expected = 0.25 * num_samples * (1 + std::log(M_PI + M_PI));
+  AllophoneStateModel::SplitResult s = a_->Split(-1, *questions[0]);
+  ASSERT_TRUE(s.first && s.second);
+  a_->SplitData(-1, &s);
+  a_->ComputeCosts(&s, scorer);
+  EXPECT_LT(fabs(s.first->GetCost() - expected), 1e-5 * expected);
+  EXPECT_LT(fabs(s.second->GetCost() - expected), 1e-5 * expected);
+  vector<QuestionSplit> splits;
+  a_->EvaluateQuestions(-1, table, scorer, &splits);
+  ASSERT_EQ(1, splits.size());
+  for (int c = 0; c < 2; ++c)
+    EXPECT_LT(fabs(splits[0].cost[c] - expected), 1e-5 * expected);
+  delete s.first;
+  delete s.second;
+  STLDeleteElements(&questions);
+}
+
+// The memory of deleted state models is reused. The models are allocated
+// from the pool of their ModelManager, other models from the heap.
+TEST_F(AllophoneStateModelTest, Allocation) {
+  const int phone = 1;
+  PhoneContext context = *pc_;
+  context.AddToContext(0, phone);
+  ModelManager models;
+  const AllophoneStateModel *state_model =
+      models.InitAllophoneModel(phone, 1, context)->GetStateModel(0);
+  ModelAllocations before, after;
+  models.GetAllocations(&before);
+  EXPECT_EQ(2, before.objects);
+  AllophoneStateModel *model = state_model->Clone();
+  const void *address = model;
+  delete model;
+  model = state_model->Clone();
+  EXPECT_EQ(address, static_cast<const void*>(model));
+  delete model;
+  delete a_->Clone();
+  models.GetAllocations(&after);
+  EXPECT_EQ(before.objects + 2, after.objects);
+  EXPECT_EQ(2, after.slabs);
+}
+
+#ifdef HAVE_THREADS
+// Clones a state model several times.
+class CloneThread : public threads::Thread {
+ public:
+  CloneThread(const AllophoneStateModel *model, int num_models,
+              vector<AllophoneStateModel*> *models)
+      : model_(model), num_models_(num_models), models_(models) {}
+ protected:
+  virtual void Run() {
+    for (int i = 0; i < num_models_; ++i)
+      models_->push_back(model_->Clone());
+  }
+ private:
+  const AllophoneStateModel *model_;
+  int num_models_;
+  vector<AllophoneStateModel*> *models_;
+};
+
+// The memory of state models allocated by other threads and deleted by
+// the main thread is reused. The number of slabs does not grow with the
+// number of threads.
+TEST_F(AllophoneStateModelTest, AllocationThreads) {
+  const int num_threads = 10;
+  const int num_models = 1000;
+  const int phone = 1;
+  PhoneContext context = *pc_;
+  context.AddToContext(0, phone);
+  ModelManager manager;
+  const AllophoneStateModel *state_model =
+      manager.InitAllophoneModel(phone, 1, context)->GetStateModel(0);
+  ModelAllocations before, after;
+  manager.GetAllocations(&before);
+  for (int t = 0; t < num_threads; ++t) {
+    vector<AllophoneStateModel*> models;
+    CloneThread thread(state_model, num_models, &models);
+    EXPECT_TRUE(thread.Start());
+    thread.Wait();
+    EXPECT_EQ(num_models, models.size());
+    STLDeleteElements(&models);
+  }
+  manager.GetAllocations(&after);
+  EXPECT_EQ(before.objects + num_threads * num_models, after.objects);
+  const int slab_objects = SlabPool<AllophoneStateModel>::SlabObjects();
+  EXPECT_LE(after.slabs - before.slabs,
+            2 * (num_models / slab_objects + 1));
+}
+#endif
+
+// Splits with a fixed minimum gain.
+class FixedGainSelector : public SplitSelector {
+ public:
+  explicit FixedGainSelector(float min_gain)
+      : num_splits(0), min_gain_(min_gain) {}
+  float MinGain() const { return min_gain_; }
+  void AddSplit(const QuestionSplit &split, float gain) { ++num_splits; }
+  int num_splits;
+ private:
+  float min_gain_;
+};
+
+// The splits evaluated with pruning have the same costs as without pruning.
+// The right context has a single phone, all of its splits are pruned.
+TEST_F(AllophoneStateModelTest, EvaluateQuestionsPruned) {
+  const int phone = 9;
+  const int num_samples = 60;
+  const int num_context_phones = 6;
+  for (int p = 1; p <= num_context_phones; ++p)
+    a_->GetContextRef()->AddToContext(-1, p);
+  Samples::SampleList samples;
+  for (int i = 0; i < num_samples; ++i) {
+    const int context = i % num_context_phones + 1;
+    samples.push_back(Sample(2));
+    Sample &sample = samples.back();
+    const float weight = i % 4 + 1;
+    sample.stat.SetWeight(weight);
+    for (int d = 0; d < 2; ++d) {
+      const float mean = 10 * context * (d + 1) + i % 3;
+      sample.stat.SumRef()[d] = weight * mean;
+      sample.stat.Sum2Ref()[d] = weight * (mean * mean + context);
+    }
+    sample.left_context_.push_back(context + 1);
+    sample.right_context_.push_back(pr + 1);
+  }
+  a_->AddStatistics(phone, samples);
+  // all non-trivial subsets of the context phones
+  vector<ContextQuestion*> questions;
+  vector<int> question_index;
+  for (int q = 1; q < (1 << num_context_phones) - 1; ++q) {
+    ContextSet c(num_phones);
+    for (int p = 0; p < num_context_phones; ++p)
+      if (q & (1 << p)) c.Add(p + 1);
+    question_index.push_back(questions.size());
+    questions.push_back(new ContextQuestion(c));
+  }
+  QuestionTable table;
+  table.Init(num_phones, questions);
+  MaximumLikelihoodScorer scorer(0.001);
+  vector<QuestionSplit> splits, pruned;
+  a_->EvaluateQuestions(-1, table, scorer, &splits);
+  float max_gain = 0;
+  for (int q = 0; q < splits.size(); ++q)
+    max_gain = std::max(max_gain, a_->GetCost() -
+                        (splits[q].cost[0] + splits[q].cost[1]));
+  FixedGainSelector selector(0.5 * max_gain);
+  a_->EvaluateQuestions(-1, table, question_index, scorer, &selector,
+                        &pruned);
+  ASSERT_EQ(splits.size(), pruned.size());
+  EXPECT_EQ(questions.size(), selector.num_splits);
+  for (int q = 0; q < splits.size(); ++q) {
+    EXPECT_TRUE(pruned[q].evaluated);
+    for (int c = 0; c < 2; ++c) {
+      EXPECT_EQ(splits[q].cost[c], pruned[q].cost[c]);
+      EXPECT_EQ(splits[q].num_observations[c], pruned[q].num_observations[c]);
+      EXPECT_EQ(splits[q].num_seen_contexts[c],
+                pruned[q].num_seen_contexts[c]);
+    }
+  }
+  a_->EvaluateQuestions(1, table, question_index, scorer, &selector,
+                        &pruned);
+  EXPECT_EQ(questions.size(), selector.num_splits);
+  for (int q = 0; q < pruned.size(); ++q)
+    EXPECT_FALSE(pruned[q].evaluated);
+  STLDeleteElements(&questions);
+}
 
 class PhonesTest : public ::testing::Test {
  protected:
@@ -168,12 +168,17 @@ bool RecipeWriter::Init() {
 
 void RecipeWriter::AddSplit(const SplitHypothesis &split) {
   SplitDef def;
-  def.position = split.position;
-  def.question = GetQuestionId(split.position, split.question);
-  def.model = AllophoneStateModelStub(**split.model);
+  GetSplitDef(split, &def);
   out_.WriteBinary(def);
 }
 
+void RecipeWriter::GetSplitDef(const SplitHypothesis &split,
+                               SplitDef *def) const {
+  def->position = split.position;
+  def->question = GetQuestionId(split.position, split.question);
+  def->model = AllophoneStateModelStub(**split.model);
+}
+
 int RecipeWriter::GetQuestionId(int pos, const ContextQuestion *question) const {
   const QuestionSet &questions = *questions_->at(num_left_contexts_ + pos);
   QuestionSet::const_iterator i =
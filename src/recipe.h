@@ -58,6 +58,10 @@ struct SplitDef {
   AllophoneStateModelStub model;
 };
 
+// Binary encoding of a SplitDef, see recipe.cc.
+template<> void OutputBuffer::WriteBinary(const SplitDef &def);
+template<> bool InputBuffer::ReadBinary(SplitDef *def);
+
 class RecipeWriter {
   typedef ContextBuilder::QuestionSet QuestionSet;
 public:
@@ -70,6 +74,8 @@ public:
   }
   bool Init();
   void AddSplit(const SplitHypothesis &split);
+  // Convert the split hypothesis to its serializable representation.
+  void GetSplitDef(const SplitHypothesis &split, SplitDef *def) const;
 
   typedef uint32_t Header;
   static const Header kHeader;
@@ -75,7 +75,9 @@ TEST_F(RecipeTest, IsEqual) {
   a_->AddAllophoneRef(&am2);
 
   AllophoneStateModel *a2 = a_->Clone();
-  a2->GetContextRef()->GetContextRef(-1)->Remove(pl1);
+  ContextSet left_context = a2->context(-1);
+  left_context.Remove(pl1);
+  a2->GetContextRef()->SetContext(-1, left_context);
 
   EXPECT_TRUE(AllophoneModelStub(am1).IsEqual(am1));
   EXPECT_FALSE(AllophoneModelStub(am1).IsEqual(am2));
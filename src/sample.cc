@@ -15,6 +15,9 @@
 // Copyright 2010 RWTH Aachen University. All Rights Reserved.
 // Author: rybach@cs.rwth-aachen.de (David Rybach)
 
+#include <cmath>
+#include <ext/hash_set>
+#include "hash.h"
 #include "sample.h"
 
 namespace trainc {
@@ -22,6 +25,10 @@ namespace trainc {
 Samples::Samples()
   : feature_dim_(-1) {}
 
+Samples::~Samples() {
+  STLDeleteElements(&blocks_);
+}
+
 void Samples::SetNumPhones(int num_phones) {
   samples_.resize(num_phones);
 }
@@ -55,16 +62,319 @@ Sample* Samples::AddSample(int phone, int state) {
   return &sample_list.back();
 }
 
-void Statistics::AddObservation(const std::vector<float> &observation, float w) {
+void Samples::Merge(Samples *other) {
+  CHECK_EQ(NumPhones(), other->NumPhones());
+  CHECK(blocks_.empty());
+  blocks_.swap(other->blocks_);
+  if (feature_dim_ < 0) feature_dim_ = other->feature_dim_;
+  for (int phone = 0; phone < other->samples_.size(); ++phone) {
+    std::vector<SampleList> &src = other->samples_[phone];
+    std::vector<SampleList> &dst = samples_[phone];
+    if (src.size() > dst.size())
+      dst.resize(src.size());
+    for (int state = 0; state < src.size(); ++state) {
+      if (!src[state].empty())
+        CHECK_EQ(feature_dim_, other->feature_dim_);
+      dst[state].splice(dst[state].end(), src[state]);
+    }
+  }
+}
+
+namespace {
+
+// Hash and equality of the contexts of a sample.
+struct SampleContextHash {
+  size_t operator()(const Sample *s) const {
+    size_t h = HashRange(s->left_context_.begin(), s->left_context_.end(),
+                         s->left_context_.size());
+    return HashRange(s->right_context_.begin(), s->right_context_.end(), h);
+  }
+};
+
+struct SampleContextEqual {
+  bool operator()(const Sample *a, const Sample *b) const {
+    return a->left_context_ == b->left_context_ &&
+        a->right_context_ == b->right_context_;
+  }
+};
+
+}  // namespace
+
+int Samples::MergeDuplicates() {
+  Samples all;
+  all.SetNumPhones(NumPhones());
+  all.Merge(this);
+  SampleMerger merger(this);
+  merger.Add(&all);
+  return merger.NumMerged();
+}
+
+int Samples::NumSamples() const {
+  int n = 0;
+  for (int phone = 0; phone < samples_.size(); ++phone) {
+    for (int state = 0; state < samples_[phone].size(); ++state)
+      n += samples_[phone][state].size();
+  }
+  return n;
+}
+
+// ====================================================================
+
+class SampleMerger::ContextIndex :
+    public __gnu_cxx::hash_set<Sample*, SampleContextHash,
+                               SampleContextEqual> {};
+
+SampleMerger::SampleMerger(Samples *target)
+    : target_(target), num_merged_(0) {}
+
+SampleMerger::~SampleMerger() {
+  for (int phone = 0; phone < index_.size(); ++phone)
+    STLDeleteElements(&index_[phone]);
+}
+
+SampleMerger::ContextIndex* SampleMerger::GetIndex(int phone, int state) {
+  if (phone >= index_.size())
+    index_.resize(phone + 1);
+  if (state >= index_[phone].size())
+    index_[phone].resize(state + 1, NULL);
+  ContextIndex *&index = index_[phone][state];
+  if (!index) {
+    index = new ContextIndex();
+    Samples::SampleList &samples = target_->samples_[phone][state];
+    for (Samples::SampleList::iterator s = samples.begin();
+         s != samples.end(); ++s)
+      index->insert(&*s);
+  }
+  return index;
+}
+
+void SampleMerger::Add(Samples *other) {
+  typedef Samples::SampleList SampleList;
+  CHECK_EQ(target_->NumPhones(), other->NumPhones());
+  CHECK(target_->blocks_.empty());
+  CHECK(other->blocks_.empty());
+  if (target_->feature_dim_ < 0)
+    target_->feature_dim_ = other->feature_dim_;
+  for (int phone = 0; phone < other->samples_.size(); ++phone) {
+    std::vector<SampleList> &src = other->samples_[phone];
+    std::vector<SampleList> &dst = target_->samples_[phone];
+    if (src.size() > dst.size())
+      dst.resize(src.size());
+    for (int state = 0; state < src.size(); ++state) {
+      SampleList &src_samples = src[state];
+      if (src_samples.empty()) continue;
+      CHECK_EQ(target_->feature_dim_, other->feature_dim_);
+      SampleList &dst_samples = dst[state];
+      ContextIndex *index = GetIndex(phone, state);
+      for (SampleList::iterator s = src_samples.begin();
+           s != src_samples.end();) {
+        ContextIndex::const_iterator i = index->find(&*s);
+        if (i != index->end()) {
+          (*i)->stat.Accumulate(s->stat);
+          s = src_samples.erase(s);
+          ++num_merged_;
+        } else {
+          SampleList::iterator next = s;
+          ++next;
+          dst_samples.splice(dst_samples.end(), src_samples, s);
+          index->insert(&dst_samples.back());
+          s = next;
+        }
+      }
+    }
+  }
+}
+
+namespace {
+
+// Statistics of the samples of one phone and HMM state.
+StatisticsBlock* CreateBlock(StatisticsFormat format,
+                             const Samples::SampleList &samples) {
+  StatisticsBlock *block = new StatisticsBlock();
+  block->format = format;
+  if (format != kBlockScaledFormat)
+    return block;
+  const int dim = samples.front().stat.dimension();
+  std::vector<float> max_mean(dim, 0.0), max_var(dim, 0.0);
+  float mean, var;
+  for (Samples::SampleList::const_iterator s = samples.begin();
+       s != samples.end(); ++s) {
+    for (int d = 0; d < dim; ++d) {
+      s->stat.GetMoments(d, &mean, &var);
+      max_mean[d] = std::max(max_mean[d], std::fabs(mean));
+      max_var[d] = std::max(max_var[d], var);
+    }
+  }
+  block->mean_scale.resize(dim);
+  block->variance_scale.resize(dim);
+  for (int d = 0; d < dim; ++d) {
+    block->mean_scale[d] = max_mean[d] > 0 ? max_mean[d] / 32767 : 1.0;
+    block->variance_scale[d] = max_var[d] > 0 ? max_var[d] / 65535 : 1.0;
+  }
+  return block;
+}
+
+}  // namespace
+
+void Samples::Pack(StatisticsFormat format) {
+  if (format == kFloatFormat) return;
+  StatisticsBlock *shared = NULL;
+  for (int phone = 0; phone < samples_.size(); ++phone) {
+    for (int state = 0; state < samples_[phone].size(); ++state) {
+      SampleList &samples = samples_[phone][state];
+      if (samples.empty()) continue;
+      StatisticsBlock *block = shared;
+      if (!block) {
+        block = CreateBlock(format, samples);
+        blocks_.push_back(block);
+        if (format != kBlockScaledFormat)
+          shared = block;
+      }
+      for (SampleList::iterator s = samples.begin(); s != samples.end(); ++s)
+        s->stat.Pack(block);
+    }
+  }
+}
+
+// ====================================================================
+
+namespace {
+uint16_t Quantize(float value, float min, float max) {
+  const float q = std::floor(value + 0.5f);
+  return static_cast<int>(std::max(min, std::min(max, q)));
+}
+}  // namespace
+
+void SampleStatistics::Pack(const StatisticsBlock *block) {
+  CHECK(!block_);
+  std::vector<float> packed(1 + dim_);
+  packed[0] = weight();
+  float mean, var;
+  for (int d = 0; d < dim_; ++d) {
+    GetMoments(d, &mean, &var);
+    uint16_t m = 0, v = 0;
+    switch (block->format) {
+      case kHalfFormat:
+        m = FloatToHalf(mean);
+        v = FloatToHalf(var);
+        break;
+      case kBFloat16Format:
+        m = FloatToBFloat16(mean);
+        v = FloatToBFloat16(var);
+        break;
+      case kBlockScaledFormat:
+        m = Quantize(mean / block->mean_scale[d], -32767, 32767);
+        v = Quantize(var / block->variance_scale[d], 0, 65535);
+        break;
+      default:
+        LOG(FATAL) << "invalid format";
+    }
+    const uint32_t word = m | (static_cast<uint32_t>(v) << 16);
+    memcpy(&packed[1 + d], &word, sizeof(word));
+  }
+  // the packed values replace the float values and their memory
+  data_.swap(packed);
+  block_ = block;
+}
+
+void SampleStatistics::GetMoments(int d, float *mean, float *variance) const {
+  if (block_) {
+    const uint32_t word = PackedWord(d);
+    if (block_->format == kHalfFormat) {
+      HalfDecoder()(d, word, mean, variance);
+    } else if (block_->format == kBFloat16Format) {
+      BFloat16Decoder()(d, word, mean, variance);
+    } else {
+      const BlockDecoder decoder(*block_);
+      decoder(d, word, mean, variance);
+    }
+    return;
+  }
+  const float w = weight();
+  if (w <= 0) {
+    *mean = *variance = 0;
+    return;
+  }
+  *mean = sum()[d] / w;
+  *variance = std::max(sum2()[d] / w - *mean * *mean, 0.0f);
+}
+
+// ====================================================================
+
+template<class T>
+void BasicStatistics<T>::AddObservation(const std::vector<float> &observation,
+                                        float w) {
   CHECK_EQ(dimension(), observation.size());
   SetWeight(weight() + w);
-  float *s = SumRef();
-  float *s2 = Sum2Ref();
+  T *s = SumRef();
+  T *s2 = Sum2Ref();
   for (int d = 0; d < dimension(); ++d, ++s, ++s2) {
-    const float &o = observation[d];
+    const T o = observation[d];
     *s += o;
     *s2 += o * o;
   }
 }
 
+template class BasicStatistics<float>;
+template class BasicStatistics<double>;
+
+void CompensatedStatistics::Accumulate(const Statistics &other) {
+  DCHECK_EQ(dimension(), other.dimension());
+  float *sum = sum_.ValuesRef();
+  const float *v = other.values();
+  std::vector<float>::iterator c = compensation_.begin();
+  for (; c != compensation_.end(); ++c, ++sum, ++v) {
+    const float y = *v - *c;
+    const float t = *sum + y;
+    *c = (t - *sum) - y;
+    *sum = t;
+  }
+}
+
+void CompensatedStatistics::Accumulate(const SampleStatistics &other) {
+  if (!other.IsPacked()) {
+    Accumulate(static_cast<const Statistics&>(other));
+    return;
+  }
+  Statistics values(other.dimension());
+  other.AddTo(&values);
+  Accumulate(values);
+}
+
+// The compensation holds the negated low order part lost in the float sum.
+void CompensatedStatistics::GetSum(DoubleStatistics *sum) const {
+  sum->Reset(dimension());
+  double *v = sum->ValuesRef();
+  const float *s = sum_.values();
+  std::vector<float>::const_iterator c = compensation_.begin();
+  for (; c != compensation_.end(); ++c, ++v, ++s)
+    *v = static_cast<double>(*s) - *c;
+}
+
+bool ParseAccumulatorType(const std::string &name, AccumulatorType *type) {
+  if (name == "float")
+    *type = kFloatAccumulator;
+  else if (name == "double")
+    *type = kDoubleAccumulator;
+  else if (name == "kahan")
+    *type = kCompensatedAccumulator;
+  else
+    return false;
+  return true;
+}
+
+bool ParseStatisticsFormat(const std::string &name, StatisticsFormat *format) {
+  if (name == "float")
+    *format = kFloatFormat;
+  else if (name == "fp16")
+    *format = kHalfFormat;
+  else if (name == "bf16")
+    *format = kBFloat16Format;
+  else if (name == "block16")
+    *format = kBlockScaledFormat;
+  else
+    return false;
+  return true;
+}
+
 }  // namespace trainc
@@ -21,23 +21,34 @@
 #ifndef CONTEXT_SAMPLE_H_
 #define CONTEXT_SAMPLE_H_
 
+#include <stdint.h>
 #include <algorithm>
+#include <cstring>
 #include <functional>
 #include <list>
+#include <string>
 #include <vector>
 #include "util.h"
 #include "debug.h"
+#include "float16.h"
+#include "kernels.h"
 
 namespace trainc {
 
+class SampleStatistics;
+
 // Sufficient statistics for a Gaussian distribution.
 // Sum of observations, sum of squared observations,
 // number of (weighted) observations.
-class Statistics {
+// T is the type of the accumulated values.
+template<class T>
+class BasicStatistics {
 public:
-  Statistics() : dim_(-1) {}
+  typedef T Value;
+
+  BasicStatistics() : dim_(-1) {}
 
-  Statistics(int dimension) : dim_(dimension), data_(dim_ * 2 + 1, 0.0) {}
+  BasicStatistics(int dimension) : dim_(dimension), data_(dim_ * 2 + 1, 0.0) {}
 
   void Reset(int dimension) {
     dim_ = dimension;
@@ -48,35 +59,288 @@ public:
   // dimensionality of the features
   int dimension() const { return dim_; }
   // number of (weighted) observations
-  float weight() const { return data_[0]; }
+  T weight() const { return data_[0]; }
   // set the weight
-  void SetWeight(float w) { data_[0] = w; }
+  void SetWeight(T w) { data_[0] = w; }
   // sum of observations
-  const float* sum() const { return &data_[1]; }
+  const T* sum() const { return &data_[1]; }
   // mutable access to sum
-  float* SumRef() { return &data_[1]; }
+  T* SumRef() { return &data_[1]; }
   // sum of squared observations
-  const float* sum2() const { return sum() + dim_; }
+  const T* sum2() const { return sum() + dim_; }
   // mutable access to squared sum
-  float* Sum2Ref() { return SumRef() + dim_; }
+  T* Sum2Ref() { return SumRef() + dim_; }
+  // all values: weight, sum, and squared sum.
+  const T* values() const { return &data_[0]; }
+  T* ValuesRef() { return &data_[0]; }
+  int NumValues() const { return data_.size(); }
 
   // accumulate statistics
-  void Accumulate(const Statistics &other) {
+  void Accumulate(const BasicStatistics<T> &other) {
     DCHECK_EQ(dimension(), other.dimension());
+    typename AccumulateKernel<T, T>::Function kernel =
+        AccumulateKernel<T, T>::Get(data_.size());
+    if (kernel) {
+      kernel(other.values(), &data_[0]);
+      return;
+    }
     std::transform(data_.begin(), data_.end(),
-                   other.data_.begin(), data_.begin(), std::plus<float>());
+                   other.data_.begin(), data_.begin(), std::plus<T>());
+  }
+
+  // accumulate statistics of a different precision
+  template<class U>
+  void Accumulate(const BasicStatistics<U> &other) {
+    DCHECK_EQ(dimension(), other.dimension());
+    typename AccumulateKernel<T, U>::Function kernel =
+        AccumulateKernel<T, U>::Get(data_.size());
+    if (kernel) {
+      kernel(other.values(), &data_[0]);
+      return;
+    }
+    const U *v = other.values();
+    for (typename std::vector<T>::iterator i = data_.begin();
+         i != data_.end(); ++i, ++v)
+      *i += *v;
   }
 
+  // accumulate the statistics of a sample, which may be packed.
+  void Accumulate(const SampleStatistics &other);
+
   void AddObservation(const std::vector<float> &observation, float weight = 1.0);
-private:
+protected:
   int dim_;
-  std::vector<float> data_;
+  std::vector<T> data_;
+};
+
+// Statistics of a sample.
+class Statistics : public BasicStatistics<float> {
+public:
+  Statistics() {}
+  Statistics(int dimension) : BasicStatistics<float>(dimension) {}
+};
+
+// Statistics accumulated in double precision.
+class DoubleStatistics : public BasicStatistics<double> {
+public:
+  DoubleStatistics() {}
+  DoubleStatistics(int dimension) : BasicStatistics<double>(dimension) {}
+};
+
+// Storage format of the values of SampleStatistics.
+enum StatisticsFormat {
+  kFloatFormat, kHalfFormat, kBFloat16Format, kBlockScaledFormat
+};
+
+// Parse the name of a StatisticsFormat: "float", "fp16", "bf16", or
+// "block16".
+bool ParseStatisticsFormat(const std::string &name, StatisticsFormat *format);
+
+// Format and scales of packed SampleStatistics.
+// The block-scaled format stores mean / mean_scale[d] as int16 and
+// variance / variance_scale[d] as uint16 with scales shared by all
+// samples of a phone and HMM state.
+struct StatisticsBlock {
+  StatisticsFormat format;
+  std::vector<float> mean_scale, variance_scale;
+};
+
+// Statistics of a Sample.
+// The values are stored as float until Pack() is called. Packed statistics
+// store the weight as float and the mean and variance of each dimension
+// as 16 bit values, which reduces the size of the values to about one
+// half. Storing mean and variance instead of the sums avoids the range
+// problems of 16 bit sums and the cancellation when computing the variance.
+// After Pack(), only weight(), dimension(), GetMoments(), and the
+// accumulation to other statistics are valid. The values are widened to
+// the precision of the sum when accumulated.
+class SampleStatistics : public Statistics {
+public:
+  SampleStatistics(int dimension) : Statistics(dimension), block_(NULL) {}
+
+  // Pack the values using the format of block.
+  // block has to be valid as long as this object is used.
+  void Pack(const StatisticsBlock *block);
+  bool IsPacked() const { return block_ != NULL; }
+
+  // sum of observations, not valid for packed statistics
+  const float* sum() const {
+    DCHECK(!IsPacked());
+    return Statistics::sum();
+  }
+  // sum of squared observations, not valid for packed statistics
+  const float* sum2() const {
+    DCHECK(!IsPacked());
+    return Statistics::sum2();
+  }
+
+  // Mean and variance of dimension d.
+  void GetMoments(int d, float *mean, float *variance) const;
+
+  // Add the statistics to sum.
+  template<class T>
+  void AddTo(BasicStatistics<T> *sum) const;
+
+private:
+  uint32_t PackedWord(int d) const {
+    uint32_t word;
+    memcpy(&word, &data_[1 + d], sizeof(word));
+    return word;
+  }
+  // Decoders of the 16 bit mean (low half) and variance (high half).
+  struct HalfDecoder {
+    void operator()(int d, uint32_t word, float *mean, float *var) const {
+      *mean = HalfToFloat(word & 0xffff);
+      *var = HalfToFloat(word >> 16);
+    }
+  };
+
+  struct BFloat16Decoder {
+    void operator()(int d, uint32_t word, float *mean, float *var) const {
+      *mean = BFloat16ToFloat(word & 0xffff);
+      *var = BFloat16ToFloat(word >> 16);
+    }
+  };
+
+  struct BlockDecoder {
+    explicit BlockDecoder(const StatisticsBlock &block)
+        : mean_scale(&block.mean_scale[0]),
+          variance_scale(&block.variance_scale[0]) {}
+    void operator()(int d, uint32_t word, float *mean, float *var) const {
+      *mean = static_cast<int16_t>(word & 0xffff) * mean_scale[d];
+      *var = (word >> 16) * variance_scale[d];
+    }
+    const float *mean_scale, *variance_scale;
+  };
+  template<class T, class D>
+  void AddPacked(const D &decoder, BasicStatistics<T> *sum) const;
+  const StatisticsBlock *block_;
+};
+
+template<class T, class D>
+void SampleStatistics::AddPacked(const D &decoder,
+                                 BasicStatistics<T> *sum) const {
+  const T w = weight();
+  sum->SetWeight(sum->weight() + w);
+  T *s = sum->SumRef(), *s2 = sum->Sum2Ref();
+  float mean, var;
+  for (int d = 0; d < dimension(); ++d) {
+    decoder(d, PackedWord(d), &mean, &var);
+    const T m = mean;
+    s[d] += w * m;
+    s2[d] += w * (var + m * m);
+  }
+}
+
+template<class T>
+void SampleStatistics::AddTo(BasicStatistics<T> *sum) const {
+  DCHECK_EQ(dimension(), sum->dimension());
+  if (!block_) {
+    sum->Accumulate(static_cast<const BasicStatistics<float>&>(*this));
+    return;
+  }
+  switch (block_->format) {
+    case kHalfFormat: AddPacked(HalfDecoder(), sum); break;
+    case kBFloat16Format: AddPacked(BFloat16Decoder(), sum); break;
+    case kBlockScaledFormat: AddPacked(BlockDecoder(*block_), sum); break;
+    default: LOG(FATAL) << "unknown format";
+  }
+}
+
+template<class T>
+void BasicStatistics<T>::Accumulate(const SampleStatistics &other) {
+  other.AddTo(this);
+}
+
+// Statistics of a batch of models in a structure of arrays layout.
+// Row k holds value k of the statistics of all models, using the order of
+// BasicStatistics::values(): the weights, the sums of each dimension, and
+// the squared sums of each dimension.
+template<class T>
+class BatchStatistics {
+public:
+  typedef T Value;
+
+  BatchStatistics() : size_(0), dim_(0) {}
+
+  // Resize to size models with statistics of the given dimension.
+  void Reset(int size, int dimension) {
+    size_ = size;
+    dim_ = dimension;
+    data_.assign(size_ * (2 * dim_ + 1), 0.0);
+  }
+
+  // number of models
+  int size() const { return size_; }
+  // dimensionality of the features
+  int dimension() const { return dim_; }
+  // weights of all models
+  const T* weight() const { return Row(0); }
+  // sums of all models for dimension d
+  const T* sum(int d) const { return Row(1 + d); }
+  // squared sums of all models for dimension d
+  const T* sum2(int d) const { return Row(1 + dim_ + d); }
+
+  // Set the statistics of model i.
+  void Set(int i, const BasicStatistics<T> &stats) {
+    DCHECK_EQ(dimension(), stats.dimension());
+    DCHECK_LT(i, size_);
+    const T *v = stats.values();
+    for (int k = 0; k < stats.NumValues(); ++k)
+      data_[k * size_ + i] = v[k];
+  }
+
+  // Get the statistics of model i.
+  void Get(int i, BasicStatistics<T> *stats) const {
+    DCHECK_LT(i, size_);
+    stats->Reset(dim_);
+    T *v = stats->ValuesRef();
+    for (int k = 0; k < stats->NumValues(); ++k)
+      v[k] = data_[k * size_ + i];
+  }
+
+private:
+  const T* Row(int k) const { return &data_[k * size_]; }
+  int size_, dim_;
+  std::vector<T> data_;
 };
 
+// Sum of Statistics in float precision using Kahan summation.
+class CompensatedStatistics {
+public:
+  CompensatedStatistics() {}
+
+  void Reset(int dimension) {
+    sum_.Reset(dimension);
+    compensation_.assign(sum_.NumValues(), 0.0);
+  }
+
+  int dimension() const { return sum_.dimension(); }
+
+  void Accumulate(const Statistics &other);
+  void Accumulate(const SampleStatistics &other);
+
+  // the float sum, without the compensation
+  const Statistics& sum() const { return sum_; }
+  // the compensated sum in double precision
+  void GetSum(DoubleStatistics *sum) const;
+private:
+  Statistics sum_;
+  std::vector<float> compensation_;
+};
+
+// Precision used to accumulate the statistics of several samples.
+enum AccumulatorType {
+  kFloatAccumulator, kDoubleAccumulator, kCompensatedAccumulator
+};
+
+// Parse the name of an AccumulatorType: "float", "double", or "kahan".
+bool ParseAccumulatorType(const std::string &name, AccumulatorType *type);
+
 // A training sample consisting of left and right context
 // and pointer to the Statistics
 struct Sample {
-  Statistics stat;
+  SampleStatistics stat;
   std::vector<int> left_context_;
   std::vector<int> right_context_;
   Sample(int feature_dim) : stat(feature_dim) {}
@@ -92,6 +356,7 @@ public:
   typedef std::list<Sample> SampleList;
 
   Samples();
+  ~Samples();
 
   // set the number of occuring phones
   void SetNumPhones(int num_phones);
@@ -110,6 +375,24 @@ public:
 
   bool HaveSample(int phone, int state) const;
 
+  // Move all samples of other to this object.
+  // Both objects must have the same number of phones and the same
+  // feature dimension, if other contains samples.
+  void Merge(Samples *other);
+
+  // Merge samples of the same phone and HMM state with identical contexts
+  // by accumulating their statistics.
+  // Returns the number of removed samples.
+  int MergeDuplicates();
+
+  // Total number of samples.
+  int NumSamples() const;
+
+  // Pack the statistics of all samples using the given format, see
+  // SampleStatistics. Samples with packed statistics cannot be the target
+  // of Merge() or SampleMerger::Add().
+  void Pack(StatisticsFormat format);
+
   // Return the list of samples for the given phone and HMM state.
   const SampleList& GetSamples(int phone, int state) const {
     CHECK_LT(phone, samples_.size());
@@ -126,10 +409,39 @@ public:
 private:
   int feature_dim_;
   std::vector< std::vector<SampleList> > samples_;
+  // formats and scales of packed statistics
+  std::vector<StatisticsBlock*> blocks_;
 
+  friend class SampleMerger;
   DISALLOW_COPY_AND_ASSIGN(Samples);
 };
 
+// Moves samples to a Samples object and merges samples of the same phone
+// and HMM state with identical contexts by accumulating their statistics.
+// The contexts of the target are indexed, such that samples can be added
+// incrementally, e.g. chunks of samples read from a stream.
+// Samples already in the target are not merged with each other.
+class SampleMerger {
+public:
+  // The target must not be modified otherwise while the merger is used.
+  explicit SampleMerger(Samples *target);
+  ~SampleMerger();
+
+  // Move all samples of other to the target. other is empty afterwards.
+  void Add(Samples *other);
+
+  // Number of samples merged with an existing sample.
+  int NumMerged() const { return num_merged_; }
+
+private:
+  class ContextIndex;
+  ContextIndex* GetIndex(int phone, int state);
+  Samples *target_;
+  std::vector< std::vector<ContextIndex*> > index_;
+  int num_merged_;
+  DISALLOW_COPY_AND_ASSIGN(SampleMerger);
+};
+
 }  // namespace trainc
 
 #endif /* CONTEXT_SAMPLE_H_ */
@@ -0,0 +1,200 @@
+// sample_format_bench.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Benchmark of the storage formats of the sample statistics.
+// Reports the memory used by the sample statistics, the run time of the
+// evaluation of split hypotheses, and the deviation of the split gains
+// from the gains computed with float statistics.
+
+#include <sys/time.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "fst/compat.h"
+#include "context_set.h"
+#include "phone_models.h"
+#include "sample.h"
+#include "scorer.h"
+#include "util.h"
+
+DEFINE_int32(num_phones, 40, "number of context phones");
+DEFINE_int32(num_samples, 20000, "number of samples");
+DEFINE_int32(num_observations, 20, "number of observations per sample");
+DEFINE_int32(dimension, 48, "feature dimension");
+DEFINE_int32(num_questions, 100, "number of questions per context position");
+DEFINE_int32(repetitions, 3, "number of repetitions");
+
+namespace trainc {
+
+namespace {
+
+double Now() {
+  timeval now;
+  gettimeofday(&now, 0);
+  return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+double Random() {
+  return 1.0 * rand() / RAND_MAX;
+}
+
+// Samples of phone 0, state 0 with random left and right contexts.
+// The mean depends on the contexts. Phone symbols are shifted by one.
+// The same samples are generated in each call.
+Samples* CreateSamples() {
+  srand(1);
+  Samples *samples = new Samples();
+  samples->SetNumPhones(FLAGS_num_phones + 1);
+  samples->SetFeatureDimension(FLAGS_dimension);
+  std::vector<float> observation(FLAGS_dimension);
+  for (int i = 0; i < FLAGS_num_samples; ++i) {
+    Sample *sample = samples->AddSample(0, 0);
+    const int left = rand() % FLAGS_num_phones;
+    const int right = rand() % FLAGS_num_phones;
+    sample->left_context_.push_back(left + 1);
+    sample->right_context_.push_back(right + 1);
+    for (int n = 0; n < FLAGS_num_observations; ++n) {
+      for (int d = 0; d < FLAGS_dimension; ++d)
+        observation[d] = 0.1 * (left - right) * (d % 5) + (d % 3) * Random();
+      sample->stat.AddObservation(observation);
+    }
+  }
+  return samples;
+}
+
+// Questions with random phone sets.
+void CreateQuestions(std::vector<ContextQuestion*> *questions) {
+  for (int q = 0; q < FLAGS_num_questions; ++q) {
+    ContextSet phones(FLAGS_num_phones);
+    for (int p = 0; p < FLAGS_num_phones; ++p)
+      if (rand() % 2) phones.Add(p);
+    questions->push_back(new ContextQuestion(phones));
+  }
+}
+
+// Size of the values of the statistics of all samples in bytes.
+size_t StatisticsSize(const Samples::SampleList &samples) {
+  size_t bytes = 0;
+  for (Samples::SampleList::const_iterator s = samples.begin();
+       s != samples.end(); ++s)
+    bytes += s->stat.NumValues() * sizeof(float);
+  return bytes;
+}
+
+}  // namespace
+
+// Evaluates all questions using samples stored in the given format.
+// Stores the gain of each question (0 for invalid splits) in gains.
+void RunFormat(const char *name, StatisticsFormat format,
+               const std::vector<ContextQuestion*> &questions,
+               const std::vector<float> &reference,
+               std::vector<float> *gains) {
+  const int phone = 0;
+  PhoneContext context(FLAGS_num_phones, 1, 1);
+  for (int p = 0; p < FLAGS_num_phones; ++p) {
+    context.AddToContext(-1, p);
+    context.AddToContext(1, p);
+  }
+  Samples *samples = CreateSamples();
+  samples->Pack(format);
+  const Samples::SampleList &list = samples->GetSamples(phone, 0);
+  const size_t bytes = StatisticsSize(list);
+  MaximumLikelihoodScorer scorer(0.001);
+  scorer.SetAccumulator(kDoubleAccumulator);
+  DoubleStatistics total(FLAGS_dimension);
+  for (Samples::SampleList::const_iterator s = list.begin();
+       s != list.end(); ++s)
+    total.Accumulate(s->stat);
+  {
+    AllophoneStateModel model(0, context);
+    model.AddStatistics(phone, list);
+    model.SetCost(scorer.score(total));
+    gains->assign(2 * questions.size(), 0);
+    int num_hyps = 0;
+    const double start = Now();
+    for (int r = 0; r < FLAGS_repetitions; ++r) {
+      for (int pos = -1; pos <= 1; pos += 2) {
+        for (int q = 0; q < questions.size(); ++q) {
+          AllophoneStateModel::SplitResult split =
+              model.Split(pos, *questions[q]);
+          if (split.first && split.second) {
+            model.SplitData(pos, &split);
+            model.ComputeCosts(&split, scorer);
+            (*gains)[(pos + 1) / 2 * questions.size() + q] =
+                model.GetGain(split);
+            ++num_hyps;
+          }
+          delete split.first;
+          delete split.second;
+        }
+      }
+    }
+    const double time = Now() - start;
+    printf("%-8s memory: %8.3f MB  time/hyp: %8.3f us", name,
+           bytes / 1048576.0, time / num_hyps * 1e6);
+  }
+  delete samples;
+  if (reference.empty()) {
+    printf("\n");
+    return;
+  }
+  double max_error = 0, sum_error = 0;
+  int num_gains = 0, best = 0, best_reference = 0;
+  for (int i = 0; i < gains->size(); ++i) {
+    if ((*gains)[i] > (*gains)[best]) best = i;
+    if (reference[i] > reference[best_reference]) best_reference = i;
+    if (reference[i] <= 0) continue;
+    const double error = fabs((*gains)[i] - reference[i]) / reference[i];
+    max_error = std::max(max_error, error);
+    sum_error += error;
+    ++num_gains;
+  }
+  printf("  gain error: max: %.2e  mean: %.2e  best question: %s\n",
+         max_error, num_gains ? sum_error / num_gains : 0.0,
+         best == best_reference ? "same" : "different");
+}
+
+void RunBenchmark() {
+  std::vector<ContextQuestion*> questions;
+  srand(2);
+  CreateQuestions(&questions);
+  printf("samples=%d observations=%d phones=%d dimension=%d questions=%d\n",
+         FLAGS_num_samples, FLAGS_num_observations, FLAGS_num_phones,
+         FLAGS_dimension, FLAGS_num_questions);
+  const char *names[] = { "float", "fp16", "bf16", "block16" };
+  std::vector<float> reference, gains;
+  RunFormat(names[0], kFloatFormat, questions, reference, &gains);
+  reference.swap(gains);
+  for (int f = 1; f < 4; ++f) {
+    StatisticsFormat format;
+    const bool valid = ParseStatisticsFormat(names[f], &format);
+    CHECK(valid);
+    RunFormat(names[f], format, questions, reference, &gains);
+  }
+  STLDeleteElements(&questions);
+}
+
+}  // namespace trainc
+
+int main(int argc, char **argv) {
+  SetFlags("", &argc, &argv, true);
+  trainc::RunBenchmark();
+  return 0;
+}
@@ -15,99 +15,392 @@
 // Copyright 2010 RWTH Aachen University. All Rights Reserved.
 // Author: rybach@cs.rwth-aachen.de (David Rybach)
 
-#include <fstream>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 #include "fst/symbol-table.h"
+#include "file.h"
 #include "sample_reader.h"
 #include "sample.h"
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
 
 namespace trainc {
 
 SampleReader* SampleReader::Create(const std::string &name) {
+  if (name == SampleBinaryReader::name())
+    return new SampleBinaryReader();
   // default reader
   return new SampleTextReader();
 }
 
-const int SampleTextReader::kFormatVersion = 1;
+SampleReader::SampleReader()
+    : phone_symbols_(NULL), in_(NULL), dimension_(0),
+      num_left_contexts_(0), num_right_contexts_(0), end_(true),
+      num_read_(0) {}
+
+SampleReader::~SampleReader() {
+  Close();
+}
 
-bool SampleTextReader::Read(const std::string &filename, Samples *samples) {
+bool SampleReader::Read(const std::string &filename, Samples *samples) {
+  if (!Open(filename))
+    return false;
+  bool success = true;
+  while (success && !AtEnd())
+    success = ReadSamples(std::numeric_limits<int>::max(), samples);
+  VLOG(1) << "read samples: " << NumRead();
+  Close();
+  return success;
+}
+
+bool SampleReader::Open(const std::string &filename) {
   CHECK_NOTNULL(phone_symbols_);
-  CHECK_GT(samples->NumPhones(), 0);
+  Close();
   VLOG(1) << "reading samples from: " << filename;
-  std::ifstream fin(filename.c_str());
-  if (!fin) {
+  File *file = filename == "-" ? File::FromDescriptor(dup(STDIN_FILENO), "r")
+      : File::Create(filename, "r");
+  if (!file) {
     LOG(ERROR) << "cannot open " << filename;
     return false;
   }
-  if (!ReadHeader(&fin)) {
+  in_ = new InputBuffer(file);
+  num_read_ = 0;
+  end_ = false;
+  if (!ReadHeader()) {
     LOG(ERROR) << "error reading header";
+    Close();
     return false;
   }
+  return true;
+}
+
+bool SampleReader::ReadSamples(int max_samples, Samples *samples) {
+  CHECK_NOTNULL(in_);
+  CHECK_GT(samples->NumPhones(), 0);
   samples->SetFeatureDimension(dimension_);
-  int line = 2;
-  while (!fin.eof()) {
-    if (!ReadSample(&fin, samples)) {
-      LOG(ERROR) << "error reading sample in line " << line;
+  for (int n = 0; n < max_samples && !end_; ++n) {
+    if (!ReadSample(samples)) {
+      LOG(ERROR) << "error reading sample " << num_read_;
       return false;
     }
-    ++line;
+    if (!end_) ++num_read_;
   }
-  VLOG(1) << "read samples: " << (line - 2);
   return true;
 }
 
-bool SampleTextReader::ReadHeader(std::ifstream *fin) {
-  std::string line;
+void SampleReader::Close() {
+  delete in_;
+  in_ = NULL;
+  end_ = true;
+}
+
+namespace {
+
+double Now() {
+  timeval now;
+  gettimeofday(&now, 0);
+  return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+// Samples read from one file.
+struct SampleFile {
+  std::string filename;
+  Samples samples;
+  bool success;
+};
+
+// Reads chunks of samples and adds them to file->samples.
+// Samples with identical contexts are merged, if merge is true.
+void ReadSampleFile(const std::string &type,
+                    const fst::SymbolTable *phone_symbols, int chunk_size,
+                    bool merge, SampleFile *file) {
+  SampleReader *reader = SampleReader::Create(type);
+  reader->SetPhoneSymbols(phone_symbols);
+  file->success = reader->Open(file->filename);
+  Samples chunk;
+  chunk.SetNumPhones(file->samples.NumPhones());
+  SampleMerger merger(&file->samples);
+  const double start = Now();
+  while (file->success && !reader->AtEnd()) {
+    file->success = reader->ReadSamples(chunk_size, &chunk);
+    if (merge)
+      merger.Add(&chunk);
+    else
+      file->samples.Merge(&chunk);
+    const double time = std::max(Now() - start, 1e-6);
+    LOG(INFO) << file->filename << ": read samples: " << reader->NumRead()
+              << " distinct: " << reader->NumRead() - merger.NumMerged()
+              << " samples/s: " << static_cast<int64_t>(
+                  reader->NumRead() / time);
+  }
+  delete reader;
+}
+
+#ifdef HAVE_THREADS
+class ReadMapper {
+public:
+  ReadMapper(const std::string &type, const fst::SymbolTable *phone_symbols,
+             int chunk_size, bool merge)
+      : type_(type), phone_symbols_(phone_symbols), chunk_size_(chunk_size),
+        merge_(merge) {}
+  ReadMapper* Clone() const {
+    return new ReadMapper(type_, phone_symbols_, chunk_size_, merge_);
+  }
+  void Map(SampleFile *file) {
+    ReadSampleFile(type_, phone_symbols_, chunk_size_, merge_, file);
+  }
+  void Reset() {}
+private:
+  std::string type_;
+  const fst::SymbolTable *phone_symbols_;
+  int chunk_size_;
+  bool merge_;
+};
+#endif
+
+}  // namespace
+
+bool ReadSampleFiles(const std::string &type,
+                     const fst::SymbolTable *phone_symbols,
+                     const std::vector<std::string> &filenames,
+                     int num_threads, int chunk_size, bool merge,
+                     Samples *samples) {
+  CHECK_GT(chunk_size, 0);
+  std::vector<SampleFile*> files(filenames.size());
+  for (int f = 0; f < files.size(); ++f) {
+    files[f] = new SampleFile();
+    files[f]->filename = filenames[f];
+    files[f]->samples.SetNumPhones(samples->NumPhones());
+  }
+#ifdef HAVE_THREADS
+  if (num_threads > 1 && files.size() > 1) {
+    threads::ThreadPool<SampleFile*, ReadMapper> pool;
+    pool.Init(std::min<int>(num_threads, files.size()),
+              ReadMapper(type, phone_symbols, chunk_size, merge));
+    for (int f = 0; f < files.size(); ++f)
+      pool.Submit(files[f]);
+    pool.Wait();
+  } else
+#endif
+  {
+    for (int f = 0; f < files.size(); ++f)
+      ReadSampleFile(type, phone_symbols, chunk_size, merge, files[f]);
+  }
+  bool success = true;
+  SampleMerger merger(samples);
+  for (int f = 0; f < files.size() && success; ++f) {
+    Samples &file_samples = files[f]->samples;
+    if (!files[f]->success) {
+      LOG(ERROR) << "cannot read samples from " << files[f]->filename;
+      success = false;
+    } else if (samples->FeatureDimension() >= 0 &&
+               file_samples.NumSamples() &&
+               file_samples.FeatureDimension() !=
+               samples->FeatureDimension()) {
+      LOG(ERROR) << "feature dimension mismatch in " << files[f]->filename;
+      success = false;
+    } else if (merge) {
+      merger.Add(&file_samples);
+    } else {
+      samples->Merge(&file_samples);
+    }
+  }
+  for (int f = 0; f < files.size(); ++f)
+    delete files[f];
+  if (success && merge) {
+    VLOG(1) << "merged samples: " << merger.NumMerged()
+            << " distinct samples: " << samples->NumSamples();
+  }
+  return success;
+}
+
+// ====================================================================
+
+const int SampleTextReader::kFormatVersion = 1;
+
+bool SampleTextReader::ReadHeader() {
   int version;
-  *fin >> version >> dimension_ >> num_left_contexts_ >> num_right_contexts_;
-  if (!fin->good()) return false;
+  if (!(in_->ReadText(&version) && in_->ReadText(&dimension_) &&
+        in_->ReadText(&num_left_contexts_) &&
+        in_->ReadText(&num_right_contexts_)))
+    return false;
   return (version == kFormatVersion);
 }
 
 template<class Iterator>
-bool SampleTextReader::ReadPhoneSequence(std::ifstream *fin,
-                                         Iterator begin, Iterator end) const {
+bool SampleTextReader::ReadPhoneSequence(Iterator begin, Iterator end) {
   std::string symbol;
   for (; begin != end; ++begin) {
-    *fin >> symbol;
+    if (!in_->ReadText(&symbol)) return false;
     *begin = phone_symbols_->Find(symbol);
-    if (fin->fail() || *begin < 0) return false;
+    if (*begin < 0) return false;
   }
   return true;
 }
 
-bool SampleTextReader::ReadSample(std::ifstream *fin, Samples *samples) const {
+bool SampleTextReader::ReadSample(Samples *samples) {
   std::string sym;
   int state;
-  *fin >> sym;
-  if (fin->eof()) return true;
-  *fin >> state;
+  if (!in_->ReadText(&sym)) {
+    // only white space left
+    end_ = true;
+    return true;
+  }
+  if (!in_->ReadText(&state)) return false;
   int phone = phone_symbols_->Find(sym);
   if (phone < 0 || state < 0) return false;
   Sample *sample = samples->AddSample(phone, state);
   sample->left_context_.resize(num_left_contexts_);
   sample->right_context_.resize(num_right_contexts_);
-  if (!(ReadPhoneSequence(fin, sample->left_context_.rbegin(),
+  if (!(ReadPhoneSequence(sample->left_context_.rbegin(),
                           sample->left_context_.rend()) &&
-        ReadPhoneSequence(fin, sample->right_context_.begin(),
+        ReadPhoneSequence(sample->right_context_.begin(),
                           sample->right_context_.end()))) {
     return false;
   }
-  return ReadStatistics(fin, &sample->stat);
+  return ReadStatistics(&sample->stat);
 }
 
-bool SampleTextReader::ReadStatistics(std::ifstream *fin, Statistics *stats) const {
+bool SampleTextReader::ReadStatistics(Statistics *stats) {
   float weight;
-  *fin >> weight;
+  if (!in_->ReadText(&weight)) return false;
   stats->SetWeight(weight);
   float *s = stats->SumRef();
   for (int d = 0; d < dimension_; ++d, ++s) {
-    *fin >> *s;
+    if (!in_->ReadText(s)) return false;
   }
   s = stats->Sum2Ref();
   for (int d = 0; d < dimension_; ++d, ++s) {
-    *fin >> *s;
+    if (!in_->ReadText(s)) return false;
   }
-  return !fin->fail();
+  return true;
+}
+
+// ====================================================================
+
+const uint32_t SampleBinaryReader::kMagic = 0x4d534354;  // "TCSM"
+const int SampleBinaryReader::kVersion = 1;
+
+bool SampleBinaryReader::ReadHeader() {
+  SampleBinaryHeader header;
+  if (!in_->ReadBinary(&header) || header.magic != kMagic ||
+      header.version != kVersion || header.dimension < 0 ||
+      header.num_left_contexts < 0 || header.num_right_contexts < 0 ||
+      header.num_phones < 0)
+    return false;
+  dimension_ = header.dimension;
+  num_left_contexts_ = header.num_left_contexts;
+  num_right_contexts_ = header.num_right_contexts;
+  phones_.resize(header.num_phones);
+  std::string symbol;
+  for (int p = 0; p < header.num_phones; ++p) {
+    symbol.clear();
+    char c;
+    while (true) {
+      if (!in_->ReadBinary(&c)) return false;
+      if (!c) break;
+      symbol += c;
+    }
+    phones_[p] = phone_symbols_->Find(symbol);
+    if (phones_[p] < 0)
+      VLOG(1) << "phone symbol not defined: " << symbol;
+  }
+  record_.resize(2 + num_left_contexts_ + num_right_contexts_);
+  return true;
+}
+
+bool SampleBinaryReader::ReadSample(Samples *samples) {
+  if (in_->AtEnd()) {
+    end_ = true;
+    return true;
+  }
+  if (!in_->ReadBinary(&record_[0], record_.size()))
+    return false;
+  for (int i = 0; i < record_.size(); ++i) {
+    if (i == 1) continue;  // hmm state
+    if (record_[i] < 0 || record_[i] >= phones_.size() ||
+        phones_[record_[i]] < 0)
+      return false;
+    record_[i] = phones_[record_[i]];
+  }
+  if (record_[1] < 0) return false;
+  Sample *sample = samples->AddSample(record_[0], record_[1]);
+  std::vector<int32_t>::const_iterator c = record_.begin() + 2;
+  sample->left_context_.assign(c, c + num_left_contexts_);
+  c += num_left_contexts_;
+  sample->right_context_.assign(c, c + num_right_contexts_);
+  Statistics &stat = sample->stat;
+  return in_->ReadBinary(stat.ValuesRef(), stat.NumValues());
+}
+
+// ====================================================================
+
+SampleBinaryWriter::SampleBinaryWriter() : out_(NULL), num_samples_(0) {}
+
+SampleBinaryWriter::~SampleBinaryWriter() {
+  Close();
+}
+
+bool SampleBinaryWriter::Open(const std::string &filename, int dimension,
+                              int num_left_contexts, int num_right_contexts,
+                              const std::vector<std::string> &phones) {
+  Close();
+  File *file = File::Create(filename, "w");
+  if (!file || !file->Open()) {
+    LOG(ERROR) << "cannot open " << filename;
+    delete file;
+    return false;
+  }
+  out_ = new OutputBuffer(file);
+  memset(&header_, 0, sizeof(header_));
+  header_.magic = SampleBinaryReader::kMagic;
+  header_.version = SampleBinaryReader::kVersion;
+  header_.dimension = dimension;
+  header_.num_left_contexts = num_left_contexts;
+  header_.num_right_contexts = num_right_contexts;
+  header_.num_phones = phones.size();
+  out_->WriteBinary(header_);
+  for (std::vector<std::string>::const_iterator p = phones.begin();
+       p != phones.end(); ++p)
+    out_->WriteString(p->c_str(), p->size() + 1);
+  record_.resize(2 + num_left_contexts + num_right_contexts);
+  num_samples_ = 0;
+  return true;
+}
+
+void SampleBinaryWriter::Write(int phone, int state,
+                               const std::vector<int> &left_context,
+                               const std::vector<int> &right_context,
+                               const Statistics &stat) {
+  CHECK_NOTNULL(out_);
+  CHECK_EQ(left_context.size(), header_.num_left_contexts);
+  CHECK_EQ(right_context.size(), header_.num_right_contexts);
+  CHECK_EQ(stat.dimension(), header_.dimension);
+  record_[0] = phone;
+  record_[1] = state;
+  std::copy(left_context.begin(), left_context.end(), record_.begin() + 2);
+  std::copy(right_context.begin(), right_context.end(),
+            record_.begin() + 2 + left_context.size());
+  out_->WriteString(reinterpret_cast<const char*>(&record_[0]),
+                    record_.size() * sizeof(int32_t));
+  out_->WriteString(reinterpret_cast<const char*>(stat.values()),
+                    stat.NumValues() * sizeof(float));
+  ++num_samples_;
+}
+
+bool SampleBinaryWriter::Close() {
+  if (!out_) return true;
+  const bool ok = out_->CloseFile();
+  delete out_;
+  out_ = NULL;
+  return ok;
 }
 
 }  // namespace trainc
@@ -21,7 +21,9 @@
 #ifndef SAMPLE_READER_H_
 #define SAMPLE_READER_H_
 
-#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
 
 namespace fst {
 class SymbolTable;
@@ -29,29 +31,69 @@ class SymbolTable;
 
 namespace trainc {
 
+class InputBuffer;
+class OutputBuffer;
 class Samples;
 class Statistics;
 
 // base class for all sample readers and factory function.
-// SetPhoneSymbols() has to be called before Read()
+// SetPhoneSymbols() has to be called before Read() or Open().
+// Samples can either be read at once using Read() or in chunks using
+// Open() and ReadSamples(). Files are read sequentially, which allows
+// reading from pipes. The filename "-" refers to stdin.
 class SampleReader {
 public:
-  SampleReader() : phone_symbols_(NULL) {}
-  virtual ~SampleReader() {}
+  SampleReader();
+  virtual ~SampleReader();
 
   // Set the symbol table.
   // Ownership stays at caller.
   void SetPhoneSymbols(const fst::SymbolTable *symbols) {
     phone_symbols_ = symbols;
   }
-  virtual bool Read(const std::string &filename, Samples *samples) = 0;
+  // Read all samples of the given file.
+  bool Read(const std::string &filename, Samples *samples);
+
+  // Open the given file and read the header.
+  bool Open(const std::string &filename);
+  // Read up to max_samples samples and add them to samples.
+  // Sets the feature dimension of samples.
+  bool ReadSamples(int max_samples, Samples *samples);
+  // All samples of the file have been read.
+  bool AtEnd() const { return end_; }
+  void Close();
+  // Number of samples read since Open().
+  int64_t NumRead() const { return num_read_; }
 
   static SampleReader* Create(const std::string &type);
 
 protected:
+  virtual bool ReadHeader() = 0;
+  // Read the next sample. Sets end_ if no sample is left.
+  virtual bool ReadSample(Samples *samples) = 0;
+
   const fst::SymbolTable *phone_symbols_;
+  InputBuffer *in_;
+  int dimension_, num_left_contexts_, num_right_contexts_;
+  bool end_;
+  int64_t num_read_;
 };
 
+// Read the sample files of the given type using up to num_threads threads.
+// Each file is read in chunks of chunk_size samples. Progress is logged
+// after each chunk.
+// Samples of all files are added to samples in the order of the files.
+// If merge is true, samples with identical phone, HMM state, and contexts
+// are merged, such that memory is required only for the distinct samples
+// and one chunk per file. Merging reduces the number of seen contexts of
+// a model, which is counted per sample.
+// samples has to be initialized with the number of phones.
+bool ReadSampleFiles(const std::string &type,
+                     const fst::SymbolTable *phone_symbols,
+                     const std::vector<std::string> &filenames,
+                     int num_threads, int chunk_size, bool merge,
+                     Samples *samples);
+
 // read samples from a simple text file.
 // file format:
 // header:
@@ -79,17 +121,75 @@ protected:
 class SampleTextReader : public SampleReader {
 public:
   virtual ~SampleTextReader() {}
-  virtual bool Read(const std::string &filename, Samples *samples);
   static std::string name() { return "text"; }
 
 protected:
-  bool ReadHeader(std::ifstream *fin);
-  bool ReadSample(std::ifstream *fin, Samples *samples) const;
-  bool ReadStatistics(std::ifstream *fin, Statistics *stats) const;
+  virtual bool ReadHeader();
+  virtual bool ReadSample(Samples *samples);
+  bool ReadStatistics(Statistics *stats);
   template<class I>
-  bool ReadPhoneSequence(std::ifstream *fin, I begin, I end) const;
+  bool ReadPhoneSequence(I begin, I end);
   static const int kFormatVersion;
-  int dimension_, num_left_contexts_, num_right_contexts_;
+};
+
+// Binary sample file, written by SampleBinaryWriter:
+//   header   SampleBinaryHeader
+//   phones   num_phones phone symbols, each terminated by '\0'
+//   samples  one record per sample up to the end of the file:
+//              int32 phone, int32 hmm_state,
+//              int32 left context phones, nearest first,
+//              int32 right context phones, nearest first,
+//              float weight, float sum[dimension], float sum2[dimension]
+// Phones are indexes in the list of phone symbols of the file.
+// Values are stored in the native byte order.
+struct SampleBinaryHeader {
+  uint32_t magic;
+  int32_t version;
+  int32_t dimension;
+  int32_t num_left_contexts;
+  int32_t num_right_contexts;
+  int32_t num_phones;
+};
+
+// read samples from a binary sample file.
+class SampleBinaryReader : public SampleReader {
+public:
+  virtual ~SampleBinaryReader() {}
+  static std::string name() { return "binary"; }
+
+  static const uint32_t kMagic;
+  static const int kVersion;
+
+protected:
+  virtual bool ReadHeader();
+  virtual bool ReadSample(Samples *samples);
+  // phone symbol for each phone index of the file, -1 if not defined.
+  std::vector<int> phones_;
+  std::vector<int32_t> record_;
+};
+
+// Write samples to a binary sample file.
+class SampleBinaryWriter {
+public:
+  SampleBinaryWriter();
+  ~SampleBinaryWriter();
+
+  // Create the file and write the header.
+  // The indexes of phones are the phone indexes used by Write().
+  bool Open(const std::string &filename, int dimension,
+            int num_left_contexts, int num_right_contexts,
+            const std::vector<std::string> &phones);
+  // Write one sample. Contexts are ordered nearest first, like in Sample.
+  void Write(int phone, int state, const std::vector<int> &left_context,
+             const std::vector<int> &right_context, const Statistics &stat);
+  bool Close();
+  int NumSamples() const { return num_samples_; }
+
+private:
+  OutputBuffer *out_;
+  SampleBinaryHeader header_;
+  std::vector<int32_t> record_;
+  int num_samples_;
 };
 
 }  // namespace trainc
@@ -16,8 +16,10 @@
 // Author: rybach@cs.rwth-aachen.de (David Rybach)
 //
 // \file
-// Tests for SampleTextReader
+// Tests for SampleTextReader and SampleBinaryReader
 
+#include <unistd.h>
+#include <algorithm>
 #include "sample_reader.h"
 #include "sample.h"
 #include "file.h"
@@ -146,4 +148,153 @@ TEST_F(SampleTextReaderTest, MultiSample) {
   Test();
 }
 
+// Two files with one shared and one distinct context each.
+TEST_F(SampleTextReaderTest, MultipleFiles) {
+  std::vector<std::string> filenames;
+  for (int f = 0; f < 2; ++f) {
+    filenames.push_back(StringPrintf("%s/samples%d.txt",
+                                     FLAGS_test_tmpdir.c_str(), f));
+    File *file = File::Create(filenames.back(), "w");
+    ASSERT_TRUE(file);
+    file->Printf("1 1 1 1\n");
+    file->Printf("a 0 b c 1 2 3\n");
+    file->Printf("a 0 %s c 1 2 3\n", f ? "a" : "c");
+    file->Close();
+    delete file;
+  }
+  symbols_->AddSymbol("a");
+  symbols_->AddSymbol("b");
+  symbols_->AddSymbol("c");
+  for (int num_threads = 1; num_threads <= 2; ++num_threads) {
+    Samples samples;
+    samples.SetNumPhones(symbols_->AvailableKey());
+    EXPECT_TRUE(ReadSampleFiles(SampleTextReader::name(), symbols_,
+                                filenames, num_threads, 1, true, &samples));
+    EXPECT_EQ(1, samples.FeatureDimension());
+    const Samples::SampleList &l = samples.GetSamples(0, 0);
+    ASSERT_EQ(3, int(l.size()));
+    Samples::SampleList::const_iterator s = l.begin();
+    EXPECT_EQ(1, s->left_context_[0]);
+    EXPECT_EQ(2.0f, s->stat.weight());
+    EXPECT_EQ(6.0f, s->stat.sum2()[0]);
+    ++s;
+    EXPECT_EQ(2, s->left_context_[0]);
+    EXPECT_EQ(1.0f, s->stat.weight());
+    ++s;
+    EXPECT_EQ(0, s->left_context_[0]);
+    EXPECT_EQ(1.0f, s->stat.weight());
+  }
+  filenames.push_back(FLAGS_test_tmpdir + "/missing.txt");
+  Samples samples;
+  samples.SetNumPhones(symbols_->AvailableKey());
+  EXPECT_FALSE(ReadSampleFiles(SampleTextReader::name(), symbols_,
+                               filenames, 2, 10, true, &samples));
+}
+
+// Without merging, each sample of a file with duplicate contexts is kept,
+// such that the number of seen contexts does not change.
+TEST_F(SampleTextReaderTest, NoMerge) {
+  std::vector<std::string> filenames(1, FLAGS_test_tmpdir + "/samples.txt");
+  File *file = File::Create(filenames[0], "w");
+  ASSERT_TRUE(file);
+  file->Printf("1 1 1 1\n");
+  file->Printf("a 0 b c 1 2 3\n");
+  file->Printf("a 0 b c 1 2 3\n");
+  file->Printf("a 0 c c 1 2 3\n");
+  file->Close();
+  delete file;
+  symbols_->AddSymbol("a");
+  symbols_->AddSymbol("b");
+  symbols_->AddSymbol("c");
+  for (int merge = 0; merge < 2; ++merge) {
+    Samples samples;
+    samples.SetNumPhones(symbols_->AvailableKey());
+    EXPECT_TRUE(ReadSampleFiles(SampleTextReader::name(), symbols_,
+                                filenames, 1, 2, merge, &samples));
+    const Samples::SampleList &l = samples.GetSamples(0, 0);
+    ASSERT_EQ(merge ? 2 : 3, int(l.size()));
+    EXPECT_EQ(merge ? 2.0f : 1.0f, l.front().stat.weight());
+    EXPECT_EQ(1, l.front().left_context_[0]);
+    EXPECT_EQ(2, l.back().left_context_[0]);
+  }
+}
+
+TEST_F(SampleTextReaderTest, Chunks) {
+  Init(2, 10, 1, 1);
+  SampleTextReader reader;
+  reader.SetPhoneSymbols(symbols_);
+  Samples samples;
+  samples.SetNumPhones(symbols_->AvailableKey());
+  ASSERT_TRUE(reader.Open(filename_));
+  int num_chunks = 0;
+  while (!reader.AtEnd()) {
+    EXPECT_TRUE(reader.ReadSamples(3, &samples));
+    EXPECT_EQ(std::min(3 * ++num_chunks, nsamples_), reader.NumRead());
+  }
+  reader.Close();
+  EXPECT_EQ(4, num_chunks);
+  EXPECT_EQ(nsamples_, samples.NumSamples());
+}
+
+// Read from a pipe, which does not support seeking.
+TEST_F(SampleTextReaderTest, Pipe) {
+  Init(3, 20, 1, 1);
+  const std::string data = File::ReadFileToStringOrDie(filename_);
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  ASSERT_EQ(data.size(), write(fds[1], data.data(), data.size()));
+  close(fds[1]);
+  filename_ = StringPrintf("/dev/fd/%d", fds[0]);
+  Test();
+  close(fds[0]);
+}
+
+TEST(SampleBinaryReaderTest, ReadWrite) {
+  const std::string filename = FLAGS_test_tmpdir + "/samples.bin";
+  const int dimension = 3, num_samples = 20;
+  std::vector<std::string> phones;
+  fst::SymbolTable symbols("phones");
+  symbols.AddSymbol("x");
+  for (int p = 0; p < 5; ++p) {
+    phones.push_back(StringPrintf("p%d", p));
+    symbols.AddSymbol(phones.back());
+  }
+  // phones of the file are mapped to the symbols
+  phones.push_back("unused");
+  SampleBinaryWriter writer;
+  ASSERT_TRUE(writer.Open(filename, dimension, 2, 1, phones));
+  std::vector<int> left(2), right(1);
+  Statistics stat(dimension);
+  for (int s = 0; s < num_samples; ++s) {
+    left[0] = s % 5;
+    left[1] = (s + 1) % 5;
+    right[0] = (s + 2) % 5;
+    for (int v = 0; v < stat.NumValues(); ++v)
+      stat.ValuesRef()[v] = s * 10 + v;
+    writer.Write(s % 5, s / 5, left, right, stat);
+  }
+  EXPECT_EQ(num_samples, writer.NumSamples());
+  EXPECT_TRUE(writer.Close());
+
+  SampleReader *reader = SampleReader::Create(SampleBinaryReader::name());
+  reader->SetPhoneSymbols(&symbols);
+  Samples samples;
+  samples.SetNumPhones(symbols.AvailableKey());
+  EXPECT_TRUE(reader->Read(filename, &samples));
+  delete reader;
+  EXPECT_EQ(dimension, samples.FeatureDimension());
+  for (int s = 0; s < num_samples; ++s) {
+    const Samples::SampleList &l = samples.GetSamples(s % 5 + 1, s / 5);
+    ASSERT_EQ(1, int(l.size()));
+    const Sample &sample = l.front();
+    ASSERT_EQ(2, int(sample.left_context_.size()));
+    ASSERT_EQ(1, int(sample.right_context_.size()));
+    EXPECT_EQ((s % 5) + 1, sample.left_context_[0]);
+    EXPECT_EQ((s + 1) % 5 + 1, sample.left_context_[1]);
+    EXPECT_EQ((s + 2) % 5 + 1, sample.right_context_[0]);
+    for (int v = 0; v < sample.stat.NumValues(); ++v)
+      EXPECT_EQ(float(s * 10 + v), sample.stat.values()[v]);
+  }
+}
+
 }  // namespace trainc
@@ -146,6 +146,113 @@ TEST(Samples, Create) {
   }
 }
 
+TEST(Samples, MergeDuplicates) {
+  const int num_phones = 3, dim = 2, num_contexts = 4, num_copies = 3;
+  Samples samples, other;
+  samples.SetFeatureDimension(dim);
+  samples.SetNumPhones(num_phones);
+  other.SetFeatureDimension(dim);
+  other.SetNumPhones(num_phones);
+  for (int c = 0; c < num_copies; ++c) {
+    Samples &target = c ? other : samples;
+    for (int i = 0; i < num_contexts; ++i) {
+      Sample *sample = target.AddSample(1, 2);
+      sample->left_context_.push_back(i % 2);
+      sample->right_context_.push_back(i / 2);
+      sample->stat.SetWeight(c + 1);
+      sample->stat.SumRef()[1] = i;
+    }
+  }
+  samples.Merge(&other);
+  EXPECT_EQ(0, other.NumSamples());
+  EXPECT_EQ(num_contexts * num_copies, samples.NumSamples());
+  EXPECT_EQ(num_contexts * (num_copies - 1), samples.MergeDuplicates());
+  const Samples::SampleList &merged = samples.GetSamples(1, 2);
+  EXPECT_EQ(num_contexts, int(merged.size()));
+  int i = 0;
+  for (Samples::SampleList::const_iterator s = merged.begin();
+       s != merged.end(); ++s, ++i) {
+    EXPECT_EQ(i % 2, s->left_context_[0]);
+    EXPECT_EQ(i / 2, s->right_context_[0]);
+    EXPECT_EQ(6.0f, s->stat.weight());
+    EXPECT_EQ(float(num_copies * i), s->stat.sum()[1]);
+  }
+  EXPECT_EQ(0, samples.MergeDuplicates());
+}
+
+TEST(Samples, Pack) {
+  const int num_samples = 50, dim = 4;
+  const StatisticsFormat formats[] = {
+      kHalfFormat, kBFloat16Format, kBlockScaledFormat };
+  const double tolerance[] = { 2e-3, 1e-2, 2e-3 };
+  for (int f = 0; f < 3; ++f) {
+    Samples samples;
+    samples.SetFeatureDimension(dim);
+    samples.SetNumPhones(2);
+    std::vector<float> observation(dim);
+    for (int i = 0; i < num_samples; ++i) {
+      Sample *sample = samples.AddSample(1, i % 2);
+      for (int n = 0; n <= i % 5; ++n) {
+        for (int d = 0; d < dim; ++d)
+          observation[d] = (d - 2) * 10.0 + std::sin(i * d + n);
+        sample->stat.AddObservation(observation);
+      }
+    }
+    DoubleStatistics expected[2], packed[2];
+    for (int state = 0; state < 2; ++state) {
+      expected[state].Reset(dim);
+      packed[state].Reset(dim);
+      const Samples::SampleList &l = samples.GetSamples(1, state);
+      for (Samples::SampleList::const_iterator s = l.begin(); s != l.end();
+           ++s)
+        expected[state].Accumulate(s->stat);
+    }
+    samples.Pack(formats[f]);
+    for (int state = 0; state < 2; ++state) {
+      const Samples::SampleList &l = samples.GetSamples(1, state);
+      CompensatedStatistics compensated;
+      compensated.Reset(dim);
+      for (Samples::SampleList::const_iterator s = l.begin(); s != l.end();
+           ++s) {
+        EXPECT_TRUE(s->stat.IsPacked());
+        packed[state].Accumulate(s->stat);
+        compensated.Accumulate(s->stat);
+      }
+      EXPECT_EQ(expected[state].weight(), packed[state].weight());
+      for (int d = 0; d < dim; ++d) {
+        const double w = expected[state].weight();
+        const double mean = expected[state].sum()[d] / w;
+        const double var = expected[state].sum2()[d] / w - mean * mean;
+        const double packed_mean = packed[state].sum()[d] / w;
+        const double packed_var =
+            packed[state].sum2()[d] / w - packed_mean * packed_mean;
+        EXPECT_LT(fabs(mean - packed_mean), tolerance[f] * fabs(mean) + 1e-3);
+        EXPECT_LT(fabs(var - packed_var), tolerance[f] * var + 1e-3);
+        EXPECT_LE(fabs(packed[state].sum()[d] - compensated.sum().sum()[d]),
+                  1e-4 * fabs(packed[state].sum()[d]));
+      }
+    }
+  }
+}
+
+TEST(Samples, Float16) {
+  const float values[] = { 0.0, 1.0, -1.5, 0.333251953125, 65504.0,
+                           6.103515625e-05, 5.9604644775390625e-08 };
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_EQ(values[i], HalfToFloat(FloatToHalf(values[i])));
+    EXPECT_LE(fabs(values[i] - BFloat16ToFloat(FloatToBFloat16(values[i]))),
+              fabs(values[i]) / 256);
+  }
+  EXPECT_EQ(65504.0f, HalfToFloat(FloatToHalf(1e6)));
+  EXPECT_EQ(0.0f, HalfToFloat(FloatToHalf(1e-9)));
+  EXPECT_EQ(1.0f, HalfToFloat(FloatToHalf(1.0f + 1.0f / 4096)));
+  EXPECT_EQ(3.140625f, BFloat16ToFloat(FloatToBFloat16(3.14159f)));
+  StatisticsFormat format;
+  EXPECT_TRUE(ParseStatisticsFormat("bf16", &format));
+  EXPECT_EQ(kBFloat16Format, format);
+  EXPECT_FALSE(ParseStatisticsFormat("int8", &format));
+}
+
 TEST(Scorer, Score) {
   std::list<Sample> samples;
   const int num_samples = 3;
@@ -166,4 +273,113 @@ TEST(Scorer, Score) {
   EXPECT_LT(fabs(score - result), 1e-6);
 }
 
+
+// The batch costs differ from the costs of the separate models only by
+// rounding.
+TEST(Scorer, Batch) {
+  const int num_models = 5;
+  const int dimension = 11;
+  MaximumLikelihoodScorer scorer(0.1);
+  BatchStatistics<float> batch;
+  BatchStatistics<double> double_batch;
+  batch.Reset(num_models, dimension);
+  double_batch.Reset(num_models, dimension);
+  std::vector<Statistics> stats(num_models, Statistics(dimension));
+  std::vector<DoubleStatistics> double_stats(num_models);
+  for (int i = 0; i < num_models; ++i) {
+    Statistics &s = stats[i];
+    s.SetWeight(i + 1);
+    for (int d = 0; d < dimension; ++d) {
+      s.SumRef()[d] = (i + 1) * (d + 1);
+      s.Sum2Ref()[d] = (i + 1) * (d + 1) * (d + 1) + i * d;
+    }
+    batch.Set(i, s);
+    double_stats[i].Reset(dimension);
+    double_stats[i].Accumulate(s);
+    double_batch.Set(i, double_stats[i]);
+  }
+  float costs[num_models], double_costs[num_models];
+  scorer.score(batch, costs);
+  scorer.score(double_batch, double_costs);
+  Statistics s;
+  for (int i = 0; i < num_models; ++i) {
+    const float cost = scorer.score(stats[i]);
+    EXPECT_LT(fabs(cost - costs[i]), 1e-5 * fabs(cost));
+    const float double_cost = scorer.score(double_stats[i]);
+    EXPECT_LT(fabs(double_cost - double_costs[i]), 1e-5 * fabs(double_cost));
+    batch.Get(i, &s);
+    EXPECT_EQ(stats[i].weight(), s.weight());
+    EXPECT_EQ(stats[i].sum2()[dimension - 1], s.sum2()[dimension - 1]);
+  }
+}
+
+// The kernels for a fixed dimension yield the same results as the generic
+// code.
+TEST(Scorer, DimensionKernels) {
+  const int dimension = 39;
+  const int num_samples = 10;
+  MaximumLikelihoodScorer scorer(0.01);
+  float costs[2], double_costs[2];
+  Statistics sums[2];
+  for (int k = 0; k < 2; ++k) {
+    if (k)
+      EXPECT_TRUE(SelectDimensionKernels(dimension));
+    Statistics &sum = sums[k];
+    sum.Reset(dimension);
+    DoubleStatistics double_sum;
+    double_sum.Reset(dimension);
+    for (int s = 0; s < num_samples; ++s) {
+      Statistics sample(dimension);
+      sample.SetWeight(1.0);
+      for (int d = 0; d < dimension; ++d) {
+        sample.SumRef()[d] = s * d * 0.1;
+        sample.Sum2Ref()[d] = s * d * d * 0.01 + d;
+      }
+      sum.Accumulate(sample);
+      double_sum.Accumulate(sample);
+    }
+    costs[k] = scorer.score(sum);
+    double_costs[k] = scorer.score(double_sum);
+  }
+  ResetDimensionKernels();
+  EXPECT_FALSE(SelectDimensionKernels(3));
+  for (int i = 0; i < sums[0].NumValues(); ++i)
+    EXPECT_EQ(sums[0].values()[i], sums[1].values()[i]);
+  EXPECT_EQ(costs[0], costs[1]);
+  EXPECT_EQ(double_costs[0], double_costs[1]);
+}
+
+// Statistics with a large mean: the float sum of squares looses the
+// variance.
+TEST(Scorer, Accumulator) {
+  const int num_samples = 100000;
+  const float mean = 1000;
+  Statistics float_sum(1);
+  DoubleStatistics double_sum(1);
+  CompensatedStatistics compensated_sum;
+  compensated_sum.Reset(1);
+  Statistics sample(1);
+  sample.SetWeight(1.0);
+  for (int s = 0; s < num_samples; ++s) {
+    const float v = mean + (s % 2 ? 1 : -1);
+    sample.SumRef()[0] = v;
+    sample.Sum2Ref()[0] = v * v;
+    float_sum.Accumulate(sample);
+    double_sum.Accumulate(sample);
+    compensated_sum.Accumulate(sample);
+  }
+  EXPECT_EQ(double(num_samples), double_sum.weight());
+  EXPECT_EQ(double(num_samples) * mean, double_sum.sum()[0]);
+  MaximumLikelihoodScorer scorer(0.001);
+  // variance 1
+  const double expected = 0.5 * num_samples * (1 + std::log(M_PI + M_PI));
+  EXPECT_LT(fabs(scorer.score(double_sum) - expected) / expected, 1e-6);
+  DoubleStatistics compensated_double;
+  compensated_sum.GetSum(&compensated_double);
+  const double compensated = scorer.score(compensated_double);
+  const double uncompensated = scorer.score(float_sum);
+  EXPECT_LT(fabs(compensated - expected), fabs(uncompensated - expected));
+  EXPECT_LT(fabs(compensated - expected) / expected, 1e-5);
+}
+
 }  // namespace trainc
@@ -21,16 +21,87 @@
 #ifndef SCORER_H_
 #define SCORER_H_
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <list>
+#include <vector>
 #include "sample.h"
 
 namespace trainc {
 
+// Base class for the computation of model costs.
+// The statistics of a model are summed using the precision given by
+// accumulator().
 class Scorer {
 public:
+  Scorer() : accumulator_(kFloatAccumulator) {}
   virtual ~Scorer() {}
   virtual float score(const Statistics &stats) const = 0;
+  virtual float score(const DoubleStatistics &stats) const = 0;
+
+  // Lower bounds of the cost, used to prune the evaluation of splits.
+  // The cost of the union of statistics s_1, ..., s_k is not lower than
+  // sum_i score_bound(s_i) and not lower than min_score() of its total
+  // weight. The default bounds are not informative.
+  virtual double score_bound(const Statistics &stats) const {
+    return -std::numeric_limits<double>::infinity();
+  }
+  virtual double score_bound(const DoubleStatistics &stats) const {
+    return -std::numeric_limits<double>::infinity();
+  }
+  virtual double min_score(double weight, int dimension) const {
+    return -std::numeric_limits<double>::infinity();
+  }
+
+  // Costs of all models of a batch, costs[i] is the cost of model i.
+  // The default implementation scores the models separately.
+  virtual void score(const BatchStatistics<float> &stats, float *costs) const {
+    Statistics s;
+    for (int i = 0; i < stats.size(); ++i) {
+      stats.Get(i, &s);
+      costs[i] = score(s);
+    }
+  }
+  virtual void score(const BatchStatistics<double> &stats,
+                     float *costs) const {
+    DoubleStatistics s;
+    for (int i = 0; i < stats.size(); ++i) {
+      stats.Get(i, &s);
+      costs[i] = score(s);
+    }
+  }
+
+  // Costs of the given statistics, computed by one call of the batch
+  // scorer. Statistics without dimension, i.e. of models without samples,
+  // are scored separately.
+  template<class S>
+  void ScoreAll(const std::vector<const S*> &stats, float *costs) const {
+    std::vector<int> models;
+    int dim = 0;
+    for (int i = 0; i < stats.size(); ++i) {
+      if (stats[i]->dimension() > 0) {
+        models.push_back(i);
+        dim = stats[i]->dimension();
+      } else {
+        costs[i] = score(*stats[i]);
+      }
+    }
+    if (models.empty()) return;
+    BatchStatistics<typename S::Value> batch;
+    batch.Reset(models.size(), dim);
+    for (int i = 0; i < models.size(); ++i)
+      batch.Set(i, *stats[models[i]]);
+    std::vector<float> batch_costs(models.size());
+    score(batch, &batch_costs[0]);
+    for (int i = 0; i < models.size(); ++i)
+      costs[models[i]] = batch_costs[i];
+  }
+
+  void SetAccumulator(AccumulatorType type) { accumulator_ = type; }
+  AccumulatorType accumulator() const { return accumulator_; }
+private:
+  AccumulatorType accumulator_;
 };
 
 // negative log-likelihood for Gaussian with diagonal covariance.
@@ -42,22 +113,115 @@ public:
   virtual ~MaximumLikelihoodScorer() {}
 
   virtual float score(const Statistics &stats) const {
-    float n = stats.weight();
-    float d = stats.dimension();
+    return Score(stats);
+  }
+
+  virtual float score(const DoubleStatistics &stats) const {
+    return Score(stats);
+  }
+
+  virtual void score(const BatchStatistics<float> &stats, float *costs) const {
+    BatchScore(stats, costs);
+  }
+
+  virtual void score(const BatchStatistics<double> &stats,
+                     float *costs) const {
+    BatchScore(stats, costs);
+  }
+
+  virtual double score_bound(const Statistics &stats) const {
+    return Bound(stats);
+  }
+
+  virtual double score_bound(const DoubleStatistics &stats) const {
+    return Bound(stats);
+  }
+
+  // The floored variance is not lower than the variance floor.
+  virtual double min_score(double weight, int dimension) const {
+    return (.5 * weight) * dimension *
+        (1 + pi_const_ + std::log(double(variance_floor_)));
+  }
+
+protected:
+  // The variance is computed in the precision of the statistics.
+  // Uses the ScoreKernel for the dimension, if available.
+  template<class T>
+  float Score(const BasicStatistics<T> &stats) const {
+    T n = stats.weight();
+    T d = stats.dimension();
     double ll = 0.0;
-    const float *sum = stats.sum();
-    const float *sum2 = stats.sum2();
-    for (int i = 0; i < d; ++i, ++sum, ++sum2) {
-      float mean = *sum / n;
-      float var = *sum2 / n;
-      var -= mean * mean;
-      if (var < variance_floor_) var = variance_floor_;
+    const T *sum = stats.sum();
+    const T *sum2 = stats.sum2();
+    typename ScoreKernel<T>::Function kernel =
+        ScoreKernel<T>::Get(stats.dimension());
+    if (kernel) {
+      ll = kernel(sum, sum2, n, variance_floor_);
+    } else {
+      for (int i = 0; i < d; ++i, ++sum, ++sum2) {
+        T mean = *sum / n;
+        T var = *sum2 / n;
+        var -= mean * mean;
+        if (var < variance_floor_) var = variance_floor_;
+        ll += std::log(var);
+      }
+    }
+    return (.5 * n) * (d + d * pi_const_ + ll);
+  }
+
+  // Cost of all models of the batch, computed as in Score().
+  // The models are processed in the inner loop, which allows to vectorize
+  // the computation of the variances. The logarithm is computed for the
+  // product of the variances of kBatchDimensions dimensions, which differs
+  // from Score() only by rounding.
+  template<class T>
+  void BatchScore(const BatchStatistics<T> &stats, float *costs) const {
+    const int num_models = stats.size();
+    const int d = stats.dimension();
+    const T *n = stats.weight();
+    std::vector<double> ll(num_models, 0.0), prod(num_models);
+    for (int k = 0; k < d; k += kBatchDimensions) {
+      std::fill(prod.begin(), prod.end(), 1.0);
+      const int end = std::min(k + kBatchDimensions, d);
+      for (int j = k; j < end; ++j) {
+        const T *sum = stats.sum(j);
+        const T *sum2 = stats.sum2(j);
+        for (int i = 0; i < num_models; ++i) {
+          const T mean = sum[i] / n[i];
+          const T var = sum2[i] / n[i] - mean * mean;
+          prod[i] *= (var < variance_floor_ ? variance_floor_ : var);
+        }
+      }
+      for (int i = 0; i < num_models; ++i)
+        ll[i] += std::log(prod[i]);
+    }
+    for (int i = 0; i < num_models; ++i)
+      costs[i] = (.5 * n[i]) * (d + d * pi_const_ + ll[i]);
+  }
+
+  // Number of variances multiplied in BatchScore(). The product of 8
+  // floored variances stays within the range of double.
+  enum { kBatchDimensions = 8 };
+
+  // Cost using the variance without flooring. The ML likelihood of the
+  // union of statistics is not higher than the sum of the likelihoods
+  // of the separately estimated parts.
+  template<class T>
+  double Bound(const BasicStatistics<T> &stats) const {
+    const double n = stats.weight();
+    const int d = stats.dimension();
+    double ll = 0.0;
+    const T *sum = stats.sum();
+    const T *sum2 = stats.sum2();
+    for (int i = 0; i < d; ++i) {
+      const double mean = sum[i] / n;
+      const double var = sum2[i] / n - mean * mean;
+      if (var <= 0) return -std::numeric_limits<double>::infinity();
       ll += std::log(var);
     }
     return (.5 * n) * (d + d * pi_const_ + ll);
   }
 
-protected:
   const float variance_floor_;
   const float pi_const_;
 };
@@ -86,9 +86,9 @@ void ShiftedLexiconTransducerInitializer::Build(const fst::StdExpandedFst &l) {
     }
   }
   State *start = target_->GetStateRef(target_->Start());
-  ContextSet *start_context = start->ContextRef()->GetContextRef(0);
-  CHECK(start_context->IsEmpty());
-  start_context->Add(boundary_phone_);
+  PhoneContext *start_context = start->ContextRef();
+  CHECK(start_context->GetContext(0).IsEmpty());
+  start_context->AddToContext(0, boundary_phone_);
 }
 
 } // namespace trainc
@@ -0,0 +1,283 @@
+// slab_pool.h
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Allocation of small objects from slabs
+
+#ifndef SLAB_POOL_H_
+#define SLAB_POOL_H_
+
+#include <cstddef>
+#include <new>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "util.h"
+
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#define SLAB_POOL_THREAD_LOCAL __thread
+#else
+#define SLAB_POOL_THREAD_LOCAL
+#endif
+
+namespace trainc {
+
+// Allocates objects of class T from slabs of kSlabObjects objects.
+// A pool is owned by the creator of the objects, e.g. the ModelManager.
+// All slabs are released in bulk when the pool is deleted. Objects
+// allocated from the pool have to be deleted before.
+// Each object is preceded by a pointer to its pool, which is used to free
+// the object. Objects allocated without a pool, and allocations of a
+// different size (e.g. of derived classes), use the global operator new.
+// Freed objects are kept in a free list and reused by later allocations.
+// The free list and the current slab of a pool are locked. Each thread
+// has a cache of free objects of one pool, which is refilled from the
+// shared free list and spilled back to it in batches of kBatchSize
+// objects. Objects freed by a thread other than the allocating one are
+// therefore reused by all threads. The cache of a thread is dropped if the
+// thread uses another pool; at most 2 * kBatchSize objects of a pool are
+// lost in the cache of a thread, until the pool is deleted.
+// Used by the class specific operators new and delete of T:
+//   static void* operator new(size_t size, SlabPool<T> *pool) {
+//     return SlabPool<T>::Allocate(pool, size);
+//   }
+//   static void operator delete(void *p, size_t size) {
+//     SlabPool<T>::Free(p);
+//   }
+template<class T>
+class SlabPool {
+ public:
+  SlabPool()
+      : id_(NextId()), free_list_(NULL), slab_pos_(NULL), slab_end_(NULL),
+        slabs_(NULL), num_allocations_(0), num_slabs_(0) {
+#ifdef HAVE_THREADS
+    pthread_mutex_init(&mutex_, NULL);
+#endif
+  }
+
+  // Releases all slabs.
+  ~SlabPool() {
+    if (cache_.pool == id_)
+      cache_.pool = 0;
+    while (slabs_) {
+      Block *slab = slabs_;
+      slabs_ = slab->next;
+      ::operator delete(slab);
+    }
+#ifdef HAVE_THREADS
+    pthread_mutex_destroy(&mutex_);
+#endif
+  }
+
+  // Allocates an object of the given size from pool, or from the heap if
+  // pool is NULL.
+  static void* Allocate(SlabPool *pool, size_t size) {
+    Header *header = NULL;
+    if (pool && size == sizeof(T)) {
+      header = reinterpret_cast<Header*>(pool->AllocateBlock());
+    } else {
+      header = static_cast<Header*>(::operator new(sizeof(Header) + size));
+      pool = NULL;
+    }
+    header->pool = pool;
+    return header + 1;
+  }
+
+  // Frees an object allocated by Allocate().
+  static void Free(void *p) {
+    if (!p) return;
+    Header *header = static_cast<Header*>(p) - 1;
+    if (header->pool)
+      header->pool->FreeBlock(reinterpret_cast<Block*>(header));
+    else
+      ::operator delete(header);
+  }
+
+  // Number of objects allocated from the pool.
+  int64 NumAllocations() const {
+#ifdef HAVE_THREADS
+    return __sync_fetch_and_add(&num_allocations_, 0);
+#else
+    return num_allocations_;
+#endif
+  }
+  // Number of slabs allocated from the system.
+  int64 NumSlabs() const {
+    Lock lock(this);
+    return num_slabs_;
+  }
+  // Number of objects per slab.
+  static int SlabObjects() { return kSlabObjects; }
+
+ private:
+  struct Block {
+    Block *next;
+  };
+  // Precedes each object.
+  struct Header {
+    SlabPool *pool;
+  };
+  // Free objects of the pool with id pool.
+  struct Cache {
+    int64 pool;
+    Block *blocks;
+    int size;
+  };
+  static const int kSlabObjects = 256;
+  static const int kBatchSize = 32;
+
+  // Size of an object and its header, aligned at pointer size.
+  static size_t BlockSize() {
+    return (sizeof(Header) + sizeof(T) + sizeof(Block) - 1) /
+        sizeof(Block) * sizeof(Block);
+  }
+
+  // Locks the shared free list and slab.
+  class Lock {
+   public:
+#ifdef HAVE_THREADS
+    explicit Lock(const SlabPool *pool) : mutex_(&pool->mutex_) {
+      pthread_mutex_lock(mutex_);
+    }
+    ~Lock() { pthread_mutex_unlock(mutex_); }
+   private:
+    pthread_mutex_t *mutex_;
+#else
+    explicit Lock(const SlabPool *pool) {}
+#endif
+  };
+
+  Block* AllocateBlock() {
+    Increment(&num_allocations_);
+    if (cache_.pool != id_) {
+      // drop the cache of another pool
+      cache_.pool = id_;
+      cache_.blocks = NULL;
+      cache_.size = 0;
+    }
+    if (!cache_.blocks)
+      Refill();
+    Block *block = cache_.blocks;
+    cache_.blocks = block->next;
+    --cache_.size;
+    return block;
+  }
+
+  void FreeBlock(Block *block) {
+    if (cache_.pool != id_) {
+      Lock lock(this);
+      block->next = free_list_;
+      free_list_ = block;
+      return;
+    }
+    block->next = cache_.blocks;
+    cache_.blocks = block;
+    if (++cache_.size > 2 * kBatchSize)
+      Spill();
+  }
+
+  // Move kBatchSize objects from the shared free list, or from the current
+  // slab if the free list is empty, to the cache of this thread.
+  void Refill() {
+    Lock lock(this);
+    for (int n = 0; n < kBatchSize; ++n) {
+      Block *block = free_list_;
+      if (block) {
+        free_list_ = block->next;
+      } else {
+        if (slab_pos_ == slab_end_)
+          NewSlab();
+        block = reinterpret_cast<Block*>(slab_pos_);
+        slab_pos_ += BlockSize();
+      }
+      block->next = cache_.blocks;
+      cache_.blocks = block;
+      ++cache_.size;
+    }
+  }
+
+  // Move all but the kBatchSize most recently freed objects from the cache
+  // of this thread to the shared free list.
+  void Spill() {
+    Block *last = cache_.blocks;
+    for (int n = 1; n < kBatchSize; ++n)
+      last = last->next;
+    Block *first = last->next, *tail = first;
+    while (tail->next)
+      tail = tail->next;
+    last->next = NULL;
+    cache_.size = kBatchSize;
+    Lock lock(this);
+    tail->next = free_list_;
+    free_list_ = first;
+  }
+
+  // The slabs are linked by their first block.
+  // Requires the lock.
+  void NewSlab() {
+    char *slab = static_cast<char*>(
+        ::operator new(BlockSize() * (kSlabObjects + 1)));
+    Block *head = reinterpret_cast<Block*>(slab);
+    head->next = slabs_;
+    slabs_ = head;
+    ++num_slabs_;
+    slab_pos_ = slab + BlockSize();
+    slab_end_ = slab + BlockSize() * (kSlabObjects + 1);
+  }
+
+  static void Increment(int64 *counter) {
+#ifdef HAVE_THREADS
+    __sync_fetch_and_add(counter, 1);
+#else
+    ++*counter;
+#endif
+  }
+
+  // Pool ids are not reused, such that the cache of a thread never refers
+  // to a deleted pool.
+  static int64 NextId() {
+#ifdef HAVE_THREADS
+    return __sync_add_and_fetch(&last_id_, 1);
+#else
+    return ++last_id_;
+#endif
+  }
+
+  static SLAB_POOL_THREAD_LOCAL Cache cache_;
+  static int64 last_id_;
+  const int64 id_;
+  Block *free_list_;
+  char *slab_pos_;
+  char *slab_end_;
+  Block *slabs_;
+  mutable int64 num_allocations_;
+  int64 num_slabs_;
+#ifdef HAVE_THREADS
+  mutable pthread_mutex_t mutex_;
+#endif
+
+  DISALLOW_COPY_AND_ASSIGN(SlabPool);
+};
+
+template<class T> SLAB_POOL_THREAD_LOCAL
+typename SlabPool<T>::Cache SlabPool<T>::cache_ = { 0, NULL, 0 };
+template<class T> int64 SlabPool<T>::last_id_ = 0;
+
+}  // namespace trainc
+
+#endif  // SLAB_POOL_H_
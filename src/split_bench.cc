@@ -0,0 +1,137 @@
+// split_bench.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Benchmark of the creation of split hypotheses.
+// Reports the run time and the number of model objects allocated, which
+// would be allocated individually without the slab pools, and the number
+// of slabs actually allocated.
+
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "fst/compat.h"
+#include "context_set.h"
+#include "phone_models.h"
+#include "sample.h"
+#include "scorer.h"
+#include "util.h"
+
+DEFINE_int32(num_phones, 40, "number of context phones");
+DEFINE_int32(num_samples, 5000, "number of samples");
+DEFINE_int32(dimension, 16, "feature dimension");
+DEFINE_int32(num_questions, 100, "number of questions per context position");
+DEFINE_int32(repetitions, 10, "number of repetitions");
+
+namespace trainc {
+
+namespace {
+
+double Now() {
+  timeval now;
+  gettimeofday(&now, 0);
+  return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+// Samples with random left and right contexts. Phone symbols are shifted
+// by one.
+void CreateSamples(Samples::SampleList *samples) {
+  std::vector<float> observation(FLAGS_dimension);
+  for (int i = 0; i < FLAGS_num_samples; ++i) {
+    samples->push_back(Sample(FLAGS_dimension));
+    Sample &sample = samples->back();
+    const int left = rand() % FLAGS_num_phones;
+    const int right = rand() % FLAGS_num_phones;
+    sample.left_context_.push_back(left + 1);
+    sample.right_context_.push_back(right + 1);
+    for (int d = 0; d < FLAGS_dimension; ++d)
+      observation[d] = left + right * d + 1.0 * rand() / RAND_MAX;
+    sample.stat.AddObservation(observation);
+  }
+}
+
+// Questions with random phone sets.
+void CreateQuestions(std::vector<ContextQuestion*> *questions) {
+  for (int q = 0; q < FLAGS_num_questions; ++q) {
+    ContextSet phones(FLAGS_num_phones);
+    for (int p = 0; p < FLAGS_num_phones; ++p)
+      if (rand() % 2) phones.Add(p);
+    questions->push_back(new ContextQuestion(phones));
+  }
+}
+
+}  // namespace
+
+void RunBenchmark() {
+  const int phone = 0;
+  PhoneContext context(FLAGS_num_phones, 1, 1);
+  for (int p = 0; p < FLAGS_num_phones; ++p) {
+    context.AddToContext(-1, p);
+    context.AddToContext(1, p);
+  }
+  Samples::SampleList samples;
+  CreateSamples(&samples);
+  std::vector<ContextQuestion*> questions;
+  CreateQuestions(&questions);
+  MaximumLikelihoodScorer scorer(0.001);
+  // the new models are allocated from the pool of the ModelManager
+  context.AddToContext(0, phone);
+  ModelManager models;
+  AllophoneStateModel &model =
+      *models.InitAllophoneModel(phone, 1, context)->GetStateModel(0);
+  model.AddStatistics(phone, samples);
+
+  ModelAllocations before, after;
+  models.GetAllocations(&before);
+  int num_hyps = 0;
+  const double start = Now();
+  for (int r = 0; r < FLAGS_repetitions; ++r) {
+    for (int pos = -1; pos <= 1; pos += 2) {
+      for (int q = 0; q < questions.size(); ++q) {
+        AllophoneStateModel::SplitResult split =
+            model.Split(pos, *questions[q]);
+        if (split.first && split.second) {
+          model.SplitData(pos, &split);
+          model.ComputeCosts(&split, scorer);
+          ++num_hyps;
+        }
+        delete split.first;
+        delete split.second;
+      }
+    }
+  }
+  const double time = Now() - start;
+  models.GetAllocations(&after);
+  printf("samples=%d phones=%d dimension=%d questions=%d\n",
+         FLAGS_num_samples, FLAGS_num_phones, FLAGS_dimension,
+         FLAGS_num_questions);
+  printf("hypotheses: %d  time/hyp: %8.3f us\n", num_hyps,
+         time / num_hyps * 1e6);
+  printf("allocations: objects: %lld  slabs: %lld\n",
+         static_cast<long long>(after.objects - before.objects),
+         static_cast<long long>(after.slabs - before.slabs));
+  STLDeleteElements(&questions);
+}
+
+}  // namespace trainc
+
+int main(int argc, char **argv) {
+  SetFlags("", &argc, &argv, true);
+  trainc::RunBenchmark();
+  return 0;
+}
@@ -16,12 +16,17 @@
 // Author: rybach@google.com (David Rybach)
 //
 
+#include <algorithm>
 #include <ext/hash_set>
+#include <functional>
 #include <limits>
+#include <queue>
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include "cost_cache.h"
 #include "hash.h"
+#include "scorer.h"
 #include "split_generator.h"
 #ifdef HAVE_THREADS
 #include "thread.h"
@@ -45,19 +50,41 @@ bool AbstractSplitGenerator::IsValidSplit(
   return true;
 }
 
+bool AbstractSplitGenerator::IsValidSplit(const QuestionSplit &split) const {
+  for (int c = 0; c < 2; ++c) {
+    if ((min_observations_ > 0 &&
+        split.num_observations[c] < min_observations_) ||
+        (min_seen_contexts_ > 0 &&
+        split.num_seen_contexts[c] < min_seen_contexts_)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void AbstractSplitGenerator::CreateSplitHypotheses(
     const ModelManager::StateModelRef state_model, bool center_only) {
   DCHECK(questions_);
   DCHECK(scorer_);
   DCHECK(hyps_);
+  DCHECK(!(cost_cache_ && (use_question_tables_ || prune_hyps_)));
   int from_context = (center_only ? 0 : -num_left_contexts_);
   int to_context = (center_only ? 0 : num_right_contexts_);
   hash_set<ContextSet, Hash<ContextSet>, Equal<ContextSet> > seen_contexts;
+  // questions evaluated using the question table, for each position.
+  // with pruning, all positions of the state model are evaluated together.
+  std::vector<std::vector<int> > table_questions(
+      to_context - from_context + 1);
+  bool have_table_questions = false;
   for (int pos = from_context; pos <= to_context; ++pos) {
     if (!split_center_ && pos == 0)
       continue;
     const ContextSet &context = (*state_model)->GetContext().GetContext(pos);
     const QuestionSet& questions = *(*questions_)[pos + num_left_contexts_];
+    const bool use_table = (use_question_tables_ || prune_hyps_) &&
+        question_tables_ &&
+        (*question_tables_)[pos + num_left_contexts_];
+    std::vector<int> &selected = table_questions[pos - from_context];
     seen_contexts.clear();
     seen_contexts.resize(questions.size());
     for (int q = 0; q < questions.size(); ++q) {
@@ -68,10 +95,80 @@ void AbstractSplitGenerator::CreateSplitHypotheses(
         // empty splits and redundant splits, i.e. questions yielding
         // an already used context, are ignored.
         seen_contexts.insert(new_context);
-        AddHypothesis(state_model, pos, question);
+        if (use_table)
+          selected.push_back(q);
+        else
+          AddHypothesis(state_model, pos, question);
       }
     }
+    if (selected.empty()) continue;
+    if (prune_hyps_) {
+      have_table_questions = true;
+    } else {
+      AddHypotheses(state_model, pos,
+                    std::vector<std::vector<int> >(1, selected));
+      selected.clear();
+    }
   }
+  if (have_table_questions)
+    AddHypotheses(state_model, from_context, table_questions);
+}
+
+void AbstractSplitGenerator::CreateSplitHypotheses(
+    const std::vector<ModelManager::StateModelRef> &state_models,
+    const std::vector<bool> &center_only) {
+  DCHECK_EQ(state_models.size(), center_only.size());
+  for (int m = 0; m < state_models.size(); ++m)
+    CreateSplitHypotheses(state_models[m], center_only[m]);
+}
+
+AbstractSplitGenerator::~AbstractSplitGenerator() {
+  delete cost_cache_;
+}
+
+void AbstractSplitGenerator::SetCostCacheSize(int capacity) {
+  CHECK(capacity <= 0 || !(use_question_tables_ || prune_hyps_));
+  delete cost_cache_;
+  cost_cache_ = NULL;
+  if (capacity > 0)
+    cost_cache_ = new LeafCostCache(capacity);
+}
+
+// The costs of the new models are looked up in cost_cache_. The statistics
+// of a new model which is not cached are summed and inserted in the cache
+// together with its cost. Missing costs are computed by one call of the
+// batch scorer.
+void AbstractSplitGenerator::ComputeCosts(SplitHypothesis *hyp) const {
+  AllophoneStateModel *model = *hyp->model;
+  if (cost_cache_) {
+    const AccumulatorType type = scorer_->accumulator();
+    AllophoneStateModel *new_models[2] = { hyp->split.first,
+                                           hyp->split.second };
+    DoubleStatistics sums[2];
+    std::vector<int> missing;
+    std::vector<const DoubleStatistics*> stats;
+    for (int c = 0; c < 2; ++c) {
+      float cost;
+      if (cost_cache_->Find(*new_models[c], &cost, &sums[c])) {
+        new_models[c]->SetCost(cost);
+      } else {
+        new_models[c]->GetSum(type, &sums[c]);
+        missing.push_back(c);
+        stats.push_back(&sums[c]);
+      }
+    }
+    if (!missing.empty()) {
+      float costs[2];
+      scorer_->ScoreAll(stats, costs);
+      for (int i = 0; i < missing.size(); ++i) {
+        const int c = missing[i];
+        new_models[c]->SetCost(costs[i]);
+        cost_cache_->Insert(*new_models[c], costs[i], sums[c]);
+      }
+    }
+  }
+  // the costs not computed yet.
+  model->ComputeCosts(&hyp->split, *scorer_);
 }
 
 bool AbstractSplitGenerator::CreateSplit(SplitHypothesis *hyp) const {
@@ -87,7 +184,7 @@ bool AbstractSplitGenerator::CreateSplit(SplitHypothesis *hyp) const {
     model->SplitData(hyp->position, &hyp->split);
     if (IsValidSplit(hyp->split)) {
       // only compute gain if the split is valid
-      model->ComputeCosts(&hyp->split, *scorer_);
+      ComputeCosts(hyp);
       hyp->gain = model->GetGain(hyp->split);
       if (hyp->gain < 0.0) {
         // negative gain shouldn't happen.
@@ -109,6 +206,93 @@ bool AbstractSplitGenerator::CreateSplit(SplitHypothesis *hyp) const {
   return keep_hyp;
 }
 
+// Gain required for a hypothesis of a state model to be kept.
+// A hypothesis with a gain lower than the gain of max_rank_ other valid
+// hypotheses of the same state model is never evaluated by the split
+// optimizer, because the optimizer considers only the max_rank_ best
+// hypotheses and all hypotheses of a state model are removed when one
+// of them is applied.
+class AbstractSplitGenerator::GainThreshold : public SplitSelector {
+public:
+  explicit GainThreshold(const AbstractSplitGenerator *parent)
+      : parent_(parent) {}
+  virtual float MinGain() const {
+    float min_gain = -std::numeric_limits<float>::max();
+    if (parent_->min_split_gain_ > 0)
+      min_gain = parent_->min_split_gain_;
+    if (parent_->max_rank_ > 0 && gains_.size() >= parent_->max_rank_)
+      min_gain = std::max(min_gain, gains_.top());
+    return min_gain;
+  }
+  virtual void AddSplit(const QuestionSplit &split, float gain) {
+    // only splits which yield a hypothesis are counted
+    if (!(split.num_seen_contexts[0] && split.num_seen_contexts[1]) ||
+        !parent_->IsValidSplit(split) || !parent_->IsEnoughGain(gain))
+      return;
+    gains_.push(gain);
+    if (parent_->max_rank_ > 0 && gains_.size() > parent_->max_rank_)
+      gains_.pop();
+  }
+private:
+  const AbstractSplitGenerator *parent_;
+  std::priority_queue<float, std::vector<float>, std::greater<float> > gains_;
+};
+
+// The new models are only created for valid splits with enough gain.
+// Their costs are set from the result of EvaluateQuestions.
+// With pruning, the gain threshold is shared by all context positions of
+// the state model and the hypotheses are filtered by the final threshold.
+void AbstractSplitGenerator::CreateSplits(
+    const ModelManager::StateModelRef state_model, int first_pos,
+    const std::vector<std::vector<int> > &questions,
+    std::vector<SplitHypothesis> *hyps) const {
+  AllophoneStateModel *model = *state_model;
+  GainThreshold threshold(this);
+  std::vector<std::vector<QuestionSplit> > splits(questions.size());
+  for (int i = 0; i < questions.size(); ++i) {
+    if (questions[i].empty()) continue;
+    const int pos = first_pos + i;
+    const QuestionTable &table =
+        *(*question_tables_)[pos + num_left_contexts_];
+    if (prune_hyps_) {
+      model->EvaluateQuestions(pos, table, questions[i], *scorer_,
+                               &threshold, &splits[i]);
+    } else {
+      model->EvaluateQuestions(pos, table, *scorer_, &splits[i]);
+    }
+  }
+  const float min_gain = prune_hyps_ ? threshold.MinGain() :
+      -std::numeric_limits<float>::max();
+  for (int i = 0; i < questions.size(); ++i) {
+    const int pos = first_pos + i;
+    const QuestionSet &question_set =
+        *(*questions_)[pos + num_left_contexts_];
+    for (std::vector<int>::const_iterator q = questions[i].begin();
+         q != questions[i].end(); ++q) {
+      const QuestionSplit &split = splits[i][*q];
+      if (!split.evaluated || !IsValidSplit(split)) continue;
+      const float gain = model->GetCost() - (split.cost[0] + split.cost[1]);
+      if (gain < 0.0) {
+        // negative gain shouldn't happen.
+        LOG(WARNING) << "negative gain" << gain;
+      }
+      if (!IsEnoughGain(gain) || gain < min_gain) continue;
+      const ContextQuestion *question = question_set[*q];
+      SplitHypothesis hyp(state_model, model->Split(pos, *question),
+                          question, pos, gain);
+      if (!(hyp.split.first && hyp.split.second)) {
+        delete hyp.split.first;
+        delete hyp.split.second;
+        continue;
+      }
+      model->SplitData(pos, &hyp.split);
+      hyp.split.first->SetCost(split.cost[0]);
+      hyp.split.second->SetCost(split.cost[1]);
+      hyps->push_back(hyp);
+    }
+  }
+}
+
 AbstractSplitGenerator* AbstractSplitGenerator::Create(
     SplitHypotheses *target, int num_threads) {
   if (num_threads > 1) {
@@ -132,8 +316,19 @@ void SequentialSplitGenerator::AddHypothesis(
   }
 }
 
+void SequentialSplitGenerator::AddHypotheses(
+    const ModelManager::StateModelRef state_model, int first_pos,
+    const std::vector<std::vector<int> > &questions) {
+  std::vector<SplitHypothesis> hyps;
+  CreateSplits(state_model, first_pos, questions, &hyps);
+  hyps_->insert(hyps.begin(), hyps.end());
+}
+
 // ===================================================================
 
+// A single split hypothesis or, if questions is not empty, all
+// hypotheses of the context positions position, position + 1, ...
+// evaluated with the question tables.
 class SplitGeneratorTask : public SplitHypothesis {
 public:
   SplitGeneratorTask(
@@ -143,6 +338,15 @@ public:
       : SplitHypothesis(state_model,
                         AllophoneStateModel::SplitResult(NULL, NULL),
                         question, pos, -std::numeric_limits<float>::max()) {}
+  SplitGeneratorTask(
+      const ModelManager::StateModelRef state_model,
+      int first_pos,
+      const std::vector<std::vector<int> > &position_questions)
+      : SplitHypothesis(state_model,
+                        AllophoneStateModel::SplitResult(NULL, NULL),
+                        NULL, first_pos, -std::numeric_limits<float>::max()),
+        questions(position_questions) {}
+  std::vector<std::vector<int> > questions;
 };
 
 class SplitGeneratorMapper {
@@ -151,22 +355,23 @@ public:
   SplitGeneratorMapper* Clone() const {
     return new SplitGeneratorMapper(parent_);
   }
-  ~SplitGeneratorMapper() {
-    STLDeleteElements(&hyps_);
-  }
   void Map(SplitGeneratorTask *task) {
-    if (parent_->CreateSplit(task))
-      hyps_.push_back(task);
+    if (!task->questions.empty()) {
+      parent_->CreateSplits(task->model, task->position, task->questions,
+                            &hyps_);
+    } else if (parent_->CreateSplit(task)) {
+      hyps_.push_back(*task);
+    }
+    delete task;
   }
   void Reset() {
-    STLDeleteElements(&hyps_);
     hyps_.clear();
   }
-  const std::vector<SplitHypothesis*>& GetHyps() const {
+  const std::vector<SplitHypothesis>& GetHyps() const {
     return hyps_;
   }
 protected:
-  std::vector<SplitHypothesis*> hyps_;
+  std::vector<SplitHypothesis> hyps_;
   ParallelSplitGenerator *parent_;
 };
 
@@ -176,9 +381,7 @@ public:
   typedef ModelSplitter::SplitHypotheses SplitHypotheses;
   SplitGeneratorReducer(SplitHypotheses *hyps) : hyps_(hyps) {}
   void Reduce(SplitGeneratorMapper *m) {
-    typedef std::vector<SplitHypothesis*>::const_iterator Iter;
-    for (Iter h = m->GetHyps().begin(); h != m->GetHyps().end(); ++h)
-      hyps_->insert(**h);
+    hyps_->insert(m->GetHyps().begin(), m->GetHyps().end());
   }
 private:
   SplitHypotheses *hyps_;
@@ -220,6 +423,12 @@ void ParallelSplitGenerator::AddHypothesis(
   pool_->Submit(new SplitGeneratorTask(state_model, pos, question));
 }
 
+void ParallelSplitGenerator::AddHypotheses(
+    const ModelManager::StateModelRef state_model, int first_pos,
+    const std::vector<std::vector<int> > &questions) {
+  pool_->Submit(new SplitGeneratorTask(state_model, first_pos, questions));
+}
+
 
 void ParallelSplitGenerator::CreateSplitHypotheses(
     const ModelManager::StateModelRef state_model, bool center_only) {
@@ -229,4 +438,16 @@ void ParallelSplitGenerator::CreateSplitHypotheses(
   pool_->Combine(&reducer);
 }
 
+void ParallelSplitGenerator::CreateSplitHypotheses(
+    const std::vector<ModelManager::StateModelRef> &state_models,
+    const std::vector<bool> &center_only) {
+  DCHECK_EQ(state_models.size(), center_only.size());
+  pool_->Reset();
+  for (int m = 0; m < state_models.size(); ++m)
+    AbstractSplitGenerator::CreateSplitHypotheses(state_models[m],
+                                                  center_only[m]);
+  SplitGeneratorReducer reducer(hyps_);
+  pool_->Combine(&reducer);
+}
+
 }  // namespace trainc {
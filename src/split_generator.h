@@ -27,6 +27,7 @@
 
 namespace trainc {
 
+class LeafCostCache;
 class Scorer;
 
 // Creates split hypotheses used in ModelSplitter.
@@ -39,8 +40,10 @@ public:
   explicit AbstractSplitGenerator(SplitHypotheses *hyps)
       : hyps_(hyps), num_left_contexts_(-1), num_right_contexts_(-1),
         split_center_(false), min_seen_contexts_(0), min_observations_(0),
-        min_split_gain_(0), scorer_(NULL), questions_(NULL) {}
-  virtual ~AbstractSplitGenerator() {}
+        min_split_gain_(0), scorer_(NULL), questions_(NULL),
+        question_tables_(NULL), use_question_tables_(false),
+        prune_hyps_(false), max_rank_(0), cost_cache_(NULL) {}
+  virtual ~AbstractSplitGenerator();
   void SetMinObservations(int min_obs) {
     min_observations_ = min_obs;
   }
@@ -61,6 +64,36 @@ public:
   void SetQuestions(const std::vector<const QuestionSet*> *questions) {
     questions_ = questions;
   }
+  // Membership tables of the questions, same indexing as questions.
+  void SetQuestionTables(const std::vector<const QuestionTable*> *tables) {
+    question_tables_ = tables;
+  }
+  // Evaluate all questions of a context position in one pass using
+  // the question tables.
+  // Not supported together with the cost cache.
+  void SetUseQuestionTables(bool use) {
+    CHECK(!(use && cost_cache_));
+    use_question_tables_ = use;
+  }
+  // Prune the evaluation of questions using upper bounds of the gain.
+  // Requires the question tables. Not supported together with the cost
+  // cache.
+  void SetPruneHypotheses(bool prune) {
+    CHECK(!(prune && cost_cache_));
+    prune_hyps_ = prune;
+  }
+  // Only the max_rank best hypotheses of a state model are considered by
+  // the split optimizer, 0 if all hypotheses are considered.
+  // Used for pruning.
+  void SetMaxRank(int max_rank) {
+    max_rank_ = max_rank;
+  }
+  // Cache the costs and summed statistics of at most capacity new state
+  // models. The cache is disabled if capacity is 0.
+  // Not supported together with question tables or pruning.
+  void SetCostCacheSize(int capacity);
+  // NULL if the cache is disabled.
+  const LeafCostCache* GetCostCache() const { return cost_cache_; }
 
   // Create split hypotheses for all possible splits of the given state model
   // using all context positions and all questions.
@@ -70,12 +103,19 @@ public:
   virtual void CreateSplitHypotheses(
       const ModelManager::StateModelRef state_model, bool center_only);
 
+  // Create split hypotheses for all given state models.
+  // center_only[i] applies to state_models[i].
+  virtual void CreateSplitHypotheses(
+      const std::vector<ModelManager::StateModelRef> &state_models,
+      const std::vector<bool> &center_only);
+
   static AbstractSplitGenerator* Create(SplitHypotheses *target,
                                         int num_threads = 1);
 
 protected:
   // Check if the split models have enough observations and seen contexts.
   bool IsValidSplit(const AllophoneStateModel::SplitResult &split) const;
+  bool IsValidSplit(const QuestionSplit &split) const;
 
   bool IsEnoughGain(float gain) const {
     return min_split_gain_ <= 0.0 || gain >= min_split_gain_;
@@ -83,7 +123,20 @@ protected:
 
   virtual void AddHypothesis(const ModelManager::StateModelRef state_model,
                              int pos, const ContextQuestion *question) = 0;
+  // Add the hypotheses for the given questions of the context positions
+  // first_pos, first_pos + 1, ... (indexes in the question set of the
+  // position), which are evaluated using the question tables.
+  virtual void AddHypotheses(
+      const ModelManager::StateModelRef state_model, int first_pos,
+      const std::vector<std::vector<int> > &questions) = 0;
   bool CreateSplit(SplitHypothesis *hyp) const;
+  // Create the hypotheses added by AddHypotheses.
+  void CreateSplits(const ModelManager::StateModelRef state_model,
+                    int first_pos,
+                    const std::vector<std::vector<int> > &questions,
+                    std::vector<SplitHypothesis> *hyps) const;
+  void ComputeCosts(SplitHypothesis *hyp) const;
+  class GainThreshold;
   SplitHypotheses *hyps_;
   int num_left_contexts_, num_right_contexts_;
   bool split_center_;
@@ -91,6 +144,10 @@ protected:
   float min_split_gain_;
   const Scorer *scorer_;
   const std::vector<const QuestionSet*> *questions_;
+  const std::vector<const QuestionTable*> *question_tables_;
+  bool use_question_tables_, prune_hyps_;
+  int max_rank_;
+  LeafCostCache *cost_cache_;
 };
 
 
@@ -102,7 +159,9 @@ public:
 protected:
   void AddHypothesis(const ModelManager::StateModelRef state_model, int pos,
                      const ContextQuestion *question);
-
+  void AddHypotheses(const ModelManager::StateModelRef state_model,
+                     int first_pos,
+                     const std::vector<std::vector<int> > &questions);
 };
 
 class SplitGeneratorMapper;
@@ -113,11 +172,19 @@ public:
   virtual ~ParallelSplitGenerator();
   virtual void CreateSplitHypotheses(
       const ModelManager::StateModelRef state_model, bool center_only);
+  // The hypotheses of all state models are generated in parallel and
+  // added to the target set once all tasks are finished.
+  virtual void CreateSplitHypotheses(
+      const std::vector<ModelManager::StateModelRef> &state_models,
+      const std::vector<bool> &center_only);
 
 protected:
   class Pool;
   void AddHypothesis(const ModelManager::StateModelRef state_model, int pos,
                      const ContextQuestion *question);
+  void AddHypotheses(const ModelManager::StateModelRef state_model,
+                     int first_pos,
+                     const std::vector<std::vector<int> > &questions);
   Pool *pool_;
   friend class SplitGeneratorMapper;
 };
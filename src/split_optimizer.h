@@ -52,6 +52,9 @@ public:
 
   virtual SplitHypRef FindBestSplit(int *num_counts_, float *best_score,
                                     int *new_states, int *rank) = 0;
+  // Number of best hypotheses considered by FindBestSplit,
+  // 0 if all hypotheses are considered.
+  virtual int MaxRank() const = 0;
 
   static SplitOptimizer* Create(const SplitHypotheses &hyps,
                                 const StateCountingTransducer &t,
@@ -74,6 +77,8 @@ public:
   virtual ~SequentialSplitOptimizer();
   SplitHypRef FindBestSplit(int *num_counts_, float *best_score,
                             int *new_states, int *rank);
+  // Only the best hypothesis is selected if the weight is 0.
+  int MaxRank() const { return weight_ == .0 ? 1 : max_hyps_; }
 protected:
   AbstractSplitPredictor *predictor_;
 };
@@ -89,6 +94,8 @@ public:
   virtual ~ParallelSplitOptimizer();
   SplitHypRef FindBestSplit(int *num_counts_, float *best_score,
                             int *new_states, int *rank);
+  // max_hyps is not supported.
+  int MaxRank() const { return 0; }
 protected:
   void Init();
   class Pool;
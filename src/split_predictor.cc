@@ -111,7 +111,7 @@ int SplitPredictor::Count(
         PhoneContext &new_history = GetPairElement(new_histories, c);
         bool &valid_state = GetPairElement(valid_states, c);
         new_history.SetContext(pos, h->GetContext(pos));
-        new_history.GetContextRef(pos)->Intersect(question.GetPhoneSet(c));
+        new_history.IntersectContext(pos, question.GetPhoneSet(c));
         if (!new_history.GetContext(pos).IsEmpty() &&
             transducer_.GetState(new_history) == NULL) {
           valid_state = true;
@@ -29,15 +29,12 @@ void LexiconStateSiblings::AddState(StateId old_state, StateId new_state,
     states_.resize(new_state + 1, StateDef(fst::kNoStateId, empty_context_));
   StateDef &entry = states_[new_state];
   DCHECK_EQ(entry.origin, fst::kNoStateId);
-  if (old_state != new_state) {
-    GetContext(old_state, &entry.context);
-  } else {
-    ContextPair old_context = make_pair(ContextSet(num_phones_),
-        ContextSet(num_phones_));
-    GetContext(old_state, &old_context);
-    entry.context = old_context;
-  }
-  GetPairElement(entry.context, context_id).Intersect(new_context);
+  ContextPair context = make_pair(ContextSet(num_phones_),
+                                  ContextSet(num_phones_));
+  GetContext(old_state, &context);
+  GetPairElement(context, context_id).Intersect(new_context);
+  entry.context.first.Set(context.first);
+  entry.context.second.Set(context.second);
   entry.origin = GetOrigin(old_state);
   AddIndex(entry, new_state);
 }
@@ -48,7 +45,10 @@ void LexiconStateSiblings::UpdateContext(StateId state, ContextId context_id,
     StateDef &entry = states_[state];
     if (context_id == LexiconStateSplitter::kRightContext)
       RemoveIndex(entry, state);
-    GetPairElement(entry.context, context_id).Intersect(new_context);
+    ContextSetRef &context_ref = GetPairElement(entry.context, context_id);
+    ContextSet context = context_ref.Get();
+    context.Intersect(new_context);
+    context_ref.Set(context);
     if (context_id == LexiconStateSplitter::kRightContext)
       AddIndex(entry, state);
   } else {
@@ -70,13 +70,17 @@ LexiconStateSiblings::StateId LexiconStateSiblings::Find(
   StateId result = fst::kNoStateId;
   if (states_.empty())
     return result;
+  // a right context which is not in the table does not occur in index_
+  ContextSetTable::Id right_id;
+  if (!ContextSetTable::Instance()->Find(right_context, &right_id))
+    return result;
   StateId origin = GetOrigin(state);
   pair<StateIndex::const_iterator, StateIndex::const_iterator> i =
-      index_.equal_range(IndexKey(origin, right_context));
+      index_.equal_range(IndexKey(origin, right_id));
   for (; i.first != i.second; ++i.first) {
     DCHECK(HasState(i.first->second));
     const StateDef &entry = states_[i.first->second];
-    if (left_context.IsSubSet(entry.context.first)) {
+    if (left_context.IsSubSet(entry.context.first.Get())) {
       result = i.first->second;
       break;
     }
@@ -87,7 +91,7 @@ LexiconStateSiblings::StateId LexiconStateSiblings::Find(
 void LexiconStateSiblings::GetContext(StateId state, ContextId context_id,
                                       ContextSet *context) const {
   if (HasState(state)) {
-    *context = GetPairElement(states_[state].context, context_id);
+    *context = GetPairElement(states_[state].context, context_id).Get();
   } else {
     context->Clear();
     context->Invert();
@@ -97,7 +101,8 @@ void LexiconStateSiblings::GetContext(StateId state, ContextId context_id,
 void LexiconStateSiblings::GetContext(StateId state,
                                       ContextPair *context) const {
   if (HasState(state)) {
-    *context = states_[state].context;
+    context->first = states_[state].context.first.Get();
+    context->second = states_[state].context.second.Get();
   } else {
     for (int i = 0; i < 2; ++i) {
       ContextSet &c = GetPairElement(*context, i);
@@ -116,12 +121,13 @@ LexiconStateSiblings::StateId LexiconStateSiblings::GetOrigin(StateId s) const {
 
 void LexiconStateSiblings::AddIndex(const StateDef &def, StateId s) {
   index_.insert(
-      StateIndex::value_type(IndexKey(def.origin, def.context.second), s));
+      StateIndex::value_type(IndexKey(def.origin, def.context.second.id()),
+                             s));
 }
 
 void LexiconStateSiblings::RemoveIndex(const StateDef &def, StateId s) {
   pair<StateIndex::iterator, StateIndex::iterator> i =
-      index_.equal_range(IndexKey(def.origin, def.context.second));
+      index_.equal_range(IndexKey(def.origin, def.context.second.id()));
   DCHECK(i.first != i.second);
   for (; i.first != i.second; ++i.first) {
     if (i.first->second == s) {
@@ -61,25 +61,31 @@ public:
   StateId GetOrigin(StateId s) const;
 
 private:
+  // The context is the id of the right context set in the ContextSetTable,
+  // which is referenced by the StateDef of the indexed state.
   class IndexKey {
   public:
     StateId state;
-    ContextSet context;
-    IndexKey(StateId s, const ContextSet &c) :
+    ContextSetTable::Id context;
+    IndexKey(StateId s, ContextSetTable::Id c) :
       state(s), context(c) {}
     size_t HashValue() const {
       size_t h = state;
-      HashCombine(h, context.HashValue());
+      HashCombine(h, context);
       return h;
     }
     bool IsEqual(const IndexKey &o) const {
-      return state == o.state && context.IsEqual(o.context);
+      return state == o.state && context == o.context;
     }
   };
+  // The context sets are stored in the ContextSetTable.
+  typedef pair<ContextSetRef, ContextSetRef> ContextRefPair;
   struct StateDef {
     StateId origin;
-    ContextPair context;
-    StateDef(StateId o, const ContextPair &c) : origin(o), context(c) {}
+    ContextRefPair context;
+    StateDef(StateId o, const ContextPair &c)
+        : origin(o),
+          context(ContextSetRef(c.first), ContextSetRef(c.second)) {}
   };
   typedef hash_multimap<IndexKey, StateId,
       Hash<IndexKey>, Equal<IndexKey> > StateIndex;
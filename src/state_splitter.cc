@@ -130,7 +130,7 @@ bool StateSplitter::SplitState(
     new_state = NULL;
     PhoneContext new_history = old_state.history();
     const ContextSet &context = GetPairElement(partition, c);
-    new_history.GetContextRef(context_pos)->Intersect(context);
+    new_history.IntersectContext(context_pos, context);
     if (!new_history.GetContext(context_pos).IsEmpty()) {
       new_state = transducer_.GetState(new_history);
       if (!new_state) {
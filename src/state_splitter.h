@@ -113,12 +113,34 @@ class StateSplitter {
   DISALLOW_COPY_AND_ASSIGN(StateSplitter);
 };
 
+// Checks the left contexts of a state sequence, see IsValidStateSequence.
+// Specialized for the common number of left contexts L, the loop is
+// unrolled by the compiler.
+template<int L>
+inline bool IsValidLeftContext(const PhoneContext &source,
+                               const PhoneContext &target) {
+  for (int l = 0; l < L; ++l) {
+    const ContextSet &source_context = source.GetContext(-l);
+    const ContextSet &target_context = target.GetContext(-l - 1);
+    // target_context may be empty, if target represents a CI phone
+    if (!(target_context.IsEmpty() ||
+          source_context.IsSubSet(target_context)))
+      return false;
+  }
+  return true;
+}
+
 inline bool StateSplitter::IsValidStateSequence(
     const PhoneContext &source, int arc_output, const PhoneContext &target,
     bool have_center_set, int num_left_contexts) {
   if (have_center_set && !target.GetContext(0).HasElement(arc_output)) {
     return false;
   }
+  switch (num_left_contexts) {
+    case 1: return IsValidLeftContext<1>(source, target);
+    case 2: return IsValidLeftContext<2>(source, target);
+    default: break;
+  }
   bool valid = true;
   for (int l = 0; l < num_left_contexts; ++l) {
     const ContextSet &source_context = source.GetContext(-l);
@@ -0,0 +1,135 @@
+// statistics_bench.cc
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 RWTH Aachen University. All Rights Reserved.
+// Author: rybach@cs.rwth-aachen.de (David Rybach)
+//
+// \file
+// Benchmark of the summation and scoring of sample statistics.
+// Reports the run time and the deviation from the double precision
+// result for each accumulator type, using the generic code and the
+// kernels for the feature dimension (if available).
+
+#include <sys/time.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "fst/compat.h"
+#include "kernels.h"
+#include "sample.h"
+#include "scorer.h"
+
+DEFINE_int32(num_samples, 10000, "number of samples");
+DEFINE_int32(dimension, 40, "feature dimension");
+DEFINE_int32(frames, 100, "number of frames per sample");
+DEFINE_double(mean, 100.0, "mean of the features");
+DEFINE_int32(repetitions, 20, "number of repetitions");
+DEFINE_double(variance_floor, 0.001, "variance floor of the scorer");
+
+namespace trainc {
+
+namespace {
+
+double Now() {
+  timeval now;
+  gettimeofday(&now, 0);
+  return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+// Samples with features drawn uniformly from [mean - 1, mean + 1].
+void CreateSamples(std::vector<Statistics> *samples) {
+  std::vector<float> observation(FLAGS_dimension);
+  samples->resize(FLAGS_num_samples, Statistics(FLAGS_dimension));
+  for (std::vector<Statistics>::iterator s = samples->begin();
+       s != samples->end(); ++s) {
+    for (int f = 0; f < FLAGS_frames; ++f) {
+      for (int d = 0; d < FLAGS_dimension; ++d)
+        observation[d] = FLAGS_mean + 2.0 * rand() / RAND_MAX - 1.0;
+      s->AddObservation(observation);
+    }
+  }
+}
+
+template<class S>
+void Sum(const std::vector<Statistics> &samples, S *sum) {
+  sum->Reset(FLAGS_dimension);
+  for (std::vector<Statistics>::const_iterator s = samples.begin();
+       s != samples.end(); ++s)
+    sum->Accumulate(*s);
+}
+
+float Score(const std::vector<Statistics> &samples, AccumulatorType type,
+            const Scorer &scorer) {
+  switch (type) {
+    case kDoubleAccumulator: {
+      DoubleStatistics sum;
+      Sum(samples, &sum);
+      return scorer.score(sum);
+    }
+    case kCompensatedAccumulator: {
+      CompensatedStatistics sum;
+      Sum(samples, &sum);
+      DoubleStatistics result;
+      sum.GetSum(&result);
+      return scorer.score(result);
+    }
+    default: {
+      Statistics sum;
+      Sum(samples, &sum);
+      return scorer.score(sum);
+    }
+  }
+}
+
+}  // namespace
+
+void RunBenchmark() {
+  std::vector<Statistics> samples;
+  CreateSamples(&samples);
+  MaximumLikelihoodScorer scorer(FLAGS_variance_floor);
+  const char *names[] = { "float", "double", "kahan" };
+  const AccumulatorType types[] = {
+      kFloatAccumulator, kDoubleAccumulator, kCompensatedAccumulator };
+  const double reference = Score(samples, kDoubleAccumulator, scorer);
+  printf("samples=%d dimension=%d frames=%d mean=%g\n",
+         FLAGS_num_samples, FLAGS_dimension, FLAGS_frames, FLAGS_mean);
+  for (int k = 0; k < 2; ++k) {
+    const char *kernel = "generic";
+    if (k) {
+      if (!SelectDimensionKernels(FLAGS_dimension)) break;
+      kernel = "kernel";
+    }
+    for (int t = 0; t < 3; ++t) {
+      float score = 0;
+      const double start = Now();
+      for (int r = 0; r < FLAGS_repetitions; ++r)
+        score = Score(samples, types[t], scorer);
+      const double time = (Now() - start) / FLAGS_repetitions;
+      printf("%-6s %-7s  time/sum: %8.3f ms  score: %14.2f  "
+             "rel. error: %.3g\n",
+             names[t], kernel, time * 1e3, score,
+             std::fabs(score - reference) / std::fabs(reference));
+    }
+  }
+  ResetDimensionKernels();
+}
+
+}  // namespace trainc
+
+int main(int argc, char **argv) {
+  SetFlags("", &argc, &argv, true);
+  trainc::RunBenchmark();
+  return 0;
+}
@@ -102,6 +102,22 @@ string StringPrintf(const char *format, ...) {
   return result;
 }
 
+// Formats into a buffer on the stack, which is sufficient in most cases.
+void StringAppendF(string *dst, const char *format, ...) {
+  char buf[128];
+  va_list ap;
+  va_start(ap, format);
+  int n = vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  if (n >= 0 && n < sizeof(buf)) {
+    dst->append(buf, n);
+  } else {
+    va_start(ap, format);
+    dst->append(StringVPrintf(format, ap));
+    va_end(ap);
+  }
+}
+
 string StringVPrintf(const char *format, va_list ap) {
   size_t buf_size = 0;
   char *buf = 0;
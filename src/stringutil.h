@@ -54,6 +54,9 @@ std::string StringPrintf(const char *format, ...);
 // printf returning a std::string.
 std::string StringVPrintf(const char *format, va_list ap);
 
+// printf appending to the given string.
+void StringAppendF(std::string *dst, const char *format, ...);
+
 }
 
 #endif /* STRINGUTIL_H_ */
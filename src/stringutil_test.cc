@@ -73,4 +73,14 @@ TEST(StringUtil, StringPrintf) {
   EXPECT_EQ(c, string("10 1.2345"));
 }
 
+TEST(StringUtil, StringAppendF) {
+  string a = "a";
+  StringAppendF(&a, " %d", 1);
+  EXPECT_EQ(a, string("a 1"));
+  string b(200, 'x');
+  string c;
+  StringAppendF(&c, "%s %s", b.c_str(), b.c_str());
+  EXPECT_EQ(c, b + " " + b);
+}
+
 }  // namespace trainc
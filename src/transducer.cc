@@ -123,8 +123,7 @@ ConstructionalTransducer::ConstructionalTransducer(
       state_map_(num_phones * num_phones),
       num_states_(0),
       splitter_(new StateSplitter(this, num_left_contexts, num_right_contexts,
-                                  num_phones, center_set)),
-      observer_(NULL) {}
+                                  num_phones, center_set)) {}
 
 ConstructionalTransducer::~ConstructionalTransducer() {
   // delete all State objects
@@ -158,7 +157,9 @@ State* ConstructionalTransducer::AddState(const PhoneContext &history) {
   CHECK(r.second);  // phone context does not exist
   ++num_states_;
   VLOG(2) << "CT::AddState " << s;
-  if (observer_) observer_->NotifyAddState(s);
+  for (ObserverList::const_iterator o = observers_.begin();
+      o != observers_.end(); ++o)
+    (*o)->NotifyAddState(s);
   return s;
 }
 
@@ -166,7 +167,9 @@ void ConstructionalTransducer::RemoveState(const State *state) {
   VLOG(2) << "CT::RemoveState " << state;
   DCHECK(state->GetArcs().empty());
   state_map_.erase(state->history());
-  if (observer_) observer_->NotifyRemoveState(state);
+  for (ObserverList::const_iterator o = observers_.begin();
+      o != observers_.end(); ++o)
+    (*o)->NotifyRemoveState(state);
   delete state;
   --num_states_;
 }
@@ -197,7 +200,9 @@ State::ArcRef ConstructionalTransducer::AddArc(
   State::ArcRef arc = source->AddArc(input, output, target);
   target->AddIncomingArc(arc);
   SetModelToArc(arc, input);
-  if (observer_) observer_->NotifyAddArc(arc);
+  for (ObserverList::const_iterator o = observers_.begin();
+      o != observers_.end(); ++o)
+    (*o)->NotifyAddArc(arc);
   return arc;
 }
 
@@ -206,6 +211,9 @@ void ConstructionalTransducer::UpdateArcInput(
   RemoveModelToArc(arc, arc->input());
   SetModelToArc(arc, new_input);
   arc->SetInput(new_input);
+  for (ObserverList::const_iterator o = observers_.begin();
+      o != observers_.end(); ++o)
+    (*o)->NotifyUpdateArc(arc);
 }
 
 void ConstructionalTransducer::RemoveArc(State::ArcRef arc) {
@@ -213,7 +221,9 @@ void ConstructionalTransducer::RemoveArc(State::ArcRef arc) {
   arc->target()->RemoveIncomingArc(arc);
   RemoveModelToArc(arc, arc->input());
   State *source = arc->source();
-  if (observer_) observer_->NotifyRemoveArc(arc);
+  for (ObserverList::const_iterator o = observers_.begin();
+      o != observers_.end(); ++o)
+    (*o)->NotifyRemoveArc(arc);
   source->RemoveArc(arc);
 }
 
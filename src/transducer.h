@@ -60,6 +60,7 @@
 #ifndef TRANSDUCER_H_
 #define TRANSDUCER_H_
 
+#include <algorithm>
 #include <ext/hash_map>
 #include <ext/hash_set>
 #include <list>
@@ -236,6 +237,8 @@ public:
   virtual void NotifyRemoveState(const State *) {}
   virtual void NotifyAddArc(const State::ArcRef) {}
   virtual void NotifyRemoveArc(const State::ArcRef) {}
+  // the input model of the arc has changed.
+  virtual void NotifyUpdateArc(const State::ArcRef) {}
 };
 
 // Transducer created during the construction of the
@@ -339,7 +342,11 @@ class ConstructionalTransducer : public StateCountingTransducer {
   // Register an observer object.
   // Ownership remains at caller.
   void RegisterObserver(TransducerChangeObserver *observer) {
-    observer_ = observer;
+    observers_.push_back(observer);
+  }
+  void UnregisterObserver(TransducerChangeObserver *observer) {
+    observers_.erase(std::remove(observers_.begin(), observers_.end(),
+                                 observer), observers_.end());
   }
 
  private:
@@ -366,7 +373,8 @@ class ConstructionalTransducer : public StateCountingTransducer {
   ModelToArcMap arcs_with_model_;
   int num_states_;
   StateSplitter *splitter_;
-  TransducerChangeObserver *observer_;
+  typedef std::vector<TransducerChangeObserver*> ObserverList;
+  ObserverList observers_;
   DISALLOW_COPY_AND_ASSIGN(ConstructionalTransducer);
 };
 
@@ -15,14 +15,20 @@
 // Copyright 2010 Google Inc. All Rights Reserved.
 // Author: rybach@google.com (David Rybach)
 
+#include <algorithm>
+#include <cstdlib>
 #include <set>
-#include "fst/compose.h"
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 #include "fst/vector-fst.h"
 #include "fst/symbol-table.h"
 #include "phone_models.h"
-#include "phone_sequence.h"
 #include "transducer.h"
 #include "transducer_check.h"
+#ifdef HAVE_THREADS
+#include "thread.h"
+#endif
 
 namespace trainc {
 
@@ -89,7 +95,7 @@ bool ConstructionalTransducerCheck::CheckStateModelCompatibility(
     const AllophoneStateModel &state_model = *model.GetStateModel(hmm_state);
     for (int i = -num_left_contexts_; i <= num_right_contexts_; ++i) {
       if (i == 0) continue;
-      common_context.GetContextRef(i)->Intersect(state_model.context(i));
+      common_context.IntersectContext(i, state_model.context(i));
     }
   }
   CHECK(!model.phones().empty());
@@ -191,24 +197,36 @@ bool ConstructionalTransducerCheck::CheckTargetState(
 bool ConstructionalTransducerCheck::IsValid() const {
   bool result = true;
   StateIterator state_iter(c_);
-  for (; !state_iter.Done(); state_iter.Next()) {
-    const State &state = state_iter.Value();
-    result &= CheckDeterministicOutput(state);
-    ArcIterator arc_iter(state);
-    for (; !arc_iter.Done(); arc_iter.Next()) {
-      const Arc &arc = arc_iter.Value();
-      result &= CheckPhoneModel(state, arc);
-      result &= CheckStateModelCompatibility(state, arc);
-      result &= CheckStateModels(state, arc);
-      result &= CheckTargetState(state, arc);
-    }
+  for (; !state_iter.Done(); state_iter.Next())
+    result &= IsValidState(state_iter.Value());
+  return result;
+}
+
+bool ConstructionalTransducerCheck::IsValidState(const State &state) const {
+  bool result = CheckDeterministicOutput(state);
+  ArcIterator arc_iter(state);
+  for (; !arc_iter.Done(); arc_iter.Next()) {
+    const Arc &arc = arc_iter.Value();
+    result &= CheckPhoneModel(state, arc);
+    result &= CheckStateModelCompatibility(state, arc);
+    result &= CheckStateModels(state, arc);
+    result &= CheckTargetState(state, arc);
   }
   return result;
 }
 
+bool IncrementalTransducerCheck::Check() {
+  bool result = true;
+  for (hash_set<const State*, PointerHash<const State> >::const_iterator s =
+      states_.begin(); s != states_.end(); ++s)
+    result &= check_.IsValidState(**s);
+  num_checked_ = states_.size();
+  states_.clear();
+  return result;
+}
+
 
 CTransducerCheck::~CTransducerCheck() {
-  delete piter_;
   delete hmms_;
   delete phones_;
 }
@@ -217,115 +235,341 @@ void CTransducerCheck::Init(
     const std::string &phone_symbols, const std::string &hmm_symbols,
     const std::string &hmm_to_phone, const std::string &boundary_phone,
     int context_length) {
-  phones_ = SymbolTable::ReadText(phone_symbols);
-  CHECK(phones_);
-  hmms_ = SymbolTable::ReadText(hmm_symbols);
-  CHECK(hmms_);
-  hmm_to_phone_.LoadMap(hmm_to_phone);
+  SymbolTable *phones = SymbolTable::ReadText(phone_symbols);
+  CHECK(phones);
+  SymbolTable *hmms = SymbolTable::ReadText(hmm_symbols);
+  CHECK(hmms);
+  StringMap hmm_map;
+  hmm_map.LoadMap(hmm_to_phone);
+  Init(*phones, *hmms, hmm_map, boundary_phone, context_length);
+  delete phones;
+  delete hmms;
+}
+
+void CTransducerCheck::Init(
+    const SymbolTable &phone_symbols, const SymbolTable &hmm_symbols,
+    const StringMap &hmm_to_phone, const std::string &boundary_phone,
+    int context_length) {
+  delete phones_;
+  delete hmms_;
+  phones_ = phone_symbols.Copy();
+  hmms_ = hmm_symbols.Copy();
+  hmm_to_phone_ = hmm_to_phone;
   length_ = context_length;
   boundary_phone_ = phones_->Find(boundary_phone);
   CHECK_GT(boundary_phone_, 0);
-  piter_ = new PhoneSequenceIterator(length_, phones_);
+  phone_ids_.clear();
+  for (fst::SymbolTableIterator i(*phones_); !i.Done(); i.Next()) {
+    if (i.Value() != 0)
+      phone_ids_.push_back(i.Value());
+  }
+  hmm_phones_.clear();
+  for (fst::SymbolTableIterator i(*hmms_); !i.Done(); i.Next()) {
+    if (i.Value() >= hmm_phones_.size())
+      hmm_phones_.resize(i.Value() + 1, -1);
+    const std::string &phone = hmm_to_phone_.get(i.Symbol());
+    if (!phone.empty())
+      hmm_phones_[i.Value()] = phones_->Find(phone);
+  }
 }
 
+namespace {
+struct OLabelCompare {
+  bool operator()(const StdArc &a, const StdArc &b) const {
+    return a.olabel < b.olabel;
+  }
+};
+}  // namespace
+
 void CTransducerCheck::SetTransducer(const StdVectorFst *c) {
   c_ = c;
   CHECK(c_);
+  arcs_.clear();
+  arc_offset_.clear();
+  for (StdArc::StateId s = 0; s < c_->NumStates(); ++s) {
+    arc_offset_.push_back(arcs_.size());
+    for (fst::ArcIterator<StdVectorFst> aiter(*c_, s); !aiter.Done();
+        aiter.Next())
+      arcs_.push_back(aiter.Value());
+    std::sort(arcs_.begin() + arc_offset_.back(), arcs_.end(),
+              OLabelCompare());
+  }
+  arc_offset_.push_back(arcs_.size());
 }
 
-bool CTransducerCheck::IsValid() const {
-  while (!piter_->Done()) {
-    StdVectorFst phone_fst;
-    std::vector<int> phone_vec;
-    piter_->TransducerValue(&phone_fst);
-    piter_->IndexValue(&phone_vec);
-    AddBoundaryPhone(&phone_fst);
-    bool valid = CheckPhoneSequence(phone_fst, phone_vec);
-    if (!valid) {
-      return false;
+// Result of the check of a set of phone sequences.
+// rank is the position of the first failing sequence in the enumeration
+// order of PhoneSequenceIterator (or the sample index).
+struct CTransducerCheck::Failure {
+  enum Type { kNone, kInvalidInput, kInvalidStructure };
+  Type type;
+  uint64 rank;
+  std::vector<int> sequence;
+  Failure() : type(kNone), rank(0) {}
+  void Update(Type t, uint64 r, const std::vector<int> &seq) {
+    if (type == kNone || r < rank) {
+      type = t;
+      rank = r;
+      sequence = seq;
     }
-    piter_->Next();
   }
-  return true;
+  void Update(const Failure &f) {
+    if (f.type != kNone)
+      Update(f.type, f.rank, f.sequence);
+  }
+};
+
+// Depth first search over phone sequences.
+// levels_[d] holds the partial paths in C for the current prefix of
+// length d.
+class CTransducerCheck::Walker {
+public:
+  explicit Walker(const CTransducerCheck &check)
+      : check_(check), num_phones_(check.phone_ids_.size()),
+        levels_(check.length_ + 2), sequence_(check.length_) {}
+
+  // Check all sequences starting with the given phone.
+  void CheckPrefix(int first_phone, Failure *failure);
+  // Check num_samples random sequences.
+  void CheckRandom(int num_samples, uint64 first_rank, unsigned int seed,
+                   Failure *failure);
+
+private:
+  struct Path {
+    StdArc::StateId state;
+    bool eps_start, valid;
+  };
+  void Init();
+  void Advance(int depth, int phone);
+  void Expand(int depth);
+  void CheckSequence();
+  uint64 Rank(int depth) const {
+    uint64 rank = 0;
+    for (int d = depth - 1; d >= 0; --d)
+      rank = rank * num_phones_ + sequence_[d];
+    return rank;
+  }
+  void SetFailure(Failure::Type type, uint64 rank);
+
+  const CTransducerCheck &check_;
+  const uint64 num_phones_;
+  std::vector< std::vector<Path> > levels_;
+  std::vector<int> sequence_;
+  Failure *failure_;
+};
+
+void CTransducerCheck::Walker::Init() {
+  Path start;
+  start.state = check_.c_->Start();
+  start.eps_start = start.valid = true;
+  levels_[0].clear();
+  levels_[0].push_back(start);
 }
 
-void CTransducerCheck::AddBoundaryPhone(StdVectorFst *phone_fst) const {
-  StdVectorFst::StateId new_final = phone_fst->AddState();
-  StdVectorFst::StateId final = fst::kNoStateId;
-  // find unique final state
-  fst::StateIterator<StdVectorFst> siter(*phone_fst);
-  siter.Next();  // skip start state
-  while (!siter.Done()) {
-    StdVectorFst::StateId s = siter.Value();
-    if (phone_fst->Final(s) != StdArc::Weight::Zero()) {
-      CHECK_EQ(final, fst::kNoStateId);
-      final = s;
+// Extend the paths for the prefix of length depth by arcs with output phone.
+void CTransducerCheck::Walker::Advance(int depth, int phone) {
+  const std::vector<Path> &paths = levels_[depth];
+  std::vector<Path> &next = levels_[depth + 1];
+  next.clear();
+  const int prev_phone =
+      depth ? check_.phone_ids_[sequence_[depth - 1]] : -1;
+  StdArc key;
+  key.olabel = phone;
+  for (std::vector<Path>::const_iterator p = paths.begin(); p != paths.end();
+      ++p) {
+    const std::vector<StdArc>::const_iterator begin =
+        check_.arcs_.begin() + check_.arc_offset_[p->state],
+        end = check_.arcs_.begin() + check_.arc_offset_[p->state + 1];
+    std::vector<StdArc>::const_iterator a =
+        std::lower_bound(begin, end, key, OLabelCompare());
+    for (; a != end && a->olabel == phone; ++a) {
+      Path n;
+      n.state = a->nextstate;
+      if (depth) {
+        n.eps_start = p->eps_start;
+        n.valid = p->valid && check_.HmmPhone(a->ilabel) == prev_phone;
+      } else {
+        n.eps_start = a->ilabel == 0;
+        n.valid = p->valid;
+      }
+      next.push_back(n);
     }
-    siter.Next();
   }
-  CHECK_NE(final, fst::kNoStateId);
-  // add new arc;
-  StdArc narc(boundary_phone_, boundary_phone_, StdArc::Weight::One(),
-              new_final);
-  phone_fst->AddArc(final, narc);
-  // set new final state
-  phone_fst->SetFinal(final, StdArc::Weight::Zero());
-  phone_fst->SetFinal(new_final, StdArc::Weight::One());
 }
 
-void CTransducerCheck::GetSequence(
-    const StdVectorFst &cl, vector<int> *hmm_seq) const {
-  StdVectorFst::StateId s = cl.Start();
-  hmm_seq->clear();
-  while (cl.NumArcs(s) > 0) {
-    CHECK_LE(cl.NumArcs(s), 1);
-    fst::ArcIterator<StdVectorFst> ai(cl, s);
-    const StdArc &arc = ai.Value();
-    hmm_seq->push_back(arc.ilabel);
-    s = arc.nextstate;
+void CTransducerCheck::Walker::SetFailure(Failure::Type type, uint64 rank) {
+  std::vector<int> seq;
+  for (int d = 0; d < check_.length_; ++d)
+    seq.push_back(check_.phone_ids_[sequence_[d]]);
+  failure_->Update(type, rank, seq);
+}
+
+// Append the boundary phone and count the successful paths.
+void CTransducerCheck::Walker::CheckSequence() {
+  const int depth = check_.length_;
+  Advance(depth, check_.boundary_phone_);
+  const std::vector<Path> &paths = levels_[depth + 1];
+  int num_final = 0;
+  const Path *final_path = NULL;
+  for (std::vector<Path>::const_iterator p = paths.begin(); p != paths.end();
+      ++p) {
+    if (check_.c_->Final(p->state) != StdArc::Weight::Zero()) {
+      ++num_final;
+      final_path = &*p;
+    }
   }
+  if (num_final != 1 || !final_path->eps_start)
+    SetFailure(Failure::kInvalidStructure, Rank(depth));
+  else if (!final_path->valid)
+    SetFailure(Failure::kInvalidInput, Rank(depth));
 }
 
+void CTransducerCheck::Walker::Expand(int depth) {
+  if (depth == check_.length_) {
+    CheckSequence();
+    return;
+  }
+  for (int p = 0; p < num_phones_; ++p) {
+    sequence_[depth] = p;
+    Advance(depth, check_.phone_ids_[p]);
+    if (levels_[depth + 1].empty()) {
+      // no path for all sequences with this prefix.
+      for (int d = depth + 1; d < check_.length_; ++d)
+        sequence_[d] = 0;
+      SetFailure(Failure::kInvalidStructure, Rank(depth + 1));
+    } else {
+      Expand(depth + 1);
+    }
+  }
+}
 
-bool CTransducerCheck::CheckPhoneSequence(
-    const StdVectorFst &phone_fst, const vector<int> &phone_seq) const {
-  StdVectorFst cl;
-  fst::Compose(*c_, phone_fst, &cl);
-  CHECK_EQ(cl.NumStates(), length_ + 2);
-  if (VLOG_IS_ON(1))
-    PrintSequence(cl);
-  vector<int> hmm_seq;
-  GetSequence(cl, &hmm_seq);
-  CHECK_EQ(hmm_seq.size(), length_ + 1);
-  CHECK_EQ(hmm_seq[0], 0);
-  for (int p = 0; p < length_; ++p) {
-    string cd_phone = hmm_to_phone_.get(hmms_->Find(hmm_seq[p+1]));
-    string phone = phones_->Find(phone_seq[p]);
-    if (cd_phone != phone) {
-      return false;
+void CTransducerCheck::Walker::CheckPrefix(int first_phone,
+                                           Failure *failure) {
+  failure_ = failure;
+  Init();
+  if (check_.length_ == 0) {
+    CheckSequence();
+    return;
+  }
+  sequence_[0] = first_phone;
+  Advance(0, check_.phone_ids_[first_phone]);
+  if (levels_[1].empty()) {
+    std::fill(sequence_.begin() + 1, sequence_.end(), 0);
+    SetFailure(Failure::kInvalidStructure, Rank(1));
+  } else {
+    Expand(1);
+  }
+}
+
+void CTransducerCheck::Walker::CheckRandom(
+    int num_samples, uint64 first_rank, unsigned int seed, Failure *failure) {
+  failure_ = NULL;
+  Failure sample_failure;
+  for (int n = 0; n < num_samples; ++n) {
+    Init();
+    bool dead = false;
+    for (int d = 0; d < check_.length_; ++d)
+      sequence_[d] = rand_r(&seed) % num_phones_;
+    for (int d = 0; d < check_.length_ && !dead; ++d) {
+      Advance(d, check_.phone_ids_[sequence_[d]]);
+      dead = levels_[d + 1].empty();
+    }
+    sample_failure = Failure();
+    failure_ = &sample_failure;
+    if (dead)
+      SetFailure(Failure::kInvalidStructure, 0);
+    else
+      CheckSequence();
+    if (sample_failure.type != Failure::kNone) {
+      failure->Update(sample_failure.type, first_rank + n,
+                      sample_failure.sequence);
+      break;
     }
   }
-  return true;
 }
 
+// A task is either the subtree of all sequences starting with a phone,
+// or a range of random samples.
+struct CTransducerCheck::CheckTask {
+  int first_phone;
+  int num_samples;
+  uint64 first_rank;
+  unsigned int seed;
+  Failure failure;
+  CheckTask() : first_phone(-1), num_samples(0), first_rank(0), seed(0) {}
+};
 
-void CTransducerCheck::PrintSequence(const StdVectorFst &cl) const {
-  StdVectorFst::StateId s = cl.Start();
-  string input, output;
-  VLOG(1) << "num states: " << cl.NumStates();
-  while (cl.NumArcs(s) > 0) {
-    CHECK_LE(cl.NumArcs(s), 1);
-    fst::ArcIterator<StdVectorFst> ai(cl, s);
-    const StdArc &arc = ai.Value();
-    const string hmm_name = hmms_->Find(arc.ilabel);
-    input += hmm_name + "/";
-    input +=  (arc.ilabel ? hmm_to_phone_.get(hmm_name) : "eps") + " ";
-    output += phones_->Find(arc.olabel) + " ";
-    s = arc.nextstate;
+class CTransducerCheck::WalkerMapper {
+public:
+  explicit WalkerMapper(const CTransducerCheck *check)
+      : check_(check), walker_(*check) {}
+  WalkerMapper* Clone() const {
+    return new WalkerMapper(check_);
+  }
+  void Map(CheckTask *task) {
+    if (task->num_samples)
+      walker_.CheckRandom(task->num_samples, task->first_rank, task->seed,
+                          &task->failure);
+    else
+      walker_.CheckPrefix(task->first_phone, &task->failure);
   }
-  VLOG(1) << "input:  " << input;
-  VLOG(1) << "output: " << output;
+  void Reset() {}
+private:
+  const CTransducerCheck *check_;
+  Walker walker_;
+};
+
+bool CTransducerCheck::Evaluate(const Failure &failure) const {
+  if (failure.type == Failure::kNone)
+    return true;
+  std::string seq;
+  for (std::vector<int>::const_iterator p = failure.sequence.begin();
+      p != failure.sequence.end(); ++p)
+    seq += phones_->Find(*p) + " ";
+  if (failure.type == Failure::kInvalidStructure)
+    LOG(FATAL) << "invalid structure of C for phone sequence: " << seq;
+  VLOG(1) << "invalid input labels for phone sequence: " << seq;
+  return false;
 }
 
+bool CTransducerCheck::IsValid() const {
+  CHECK(c_);
+  CHECK(!phone_ids_.empty());
+  const int kSamplesPerTask = 1024;
+  std::vector<CheckTask> tasks;
+  if (num_samples_) {
+    for (int n = 0; n < num_samples_; n += kSamplesPerTask) {
+      tasks.push_back(CheckTask());
+      tasks.back().num_samples = std::min(kSamplesPerTask, num_samples_ - n);
+      tasks.back().first_rank = n;
+      tasks.back().seed = seed_ + n;
+    }
+  } else {
+    tasks.resize(phone_ids_.size());
+    for (int p = 0; p < tasks.size(); ++p)
+      tasks[p].first_phone = p;
+  }
+  WalkerMapper mapper(this);
+#ifdef HAVE_THREADS
+  if (num_threads_ > 1) {
+    threads::ThreadPool<CheckTask*, WalkerMapper> pool;
+    pool.Init(num_threads_, mapper);
+    for (std::vector<CheckTask>::iterator t = tasks.begin(); t != tasks.end();
+        ++t)
+      pool.Submit(&*t);
+    pool.Wait();
+  } else
+#endif
+  {
+    for (std::vector<CheckTask>::iterator t = tasks.begin(); t != tasks.end();
+        ++t)
+      mapper.Map(&*t);
+  }
+  Failure failure;
+  for (std::vector<CheckTask>::const_iterator t = tasks.begin();
+      t != tasks.end(); ++t)
+    failure.Update(t->failure);
+  return Evaluate(failure);
+}
 
 }  // namespace trainc
@@ -29,13 +29,11 @@
 #include "fst/vector-fst.h"
 #include "context_set.h"
 #include "stringmap.h"
+#include "transducer.h"
 
 
 namespace trainc {
 
-class ConstructionalTransducer;
-class State;
-class Arc;
 class Phones;
 
 // Checks the validity of a ConstructionalTransducer.
@@ -50,6 +48,8 @@ class ConstructionalTransducerCheck {
                   int num_left_contexts, int num_right_contexts);
   ~ConstructionalTransducerCheck() {}
   bool IsValid() const;
+  // Check the given state and its outgoing arcs.
+  bool IsValidState(const State &state) const;
 
  private:
   bool CheckDeterministicOutput(const State &state) const;
@@ -65,15 +65,56 @@ class ConstructionalTransducerCheck {
 };
 
 
-class PhoneSequenceIterator;
+// Checks the states of a ConstructionalTransducer modified since the last
+// call of Check(). The modified states are recorded by observing the
+// changes of the transducer. A state is checked if it has been added,
+// or if an outgoing arc has been added, removed, or relabeled.
+class IncrementalTransducerCheck : public TransducerChangeObserver {
+ public:
+  IncrementalTransducerCheck(const ConstructionalTransducer &c,
+                             const Phones *phone_info,
+                             int num_left_contexts, int num_right_contexts)
+      : check_(c, phone_info, num_left_contexts, num_right_contexts),
+        num_checked_(0) {}
+  virtual ~IncrementalTransducerCheck() {}
+
+  virtual void NotifyAddState(const State *state) { states_.insert(state); }
+  virtual void NotifyRemoveState(const State *state) { states_.erase(state); }
+  virtual void NotifyAddArc(const State::ArcRef arc) {
+    states_.insert(arc->source());
+  }
+  virtual void NotifyRemoveArc(const State::ArcRef arc) {
+    states_.insert(arc->source());
+  }
+  virtual void NotifyUpdateArc(const State::ArcRef arc) {
+    states_.insert(arc->source());
+  }
+
+  // Check all modified states and reset the set of modified states.
+  bool Check();
+  int NumCheckedStates() const { return num_checked_; }
 
+ private:
+  ConstructionalTransducerCheck check_;
+  hash_set<const State*, PointerHash<const State> > states_;
+  int num_checked_;
+};
 
-// Checks the validity of a context dependency transducer by
-// enumerating all possible phone sequences, composing them with the
-// C transducer and validating the input of the composed transducer.
+// Checks the validity of a context dependency transducer for all possible
+// phone sequences of the given length followed by the boundary phone.
+// The composition of the C transducer with each phone sequence has to be
+// a single path. The first input label is epsilon, the following input
+// labels have to be HMMs of the phones in the sequence.
+// Instead of composing C with each sequence, the phone sequences are
+// enumerated by a depth first search following the output labels of C.
+// The composition states of common prefixes are shared. The search is
+// distributed over several threads by the first phone of the sequence.
+// Arcs of C with epsilon output are not followed.
 class CTransducerCheck {
  public:
-  CTransducerCheck() : phones_(NULL), hmms_(0), length_(0), c_(NULL) {}
+  CTransducerCheck()
+      : phones_(NULL), hmms_(0), length_(0), c_(NULL), num_threads_(1),
+        num_samples_(0), seed_(0) {}
   ~CTransducerCheck();
 
   // Initialize symbol tables for phone symbols and hmm symbols.
@@ -85,24 +126,53 @@ class CTransducerCheck {
             const std::string &hmm_to_phone, const std::string &boundary_phone,
             int context_length);
 
+  // Initialize with the given symbol tables and mapping from HMM symbols
+  // to phone symbols. The symbol tables are copied.
+  void Init(const fst::SymbolTable &phone_symbols,
+            const fst::SymbolTable &hmm_symbols,
+            const StringMap &hmm_to_phone, const std::string &boundary_phone,
+            int context_length);
+
   // Set the transducer to be validated.
   void SetTransducer(const fst::StdVectorFst *c);
 
+  void SetNumThreads(int num_threads) { num_threads_ = num_threads; }
+
+  // Check only num_samples randomly drawn phone sequences instead of all
+  // sequences. num_samples = 0 enables the exhaustive check.
+  void SetSampling(int num_samples, unsigned int seed) {
+    num_samples_ = num_samples;
+    seed_ = seed;
+  }
+
   // Perform the check and return true if the transducer
   // passes all tests.
+  // Aborts if the structure of the composed transducer is invalid for the
+  // first failing phone sequence in enumeration order.
   bool IsValid() const;
 
  private:
-  void AddBoundaryPhone(fst::StdVectorFst *phone_fst) const;
-  bool CheckPhoneSequence(const fst::StdVectorFst &phone_fst,
-                          const vector<int> &phone_seq) const;
-  void PrintSequence(const fst::StdVectorFst &cl) const;
-  void GetSequence(const fst::StdVectorFst &cl, vector<int> *hmm_seq) const;
+  class Walker;
+  class WalkerMapper;
+  struct Failure;
+  struct CheckTask;
+  int HmmPhone(int hmm) const {
+    return hmm < hmm_phones_.size() ? hmm_phones_[hmm] : -1;
+  }
+  bool Evaluate(const Failure &failure) const;
   fst::SymbolTable *phones_, *hmms_;
   int length_, boundary_phone_;
   const fst::StdVectorFst *c_;
   StringMap hmm_to_phone_;
-  PhoneSequenceIterator *piter_;
+  int num_threads_, num_samples_;
+  unsigned int seed_;
+  // phone symbols of the sequences
+  std::vector<int> phone_ids_;
+  // phone symbol of each hmm symbol, -1 if not defined
+  std::vector<int> hmm_phones_;
+  // arcs of C grouped by state and sorted by output label
+  std::vector<fst::StdArc> arcs_;
+  std::vector<size_t> arc_offset_;
 };
 
 
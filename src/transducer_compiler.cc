@@ -15,7 +15,11 @@
 // Copyright 2010 Google Inc. All Rights Reserved.
 // Author: rybach@google.com (David Rybach)
 
+#include <algorithm>
+#include <fstream>
 #include <string>
+#include "fst/compact-fst.h"
+#include "fst/const-fst.h"
 #include "fst/vector-fst.h"
 #include "hmm_compiler.h"
 #include "transducer.h"
@@ -33,18 +37,6 @@ TransducerCompiler::TransducerCompiler()
 
 TransducerCompiler::~TransducerCompiler() {}
 
-StdArc::StateId TransducerCompiler::GetState(
-    StdVectorFst *c, const State *state) {
-  StateMap::const_iterator si = state_map_.find(state);
-  if (si == state_map_.end()) {
-    StdArc::StateId id = c->AddState();
-    state_map_.insert(std::make_pair(state, id));
-    return id;
-  } else {
-    return si->second;
-  }
-}
-
 bool TransducerCompiler::IsBoundaryState(
     const State &state, int boundary_phone) {
   if (!state.center().HasElement(boundary_phone))
@@ -62,71 +54,211 @@ bool TransducerCompiler::IsBoundaryState(
   return boundary_in_all_histories;
 }
 
-// Create an initial state with the same arcs as the given state, but with
-// an epsilon as input symbol (shifted C transducer).
-// This ensures that the first CD phone of a sequence of phones has the boundary
-// phone in all of its left contexts.
-void TransducerCompiler::CreateStartState(
-    const State &state, StdVectorFst *c) {
-  StdArc::StateId state_id = c->AddState();
-  c->SetStart(state_id);
-  CreateArcs(state, state_id, true, c);
+// ===================================================================
+
+namespace {
+// Order of the arcs in the written transducer.
+struct ArcLabelCompare {
+  bool operator()(const StdArc &a, const StdArc &b) const {
+    return a.ilabel < b.ilabel ||
+        (a.ilabel == b.ilabel && a.olabel < b.olabel);
+  }
+};
+}  // namespace
+
+// Read-only view of the final C transducer, which is computed state by
+// state from the ConstructionalTransducer.
+// The arcs of the most recently accessed state are cached. An arc iterator
+// is valid only until the arcs of another state are accessed.
+class TransducerCompiler::FstViewImpl : public fst::FstImpl<StdArc> {
+ public:
+  typedef StdArc Arc;
+  typedef Arc::Weight Weight;
+  typedef Arc::StateId StateId;
+
+  explicit FstViewImpl(TransducerCompiler *compiler)
+      : compiler_(compiler), cached_state_(fst::kNoStateId) {
+    SetType("constructional-c-view");
+    SetProperties(fst::kExpanded | fst::kILabelSorted | fst::kUnweighted);
+    compiler_->EnumerateStates(&states_);
+  }
+  StateId Start() const {
+    return states_.empty() ? fst::kNoStateId : 0;
+  }
+  Weight Final(StateId s) const {
+    if (s > 0 && states_[s]->center().HasElement(compiler_->boundary_phone_))
+      return Weight::One();
+    return Weight::Zero();
+  }
+  size_t NumArcs(StateId s) const {
+    return GetArcs(s).size();
+  }
+  size_t NumInputEpsilons(StateId s) const {
+    const std::vector<Arc> &arcs = GetArcs(s);
+    size_t n = 0;
+    for (; n < arcs.size() && arcs[n].ilabel == 0; ++n) {}
+    return n;
+  }
+  size_t NumOutputEpsilons(StateId s) const {
+    const std::vector<Arc> &arcs = GetArcs(s);
+    size_t n = 0;
+    for (std::vector<Arc>::const_iterator a = arcs.begin();
+        a != arcs.end(); ++a)
+      if (a->olabel == 0) ++n;
+    return n;
+  }
+  StateId NumStates() const {
+    return states_.size();
+  }
+  void InitStateIterator(fst::StateIteratorData<Arc> *data) const {
+    data->base = NULL;
+    data->nstates = states_.size();
+  }
+  void InitArcIterator(StateId s, fst::ArcIteratorData<Arc> *data) const {
+    const std::vector<Arc> &arcs = GetArcs(s);
+    data->base = NULL;
+    data->arcs = arcs.empty() ? NULL : &arcs[0];
+    data->narcs = arcs.size();
+    data->ref_count = NULL;
+  }
+
+ private:
+  // The start state has the arcs of the boundary state with epsilon input.
+  const std::vector<Arc>& GetArcs(StateId s) const {
+    DCHECK_LT(s, states_.size());
+    if (s != cached_state_) {
+      arcs_.clear();
+      compiler_->GetArcs(*states_[s], s == 0, &arcs_);
+      std::sort(arcs_.begin(), arcs_.end(), ArcLabelCompare());
+      cached_state_ = s;
+    }
+    return arcs_;
+  }
+  TransducerCompiler *compiler_;
+  std::vector<const State*> states_;
+  mutable StateId cached_state_;
+  mutable std::vector<Arc> arcs_;
+};
+
+class TransducerCompiler::FstView :
+    public fst::ImplToExpandedFst<TransducerCompiler::FstViewImpl> {
+ public:
+  typedef FstViewImpl Impl;
+
+  explicit FstView(TransducerCompiler *compiler)
+      : fst::ImplToExpandedFst<Impl>(new Impl(compiler)) {}
+  FstView(const FstView &fst) : fst::ImplToExpandedFst<Impl>(fst) {}
+
+  FstView* Copy(bool safe = false) const {
+    return new FstView(*this);
+  }
+  void InitStateIterator(fst::StateIteratorData<Arc> *data) const {
+    GetImpl()->InitStateIterator(data);
+  }
+  void InitArcIterator(StateId s, fst::ArcIteratorData<Arc> *data) const {
+    GetImpl()->InitArcIterator(s, data);
+  }
+};
+
+// states[0] is the boundary state, used for the start state.
+// All states are numbered in breadth-first order starting from the
+// boundary state, followed by the unreachable states.
+void TransducerCompiler::EnumerateStates(std::vector<const State*> *states) {
+  state_map_.clear();
+  states->clear();
+  const State *boundary_state = NULL;
+  for (StateIterator si(*transducer_); !si.Done(); si.Next()) {
+    if (IsBoundaryState(si.Value())) {
+      CHECK(!boundary_state);
+      boundary_state = &si.Value();
+    }
+  }
+  if (!boundary_state)
+    LOG(FATAL) << "no boundary state found";
+  states->reserve(transducer_->NumStates() + 1);
+  states->push_back(boundary_state);
+  state_map_.insert(std::make_pair(boundary_state, 1));
+  states->push_back(boundary_state);
+  for (size_t s = 1; s < states->size(); ++s) {
+    for (ArcIterator ai(*(*states)[s]); !ai.Done(); ai.Next()) {
+      const State *target = ai.Value().target();
+      if (state_map_.insert(std::make_pair(target, states->size())).second)
+        states->push_back(target);
+    }
+  }
+  for (StateIterator si(*transducer_); !si.Done(); si.Next()) {
+    const State *state = &si.Value();
+    if (state_map_.insert(std::make_pair(state, states->size())).second)
+      states->push_back(state);
+  }
 }
 
-// Create arcs in the C transducer using the arcs of the state in the
-// ConstructionalTransducer. If eps_input == true, all input symbols
-// are set to epsilon.
-void TransducerCompiler::CreateArcs(
-    const State &state, StdArc::StateId state_id, bool eps_input,
-    StdVectorFst *c) {
-  ArcIterator ai(state);
-  while (!ai.Done()) {
+void TransducerCompiler::GetArcs(const State &state, bool eps_input,
+                                 std::vector<StdArc> *arcs) {
+  for (ArcIterator ai(state); !ai.Done(); ai.Next()) {
     const Arc &arc = ai.Value();
-    StdArc::Label input = 0;  // epsilon
-    if (!eps_input)
-      input = GetInputLabel(arc);
-    StdArc::Label output = GetOutputLabel(arc);
-    StdArc::StateId next_state = GetState(c, arc.target());
-    c->AddArc(state_id, StdArc(input, output, StdArc::Weight::One(),
-                               next_state));
-    ai.Next();
+    StdArc::Label input = eps_input ? 0 : GetInputLabel(arc);
+    StateMap::const_iterator target = state_map_.find(arc.target());
+    DCHECK(target != state_map_.end());
+    arcs->push_back(StdArc(input, GetOutputLabel(arc),
+                           StdArc::Weight::One(), target->second));
   }
 }
 
+bool TransducerCompiler::WriteTransducer(const std::string &filename,
+                                         const std::string &fst_type) {
+  CHECK_NOTNULL(transducer_);
+  CHECK_GE(boundary_phone_, 0);
+  if (fst_type != "const" && fst_type != "compact") {
+    LOG(ERROR) << "unsupported transducer type: " << fst_type;
+    return false;
+  }
+  FstView c(this);
+  std::ofstream strm(filename.c_str(),
+                     std::ios_base::out | std::ios_base::binary);
+  if (!strm) {
+    LOG(ERROR) << "cannot open " << filename;
+    return false;
+  }
+  fst::FstWriteOptions opts(filename);
+  bool ok = false;
+  if (fst_type == "const") {
+    ok = fst::ConstFst<StdArc>::WriteFst(c, strm, opts);
+  } else {
+    typedef fst::CompactFst<StdArc, fst::UnweightedCompactor<StdArc> >
+        CompactFst;
+    ok = CompactFst::WriteFst(c, fst::UnweightedCompactor<StdArc>(), strm,
+                              opts);
+  }
+  state_map_.clear();
+  return ok && strm;
+}
+
+// The StdVectorFst is a copy of the FstView, such that all transducer
+// types have the same states and arcs.
 StdVectorFst* TransducerCompiler::CreateTransducer() {
   CHECK_NOTNULL(transducer_);
   CHECK_GE(boundary_phone_, 0);
+  StdVectorFst *c = new StdVectorFst(FstView(this));
   state_map_.clear();
-  StdVectorFst *c = new StdVectorFst();
-  StateIterator si(*transducer_);
-  bool found_initial = false;
-  while (!si.Done()) {
-    const State &state = si.Value();
-    StdArc::StateId state_id = GetState(c, &state);
-    if (IsBoundaryState(state)) {
-      // ensure creating only one initial state
-      CHECK(!found_initial);
-      found_initial = true;
-      CreateStartState(state, c);
-    }
-    if (state.center().HasElement(boundary_phone_)) {
-      // Ensure that the last CD phone of a sequence of phones has
-      // the boundary phone as right context.
-      c->SetFinal(state_id, StdArc::Weight::One());
-    }
-    CreateArcs(state, state_id, false, c);
-    si.Next();
-  }
   return c;
 }
 
+// ===================================================================
 
 HmmTransducerCompiler::HmmTransducerCompiler() :
     hmm_compiler_(NULL) {}
 
+// The symbol lookup is cached, because it requires the construction of the
+// HMM name.
 StdArc::Label HmmTransducerCompiler::GetInputLabel(const Arc &arc) {
+  LabelMap::const_iterator i = labels_.find(arc.input());
+  if (i != labels_.end())
+    return i->second;
   string input_symbol = hmm_compiler_->GetHmmName(arc.input());
-  return hmm_compiler_->GetHmmSymbols().Find(input_symbol);
+  StdArc::Label label = hmm_compiler_->GetHmmSymbols().Find(input_symbol);
+  labels_.insert(LabelMap::value_type(arc.input(), label));
+  return label;
 }
 
 StdArc::Label HmmTransducerCompiler::GetOutputLabel(const Arc &arc) {
@@ -139,6 +271,12 @@ StdVectorFst* HmmTransducerCompiler::CreateTransducer() {
   return TransducerCompiler::CreateTransducer();
 }
 
+bool HmmTransducerCompiler::WriteTransducer(const std::string &filename,
+                                            const std::string &fst_type) {
+  CHECK_NOTNULL(hmm_compiler_);
+  return TransducerCompiler::WriteTransducer(filename, fst_type);
+}
+
 
 StdArc::Label ModelTransducerCompiler::GetInputLabel(const Arc &arc) {
   LabelMap::const_iterator i = label_map_.find(arc.input());
@@ -22,6 +22,8 @@
 #define TRANSDUCER_COMPILER_H_
 
 #include <ext/hash_map>
+#include <string>
+#include <vector>
 #include "fst/arc.h"
 #include "fst/fst-decl.h"
 #include "util.h"
@@ -56,24 +58,35 @@ class TransducerCompiler {
   }
 
   // Create the final context dependency transducer.
+  // The start state has id 0, the other states are numbered in
+  // breadth-first order. The arcs of each state are sorted by input label.
   virtual fst::StdVectorFst* CreateTransducer();
 
+  // Write the final context dependency transducer as fst_type ("const" or
+  // "compact") without creating an intermediate StdVectorFst.
+  // The states and arcs are the same as the ones of CreateTransducer().
+  virtual bool WriteTransducer(const std::string &filename,
+                               const std::string &fst_type);
+
   // The boundary state is the state that has the boundary_phone_ as
   // center phone and the boundary phone occurs in all but the last
   // context sets in the state's history, e.g. [ {},{sil,a} sil ].
   // This state is used to create the initial state of the C transducer.
-  // See CreateStartState().
+  // See EnumerateStates().
   static bool IsBoundaryState(const State &state, int boundary_phone);
 
  protected:
   virtual fst::StdArc::Label GetInputLabel(const Arc &arc) = 0;
   virtual fst::StdArc::Label GetOutputLabel(const Arc &arc) = 0;
+  typedef hash_map<const AllophoneModel*, fst::StdArc::Label,
+                   PointerHash<const AllophoneModel> > LabelMap;
 
  private:
-  fst::StdArc::StateId GetState(fst::StdVectorFst *c, const State *state);
-  void CreateStartState(const State &state, fst::StdVectorFst *c);
-  void CreateArcs(const State &state, fst::StdArc::StateId,
-                  bool eps_input, fst::StdVectorFst *c);
+  class FstViewImpl;
+  class FstView;
+  void EnumerateStates(std::vector<const State*> *states);
+  void GetArcs(const State &state, bool eps_input,
+               std::vector<fst::StdArc> *arcs);
   bool IsBoundaryState(const State &state) const {
     return IsBoundaryState(state, boundary_phone_);
   }
@@ -97,6 +110,8 @@ class HmmTransducerCompiler : public TransducerCompiler {
   }
 
   virtual fst::StdVectorFst* CreateTransducer();
+  virtual bool WriteTransducer(const std::string &filename,
+                               const std::string &fst_type);
 
  protected:
   virtual fst::StdArc::Label GetInputLabel(const Arc &arc);
@@ -104,6 +119,8 @@ class HmmTransducerCompiler : public TransducerCompiler {
 
  private:
   const HmmCompiler *hmm_compiler_;
+  // HMM symbols of the models seen so far.
+  LabelMap labels_;
 };
 
 
@@ -121,8 +138,6 @@ public:
   virtual fst::StdArc::Label GetOutputLabel(const Arc &arc);
 
  private:
-  typedef hash_map<const AllophoneModel*, fst::StdArc::Label,
-                   PointerHash<const AllophoneModel> > LabelMap;
   LabelMap label_map_;
 };
 }  // namespace trainc
@@ -54,14 +54,14 @@ void BasicTransducerInitialization::CreateUnits(int num_phones) {
 void BasicTransducerInitialization::SetUnitHistory(
     int phone, PhoneContext *history) const {
   CHECK(history->GetContext(0).IsEmpty());
-  history->GetContextRef(0)->Add(phone);
+  history->AddToContext(0, phone);
 }
 
 void BasicTransducerInitialization::CreatePhoneModel(
     ModelManager *models, int phone, const PhoneContext &context) {
   PhoneContext phone_context = context;
   CHECK(phone_context.GetContext(0).IsEmpty());
-  phone_context.GetContextRef(0)->Add(phone);
+  phone_context.AddToContext(0, phone);
   phone_models_[phone] = models->InitAllophoneModel(
       phone, phone_info_->NumHmmStates(phone), phone_context);
 }
@@ -121,7 +121,7 @@ void TiedModelTransducerInitialization::CreatePhoneModel(
     result->AddPhone(i->first);
     for (int s = 0; s < result->NumStates(); ++s) {
       PhoneContext *state_context = result->GetStateModel(s)->GetContextRef();
-      state_context->GetContextRef(0)->Add(i->first);
+      state_context->AddToContext(0, i->first);
     }
     phone_models_[i->first] = result;
   } else {
@@ -156,7 +156,7 @@ void SharedStateTransducerInitialization::CreateUnits(int num_phones) {
 // context set of history.
 void SharedStateTransducerInitialization::SetUnitHistory(
     int phone, PhoneContext *history) const {
-  ContextSet &center = *history->GetContextRef(0);
+  ContextSet center = history->GetContext(0);
   CHECK(center.IsEmpty());
   center.Add(phone);
   map<int, list<int> >::const_iterator i = reverse_mapping_.find(phone);
@@ -165,6 +165,7 @@ void SharedStateTransducerInitialization::SetUnitHistory(
         p != i->second.end(); ++p)
       center.Add(*p);
   }
+  history->SetContext(0, center);
 }
 
 // Create the state mapping.
@@ -20,6 +20,7 @@
 
 #include <set>
 #include "transducer_test.h"
+#include "file.h"
 #include "phone_models.h"
 #include "split_predictor.h"
 #include "transducer_check.h"
@@ -467,4 +468,143 @@ TEST_F(ConstructionalTransducerTest, SplitPredictionSharedState) {
 }
 
 
+// The incremental check observes valid splits and detects an arc with an
+// invalid input model.
+TEST_F(ConstructionalTransducerTest, IncrementalCheck) {
+  Init(10, 1, 1);
+  InitTransducer();
+  IncrementalTransducerCheck check(*c_, phone_info_, num_left_contexts_,
+                                   num_right_contexts_);
+  c_->RegisterObserver(&check);
+  SplitOneModel(1);
+  EXPECT_TRUE(check.Check());
+  EXPECT_GT(check.NumCheckedStates(), 0);
+  EXPECT_TRUE(check.Check());
+  EXPECT_EQ(check.NumCheckedStates(), 0);
+  // phone models of two different context dependent phones.
+  const AllophoneModel *models[2] = { NULL, NULL };
+  typedef ModelManager::StateModelList::const_iterator SmIter;
+  for (SmIter sm = models_->GetStateModels().begin();
+       sm != models_->GetStateModels().end() && !models[1]; ++sm) {
+    const AllophoneModel *model = (*sm)->GetAllophones().front();
+    if (phone_info_->IsCiPhone(model->phones().front())) continue;
+    if (!models[0])
+      models[0] = model;
+    else if (model->phones().front() != models[0]->phones().front())
+      models[1] = model;
+  }
+  ASSERT_NOTNULL(models[1]);
+  vector<State::ArcRef> arcs;
+  c_->GetArcsWithModel(models[0], &arcs);
+  ASSERT_GT(arcs.size(), 1);
+  // removing an arc modifies its source state.
+  State::ArcRef arc = arcs.back();
+  const State *source = arc->source();
+  State *target = arc->target();
+  const int output = arc->output();
+  c_->RemoveArc(arc);
+  EXPECT_TRUE(check.Check());
+  EXPECT_EQ(check.NumCheckedStates(), 1);
+  c_->AddArc(const_cast<State*>(source), target, models[0], output);
+  EXPECT_TRUE(check.Check());
+  // the phone of the input model does not match the source state.
+  c_->UpdateArcInput(arcs.front(), models[1]);
+  EXPECT_FALSE(check.Check());
+  c_->UpdateArcInput(arcs.front(), models[0]);
+  EXPECT_TRUE(check.Check());
+  c_->UnregisterObserver(&check);
+  VerifyTransducer();
+}
+
+// Monophone C transducer for the phones a, b, and the boundary phone #.
+// State 0 is the start state, state p has seen phone p.
+class CTransducerCheckTest : public ::testing::Test {
+ protected:
+  static const int kNumPhones = 3;
+  void SetUp() {
+    const char *phones[] = { "a", "b", "#" };
+    const char *hmms[] = { "A", "B", "S" };
+    File *phone_file = File::OpenOrDie(PhoneFile(), "w");
+    File *hmm_file = File::OpenOrDie(HmmFile(), "w");
+    File *map_file = File::OpenOrDie(MapFile(), "w");
+    phone_file->Printf("eps 0\n");
+    hmm_file->Printf("eps 0\n");
+    for (int p = 0; p < kNumPhones; ++p) {
+      phone_file->Printf("%s %d\n", phones[p], p + 1);
+      hmm_file->Printf("%s %d\n", hmms[p], p + 1);
+      map_file->Printf("%s %s\n", hmms[p], phones[p]);
+    }
+    phone_file->Close();
+    hmm_file->Close();
+    map_file->Close();
+    delete phone_file;
+    delete hmm_file;
+    delete map_file;
+    const fst::StdArc::Weight one = fst::StdArc::Weight::One();
+    for (int s = 0; s <= kNumPhones; ++s)
+      c_.AddState();
+    c_.SetStart(0);
+    c_.SetFinal(kNumPhones, one);
+    for (int p = 1; p <= kNumPhones; ++p) {
+      c_.AddArc(0, fst::StdArc(0, p, one, p));
+      for (int s = 1; s <= kNumPhones; ++s)
+        c_.AddArc(s, fst::StdArc(s, p, one, p));
+    }
+  }
+  string PhoneFile() const { return FLAGS_test_tmpdir + "/check_phones.txt"; }
+  string HmmFile() const { return FLAGS_test_tmpdir + "/check_hmms.txt"; }
+  string MapFile() const { return FLAGS_test_tmpdir + "/check_map.txt"; }
+  bool IsValid(int length, int num_threads, int num_samples) {
+    CTransducerCheck check;
+    check.Init(PhoneFile(), HmmFile(), MapFile(), "#", length);
+    check.SetTransducer(&c_);
+    check.SetNumThreads(num_threads);
+    check.SetSampling(num_samples, 1);
+    return check.IsValid();
+  }
+  fst::StdVectorFst c_;
+};
+
+TEST_F(CTransducerCheckTest, Valid) {
+  for (int length = 1; length <= 3; ++length) {
+    EXPECT_TRUE(IsValid(length, 1, 0));
+    EXPECT_TRUE(IsValid(length, 2, 0));
+    EXPECT_TRUE(IsValid(length, 2, 100));
+  }
+}
+
+TEST_F(CTransducerCheckTest, Invalid) {
+  // a followed by # has input B
+  fst::MutableArcIterator<fst::StdVectorFst> aiter(&c_, 1);
+  for (; !aiter.Done(); aiter.Next()) {
+    fst::StdArc arc = aiter.Value();
+    if (arc.olabel == kNumPhones) {
+      arc.ilabel = 2;
+      aiter.SetValue(arc);
+    }
+  }
+  EXPECT_FALSE(IsValid(1, 1, 0));
+  EXPECT_FALSE(IsValid(2, 2, 0));
+  EXPECT_FALSE(IsValid(2, 1, 1000));
+}
+
+// The invalid arc is only reached by sequences with the prefix "b a",
+// which is shared with valid sequences.
+TEST_F(CTransducerCheckTest, InvalidPrefix) {
+  // a following b has input A
+  fst::MutableArcIterator<fst::StdVectorFst> aiter(&c_, 2);
+  for (; !aiter.Done(); aiter.Next()) {
+    fst::StdArc arc = aiter.Value();
+    if (arc.olabel == 1) {
+      arc.ilabel = 1;
+      aiter.SetValue(arc);
+    }
+  }
+  EXPECT_TRUE(IsValid(1, 2, 0));
+  for (int length = 2; length <= 3; ++length) {
+    EXPECT_FALSE(IsValid(length, 1, 0));
+    EXPECT_FALSE(IsValid(length, 3, 0));
+  }
+}
+
 }  // namespace trainc
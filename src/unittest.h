@@ -31,6 +31,7 @@
 #include "fst/compat.h"
 
 DECLARE_string(test_tmpdir);
+DECLARE_int32(num_threads);
 
 #define STR(s) #s
 